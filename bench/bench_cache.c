@@ -0,0 +1,480 @@
+/**
+ * @file bench_cache.c
+ * @brief Microbenchmark for the persistent response cache
+ *
+ * Runs the respcache module against files in a scratch directory:
+ *
+ * - put: --entries answers stored under keys shaped like AISH's (context
+ *   hash, scope, query);
+ * - hit and miss: lookups of stored keys in shuffled order and of keys
+ *   never stored;
+ * - reopen: the cache closed and opened again, as by the next AISH
+ *   session, and the first lookup after it;
+ * - churn: --churn times as many answers pushed through a cache limited
+ *   to --max-kb, counting evictions and compactions and checking that the
+ *   newest answers survive them. Upkeep runs after each store that calls
+ *   for it and is timed on its own, as AISH runs it off a timer;
+ * - shared: --processes readers looking up answers in a cache that a
+ *   writer process keeps changing, for --shared-ms. The writer is killed
+ *   with SIGKILL every few milliseconds and started again, so some kills
+ *   land in the middle of a change. Every answer found is checked.
+ *
+ * Latencies are per operation, in microseconds, with flock() and the
+ * read or write of the log included. Results are printed to stdout as one
+ * JSON object.
+ */
+
+#include "respcache.h"
+#include "histogram.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define DEFAULT_ENTRIES 2000
+#define DEFAULT_CHURN 8
+#define DEFAULT_MAX_KB 256
+#define DEFAULT_PROCESSES 4
+#define DEFAULT_SHARED_MS 2000
+#define CACHE_NAME "response-cache"
+#define SHARED_NAME "shared-cache"
+#define MAX_KILL_US 4000            // Longest the writer runs before it is killed
+
+/**
+ * @brief What the processes of the shared phase report, in shared memory
+ */
+typedef struct {
+    int stop;                   // Set when the readers should finish
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t wrong;             // Answers that were not the one stored
+    uint64_t read_retries;
+    uint64_t locked_reads;
+    uint64_t recoveries;        // Tables repaired, by readers and writers
+    uint64_t puts;              // Stores completed by writers
+    uint64_t busy_puts;         // Stores given up because another process held the lock
+    Histogram lookup[];         // One per reader
+} SharedReport;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Write the key of query number index
+ *
+ * @return Length of the key
+ */
+static size_t make_key(char *key, size_t size, size_t index) {
+    return (size_t)snprintf(key, size, "%016llx\n/home/user/projects/aish\nfind the log files changed in "
+                            "the last %zu days", 0x5eed5eed5eedULL, index);
+}
+
+/**
+ * @brief Write the answer to query number index
+ *
+ * @return Length of the answer
+ */
+static size_t make_value(char *value, size_t size, size_t index) {
+    return (size_t)snprintf(value, size, "find . -name \"*.log\" -mtime -%zu -print", index);
+}
+
+/**
+ * @brief Look up query number index, checking the answer on a hit
+ *
+ * @param hist Lookup time is recorded here, in nanoseconds
+ * @return 1 on a hit, 0 on a miss, -1 on a wrong answer
+ */
+static int timed_get(RespCache *cache, size_t index, Histogram *hist) {
+    char key[256], expected[256];
+    size_t key_len = make_key(key, sizeof(key), index);
+    char *value = NULL;
+    size_t value_len = 0;
+
+    uint64_t start = now_ns();
+    bool hit = respcache_get(cache, key, key_len, &value, &value_len);
+    histogram_record(hist, now_ns() - start);
+    if (!hit) {
+        return 0;
+    }
+
+    size_t expected_len = make_value(expected, sizeof(expected), index);
+    int outcome = (value_len == expected_len && memcmp(value, expected, value_len) == 0) ? 1 : -1;
+    free(value);
+    return outcome;
+}
+
+static bool timed_put(RespCache *cache, size_t index, Histogram *hist) {
+    char key[256], value[256];
+    size_t key_len = make_key(key, sizeof(key), index);
+    size_t value_len = make_value(value, sizeof(value), index);
+
+    uint64_t start = now_ns();
+    bool stored = respcache_put(cache, key, key_len, value, value_len);
+    histogram_record(hist, now_ns() - start);
+    return stored;
+}
+
+/**
+ * @brief Run the cache's upkeep if it is due, timing it
+ */
+static void timed_upkeep(RespCache *cache, Histogram *hist) {
+    if (!respcache_needs_upkeep(cache)) {
+        return;
+    }
+
+    uint64_t start = now_ns();
+    respcache_upkeep(cache);
+    histogram_record(hist, now_ns() - start);
+}
+
+/**
+ * @brief Store answers over and over until killed
+ *
+ * Twice as many keys as the cache holds, so it evicts and compacts.
+ */
+static void run_writer(const char *path, size_t entries, size_t max_kb, SharedReport *report, uint64_t seed) {
+    RespCache cache;
+    if (!respcache_open(&cache, path, 0, (uint64_t)max_kb * 1024, (uint32_t)entries)) {
+        _exit(1);
+    }
+    __atomic_add_fetch(&report->recoveries, cache.recoveries, __ATOMIC_RELAXED);
+
+    Histogram unused;
+    histogram_reset(&unused);
+    for (uint64_t i = seed;; i++) {
+        uint64_t recoveries = cache.recoveries;
+        uint64_t busy_puts = cache.busy_puts;
+        if (timed_put(&cache, (size_t)(i % (entries * 2)), &unused)) {
+            __atomic_add_fetch(&report->puts, 1, __ATOMIC_RELAXED);
+        }
+        timed_upkeep(&cache, &unused);
+        __atomic_add_fetch(&report->recoveries, cache.recoveries - recoveries, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&report->busy_puts, cache.busy_puts - busy_puts, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Look up random answers until told to stop, checking each one
+ */
+static void run_reader(const char *path, size_t entries, size_t max_kb, SharedReport *report, int reader) {
+    RespCache cache;
+    if (!respcache_open(&cache, path, 0, (uint64_t)max_kb * 1024, (uint32_t)entries)) {
+        _exit(1);
+    }
+
+    uint64_t lookups = 0, hits = 0, wrong = 0;
+    srand((unsigned)reader + 1);
+    while (!__atomic_load_n(&report->stop, __ATOMIC_RELAXED)) {
+        int outcome = timed_get(&cache, (size_t)rand() % (entries * 2), &report->lookup[reader]);
+        lookups++;
+        hits += (outcome == 1) ? 1 : 0;
+        wrong += (outcome < 0) ? 1 : 0;
+    }
+
+    __atomic_add_fetch(&report->lookups, lookups, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&report->hits, hits, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&report->wrong, wrong, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&report->read_retries, cache.read_retries, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&report->locked_reads, cache.locked_reads, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&report->recoveries, cache.recoveries, __ATOMIC_RELAXED);
+    respcache_close(&cache);
+    _exit(0);
+}
+
+static pid_t start_writer(const char *path, size_t entries, size_t max_kb, SharedReport *report, uint64_t seed) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        run_writer(path, entries, max_kb, report, seed);
+    }
+    return pid;
+}
+
+/**
+ * @brief Run readers against a writer that keeps getting killed
+ *
+ * @param lookup Filled with the lookup latencies of all readers
+ * @param kills Set to the number of times the writer was killed
+ * @return true if every process ran, false otherwise
+ */
+static bool run_shared(const char *path, size_t entries, size_t max_kb, size_t processes, size_t shared_ms,
+                       SharedReport *report, Histogram *lookup, uint64_t *kills) {
+    for (size_t i = 0; i < processes; i++) {
+        histogram_reset(&report->lookup[i]);
+    }
+
+    pid_t *readers = calloc(processes, sizeof(pid_t));
+    bool ok = readers != NULL;
+    for (size_t i = 0; ok && i < processes; i++) {
+        readers[i] = fork();
+        if (readers[i] == 0) {
+            run_reader(path, entries, max_kb, report, (int)i);
+        }
+        ok = readers[i] > 0;
+    }
+
+    *kills = 0;
+    srand(7);
+    uint64_t end = now_ns() + (uint64_t)shared_ms * 1000000u;
+    while (ok && now_ns() < end) {
+        pid_t writer = start_writer(path, entries, max_kb, report, (uint64_t)rand());
+        ok = writer > 0;
+        if (ok) {
+            usleep((useconds_t)(rand() % MAX_KILL_US) + 100);
+            kill(writer, SIGKILL);
+            waitpid(writer, NULL, 0);
+            (*kills)++;
+        }
+    }
+
+    __atomic_store_n(&report->stop, 1, __ATOMIC_RELAXED);
+    for (size_t i = 0; readers != NULL && i < processes; i++) {
+        int status = 0;
+        if (readers[i] > 0 && (waitpid(readers[i], &status, 0) < 0 || !WIFEXITED(status) ||
+                               WEXITSTATUS(status) != 0)) {
+            ok = false;
+        }
+    }
+    free(readers);
+
+    histogram_reset(lookup);
+    for (size_t i = 0; i < processes; i++) {
+        for (size_t j = 0; j < HISTOGRAM_BUCKETS; j++) {
+            lookup->counts[j] += report->lookup[i].counts[j];
+        }
+        lookup->count += report->lookup[i].count;
+        lookup->max = (report->lookup[i].max > lookup->max) ? report->lookup[i].max : lookup->max;
+    }
+    return ok;
+}
+
+static void print_latency(const char *name, const Histogram *hist, bool last) {
+    printf("    \"%s\": { \"samples\": %llu, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f }%s\n",
+           name, (unsigned long long)hist->count,
+           (double)histogram_percentile(hist, 50.0) / 1000.0,
+           (double)histogram_percentile(hist, 90.0) / 1000.0,
+           (double)histogram_percentile(hist, 99.0) / 1000.0,
+           (double)hist->max / 1000.0, last ? "" : ",");
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--entries N] [--churn N] [--max-kb N] [--processes N] [--shared-ms N]\n"
+            "\n"
+            "  --entries N    Answers stored and looked up, also the entry limit (default: %d)\n"
+            "  --churn N      Multiple of the entries pushed through the limited cache (default: %d)\n"
+            "  --max-kb N     Byte limit of the limited and shared caches (default: %d)\n"
+            "  --processes N  Reader processes sharing a cache with a writer (default: %d, 0 to skip)\n"
+            "  --shared-ms N  How long they run (default: %d)\n",
+            program, DEFAULT_ENTRIES, DEFAULT_CHURN, DEFAULT_MAX_KB, DEFAULT_PROCESSES, DEFAULT_SHARED_MS);
+}
+
+int main(int argc, char *argv[]) {
+    size_t entries = DEFAULT_ENTRIES;
+    size_t churn = DEFAULT_CHURN;
+    size_t max_kb = DEFAULT_MAX_KB;
+    size_t processes = DEFAULT_PROCESSES;
+    size_t shared_ms = DEFAULT_SHARED_MS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc) {
+            entries = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--churn") == 0 && i + 1 < argc) {
+            churn = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-kb") == 0 && i + 1 < argc) {
+            max_kb = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--processes") == 0 && i + 1 < argc) {
+            processes = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--shared-ms") == 0 && i + 1 < argc) {
+            shared_ms = (size_t)strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (entries == 0 || entries > UINT32_MAX / 2 || max_kb == 0 || processes > 256) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char dir[] = "/tmp/aish-cache-bench-XXXXXX";
+    char path[sizeof(dir) + 32];
+    char shared_path[sizeof(dir) + 32];
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Error: Failed to create a scratch directory: %s\n", strerror(errno));
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, CACHE_NAME);
+    snprintf(shared_path, sizeof(shared_path), "%s/%s", dir, SHARED_NAME);
+
+    // Room for everything, so nothing is evicted while timing
+    RespCache cache;
+    Histogram put, hit, miss, reopen, first_hit, churn_put, upkeep;
+    histogram_reset(&put);
+    histogram_reset(&hit);
+    histogram_reset(&miss);
+    histogram_reset(&reopen);
+    histogram_reset(&first_hit);
+    histogram_reset(&churn_put);
+    histogram_reset(&upkeep);
+    bool ok = respcache_open(&cache, path, 0, (uint64_t)entries * 1024, (uint32_t)entries);
+
+    for (size_t i = 0; ok && i < entries; i++) {
+        ok = timed_put(&cache, i, &put);
+    }
+
+    // Shuffled so consecutive lookups do not walk the log in order
+    size_t *order = malloc(entries * sizeof(size_t));
+    ok = ok && order != NULL;
+    for (size_t i = 0; ok && i < entries; i++) {
+        order[i] = i;
+    }
+    srand(42);
+    for (size_t i = entries - 1; ok && i > 0; i--) {
+        size_t j = (size_t)rand() % (i + 1);
+        size_t swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    for (size_t i = 0; ok && i < entries; i++) {
+        ok = timed_get(&cache, order[i], &hit) == 1;
+    }
+    for (size_t i = 0; ok && i < entries; i++) {
+        ok = timed_get(&cache, entries + i, &miss) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: The cache did not return what was stored\n");
+    }
+
+    // What the next session finds
+    uint64_t persisted = 0;
+    if (ok) {
+        respcache_close(&cache);
+        uint64_t start = now_ns();
+        ok = respcache_open(&cache, path, 0, (uint64_t)entries * 1024, (uint32_t)entries);
+        histogram_record(&reopen, now_ns() - start);
+        ok = ok && timed_get(&cache, order[0], &first_hit) == 1;
+        persisted = ok ? respcache_entries(&cache) : 0;
+        respcache_close(&cache);
+    }
+    free(order);
+
+    // A cache too small for the traffic evicts and compacts as it goes
+    uint64_t churn_entries = 0, log_bytes = 0, live_bytes = 0, evictions = 0, compactions = 0;
+    size_t recent_hits = 0;
+    size_t total = entries * churn;
+    if (ok) {
+        ok = respcache_open(&cache, path, 0, (uint64_t)max_kb * 1024, (uint32_t)entries);
+        for (size_t i = 0; ok && i < total; i++) {
+            ok = timed_put(&cache, entries * 2 + i, &churn_put);
+            timed_upkeep(&cache, &upkeep);
+        }
+
+        size_t recent = (total < 100) ? total : 100;
+        for (size_t i = 0; ok && i < recent; i++) {
+            Histogram unused;
+            histogram_reset(&unused);
+            int outcome = timed_get(&cache, entries * 2 + total - 1 - i, &unused);
+            ok = outcome >= 0;
+            recent_hits += (outcome == 1) ? 1 : 0;
+        }
+
+        churn_entries = respcache_entries(&cache);
+        log_bytes = respcache_log_bytes(&cache, &live_bytes);
+        evictions = cache.evictions;
+        compactions = cache.compactions;
+        respcache_close(&cache);
+    }
+
+    // Readers and a writer that keeps dying, in separate processes
+    Histogram shared_lookup;
+    histogram_reset(&shared_lookup);
+    uint64_t kills = 0, shared_entries = 0;
+    size_t report_size = sizeof(SharedReport) + processes * sizeof(Histogram);
+    SharedReport *report = NULL;
+    if (ok && processes > 0) {
+        void *map = mmap(NULL, report_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        report = (map != MAP_FAILED) ? (SharedReport *)map : NULL;
+        ok = report != NULL && respcache_open(&cache, shared_path, 0, (uint64_t)max_kb * 1024, (uint32_t)entries);
+        for (size_t i = 0; ok && i < entries; i++) {
+            Histogram unused;
+            histogram_reset(&unused);
+            ok = timed_put(&cache, i, &unused);
+        }
+        if (ok) {
+            respcache_close(&cache);
+            ok = run_shared(shared_path, entries, max_kb, processes, shared_ms, report, &shared_lookup, &kills);
+        }
+
+        // Whatever state the last kill left, the cache still works
+        if (ok) {
+            Histogram unused;
+            histogram_reset(&unused);
+            ok = respcache_open(&cache, shared_path, 0, (uint64_t)max_kb * 1024, (uint32_t)entries) &&
+                 timed_put(&cache, entries * 3, &unused) && timed_get(&cache, entries * 3, &unused) == 1;
+            report->recoveries += cache.recoveries;
+            shared_entries = respcache_entries(&cache);
+            respcache_close(&cache);
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: The shared cache failed\n");
+        }
+    }
+
+    const char *paths[] = { path, shared_path };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        char file[sizeof(path) + 8];
+        snprintf(file, sizeof(file), "%s.idx", paths[i]);
+        unlink(file);
+        snprintf(file, sizeof(file), "%s.log", paths[i]);
+        unlink(file);
+    }
+    rmdir(dir);
+    if (!ok) {
+        fprintf(stderr, "Error: The benchmark failed\n");
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"entries\": %zu,\n", entries);
+    printf("  \"latency_us\": {\n");
+    print_latency("put", &put, false);
+    print_latency("hit", &hit, false);
+    print_latency("miss", &miss, false);
+    print_latency("reopen", &reopen, false);
+    print_latency("first_hit_after_reopen", &first_hit, false);
+    print_latency("put_under_churn", &churn_put, false);
+    print_latency("upkeep", &upkeep, report == NULL);
+    if (report != NULL) {
+        print_latency("shared_lookup", &shared_lookup, true);
+    }
+    printf("  },\n");
+    printf("  \"persisted_entries\": %llu,\n", (unsigned long long)persisted);
+    printf("  \"churn\": { \"puts\": %zu, \"max_bytes\": %zu, \"entries\": %llu, \"log_bytes\": %llu, "
+           "\"live_bytes\": %llu, \"evictions\": %llu, \"compactions\": %llu, \"newest_100_hits\": %zu }",
+           total, max_kb * 1024, (unsigned long long)churn_entries, (unsigned long long)log_bytes,
+           (unsigned long long)live_bytes, (unsigned long long)evictions, (unsigned long long)compactions,
+           recent_hits);
+    if (report != NULL) {
+        printf(",\n  \"shared\": { \"readers\": %zu, \"ms\": %zu, \"lookups\": %llu, \"hits\": %llu, "
+               "\"wrong_answers\": %llu, \"read_retries\": %llu, \"locked_reads\": %llu, \"writer_puts\": %llu, "
+               "\"writer_busy_puts\": %llu, \"writer_kills\": %llu, \"recoveries\": %llu, \"entries_after\": %llu }",
+               processes, shared_ms, (unsigned long long)report->lookups, (unsigned long long)report->hits,
+               (unsigned long long)report->wrong, (unsigned long long)report->read_retries,
+               (unsigned long long)report->locked_reads, (unsigned long long)report->puts,
+               (unsigned long long)report->busy_puts, (unsigned long long)kills,
+               (unsigned long long)report->recoveries, (unsigned long long)shared_entries);
+        munmap(report, report_size);
+    }
+    printf("\n}\n");
+    return 0;
+}
@@ -0,0 +1,667 @@
+/**
+ * @file bench_chat.c
+ * @brief End-to-end latency benchmark for AISH chat requests
+ *
+ * Starts bin/mock_server on localhost and runs bin/aish on a pseudo-terminal
+ * of its own, configured with the openai-compatible backend pointing at the
+ * mock. Each query is typed in Chat mode and timed from the Enter key until
+ * the output of the returned command reaches the terminal
+ * (keystroke-to-executed). At the end AISH is sent SIGUSR1 and the
+ * statistics it prints give the time spent building request bodies, the
+ * time to first byte and the time spent parsing answers.
+ *
+ * With --cancel N, N more queries are sent and abandoned with Ctrl+C while
+ * the status line shows they are pending; each is timed from Ctrl+C until
+ * the Chat prompt is redrawn, and the run fails if one takes longer than
+ * CANCEL_BOUND_MS or the cancelled command runs anyway. The server latency
+ * must be long enough for the requests to still be pending.
+ *
+ * Results are printed to stdout as one JSON object.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE // mkdtemp()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+
+#if defined(__linux__)
+#include <pty.h>
+#else
+#include <util.h>
+#endif
+
+#define DEFAULT_AISH "bin/aish"
+#define DEFAULT_SERVER "bin/mock_server"
+#define DEFAULT_QUERIES 50
+#define READ_SIZE (64 * 1024)
+#define START_TIMEOUT_MS 10000
+#define REQUEST_TIMEOUT_MS 35000    // AISH gives up on a request after 30s
+#define QUIET_MS 50                 // Output settled after this long
+#define SETTLE_MS 300               // Same, while the program starts up
+#define CANCEL_DELAY_MS 20          // Time a request is pending before Ctrl+C
+#define CANCEL_BOUND_MS 100         // Slowest acceptable Ctrl+C to redrawn prompt
+#define MAX_SERVER_ARGS 24
+
+// The markers are printed by `echo A""B` so the echoed command line never contains them
+#define READY_COMMAND "echo __CHAT_\"\"READY__\r"
+#define READY_MARKER "__CHAT_READY__"
+#define MODEL_COMMAND "echo __CHAT_\"\"DONE__"
+#define DONE_MARKER "__CHAT_DONE__"
+#define ERROR_MARKER "Error: "
+#define CHAT_PROMPT "aish (CHAT): "
+#define STATUS_MARKER "[AISH] Waiting for the model"
+#define STATS_PREFIX "[AISH stats] latency "
+#define STATS_END "[AISH stats] speculation"
+
+/**
+ * @struct Session
+ * @brief A program running on a pseudo-terminal owned by the benchmark
+ */
+typedef struct {
+    int fd;         /**< Pty master */
+    pid_t pid;      /**< Program on the slave side */
+} Session;
+
+/**
+ * @struct Percentiles
+ * @brief Latency summary in microseconds
+ */
+typedef struct {
+    unsigned long long samples;
+    unsigned long long p50;
+    unsigned long long p90;
+    unsigned long long p99;
+    unsigned long long max;
+    bool found;                 /**< Reported by AISH */
+} Percentiles;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/**
+ * @brief Start a program on a new pty with HOME pointing at a scratch directory
+ */
+static bool session_start(Session *session, char *const argv[], const char *home) {
+    struct winsize ws = { .ws_row = 24, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0 };
+
+    session->pid = forkpty(&session->fd, NULL, NULL, &ws);
+    if (session->pid == -1) {
+        fprintf(stderr, "Error: forkpty failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (session->pid == 0) {
+        setenv("HOME", home, 1);
+        setenv("XDG_STATE_HOME", home, 1);
+        setenv("HISTFILE", "/dev/null", 1);
+        setenv("TERM", "xterm-256color", 1);
+        execvp(argv[0], argv);
+        fprintf(stderr, "Error: Failed to execute %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Wait up to timeout_ms for output, returning what was read
+ *
+ * @return Bytes read, 0 on timeout, -1 when the program went away
+ */
+static ssize_t session_read(Session *session, char *buffer, size_t size, int timeout_ms) {
+    struct pollfd pfd = { .fd = session->fd, .events = POLLIN, .revents = 0 };
+
+    for (;;) {
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return ready;
+        }
+
+        ssize_t bytes_read = read(session->fd, buffer, size);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        return bytes_read > 0 ? bytes_read : -1;
+    }
+}
+
+static bool session_write(Session *session, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(session->fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+/**
+ * @brief Read until one of two markers appears in the output
+ *
+ * @param other Second marker, may be NULL
+ * @return 1 if marker was seen, 2 if other was, 0 on timeout or exit
+ */
+static int session_wait_for(Session *session, const char *marker, const char *other, int timeout_ms) {
+    static char buffer[READ_SIZE];
+    char window[64 + READ_SIZE];
+    const char *markers[2] = { marker, other };
+    size_t carry = 0;
+
+    for (;;) {
+        ssize_t bytes_read = session_read(session, buffer, sizeof(buffer), timeout_ms);
+        if (bytes_read <= 0) {
+            return 0;
+        }
+
+        // Keep the end of the previous read so a marker split across reads is found
+        memcpy(window + carry, buffer, (size_t)bytes_read);
+        size_t window_len = carry + (size_t)bytes_read;
+        for (size_t i = 0; i < window_len; i++) {
+            for (int m = 0; m < 2; m++) {
+                size_t len = markers[m] != NULL ? strlen(markers[m]) : 0;
+                if (len > 0 && i + len <= window_len && memcmp(window + i, markers[m], len) == 0) {
+                    return m + 1;
+                }
+            }
+        }
+
+        carry = (window_len < 63) ? window_len : 63;
+        memmove(window, window + window_len - carry, carry);
+    }
+}
+
+/**
+ * @brief Read and discard output until the program has been quiet for a while
+ */
+static void session_drain(Session *session, int quiet_ms) {
+    char buffer[4096];
+    while (session_read(session, buffer, sizeof(buffer), quiet_ms) > 0) {
+        continue;
+    }
+}
+
+/**
+ * @brief Ask the program to exit, killing it if it does not
+ */
+static void session_stop(Session *session) {
+    session_write(session, "\003exit\r", 6);
+
+    uint64_t deadline = now_us() + 3000000u;
+    while (waitpid(session->pid, NULL, WNOHANG) == 0) {
+        if (now_us() > deadline) {
+            kill(session->pid, SIGKILL);
+            waitpid(session->pid, NULL, 0);
+            break;
+        }
+        session_drain(session, 10);
+    }
+
+    close(session->fd);
+}
+
+/**
+ * @brief Start the mock server and read the port it listens on
+ *
+ * @return The server's pid, or -1 on failure
+ */
+static pid_t server_start(char *const argv[], int *port) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        execvp(argv[0], argv);
+        fprintf(stderr, "Error: Failed to execute %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    close(fds[1]);
+
+    char line[64];
+    size_t len = 0;
+    struct pollfd pfd = { .fd = fds[0], .events = POLLIN, .revents = 0 };
+    while (pid > 0 && len < sizeof(line) - 1 && memchr(line, '\n', len) == NULL &&
+           poll(&pfd, 1, START_TIMEOUT_MS) > 0) {
+        ssize_t bytes_read = read(fds[0], line + len, sizeof(line) - 1 - len);
+        if (bytes_read <= 0) {
+            break;
+        }
+        len += (size_t)bytes_read;
+    }
+    close(fds[0]);
+    line[len] = '\0';
+
+    if (pid > 0 && sscanf(line, "port %d", port) != 1) {
+        fprintf(stderr, "Error: The mock server did not start\n");
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * @brief Type one query in Chat mode and time it until its command has run
+ *
+ * @param latency_us Set to the time from Enter to the command's output
+ * @return 1 if the command ran, 2 if AISH reported an error, 0 if it hung
+ */
+static int run_query(Session *session, size_t index, uint64_t *latency_us) {
+    char query[64];
+    snprintf(query, sizeof(query), "show a greeting %zu", index);
+
+    if (!session_write(session, "\t", 1) ||
+        session_wait_for(session, CHAT_PROMPT, NULL, START_TIMEOUT_MS) == 0 ||
+        !session_write(session, query, strlen(query))) {
+        return 0;
+    }
+    session_drain(session, QUIET_MS);
+
+    uint64_t start = now_us();
+    if (!session_write(session, "\r", 1)) {
+        return 0;
+    }
+    int outcome = session_wait_for(session, DONE_MARKER, ERROR_MARKER, REQUEST_TIMEOUT_MS);
+    *latency_us = now_us() - start;
+    session_drain(session, QUIET_MS);
+
+    if (outcome == 2) {
+        // A failed request leaves AISH in Chat mode
+        session_write(session, "\t", 1);
+        session_drain(session, QUIET_MS);
+    }
+    return outcome;
+}
+
+/**
+ * @brief Send one query in Chat mode and abandon it with Ctrl+C while it is pending
+ *
+ * @param latency_us Set to the time from Ctrl+C to the redrawn Chat prompt
+ * @return 1 if the prompt came back, 2 if the command ran anyway, 0 if it hung
+ */
+static int run_cancel(Session *session, size_t index, uint64_t *latency_us) {
+    char query[64];
+    snprintf(query, sizeof(query), "show a farewell %zu", index);
+
+    if (!session_write(session, "\t", 1) ||
+        session_wait_for(session, CHAT_PROMPT, NULL, START_TIMEOUT_MS) == 0 ||
+        !session_write(session, query, strlen(query))) {
+        return 0;
+    }
+    session_drain(session, QUIET_MS);
+
+    if (!session_write(session, "\r", 1) ||
+        session_wait_for(session, STATUS_MARKER, DONE_MARKER, START_TIMEOUT_MS) != 1) {
+        return 0;
+    }
+    poll(NULL, 0, CANCEL_DELAY_MS);
+
+    uint64_t start = now_us();
+    if (!session_write(session, "\003", 1)) {
+        return 0;
+    }
+    int outcome = session_wait_for(session, CHAT_PROMPT, DONE_MARKER, START_TIMEOUT_MS);
+    *latency_us = now_us() - start;
+    if (outcome != 1) {
+        return outcome;
+    }
+
+    // The answer to the abandoned request must not run once it arrives
+    if (session_wait_for(session, DONE_MARKER, NULL, CANCEL_BOUND_MS) != 0) {
+        return 2;
+    }
+
+    // Back to Bash mode for the next query
+    session_write(session, "\t", 1);
+    session_drain(session, QUIET_MS);
+    return 1;
+}
+
+/**
+ * @brief Ask AISH for its statistics and pick out one latency line
+ *
+ * @param text The statistics output
+ * @param name Name of the latency, like "api build"
+ */
+static void parse_latency(const char *text, const char *name, Percentiles *result) {
+    char key[64];
+    snprintf(key, sizeof(key), STATS_PREFIX "%s: ", name);
+
+    const char *line = strstr(text, key);
+    memset(result, 0, sizeof(*result));
+    if (line != NULL) {
+        result->found = sscanf(line + strlen(key), "%llu samples, p50 %lluus, p90 %lluus, p99 %lluus, max %lluus",
+                               &result->samples, &result->p50, &result->p90, &result->p99, &result->max) == 5;
+    }
+}
+
+/**
+ * @brief Pick out the memory held by AISH's request arenas
+ *
+ * @return true if the line was found
+ */
+static bool parse_memory(const char *text, unsigned long long *arenas, unsigned long long *bytes,
+                         unsigned long long *peak) {
+    const char *key = "[AISH stats] api memory: ";
+    const char *line = strstr(text, key);
+    return line != NULL &&
+           sscanf(line + strlen(key), "%llu arenas holding %llu bytes, peak %llu bytes", arenas, bytes, peak) == 3;
+}
+
+/**
+ * @brief Send SIGUSR1 and collect the statistics AISH prints
+ *
+ * @return The output (free with free()), or NULL if it did not come
+ */
+static char *collect_stats(Session *session) {
+    size_t capacity = 16384;
+    size_t len = 0;
+    char *text = malloc(capacity);
+    if (text == NULL) {
+        return NULL;
+    }
+    text[0] = '\0';
+
+    kill(session->pid, SIGUSR1);
+    uint64_t deadline = now_us() + (uint64_t)START_TIMEOUT_MS * 1000u;
+    while (now_us() < deadline) {
+        // The last line is complete once its CRLF has arrived
+        const char *end = strstr(text, STATS_END);
+        if (end != NULL && strchr(end, '\n') != NULL) {
+            return text;
+        }
+        if (len + 4096 + 1 > capacity) {
+            capacity *= 2;
+            char *text_new = realloc(text, capacity);
+            if (text_new == NULL) {
+                break;
+            }
+            text = text_new;
+        }
+        ssize_t bytes_read = session_read(session, text + len, 4096, START_TIMEOUT_MS);
+        if (bytes_read <= 0) {
+            break;
+        }
+        len += (size_t)bytes_read;
+        text[len] = '\0';
+    }
+
+    free(text);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    return sorted[(size_t)(p * (double)(count - 1) + 0.5)];
+}
+
+static void print_percentiles(const char *name, const Percentiles *result, bool last) {
+    if (!result->found) {
+        printf("    \"%s\": null%s\n", name, last ? "" : ",");
+        return;
+    }
+    printf("    \"%s\": { \"samples\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu }%s\n",
+           name, result->samples, result->p50, result->p90, result->p99, result->max, last ? "" : ",");
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--aish PATH] [--server PATH] [--queries N] [--cancel N] [--no-stream]\n"
+            "          [SERVER OPTIONS]\n"
+            "\n"
+            "  --aish PATH        AISH binary to measure (default: %s)\n"
+            "  --server PATH      Mock server binary (default: %s)\n"
+            "  --queries N        Chat queries to time (default: %d)\n"
+            "  --cancel N         Queries to abandon with Ctrl+C (default: 0; needs --latency\n"
+            "                     well above %d ms)\n"
+            "  --no-stream        Ask for complete answers instead of SSE streams\n"
+            "\n"
+            "Passed to the mock server: --latency MS, --token-rate N, --tokens N,\n"
+            "--error-rate PCT, --error-status CODE, --drip-ms MS, --drip-bytes N, --seed N\n",
+            program, DEFAULT_AISH, DEFAULT_SERVER, DEFAULT_QUERIES, CANCEL_DELAY_MS);
+}
+
+int main(int argc, char *argv[]) {
+    const char *aish = DEFAULT_AISH;
+    const char *server = DEFAULT_SERVER;
+    size_t queries = DEFAULT_QUERIES;
+    size_t cancels = 0;
+    bool stream = true;
+    char *server_argv[MAX_SERVER_ARGS];
+    int server_argc = 0;
+
+    server_argv[server_argc++] = NULL; // Filled in below
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--aish") == 0 && i + 1 < argc) {
+            aish = argv[++i];
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            server = argv[++i];
+        } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+            queries = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--cancel") == 0 && i + 1 < argc) {
+            cancels = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--no-stream") == 0) {
+            stream = false;
+        } else if ((strcmp(argv[i], "--latency") == 0 || strcmp(argv[i], "--token-rate") == 0 ||
+                    strcmp(argv[i], "--tokens") == 0 || strcmp(argv[i], "--error-rate") == 0 ||
+                    strcmp(argv[i], "--error-status") == 0 || strcmp(argv[i], "--drip-ms") == 0 ||
+                    strcmp(argv[i], "--drip-bytes") == 0 || strcmp(argv[i], "--seed") == 0) &&
+                   i + 1 < argc && server_argc + 6 < MAX_SERVER_ARGS) {
+            server_argv[server_argc++] = argv[i];
+            server_argv[server_argc++] = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    server_argv[0] = (char *)server;
+    server_argv[server_argc++] = "--port";
+    server_argv[server_argc++] = "0";
+    server_argv[server_argc++] = "--command";
+    server_argv[server_argc++] = MODEL_COMMAND;
+    server_argv[server_argc] = NULL;
+
+    int port = 0;
+    pid_t server_pid = server_start(server_argv, &port);
+    if (server_pid == -1) {
+        return 1;
+    }
+
+    // AISH gets an empty home with a configuration pointing at the mock
+    char home[] = "/tmp/aish-bench-XXXXXX";
+    char config_path[sizeof(home) + 8];
+    char state_dir[sizeof(home) + 8];
+    char cache_path[sizeof(home) + 24];
+    if (mkdtemp(home) == NULL) {
+        fprintf(stderr, "Error: Failed to create a scratch directory: %s\n", strerror(errno));
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+        return 1;
+    }
+    snprintf(config_path, sizeof(config_path), "%s/.aish", home);
+    snprintf(state_dir, sizeof(state_dir), "%s/aish", home);
+    snprintf(cache_path, sizeof(cache_path), "%s/net-cache", state_dir);
+    FILE *config = fopen(config_path, "w");
+    bool ok = config != NULL;
+    if (ok) {
+        fprintf(config, "{\"backend\": \"openai-compatible\", \"base_url\": \"http://127.0.0.1:%d/v1\", "
+                "\"stream\": %s}\n", port, stream ? "true" : "false");
+        fclose(config);
+    } else {
+        fprintf(stderr, "Error: Failed to write %s: %s\n", config_path, strerror(errno));
+    }
+
+    Session session;
+    char *aish_argv[] = { (char *)aish, NULL };
+    ok = ok && session_start(&session, aish_argv, home);
+    bool started = ok;
+
+    // Typing before AISH has put the terminal in raw mode would lose the keys
+    char buffer[4096];
+    ok = ok && session_read(&session, buffer, sizeof(buffer), START_TIMEOUT_MS) > 0;
+    if (ok) {
+        session_drain(&session, SETTLE_MS);
+        ok = session_write(&session, READY_COMMAND, strlen(READY_COMMAND)) &&
+             session_wait_for(&session, READY_MARKER, NULL, START_TIMEOUT_MS) == 1;
+        if (!ok) {
+            fprintf(stderr, "Error: %s did not start\n", aish);
+        }
+        session_drain(&session, QUIET_MS);
+    }
+
+    uint64_t *latencies = calloc(queries > 0 ? queries : 1, sizeof(uint64_t));
+    size_t completed = 0;
+    size_t errors = 0;
+    ok = ok && latencies != NULL;
+    for (size_t i = 0; ok && i < queries; i++) {
+        uint64_t latency_us = 0;
+        int outcome = run_query(&session, i, &latency_us);
+        if (outcome == 1) {
+            latencies[completed++] = latency_us;
+        } else if (outcome == 2) {
+            errors++;
+        } else {
+            fprintf(stderr, "Error: Query %zu got no answer\n", i);
+            ok = false;
+        }
+    }
+
+    uint64_t *cancel_latencies = calloc(cancels > 0 ? cancels : 1, sizeof(uint64_t));
+    size_t cancelled = 0;
+    size_t slow_cancels = 0;
+    ok = ok && cancel_latencies != NULL;
+    for (size_t i = 0; ok && i < cancels; i++) {
+        uint64_t latency_us = 0;
+        int outcome = run_cancel(&session, i, &latency_us);
+        if (outcome == 1) {
+            cancel_latencies[cancelled++] = latency_us;
+            if (latency_us > (uint64_t)CANCEL_BOUND_MS * 1000u) {
+                fprintf(stderr, "Error: Cancelling query %zu took %llu us\n", i, (unsigned long long)latency_us);
+                slow_cancels++;
+            }
+        } else if (outcome == 2) {
+            fprintf(stderr, "Error: The command of cancelled query %zu ran (is --latency long enough?)\n", i);
+            ok = false;
+        } else {
+            fprintf(stderr, "Error: Ctrl+C did not bring the prompt back for query %zu\n", i);
+            ok = false;
+        }
+    }
+
+    char *stats = ok ? collect_stats(&session) : NULL;
+    if (ok && stats == NULL) {
+        fprintf(stderr, "Error: %s did not report its statistics\n", aish);
+        ok = false;
+    }
+
+    if (started) {
+        session_stop(&session);
+    }
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+
+    unlink(config_path);
+    unlink(cache_path);
+    rmdir(state_dir);
+    rmdir(home);
+
+    if (ok) {
+        Percentiles build, first_byte, parse, answer, executed;
+        parse_latency(stats, "api build", &build);
+        parse_latency(stats, "api first byte", &first_byte);
+        parse_latency(stats, "api parse", &parse);
+        parse_latency(stats, "api answer", &answer);
+        unsigned long long arenas = 0, arena_bytes = 0, arena_peak = 0;
+        bool memory = parse_memory(stats, &arenas, &arena_bytes, &arena_peak);
+
+        qsort(latencies, completed, sizeof(uint64_t), compare_u64);
+        executed.found = completed > 0;
+        executed.samples = completed;
+        executed.p50 = percentile(latencies, completed, 0.50);
+        executed.p90 = percentile(latencies, completed, 0.90);
+        executed.p99 = percentile(latencies, completed, 0.99);
+        executed.max = completed > 0 ? latencies[completed - 1] : 0;
+
+        printf("{\n");
+        printf("  \"queries\": %zu,\n", queries);
+        printf("  \"completed\": %zu,\n", completed);
+        printf("  \"errors\": %zu,\n", errors);
+        if (cancels > 0) {
+            printf("  \"cancelled\": %zu,\n", cancelled);
+            printf("  \"slow_cancels\": %zu,\n", slow_cancels);
+        }
+        printf("  \"stream\": %s,\n", stream ? "true" : "false");
+        printf("  \"server\": \"");
+        for (int i = 1; server_argv[i] != NULL && strcmp(server_argv[i], "--port") != 0; i++) {
+            printf("%s%s", i > 1 ? " " : "", server_argv[i]);
+        }
+        printf("\",\n");
+        printf("  \"latency_us\": {\n");
+        print_percentiles("request_build", &build, false);
+        print_percentiles("first_byte", &first_byte, false);
+        print_percentiles("parse", &parse, false);
+        print_percentiles("answer", &answer, false);
+        print_percentiles("keystroke_to_executed", &executed, cancels == 0);
+        if (cancels > 0) {
+            Percentiles cancel;
+            qsort(cancel_latencies, cancelled, sizeof(uint64_t), compare_u64);
+            cancel.found = true;
+            cancel.samples = cancelled;
+            cancel.p50 = percentile(cancel_latencies, cancelled, 0.50);
+            cancel.p90 = percentile(cancel_latencies, cancelled, 0.90);
+            cancel.p99 = percentile(cancel_latencies, cancelled, 0.99);
+            cancel.max = cancelled > 0 ? cancel_latencies[cancelled - 1] : 0;
+            print_percentiles("cancel_to_prompt", &cancel, true);
+        }
+        printf("  },\n");
+        if (memory) {
+            printf("  \"memory\": { \"arenas\": %llu, \"arena_bytes\": %llu, \"peak_bytes_per_request\": %llu }\n",
+                   arenas, arena_bytes, arena_peak);
+        } else {
+            printf("  \"memory\": null\n");
+        }
+        printf("}\n");
+    }
+
+    free(stats);
+    free(latencies);
+    free(cancel_latencies);
+    return (ok && slow_cancels == 0) ? 0 : 1;
+}
@@ -0,0 +1,294 @@
+/**
+ * @file bench_parse.c
+ * @brief Microbenchmark for extracting the command from chat answers
+ *
+ * Compares the two ways AISH has taken the command out of a complete
+ * chat-completions answer:
+ *
+ * - json_c: json_tokener_parse() of the whole body, a walk to
+ *   choices[0].message.content, and a second json_tokener_parse() of that
+ *   string to read "command", as before the scanner existed;
+ * - jscan: the backend's parse_response, one pass of the jscan scanner
+ *   that skips everything off the path and decodes the strings in place,
+ *   with the command carved from an arena reset after every answer.
+ *
+ * Answers are measured bare and with a "logprobs" payload of --tokens
+ * entries (each with five alternatives), like the ones some servers
+ * attach: after the message, where OpenAI puts it, and before it, where
+ * the scanner has to skip all of it. Allocations are counted by
+ * interposing malloc() and friends, which works with glibc; elsewhere they
+ * are reported as null.
+ *
+ * Results are printed to stdout as one JSON object.
+ */
+
+#include "backend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <json-c/json.h>
+
+#define DEFAULT_ITERATIONS 2000
+#define DEFAULT_TOKENS 500
+#define COMMAND_CONTENT "{\\\"command\\\": \\\"find . -name \\\\\\\"*.log\\\\\\\" -mtime -2\\\", " \
+                        "\\\"explanation\\\": \\\"Lists log files changed in the last two days\\\"}"
+
+#if defined(__GLIBC__)
+#define COUNTS_ALLOCATIONS 1
+
+// glibc's allocator under the names it keeps for replacements like this one
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t allocations = 0;
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+#else
+#define COUNTS_ALLOCATIONS 0
+static uint64_t allocations = 0;
+#endif
+
+/**
+ * @struct ParseResult
+ * @brief Measurements for one way of parsing one answer
+ */
+typedef struct {
+    const char *method;     /**< "json_c" or "jscan" */
+    const char *answer;     /**< "bare", "logprobs" or "logprobs_first" */
+    size_t body_size;       /**< Bytes in the answer */
+    double ns_per_parse;    /**< Time per answer */
+    double allocations;     /**< Heap allocations per answer */
+} ParseResult;
+
+// Commands are not checked here
+bool api_validate_command(const char *command) {
+    return command != NULL;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Build an answer, with tokens logprobs entries if tokens > 0
+ *
+ * @param logprobs_first Put the logprobs before the message
+ */
+static char *build_answer(size_t tokens, bool logprobs_first) {
+    size_t capacity = 1024 + tokens * 512;
+    char *body = malloc(capacity);
+    if (body == NULL) {
+        return NULL;
+    }
+
+    char message[512];
+    snprintf(message, sizeof(message), "\"message\": {\"role\": \"assistant\", \"content\": \"%s\"}, ",
+             COMMAND_CONTENT);
+    size_t len = (size_t)snprintf(body, capacity,
+                                  "{\"id\": \"chatcmpl-bench\", \"object\": \"chat.completion\", "
+                                  "\"created\": 1700000000, \"model\": \"gpt-4-turbo\", \"choices\": [{"
+                                  "\"index\": 0, %s\"logprobs\": {\"content\": [",
+                                  logprobs_first ? "" : message);
+    for (size_t i = 0; i < tokens; i++) {
+        len += (size_t)snprintf(body + len, capacity - len,
+                                "%s{\"token\": \"tok%zu\\\"\", \"logprob\": -0.%zu, \"bytes\": [116, 111, 107], "
+                                "\"top_logprobs\": [{\"token\": \"a\", \"logprob\": -1.5}, "
+                                "{\"token\": \"b\", \"logprob\": -2.5}, {\"token\": \"c\", \"logprob\": -3.5}, "
+                                "{\"token\": \"d\", \"logprob\": -4.5}, {\"token\": \"e\", \"logprob\": -5.5}]}",
+                                i > 0 ? ", " : "", i, i % 1000);
+    }
+    snprintf(body + len, capacity - len,
+             "]}, %s\"finish_reason\": \"stop\"}], \"usage\": {\"prompt_tokens\": 61, "
+             "\"completion_tokens\": %zu, \"total_tokens\": %zu}}",
+             logprobs_first ? message : "", tokens, tokens + 61);
+    return body;
+}
+
+/**
+ * @brief Take the command out of an answer the way AISH did with json-c
+ */
+static char *parse_json_c(const char *body) {
+    struct json_object *json_response = json_tokener_parse(body);
+    struct json_object *choices_array, *message_obj, *content_obj, *command_obj;
+    char *command = NULL;
+
+    if (json_response != NULL &&
+        json_object_object_get_ex(json_response, "choices", &choices_array) &&
+        json_object_get_type(choices_array) == json_type_array &&
+        json_object_array_length(choices_array) > 0 &&
+        json_object_object_get_ex(json_object_array_get_idx(choices_array, 0), "message", &message_obj) &&
+        json_object_object_get_ex(message_obj, "content", &content_obj)) {
+        const char *content_str = json_object_get_string(content_obj);
+        struct json_object *command_json = json_tokener_parse(content_str);
+        if (command_json != NULL && json_object_object_get_ex(command_json, "command", &command_obj)) {
+            command = strdup(json_object_get_string(command_obj));
+        } else {
+            command = strdup(content_str);
+        }
+        json_object_put(command_json);
+    }
+
+    json_object_put(json_response);
+    return command;
+}
+
+static bool bench_json_c(const char *body, size_t iterations, ParseResult *result) {
+    uint64_t allocations_before = allocations;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < iterations; i++) {
+        char *command = parse_json_c(body);
+        if (command == NULL) {
+            return false;
+        }
+        free(command);
+    }
+    result->ns_per_parse = (double)(now_ns() - start) / (double)iterations;
+    result->allocations = (double)(allocations - allocations_before) / (double)iterations;
+    return true;
+}
+
+/**
+ * @brief Time the backend's parser, which decodes in place
+ *
+ * Each iteration parses a fresh copy of the answer (the copy is timed
+ * too: AISH parses the response buffer it received into).
+ */
+static bool bench_jscan(const char *body, size_t iterations, Arena *arena, ParseResult *result) {
+    const ApiBackend *backend = backend_get(BACKEND_OPENAI);
+    size_t len = strlen(body);
+    char *copy = malloc(len + 1);
+    if (copy == NULL) {
+        return false;
+    }
+
+    uint64_t allocations_before = allocations;
+    uint64_t start = now_ns();
+    bool ok = true;
+    for (size_t i = 0; ok && i < iterations; i++) {
+        memcpy(copy, body, len + 1);
+        ApiResponse response = { NULL, false, NULL };
+        ok = backend->parse_response(copy, len, arena, &response) && response.command != NULL;
+        arena_reset(arena);
+    }
+    result->ns_per_parse = (double)(now_ns() - start) / (double)iterations;
+    result->allocations = (double)(allocations - allocations_before) / (double)iterations;
+
+    free(copy);
+    return ok;
+}
+
+static void print_result(const ParseResult *result, bool last) {
+    printf("    { \"method\": \"%s\", \"answer\": \"%s\", \"body_bytes\": %zu, \"us_per_parse\": %.2f, ",
+           result->method, result->answer, result->body_size, result->ns_per_parse / 1000.0);
+    if (COUNTS_ALLOCATIONS) {
+        printf("\"allocations_per_parse\": %.1f }%s\n", result->allocations, last ? "" : ",");
+    } else {
+        printf("\"allocations_per_parse\": null }%s\n", last ? "" : ",");
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--iterations N] [--tokens N]\n"
+            "\n"
+            "  --iterations N  Answers parsed per measurement (default: %d)\n"
+            "  --tokens N      Logprobs entries in the large answer (default: %d)\n",
+            program, DEFAULT_ITERATIONS, DEFAULT_TOKENS);
+}
+
+int main(int argc, char *argv[]) {
+    size_t iterations = DEFAULT_ITERATIONS;
+    size_t tokens = DEFAULT_TOKENS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--tokens") == 0 && i + 1 < argc) {
+            tokens = (size_t)strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char *bodies[3] = { build_answer(0, false), build_answer(tokens, false), build_answer(tokens, true) };
+    const char *answer_names[] = { "bare", "logprobs", "logprobs_first" };
+    ParseResult results[6];
+    Arena arena;
+    bool ok = bodies[0] != NULL && bodies[1] != NULL && bodies[2] != NULL && arena_init(&arena, 0);
+
+    // Both must agree before their speed means anything
+    for (size_t i = 0; ok && i < 3; i++) {
+        char *expected = parse_json_c(bodies[i]);
+        char *copy = strdup(bodies[i]);
+        ApiResponse response = { NULL, false, NULL };
+        ok = expected != NULL && copy != NULL &&
+             backend_get(BACKEND_OPENAI)->parse_response(copy, strlen(copy), &arena, &response) &&
+             strcmp(expected, response.command) == 0;
+        if (!ok) {
+            fprintf(stderr, "Error: The parsers disagree: \"%s\" and \"%s\"\n",
+                    expected != NULL ? expected : "", response.command != NULL ? response.command : "");
+        }
+        free(expected);
+        free(copy);
+        arena_reset(&arena);
+    }
+
+    for (size_t i = 0; ok && i < 3; i++) {
+        results[i * 2].method = "json_c";
+        results[i * 2 + 1].method = "jscan";
+        for (size_t j = 0; j < 2; j++) {
+            results[i * 2 + j].answer = answer_names[i];
+            results[i * 2 + j].body_size = strlen(bodies[i]);
+        }
+        ok = bench_json_c(bodies[i], iterations, &results[i * 2]) &&
+             bench_jscan(bodies[i], iterations, &arena, &results[i * 2 + 1]);
+    }
+
+    for (size_t i = 0; i < 3; i++) {
+        free(bodies[i]);
+    }
+    arena_free(&arena);
+    if (!ok) {
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"iterations\": %zu,\n", iterations);
+    printf("  \"logprobs_tokens\": %zu,\n", tokens);
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < 6; i++) {
+        print_result(&results[i], i == 5);
+    }
+    printf("  ]\n");
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,678 @@
+/**
+ * @file bench_relay.c
+ * @brief Throughput and latency benchmark for the AISH pty relay
+ *
+ * Runs bin/aish on a pseudo-terminal of its own, the way a terminal
+ * emulator would, and measures what its interposition costs compared with
+ * plain bash on the same kind of terminal:
+ *
+ * - throughput: `yes | head -c N` is run at the prompt and every byte that
+ *   reaches the terminal is counted until a marker printed after it arrives;
+ * - system calls: every call made by the AISH process during a second,
+ *   traced output run (Linux only; falls back to the read/write counters
+ *   in /proc/<pid>/io where ptrace is not allowed);
+ * - echo latency: single keystrokes are typed at the prompt and the time
+ *   until each one is echoed back is recorded.
+ *
+ * Results are printed to stdout as one JSON object.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE // mkdtemp()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+
+#if defined(__linux__)
+#include <pty.h>
+#include <sys/ptrace.h>
+#else
+#include <util.h>
+#endif
+
+#define DEFAULT_AISH "bin/aish"
+#define DEFAULT_BYTES (64ULL * 1024 * 1024)
+#define DEFAULT_KEYS 500
+#define READ_SIZE (64 * 1024)
+#define START_TIMEOUT_MS 10000
+#define ECHO_TIMEOUT_MS 2000
+#define KEYS_PER_LINE 50            // Ctrl+U after this many keystrokes
+#define QUIET_MS 50                 // Output settled after this long
+#define SETTLE_MS 300               // Same, while the program starts up
+
+// The markers are printed by `echo A""B` so the echoed command line never contains them
+#define READY_COMMAND "echo __RELAY_\"\"READY__\r"
+#define READY_MARKER "__RELAY_READY__"
+#define DONE_MARKER "__RELAY_DONE__"
+
+/**
+ * @struct Session
+ * @brief A program running on a pseudo-terminal owned by the benchmark
+ */
+typedef struct {
+    int fd;         /**< Pty master */
+    pid_t pid;      /**< Program on the slave side */
+} Session;
+
+/**
+ * @struct RelayResult
+ * @brief Measurements for one program
+ */
+typedef struct {
+    const char *target;         /**< "aish" or "bash" */
+    uint64_t bytes;             /**< Bytes that reached the terminal */
+    double seconds;             /**< Time to relay them */
+    long long syscalls;         /**< System calls during a second output run, -1 if not counted */
+    uint64_t syscall_bytes;     /**< Bytes relayed during that run */
+    const char *syscall_source; /**< "ptrace", or "proc_io" (reads and writes only) */
+    double *echo_us;            /**< Keystroke-to-echo latencies */
+    size_t echo_count;          /**< Number of latencies recorded */
+} RelayResult;
+
+/**
+ * @struct SyscallCounter
+ * @brief Helper process counting another process's system calls
+ */
+typedef struct {
+    pid_t pid;      /**< Helper process */
+    int fd;         /**< Pipe the helper reports on */
+} SyscallCounter;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/**
+ * @brief Parse a byte count with an optional K, M or G suffix
+ */
+static bool parse_size(const char *text, uint64_t *size) {
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+
+    if (end == text) {
+        return false;
+    }
+
+    switch (*end) {
+    case 'G': case 'g': value *= 1024; /* fall through */
+    case 'M': case 'm': value *= 1024; /* fall through */
+    case 'K': case 'k': value *= 1024; end++; break;
+    default: break;
+    }
+
+    if (*end != '\0' || value == 0) {
+        return false;
+    }
+    *size = value;
+    return true;
+}
+
+/**
+ * @brief Start a program on a new pty with HOME pointing at a scratch directory
+ */
+static bool session_start(Session *session, char *const argv[], const char *home) {
+    struct winsize ws = { .ws_row = 24, .ws_col = 80, .ws_xpixel = 0, .ws_ypixel = 0 };
+
+    session->pid = forkpty(&session->fd, NULL, NULL, &ws);
+    if (session->pid == -1) {
+        fprintf(stderr, "Error: forkpty failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (session->pid == 0) {
+        setenv("HOME", home, 1);
+        setenv("HISTFILE", "/dev/null", 1);
+        setenv("TERM", "xterm-256color", 1);
+        execvp(argv[0], argv);
+        fprintf(stderr, "Error: Failed to execute %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Wait up to timeout_ms for output, returning what was read
+ *
+ * @return Bytes read, 0 on timeout, -1 when the program went away
+ */
+static ssize_t session_read(Session *session, char *buffer, size_t size, int timeout_ms) {
+    struct pollfd pfd = { .fd = session->fd, .events = POLLIN, .revents = 0 };
+
+    for (;;) {
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return ready;
+        }
+
+        ssize_t bytes_read = read(session->fd, buffer, size);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        return bytes_read > 0 ? bytes_read : -1;
+    }
+}
+
+static bool session_write(Session *session, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(session->fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+/**
+ * @brief Read until a marker appears in the output
+ *
+ * @param bytes If not NULL, incremented by every byte read
+ * @return true if the marker was seen, false on timeout or exit
+ */
+static bool session_wait_for(Session *session, const char *marker, int timeout_ms, uint64_t *bytes) {
+    static char buffer[READ_SIZE];
+    char window[64 + READ_SIZE];
+    size_t marker_len = strlen(marker);
+    size_t carry = 0;
+
+    for (;;) {
+        ssize_t bytes_read = session_read(session, buffer, sizeof(buffer), timeout_ms);
+        if (bytes_read <= 0) {
+            return false;
+        }
+        if (bytes != NULL) {
+            *bytes += (uint64_t)bytes_read;
+        }
+
+        // Keep the end of the previous read so a marker split across reads is found
+        memcpy(window + carry, buffer, (size_t)bytes_read);
+        size_t window_len = carry + (size_t)bytes_read;
+        for (size_t i = 0; i + marker_len <= window_len; i++) {
+            if (window[i] == marker[0] && memcmp(window + i, marker, marker_len) == 0) {
+                return true;
+            }
+        }
+
+        carry = (window_len < marker_len) ? window_len : marker_len - 1;
+        memmove(window, window + window_len - carry, carry);
+    }
+}
+
+/**
+ * @brief Read and discard output until the program has been quiet for a while
+ */
+static void session_drain(Session *session, int quiet_ms) {
+    char buffer[4096];
+    while (session_read(session, buffer, sizeof(buffer), quiet_ms) > 0) {
+        continue;
+    }
+}
+
+/**
+ * @brief Ask the program to exit, killing it if it does not
+ */
+static void session_stop(Session *session) {
+    session_write(session, "\003exit\r", 6);
+
+    uint64_t deadline = now_us() + 3000000u;
+    while (waitpid(session->pid, NULL, WNOHANG) == 0) {
+        if (now_us() > deadline) {
+            kill(session->pid, SIGKILL);
+            waitpid(session->pid, NULL, 0);
+            break;
+        }
+        session_drain(session, 10);
+    }
+
+    close(session->fd);
+}
+
+/**
+ * @brief Read the read/write system call counters of a process
+ */
+static void read_io_counters(pid_t pid, long long *reads, long long *writes) {
+    char path[64];
+    char line[128];
+
+    *reads = -1;
+    *writes = -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        sscanf(line, "syscr: %lld", reads);
+        sscanf(line, "syscw: %lld", writes);
+    }
+    fclose(file);
+}
+
+#if defined(__linux__)
+static volatile sig_atomic_t counter_done = 0;
+
+static void counter_on_term(int sig) {
+    (void)sig;
+    counter_done = 1;
+}
+
+/**
+ * @brief Body of the helper process that counts a target's system calls
+ *
+ * Stops at every system call entry and exit of the target until SIGTERM,
+ * then detaches and writes the count (or -1) to fd.
+ */
+static void counter_main(pid_t target, int fd) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = counter_on_term; // no SA_RESTART: SIGTERM interrupts waitpid()
+    sigaction(SIGTERM, &sa, NULL);
+
+    long long stops = 0;
+    bool interrupted = false;
+    int status;
+
+    if (ptrace(PTRACE_SEIZE, target, NULL, (void *)PTRACE_O_TRACESYSGOOD) == -1 ||
+        ptrace(PTRACE_INTERRUPT, target, NULL, NULL) == -1) {
+        _exit(1);
+    }
+    write(fd, "y", 1);
+
+    for (;;) {
+        if (counter_done && !interrupted) {
+            ptrace(PTRACE_INTERRUPT, target, NULL, NULL);
+            interrupted = true;
+        }
+        if (waitpid(target, &status, __WALL) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (!WIFSTOPPED(status)) {
+            break;
+        }
+
+        // Pass real signals on; syscall and ptrace event stops carry none
+        int sig = WSTOPSIG(status);
+        if (sig == (SIGTRAP | 0x80)) {
+            stops++;
+            sig = 0;
+        } else if (sig == SIGTRAP || (status >> 16) == PTRACE_EVENT_STOP) {
+            sig = 0;
+        }
+
+        if (counter_done) {
+            ptrace(PTRACE_DETACH, target, NULL, (void *)(intptr_t)sig);
+            break;
+        }
+        ptrace(PTRACE_SYSCALL, target, NULL, (void *)(intptr_t)sig);
+    }
+
+    long long count = stops / 2; // one stop on entry and one on exit
+    write(fd, &count, sizeof(count));
+    _exit(0);
+}
+#endif
+
+/**
+ * @brief Start counting the system calls of a process
+ *
+ * Uses a helper process attached with ptrace, because the relay's splice()
+ * and io_uring_enter() calls do not show up in /proc/<pid>/io.
+ *
+ * @return true if counting started, false if ptrace is not available
+ */
+static bool counter_start(SyscallCounter *counter, pid_t target) {
+#if defined(__linux__)
+    int fds[2];
+    char ready;
+
+    if (pipe(fds) == -1) {
+        return false;
+    }
+
+    counter->pid = fork();
+    if (counter->pid == 0) {
+        close(fds[0]);
+        counter_main(target, fds[1]);
+    }
+    close(fds[1]);
+    counter->fd = fds[0];
+
+    if (counter->pid == -1 || read(counter->fd, &ready, 1) != 1) {
+        // The helper could not attach
+        close(counter->fd);
+        if (counter->pid > 0) {
+            waitpid(counter->pid, NULL, 0);
+        }
+        return false;
+    }
+    return true;
+#else
+    (void)counter;
+    (void)target;
+    return false;
+#endif
+}
+
+/**
+ * @brief Stop counting and collect the result
+ *
+ * @return System calls made since counter_start(), -1 on failure
+ */
+static long long counter_stop(SyscallCounter *counter) {
+    long long count = -1;
+    struct pollfd pfd = { .fd = counter->fd, .events = POLLIN, .revents = 0 };
+
+    // The helper may be blocked waiting for an idle target; keep nudging it
+    do {
+        kill(counter->pid, SIGTERM);
+    } while (poll(&pfd, 1, 50) == 0);
+
+    if (read(counter->fd, &count, sizeof(count)) != (ssize_t)sizeof(count)) {
+        count = -1;
+    }
+    close(counter->fd);
+    waitpid(counter->pid, NULL, 0);
+    return count;
+}
+
+/**
+ * @brief Time `yes | head -c bytes` at the prompt
+ *
+ * @param received Incremented by the bytes that reached the terminal
+ * @param seconds Set to the time it took
+ */
+static bool run_throughput(Session *session, uint64_t bytes, uint64_t *received, double *seconds) {
+    char command[128];
+
+    snprintf(command, sizeof(command), "yes | head -c %llu; echo; echo __RELAY_\"\"DONE__\r",
+             (unsigned long long)bytes);
+
+    uint64_t start = now_us();
+    if (!session_write(session, command, strlen(command)) ||
+        !session_wait_for(session, DONE_MARKER, START_TIMEOUT_MS, received)) {
+        return false;
+    }
+    *seconds = (double)(now_us() - start) / 1e6;
+
+    session_drain(session, QUIET_MS);
+    return true;
+}
+
+/**
+ * @brief Repeat the output run while counting the program's system calls
+ *
+ * A separate run, since tracing slows the program down.
+ */
+static bool run_syscall_count(Session *session, uint64_t bytes, RelayResult *result) {
+    SyscallCounter counter;
+    long long reads_before, writes_before, reads, writes;
+    double seconds;
+
+    bool traced = counter_start(&counter, session->pid);
+    if (!traced) {
+        read_io_counters(session->pid, &reads_before, &writes_before);
+    }
+
+    bool ok = run_throughput(session, bytes, &result->syscall_bytes, &seconds);
+
+    if (traced) {
+        result->syscalls = counter_stop(&counter);
+        result->syscall_source = "ptrace";
+    } else {
+        read_io_counters(session->pid, &reads, &writes);
+        if (reads_before >= 0 && reads >= 0) {
+            result->syscalls = (reads - reads_before) + (writes - writes_before);
+            result->syscall_source = "proc_io";
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Type keys one at a time and time each echo
+ */
+static bool run_latency(Session *session, size_t keys, RelayResult *result) {
+    char buffer[4096];
+
+    result->echo_us = calloc(keys > 0 ? keys : 1, sizeof(double));
+    if (result->echo_us == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < keys; i++) {
+        if (i > 0 && i % KEYS_PER_LINE == 0) {
+            // Clear the line so readline never has to redraw a wrapped one
+            session_write(session, "\025", 1);
+            session_drain(session, QUIET_MS);
+        }
+
+        char key = (char)('a' + i % 26);
+        uint64_t start = now_us();
+        if (!session_write(session, &key, 1)) {
+            return false;
+        }
+
+        for (;;) {
+            ssize_t bytes_read = session_read(session, buffer, sizeof(buffer), ECHO_TIMEOUT_MS);
+            if (bytes_read <= 0) {
+                fprintf(stderr, "Error: %s did not echo keystroke %zu\n", result->target, i);
+                return false;
+            }
+            if (memchr(buffer, key, (size_t)bytes_read) != NULL) {
+                break;
+            }
+        }
+        result->echo_us[result->echo_count++] = (double)(now_us() - start);
+    }
+
+    session_write(session, "\025", 1);
+    session_drain(session, QUIET_MS);
+    return true;
+}
+
+/**
+ * @brief Run the whole benchmark against one program
+ */
+static bool bench_target(char *const argv[], const char *home, uint64_t bytes, size_t keys,
+                         bool count_calls, RelayResult *result) {
+    Session session;
+
+    if (!session_start(&session, argv, home)) {
+        return false;
+    }
+
+    // Typing before the program has put the terminal in raw mode would lose
+    // the keys, so wait for the first prompt to settle
+    char buffer[4096];
+    bool ok = session_read(&session, buffer, sizeof(buffer), START_TIMEOUT_MS) > 0;
+    if (ok) {
+        session_drain(&session, SETTLE_MS);
+        ok = session_write(&session, READY_COMMAND, strlen(READY_COMMAND)) &&
+             session_wait_for(&session, READY_MARKER, START_TIMEOUT_MS, NULL);
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: %s did not start\n", result->target);
+    } else {
+        session_drain(&session, QUIET_MS);
+        ok = run_throughput(&session, bytes, &result->bytes, &result->seconds);
+        if (!ok) {
+            fprintf(stderr, "Error: %s did not finish the output run\n", result->target);
+        }
+        ok = ok && (!count_calls || run_syscall_count(&session, bytes, result)) &&
+             run_latency(&session, keys, result);
+    }
+
+    session_stop(&session);
+    return ok;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t count, double p) {
+    if (count == 0) {
+        return 0.0;
+    }
+    return sorted[(size_t)(p * (double)(count - 1) + 0.5)];
+}
+
+static void print_result(const RelayResult *result, bool last) {
+    double mb = (double)result->bytes / (1024.0 * 1024.0);
+
+    qsort(result->echo_us, result->echo_count, sizeof(double), compare_double);
+
+    printf("    {\n");
+    printf("      \"target\": \"%s\",\n", result->target);
+    printf("      \"bytes\": %llu,\n", (unsigned long long)result->bytes);
+    printf("      \"seconds\": %.3f,\n", result->seconds);
+    printf("      \"mb_per_s\": %.2f,\n", result->seconds > 0 ? mb / result->seconds : 0.0);
+    double syscall_mb = (double)result->syscall_bytes / (1024.0 * 1024.0);
+    if (result->syscalls >= 0 && syscall_mb > 0) {
+        printf("      \"syscalls\": %lld,\n", result->syscalls);
+        printf("      \"syscalls_per_mb\": %.1f,\n", (double)result->syscalls / syscall_mb);
+        printf("      \"syscall_source\": \"%s\",\n", result->syscall_source);
+    } else {
+        printf("      \"syscalls\": null,\n");
+        printf("      \"syscalls_per_mb\": null,\n");
+        printf("      \"syscall_source\": null,\n");
+    }
+    printf("      \"echo_us\": { \"samples\": %zu, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f }\n",
+           result->echo_count,
+           percentile(result->echo_us, result->echo_count, 0.50),
+           percentile(result->echo_us, result->echo_count, 0.90),
+           percentile(result->echo_us, result->echo_count, 0.99),
+           result->echo_count > 0 ? result->echo_us[result->echo_count - 1] : 0.0);
+    printf("    }%s\n", last ? "" : ",");
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--aish PATH] [--bytes N[K|M|G]] [--keys N] [--relay epoll|io_uring] [--no-baseline]\n"
+            "\n"
+            "  --aish PATH     AISH binary to measure (default: %s)\n"
+            "  --bytes N       Output volume for the throughput run (default: 64M)\n"
+            "  --keys N        Keystrokes for the echo latency run (default: %d)\n"
+            "  --relay NAME    Relay backend passed to AISH\n"
+            "  --no-baseline   Do not measure plain bash for comparison\n",
+            program, DEFAULT_AISH, DEFAULT_KEYS);
+}
+
+int main(int argc, char *argv[]) {
+    const char *aish = DEFAULT_AISH;
+    const char *relay = NULL;
+    uint64_t bytes = DEFAULT_BYTES;
+    size_t keys = DEFAULT_KEYS;
+    bool baseline = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--aish") == 0 && i + 1 < argc) {
+            aish = argv[++i];
+        } else if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc) {
+            if (!parse_size(argv[++i], &bytes)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+            keys = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--relay") == 0 && i + 1 < argc) {
+            relay = argv[++i];
+        } else if (strcmp(argv[i], "--no-baseline") == 0) {
+            baseline = false;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // AISH and bash get an empty home with just enough configuration to start
+    char home[] = "/tmp/aish-bench-XXXXXX";
+    char config_path[sizeof(home) + 8];
+    if (mkdtemp(home) == NULL) {
+        fprintf(stderr, "Error: Failed to create a scratch directory: %s\n", strerror(errno));
+        return 1;
+    }
+    snprintf(config_path, sizeof(config_path), "%s/.aish", home);
+    FILE *config = fopen(config_path, "w");
+    if (config == NULL) {
+        fprintf(stderr, "Error: Failed to write %s: %s\n", config_path, strerror(errno));
+        rmdir(home);
+        return 1;
+    }
+    fputs("{\"openai_api_key\": \"bench\"}\n", config);
+    fclose(config);
+
+    char relay_arg[64];
+    char *aish_argv[] = { (char *)aish, NULL, NULL };
+    if (relay != NULL) {
+        snprintf(relay_arg, sizeof(relay_arg), "--relay=%s", relay);
+        aish_argv[1] = relay_arg;
+    }
+    char *bash_argv[] = { "bash", "--login", NULL };
+
+    RelayResult results[2];
+    memset(results, 0, sizeof(results));
+    results[0].target = "aish";
+    results[0].syscalls = -1;
+    results[1].target = "bash";
+    results[1].syscalls = -1;
+
+    bool ok = bench_target(aish_argv, home, bytes, keys, true, &results[0]);
+    if (ok && baseline) {
+        ok = bench_target(bash_argv, home, bytes, keys, false, &results[1]);
+    }
+
+    unlink(config_path);
+    rmdir(home);
+
+    if (!ok) {
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"bytes_requested\": %llu,\n", (unsigned long long)bytes);
+    printf("  \"keys\": %zu,\n", keys);
+    printf("  \"relay\": \"%s\",\n", relay != NULL ? relay : "default");
+    printf("  \"results\": [\n");
+    print_result(&results[0], !baseline);
+    if (baseline) {
+        print_result(&results[1], true);
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    free(results[0].echo_us);
+    free(results[1].echo_us);
+    return 0;
+}
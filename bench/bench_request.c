@@ -0,0 +1,252 @@
+/**
+ * @file bench_request.c
+ * @brief Microbenchmark for building chat request bodies
+ *
+ * Compares the two ways AISH has built the body of a chat request:
+ *
+ * - json_c_tree: a fresh json-c tree per request (system prompt, model,
+ *   temperature, response_format, user input), serialized with
+ *   json_object_to_json_string() and copied out, as before the request
+ *   template existed;
+ * - template: the constant part rendered once by the backend, with the
+ *   JSON-escaped input spliced into a reused buffer
+ *   (backend_render_request()).
+ *
+ * For each, the time per request and the heap allocations per request in
+ * steady state are measured for a short and a long input. Allocations are
+ * counted by interposing malloc() and friends, which works with glibc;
+ * elsewhere they are reported as null.
+ *
+ * Results are printed to stdout as one JSON object.
+ */
+
+#include "backend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <json-c/json.h>
+
+#define DEFAULT_ITERATIONS 200000
+#define SHORT_INPUT "list files"
+#define LONG_INPUT "find every \"*.log\" file under /var/log bigger than 10MB that changed in the " \
+                   "last 2 days,\tsort them by size and show the 5 largest with human-readable sizes"
+#define SYSTEM_PROMPT "You are a CLI assistant that translates natural language to valid Bash commands. " \
+                      "Always return structured JSON output with a 'command' field containing the bash " \
+                      "command. Example: {\"command\": \"ls -la\"}"
+
+#if defined(__GLIBC__)
+#define COUNTS_ALLOCATIONS 1
+
+// glibc's allocator under the names it keeps for replacements like this one
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t allocations = 0;
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+#else
+#define COUNTS_ALLOCATIONS 0
+static uint64_t allocations = 0;
+#endif
+
+/**
+ * @struct BuildResult
+ * @brief Measurements for one way of building one input
+ */
+typedef struct {
+    const char *method;     /**< "json_c_tree" or "template" */
+    const char *input;      /**< "short" or "long" */
+    size_t body_size;       /**< Bytes in the body */
+    double ns_per_request;  /**< Time per body */
+    double allocations;     /**< Heap allocations per body */
+} BuildResult;
+
+// Answer parsing in backend.c is not exercised here
+bool api_validate_command(const char *command) {
+    return command != NULL;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Build a body the way api_send_request() did before the template
+ */
+static char *build_tree(const char *user_input, const Config *config) {
+    struct json_object *request_obj = json_object_new_object();
+    struct json_object *messages_array = json_object_new_array();
+
+    struct json_object *system_msg = json_object_new_object();
+    json_object_object_add(system_msg, "role", json_object_new_string("system"));
+    json_object_object_add(system_msg, "content", json_object_new_string(SYSTEM_PROMPT));
+    json_object_array_add(messages_array, system_msg);
+
+    struct json_object *user_msg = json_object_new_object();
+    json_object_object_add(user_msg, "role", json_object_new_string("user"));
+    json_object_object_add(user_msg, "content", json_object_new_string(user_input));
+    json_object_array_add(messages_array, user_msg);
+
+    json_object_object_add(request_obj, "messages", messages_array);
+    json_object_object_add(request_obj, "model", json_object_new_string(config->openai_model));
+    json_object_object_add(request_obj, "temperature", json_object_new_double(config->temperature));
+    json_object_object_add(request_obj, "max_tokens", json_object_new_int(config->max_tokens));
+
+    struct json_object *response_format = json_object_new_object();
+    json_object_object_add(response_format, "type", json_object_new_string("json_object"));
+    json_object_object_add(request_obj, "response_format", response_format);
+
+    if (config->stream) {
+        json_object_object_add(request_obj, "stream", json_object_new_boolean(1));
+    }
+
+    char *body = strdup(json_object_to_json_string(request_obj));
+    json_object_put(request_obj);
+    return body;
+}
+
+static bool bench_tree(const char *input, const Config *config, size_t iterations, BuildResult *result) {
+    char *body = build_tree(input, config);
+    if (body == NULL) {
+        return false;
+    }
+    result->body_size = strlen(body);
+    free(body);
+
+    uint64_t allocations_before = allocations;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < iterations; i++) {
+        body = build_tree(input, config);
+        if (body == NULL) {
+            return false;
+        }
+        free(body);
+    }
+    result->ns_per_request = (double)(now_ns() - start) / (double)iterations;
+    result->allocations = (double)(allocations - allocations_before) / (double)iterations;
+    return true;
+}
+
+static bool bench_template(const char *input, const RequestTemplate *tmpl, RequestBuffer *buffer,
+                           size_t iterations, BuildResult *result) {
+    // The first render sizes the buffer
+    if (!backend_render_request(tmpl, input, buffer)) {
+        return false;
+    }
+    result->body_size = buffer->size;
+
+    uint64_t allocations_before = allocations;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < iterations; i++) {
+        if (!backend_render_request(tmpl, input, buffer)) {
+            return false;
+        }
+    }
+    result->ns_per_request = (double)(now_ns() - start) / (double)iterations;
+    result->allocations = (double)(allocations - allocations_before) / (double)iterations;
+    return true;
+}
+
+static void print_result(const BuildResult *result, bool last) {
+    printf("    { \"method\": \"%s\", \"input\": \"%s\", \"body_bytes\": %zu, \"ns_per_request\": %.1f, ",
+           result->method, result->input, result->body_size, result->ns_per_request);
+    if (COUNTS_ALLOCATIONS) {
+        printf("\"allocations_per_request\": %.2f }%s\n", result->allocations, last ? "" : ",");
+    } else {
+        printf("\"allocations_per_request\": null }%s\n", last ? "" : ",");
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--iterations N]\n"
+            "\n"
+            "  --iterations N  Bodies built per measurement (default: %d)\n",
+            program, DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char *argv[]) {
+    size_t iterations = DEFAULT_ITERATIONS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = (size_t)strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // The defaults of config.c, with streaming on
+    Config config;
+    memset(&config, 0, sizeof(config));
+    config.openai_model = "gpt-4-turbo";
+    config.temperature = 0.2;
+    config.max_tokens = 100;
+    config.stream = true;
+
+    RequestTemplate tmpl;
+    RequestBuffer buffer = { NULL, 0, 0 };
+    if (!backend_get(BACKEND_OPENAI)->build_template(&config, &tmpl)) {
+        fprintf(stderr, "Error: Failed to render the request template\n");
+        return 1;
+    }
+
+    const char *inputs[] = { SHORT_INPUT, LONG_INPUT };
+    const char *input_names[] = { "short", "long" };
+    BuildResult results[4];
+    bool ok = true;
+    for (size_t i = 0; ok && i < 2; i++) {
+        results[i * 2].method = "json_c_tree";
+        results[i * 2].input = input_names[i];
+        results[i * 2 + 1].method = "template";
+        results[i * 2 + 1].input = input_names[i];
+        ok = bench_tree(inputs[i], &config, iterations, &results[i * 2]) &&
+             bench_template(inputs[i], &tmpl, &buffer, iterations, &results[i * 2 + 1]);
+    }
+
+    backend_free_template(&tmpl);
+    backend_free_buffer(&buffer);
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to build a request body\n");
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"iterations\": %zu,\n", iterations);
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < 4; i++) {
+        print_result(&results[i], i == 3);
+    }
+    printf("  ]\n");
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,316 @@
+/**
+ * @file bench_similar.c
+ * @brief Microbenchmark for looking up cached answers by similar queries
+ *
+ * Fills a response cache and its similarity index with --entries queries
+ * the way AISH does (respcache and simindex modules, in a scratch
+ * directory), then looks up:
+ *
+ * - paraphrases of stored queries: other verbs, adjectives and places
+ *   for the same request ("list big logs here" as "display the largest
+ *   log files in this folder"), with filler words added;
+ * - unrelated queries: the same phrasing about other names, sharing most
+ *   of their words with many stored queries.
+ *
+ * Queries are built from a small grammar and a random name, so each
+ * template is shared by about entries / 3000 stored queries: the worst
+ * case for an index that must tell them apart. A lookup is what AISH
+ * does on Enter: the signature, the index probe, and reading the answer
+ * of the best match from the cache, checked for the same numbers and
+ * word order.
+ *
+ * Results (latencies in microseconds, recall of paraphrases, share of
+ * unrelated queries given an answer) are printed to stdout as one JSON
+ * object.
+ */
+
+#include "respcache.h"
+#include "simindex.h"
+#include "histogram.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DEFAULT_ENTRIES 100000
+#define DEFAULT_LOOKUPS 2000
+#define DEFAULT_THRESHOLD 0.8
+#define CACHE_NAME "response-cache"
+#define KEY_PREFIX "00000000c0ffee00\n\n"   // Context hash and empty scope, as AISH writes them
+#define MAX_QUERY 256
+#define CANDIDATES 4                // Matches checked per lookup, as by AISH
+
+/**
+ * @brief A word of the grammar and the way a paraphrase puts it
+ */
+typedef struct {
+    const char *word;
+    const char *paraphrase;
+} Word;
+
+static const Word verbs[] = {
+    { "list", "show me" }, { "find", "search for" }, { "delete", "remove" }, { "count", "count all" },
+    { "compress", "compress" }, { "archive", "archive" }, { "copy", "copy" }, { "print", "display" }
+};
+static const Word adjectives[] = {
+    { "big", "the largest" }, { "small", "tiny" }, { "old", "the oldest" }, { "recent", "the latest" },
+    { "hidden", "the hidden" }, { "empty", "empty" }
+};
+static const Word nouns[] = {
+    { "files", "file" }, { "logs", "log files" }, { "images", "image files" }, { "directories", "folders" },
+    { "backups", "backup" }, { "scripts", "script files" }, { "videos", "video" }, { "archives", "archive" }
+};
+static const Word places[] = {
+    { "here", "in this folder" }, { "in home", "in my home" }, { "under src", "under the src dir" },
+    { "in tmp", "inside tmp" }, { "in the repo", "in this repo" }
+};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Step a xorshift generator
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * @brief Write query number index, or a paraphrase of it
+ *
+ * The same index always gives the same words and name.
+ *
+ * @param seed Picks the names: queries with another seed are about other things
+ * @return Length of the query
+ */
+static size_t make_query(char *query, size_t size, uint64_t seed, size_t index, bool paraphrase) {
+    uint64_t state = (seed * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)index * 0xbf58476d1ce4e5b9ULL) ^ 1;
+    for (int i = 0; i < 4; i++) {
+        next_random(&state);
+    }
+
+    const Word *verb = &verbs[next_random(&state) % COUNT(verbs)];
+    const Word *adjective = &adjectives[next_random(&state) % COUNT(adjectives)];
+    const Word *noun = &nouns[next_random(&state) % COUNT(nouns)];
+    const Word *place = &places[next_random(&state) % COUNT(places)];
+    char name[7];
+    for (int i = 0; i < 6; i++) {
+        name[i] = (char)('a' + next_random(&state) % 26);
+    }
+    name[6] = '\0';
+
+    if (paraphrase) {
+        return (size_t)snprintf(query, size, "please %s %s %s named %s %s", verb->paraphrase,
+                                adjective->paraphrase, noun->paraphrase, name, place->paraphrase);
+    }
+    return (size_t)snprintf(query, size, "%s %s %s named %s %s", verb->word, adjective->word, noun->word,
+                            name, place->word);
+}
+
+/**
+ * @brief Write the key AISH would store a query under
+ *
+ * @return Length of the key
+ */
+static size_t make_key(char *key, size_t size, const char *query) {
+    return (size_t)snprintf(key, size, "%s%s", KEY_PREFIX, query);
+}
+
+/**
+ * @brief Look up a query the way AISH does
+ *
+ * @param key Set to the hash of the key of the answer found
+ * @return true if an answer was found, false otherwise
+ */
+static bool lookup(RespCache *cache, SimIndex *index, const char *query, double threshold, uint64_t *key) {
+    uint8_t signature[SIMINDEX_HASHES];
+    SimIndexMatch matches[CANDIDATES];
+    size_t count = 0;
+    size_t prefix_len = strlen(KEY_PREFIX);
+
+    if (simindex_signature(query, strlen(query), signature)) {
+        count = simindex_find(index, respcache_hash(KEY_PREFIX, prefix_len), signature, threshold, matches,
+                              CANDIDATES);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        char *stored_key = NULL;
+        char *command = NULL;
+        if (!respcache_get_hash(cache, matches[i].key, &stored_key, &command, NULL)) {
+            continue;
+        }
+
+        bool similar = simindex_same_numbers(stored_key + prefix_len, query) &&
+                       simindex_same_order(stored_key + prefix_len, query) &&
+                       simindex_text_similarity(stored_key + prefix_len, strlen(stored_key + prefix_len),
+                                                query, strlen(query)) >= threshold;
+        free(stored_key);
+        free(command);
+        if (similar) {
+            *key = matches[i].key;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void print_latency(const char *name, const Histogram *hist, bool last) {
+    printf("    \"%s\": { \"samples\": %llu, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f }%s\n",
+           name, (unsigned long long)hist->count,
+           (double)histogram_percentile(hist, 50.0) / 1000.0,
+           (double)histogram_percentile(hist, 90.0) / 1000.0,
+           (double)histogram_percentile(hist, 99.0) / 1000.0,
+           (double)hist->max / 1000.0, last ? "" : ",");
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--entries N] [--lookups N] [--threshold X]\n"
+            "\n"
+            "  --entries N    Queries cached and indexed (default: %d)\n"
+            "  --lookups N    Paraphrases and unrelated queries looked up (default: %d each)\n"
+            "  --threshold X  Least similarity of a match (default: %.1f)\n",
+            program, DEFAULT_ENTRIES, DEFAULT_LOOKUPS, DEFAULT_THRESHOLD);
+}
+
+int main(int argc, char *argv[]) {
+    size_t entries = DEFAULT_ENTRIES;
+    size_t lookups = DEFAULT_LOOKUPS;
+    double threshold = DEFAULT_THRESHOLD;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc) {
+            entries = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--lookups") == 0 && i + 1 < argc) {
+            lookups = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = strtod(argv[++i], NULL);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (entries == 0 || entries > UINT32_MAX / 2 || lookups == 0 || threshold <= 0.0 || threshold > 1.0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char dir[] = "/tmp/aish-similar-bench-XXXXXX";
+    char path[sizeof(dir) + 32];
+    char index_path[sizeof(dir) + 32];
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Error: Failed to create a scratch directory: %s\n", strerror(errno));
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, CACHE_NAME);
+    snprintf(index_path, sizeof(index_path), "%s/%s.sim", dir, CACHE_NAME);
+
+    RespCache cache;
+    SimIndex index;
+    Histogram add, signature_time, paraphrase, unrelated;
+    histogram_reset(&add);
+    histogram_reset(&signature_time);
+    histogram_reset(&paraphrase);
+    histogram_reset(&unrelated);
+    bool cache_open = respcache_open(&cache, path, 0, (uint64_t)entries * 1024, (uint32_t)entries);
+    bool index_open = simindex_open(&index, index_path, (uint32_t)entries);
+    bool ok = cache_open && index_open;
+    uint64_t group = respcache_hash(KEY_PREFIX, strlen(KEY_PREFIX));
+
+    // What AISH does when an answer comes back
+    char query[MAX_QUERY], key[MAX_QUERY + 32], command[MAX_QUERY + 16];
+    uint8_t signature[SIMINDEX_HASHES];
+    for (size_t i = 0; ok && i < entries; i++) {
+        make_query(query, sizeof(query), 1, i, false);
+        size_t key_len = make_key(key, sizeof(key), query);
+        size_t command_len = (size_t)snprintf(command, sizeof(command), "echo %zu", i);
+
+        uint64_t start = now_ns();
+        ok = respcache_put(&cache, key, key_len, command, command_len) &&
+             simindex_signature(query, strlen(query), signature) &&
+             simindex_add(&index, group, respcache_hash(key, key_len), signature);
+        histogram_record(&add, now_ns() - start);
+    }
+
+    // Paraphrases of stored queries, spread over all of them
+    size_t found = 0, right = 0;
+    for (size_t i = 0; ok && i < lookups; i++) {
+        size_t target = (size_t)((uint64_t)i * entries / lookups);
+        make_query(query, sizeof(query), 1, target, false);
+        uint64_t expected = respcache_hash(key, make_key(key, sizeof(key), query));
+        make_query(query, sizeof(query), 1, target, true);
+
+        uint64_t start = now_ns();
+        simindex_signature(query, strlen(query), signature);
+        histogram_record(&signature_time, now_ns() - start);
+
+        uint64_t match = 0;
+        start = now_ns();
+        bool hit = lookup(&cache, &index, query, threshold, &match);
+        histogram_record(&paraphrase, now_ns() - start);
+        found += hit ? 1 : 0;
+        right += (hit && match == expected) ? 1 : 0;
+    }
+
+    // Same phrasing, other names: nothing should be offered
+    size_t false_matches = 0;
+    for (size_t i = 0; ok && i < lookups; i++) {
+        make_query(query, sizeof(query), 2, i, i % 2 == 0);
+        uint64_t match = 0;
+        uint64_t start = now_ns();
+        false_matches += lookup(&cache, &index, query, threshold, &match) ? 1 : 0;
+        histogram_record(&unrelated, now_ns() - start);
+    }
+
+    uint64_t indexed = simindex_entries(&index);
+    struct stat index_stat;
+    uint64_t index_bytes = (stat(index_path, &index_stat) == 0) ? (uint64_t)index_stat.st_blocks * 512 : 0;
+    if (index_open) {
+        simindex_close(&index);
+    }
+    if (cache_open) {
+        respcache_close(&cache);
+    }
+
+    char file[sizeof(path) + 8];
+    snprintf(file, sizeof(file), "%s.idx", path);
+    unlink(file);
+    snprintf(file, sizeof(file), "%s.log", path);
+    unlink(file);
+    unlink(index_path);
+    rmdir(dir);
+    if (!ok) {
+        fprintf(stderr, "Error: The benchmark failed\n");
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"entries\": %zu,\n", entries);
+    printf("  \"indexed\": %llu,\n", (unsigned long long)indexed);
+    printf("  \"index_bytes_on_disk\": %llu,\n", (unsigned long long)index_bytes);
+    printf("  \"threshold\": %.2f,\n", threshold);
+    printf("  \"latency_us\": {\n");
+    print_latency("store_and_index", &add, false);
+    print_latency("signature", &signature_time, false);
+    print_latency("paraphrase_lookup", &paraphrase, false);
+    print_latency("unrelated_lookup", &unrelated, true);
+    printf("  },\n");
+    printf("  \"paraphrases\": { \"lookups\": %zu, \"found\": %zu, \"right_answer\": %zu },\n",
+           lookups, found, right);
+    printf("  \"unrelated\": { \"lookups\": %zu, \"answered\": %zu }\n", lookups, false_matches);
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,525 @@
+/**
+ * @file mock_server.c
+ * @brief Local chat-completions server for benchmarking AISH
+ *
+ * Answers POST .../chat/completions on 127.0.0.1 the way an OpenAI-style
+ * server would, with a fixed command, so the API path of AISH can be
+ * measured without a live service:
+ *
+ * - latency: delay before the response headers (time to first byte);
+ * - token rate: streamed answers (`"stream": true`) are sent as SSE
+ *   events of a few characters each at this rate;
+ * - error injection: a share of the requests gets an HTTP error instead;
+ * - slow drip: every body is written a few bytes at a time with a pause
+ *   in between, splitting SSE events and JSON documents mid-way.
+ *
+ * Other methods get 405 (AISH pre-warms with HEAD). Each connection is
+ * served by a child process, so overlapping requests (hedges,
+ * speculation) are answered independently. The port is printed to stdout
+ * as "port N" once the server is listening.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define DEFAULT_COMMAND "echo hello"
+#define DEFAULT_TRAILING_TOKENS 16
+#define DEFAULT_ERROR_STATUS 500
+#define DEFAULT_DRIP_BYTES 8
+#define TOKEN_CHARS 4                   // Characters of content per streamed event
+#define MAX_REQUEST_SIZE (256 * 1024)
+
+/**
+ * @struct ServerOptions
+ * @brief Behaviour of the server, from the command line
+ */
+typedef struct {
+    int port;                   /**< Port to listen on, 0 for any */
+    unsigned latency_ms;        /**< Delay before the response headers */
+    unsigned token_rate;        /**< Streamed events per second, 0 for no pacing */
+    unsigned trailing_tokens;   /**< Explanation tokens sent after the command */
+    double error_rate;          /**< Percentage of requests answered with an error */
+    int error_status;           /**< HTTP status of injected errors */
+    unsigned drip_ms;           /**< Pause between body pieces, 0 to send at once */
+    size_t drip_bytes;          /**< Size of those pieces */
+    const char *command;        /**< Command every answer contains */
+    unsigned seed;              /**< Seed for error injection */
+} ServerOptions;
+
+/**
+ * @struct Buffer
+ * @brief Growable byte string
+ */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+static ServerOptions options;
+
+static void sleep_ms(unsigned ms) {
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        continue;
+    }
+}
+
+static bool buffer_append(Buffer *buffer, const char *data, size_t len) {
+    if (buffer->size + len + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 256;
+        while (buffer->size + len + 1 > capacity) {
+            capacity *= 2;
+        }
+        char *data_new = realloc(buffer->data, capacity);
+        if (data_new == NULL) {
+            return false;
+        }
+        buffer->data = data_new;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, len);
+    buffer->size += len;
+    buffer->data[buffer->size] = '\0';
+    return true;
+}
+
+static bool buffer_append_text(Buffer *buffer, const char *text) {
+    return buffer_append(buffer, text, strlen(text));
+}
+
+/**
+ * @brief Append text as the inside of a JSON string
+ */
+static bool buffer_append_escaped(Buffer *buffer, const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        char escaped[8];
+        if (c == '"' || c == '\\') {
+            escaped[0] = '\\';
+            escaped[1] = (char)c;
+            escaped[2] = '\0';
+        } else if (c < 0x20) {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        } else {
+            escaped[0] = (char)c;
+            escaped[1] = '\0';
+        }
+        if (!buffer_append_text(buffer, escaped)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+/**
+ * @brief Write body bytes, a few at a time when dripping
+ */
+static bool write_body(int fd, const char *data, size_t len) {
+    if (options.drip_ms == 0) {
+        return write_all(fd, data, len);
+    }
+
+    while (len > 0) {
+        size_t piece = len < options.drip_bytes ? len : options.drip_bytes;
+        if (!write_all(fd, data, piece)) {
+            return false;
+        }
+        data += piece;
+        len -= piece;
+        if (len > 0) {
+            sleep_ms(options.drip_ms);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Build the message content: a JSON object with the command first
+ */
+static bool build_content(Buffer *content) {
+    if (!buffer_append_text(content, "{\"command\": \"") ||
+        !buffer_append_escaped(content, options.command, strlen(options.command)) ||
+        !buffer_append_text(content, "\", \"explanation\": \"")) {
+        return false;
+    }
+    for (unsigned i = 0; i < options.trailing_tokens; i++) {
+        if (!buffer_append_text(content, i > 0 ? " more" : "Runs")) {
+            return false;
+        }
+    }
+    return buffer_append_text(content, ".\"}");
+}
+
+static const char *status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default: return "Error";
+    }
+}
+
+/**
+ * @brief Send a complete response with a Content-Length body
+ */
+static bool send_response(int fd, int status, const char *content_type, const char *body, size_t len) {
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                              status, status_text(status), content_type, len);
+    return write_all(fd, header, (size_t)header_len) && write_body(fd, body, len);
+}
+
+static bool send_error(int fd, int status, const char *message) {
+    char body[256];
+    int len = snprintf(body, sizeof(body),
+                       "{\"error\": {\"message\": \"%s\", \"type\": \"server_error\", \"code\": %d}}",
+                       message, status);
+    return send_response(fd, status, "application/json", body, (size_t)len);
+}
+
+/**
+ * @brief Answer with the whole message in one JSON document
+ */
+static bool send_completion(int fd, const Buffer *content) {
+    Buffer body = { NULL, 0, 0 };
+    bool ok = buffer_append_text(&body, "{\"id\": \"chatcmpl-mock\", \"object\": \"chat.completion\", "
+                                 "\"choices\": [{\"index\": 0, \"message\": {\"role\": \"assistant\", "
+                                 "\"content\": \"") &&
+              buffer_append_escaped(&body, content->data, content->size) &&
+              buffer_append_text(&body, "\"}, \"finish_reason\": \"stop\"}]}");
+
+    ok = ok && send_response(fd, 200, "application/json", body.data, body.size);
+    free(body.data);
+    return ok;
+}
+
+/**
+ * @brief Send one chunk of a chunked body
+ */
+static bool send_chunk(int fd, const char *data, size_t len) {
+    char size_line[32];
+    int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    return write_body(fd, size_line, (size_t)size_len) && write_body(fd, data, len) &&
+           write_body(fd, "\r\n", 2);
+}
+
+/**
+ * @brief Answer with an SSE stream of a few characters per event
+ *
+ * Stops early (returning false) when the client hangs up, which AISH does
+ * as soon as the command is complete.
+ */
+static bool send_stream(int fd, const Buffer *content) {
+    static const char header[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                                 "Cache-Control: no-cache\r\nTransfer-Encoding: chunked\r\n\r\n";
+    if (!write_all(fd, header, sizeof(header) - 1)) {
+        return false;
+    }
+
+    unsigned interval_ms = options.token_rate > 0 ? 1000 / options.token_rate : 0;
+    Buffer event = { NULL, 0, 0 };
+    bool ok = true;
+    for (size_t offset = 0; ok && offset < content->size; offset += TOKEN_CHARS) {
+        size_t len = content->size - offset < TOKEN_CHARS ? content->size - offset : TOKEN_CHARS;
+        if (offset > 0 && interval_ms > 0) {
+            sleep_ms(interval_ms);
+        }
+
+        event.size = 0;
+        ok = buffer_append_text(&event, "data: {\"id\": \"chatcmpl-mock\", \"object\": \"chat.completion.chunk\", "
+                                "\"choices\": [{\"index\": 0, \"delta\": {\"content\": \"") &&
+             buffer_append_escaped(&event, content->data + offset, len) &&
+             buffer_append_text(&event, "\"}, \"finish_reason\": null}]}\n\n") &&
+             send_chunk(fd, event.data, event.size);
+    }
+    free(event.data);
+
+    static const char done[] = "data: [DONE]\n\n";
+    return ok && send_chunk(fd, done, sizeof(done) - 1) && write_body(fd, "0\r\n\r\n", 5);
+}
+
+/**
+ * @brief Tell whether a request body asks for a stream
+ */
+static bool wants_stream(const char *body) {
+    const char *key = strstr(body, "\"stream\"");
+    if (key == NULL) {
+        return false;
+    }
+    key += 8;
+    while (*key == ' ' || *key == ':') {
+        key++;
+    }
+    return strncmp(key, "true", 4) == 0;
+}
+
+/**
+ * @brief Find a header value in the request head (case-insensitive name)
+ */
+static const char *find_header(const char *head, const char *name) {
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(head, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *value = line + name_len + 1;
+            while (*value == ' ') {
+                value++;
+            }
+            return value;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Answer one request
+ *
+ * @return true to keep the connection open for the next one
+ */
+static bool handle_request(int fd, const char *head, const char *body, unsigned *seed) {
+    char method[16];
+    char path[256];
+    if (sscanf(head, "%15s %255s", method, path) != 2) {
+        send_error(fd, 400, "bad request line");
+        return false;
+    }
+
+    if (strcmp(method, "POST") != 0) {
+        send_response(fd, 405, "text/plain", "", 0);
+        return true;
+    }
+    size_t path_len = strlen(path);
+    if (path_len < 17 || strcmp(path + path_len - 17, "/chat/completions") != 0) {
+        return send_error(fd, 404, "unknown endpoint");
+    }
+
+    if (options.latency_ms > 0) {
+        sleep_ms(options.latency_ms);
+    }
+    if (options.error_rate > 0 && (double)rand_r(seed) / ((double)RAND_MAX + 1.0) * 100.0 < options.error_rate) {
+        return send_error(fd, options.error_status, "injected error");
+    }
+
+    Buffer content = { NULL, 0, 0 };
+    bool ok = build_content(&content);
+    if (ok) {
+        ok = wants_stream(body) ? send_stream(fd, &content) : send_completion(fd, &content);
+    }
+    free(content.data);
+    return ok;
+}
+
+/**
+ * @brief Serve the requests of one connection until it closes
+ */
+static void serve_connection(int fd, unsigned seed) {
+    Buffer input = { NULL, 0, 0 };
+    char buffer[16384];
+
+    for (;;) {
+        // Handle every complete request received so far
+        char *head_end;
+        while (input.size > 0 && (head_end = strstr(input.data, "\r\n\r\n")) != NULL) {
+            *head_end = '\0';
+            size_t head_len = (size_t)(head_end - input.data) + 4;
+            const char *length = find_header(input.data, "Content-Length");
+            size_t body_len = length != NULL ? strtoul(length, NULL, 10) : 0;
+            if (head_len + body_len > MAX_REQUEST_SIZE) {
+                send_error(fd, 400, "request too large");
+                goto done;
+            }
+            if (input.size < head_len + body_len) {
+                // Ask for the body if the client waits to be told
+                const char *expect = find_header(input.data, "Expect");
+                if (expect != NULL && strncasecmp(expect, "100-continue", 12) == 0 &&
+                    input.size == head_len) {
+                    write_all(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+                }
+                *head_end = '\r';
+                break;
+            }
+
+            char *body = strndup(input.data + head_len, body_len);
+            bool keep_open = body != NULL && handle_request(fd, input.data, body, &seed);
+            const char *connection = find_header(input.data, "Connection");
+            free(body);
+            if (!keep_open || (connection != NULL && strncasecmp(connection, "close", 5) == 0)) {
+                goto done;
+            }
+
+            input.size -= head_len + body_len;
+            memmove(input.data, input.data + head_len + body_len, input.size);
+            input.data[input.size] = '\0';
+        }
+
+        ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0 || !buffer_append(&input, buffer, (size_t)bytes_read)) {
+            break;
+        }
+    }
+
+done:
+    free(input.data);
+    close(fd);
+}
+
+static bool parse_unsigned(const char *text, unsigned *value) {
+    char *end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    *value = (unsigned)parsed;
+    return true;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--port N] [--latency MS] [--token-rate N] [--tokens N] [--error-rate PCT]\n"
+            "       [--error-status CODE] [--drip-ms MS] [--drip-bytes N] [--command TEXT] [--seed N]\n"
+            "\n"
+            "  --port N           Port on 127.0.0.1 (default: any free port)\n"
+            "  --latency MS       Delay before each response (default: 0)\n"
+            "  --token-rate N     Streamed events per second (default: 0, no pacing)\n"
+            "  --tokens N         Explanation tokens after the command (default: %d)\n"
+            "  --error-rate PCT   Percentage of requests answered with an error (default: 0)\n"
+            "  --error-status N   HTTP status of those errors (default: %d)\n"
+            "  --drip-ms MS       Pause between body pieces (default: 0, send at once)\n"
+            "  --drip-bytes N     Size of the body pieces (default: %d)\n"
+            "  --command TEXT     Command returned by every answer (default: %s)\n"
+            "  --seed N           Seed for error injection (default: 1)\n",
+            program, DEFAULT_TRAILING_TOKENS, DEFAULT_ERROR_STATUS, DEFAULT_DRIP_BYTES, DEFAULT_COMMAND);
+}
+
+int main(int argc, char *argv[]) {
+    options.trailing_tokens = DEFAULT_TRAILING_TOKENS;
+    options.error_status = DEFAULT_ERROR_STATUS;
+    options.drip_bytes = DEFAULT_DRIP_BYTES;
+    options.command = DEFAULT_COMMAND;
+    options.seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *next = (i + 1 < argc) ? argv[++i] : NULL;
+        unsigned value = 0;
+        bool ok = next != NULL;
+
+        if (ok && strcmp(arg, "--command") == 0) {
+            options.command = next;
+        } else if (ok && strcmp(arg, "--error-rate") == 0) {
+            options.error_rate = atof(next);
+        } else if (ok && parse_unsigned(next, &value)) {
+            if (strcmp(arg, "--port") == 0) {
+                options.port = (int)value;
+            } else if (strcmp(arg, "--latency") == 0) {
+                options.latency_ms = value;
+            } else if (strcmp(arg, "--token-rate") == 0) {
+                options.token_rate = value;
+            } else if (strcmp(arg, "--tokens") == 0) {
+                options.trailing_tokens = value;
+            } else if (strcmp(arg, "--error-status") == 0) {
+                options.error_status = (int)value;
+            } else if (strcmp(arg, "--drip-ms") == 0) {
+                options.drip_ms = value;
+            } else if (strcmp(arg, "--drip-bytes") == 0) {
+                options.drip_bytes = value > 0 ? value : 1;
+            } else if (strcmp(arg, "--seed") == 0) {
+                options.seed = value;
+            } else {
+                ok = false;
+            }
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Clients hanging up mid-answer must not kill the server; children are not waited for
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)options.port);
+    socklen_t addr_len = sizeof(addr);
+    if (listen_fd == -1 ||
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, 64) == -1 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) == -1) {
+        fprintf(stderr, "Error: Failed to listen on port %d: %s\n", options.port, strerror(errno));
+        return 1;
+    }
+
+    printf("port %d\n", ntohs(addr.sin_port));
+    fflush(stdout);
+
+    for (unsigned connection = 0;; connection++) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+            return 1;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            serve_connection(fd, options.seed * 2654435761u + connection);
+            _exit(0);
+        }
+        if (pid == -1) {
+            fprintf(stderr, "Warning: fork failed: %s\n", strerror(errno));
+        }
+        close(fd);
+    }
+}
@@ -3,6 +3,10 @@
  * @brief Main implementation for AISH (AI Shell)
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE // splice()
+#endif
+
 #include "aish.h"
 #include "prompt.h"
 #include "chat.h"
@@ -13,8 +17,9 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <termios.h>
 
@@ -27,15 +32,57 @@
 
 #define BUFFER_SIZE 4096
 #define INPUT_BUFFER_SIZE 1024
+#define STDIN_READ_SIZE 4096
+#define BASH_INPUT_QUEUE_SIZE (64 * 1024)
+#define BASH_INPUT_SLACK 1024
+#define SPLICE_CHUNK (64 * 1024)
+#define OWNER_RECHECK_MS 50
+
+static void report_stats(AishState *state);
+static bool drain_all_output(AishState *state);
+static void stop_uring(AishState *state);
 
-// Global state for signal handling
-static AishState *g_state = NULL;
+/**
+ * @brief Propagate the terminal's window size to the pty
+ * 
+ * @param state The AISH state
+ */
+static void resize_pty(AishState *state) {
+    struct winsize ws;
+    if (state->bash_master_fd == -1 || ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == -1) {
+        return;
+    }
+    
+    // The kernel forwards SIGWINCH to the pty's foreground process group
+    if (ioctl(state->bash_master_fd, TIOCSWINSZ, &ws) == -1) {
+        fprintf(stderr, "Warning: Failed to resize pty: %s\r\n", strerror(errno));
+    }
+}
 
-// Signal handler
-void aish_signal_handler(int signal) {
-    (void)signal; // Suppress unused parameter warning
-    if (g_state != NULL) {
-        g_state->running = false;
+// Signal handler (runs from the event loop, not asynchronously)
+void aish_signal_handler(int signal, void *userdata) {
+    AishState *state = (AishState *)userdata;
+    
+    switch (signal) {
+    case SIGUSR1:
+        // Stats go to stderr; keep them from cutting into queued output
+        drain_all_output(state);
+        report_stats(state);
+        break;
+    case SIGWINCH:
+        resize_pty(state);
+        break;
+    case SIGINT:
+        // Like Ctrl+C: abandon a pending chat request rather than quit
+        if (chat_cancel_request(state)) {
+            display_prompt(state);
+            break;
+        }
+        state->running = false;
+        break;
+    default:
+        state->running = false;
+        break;
     }
 }
 
@@ -49,6 +96,11 @@ bool aish_init(AishState *state) {
     state->bash_master_fd = -1;
     state->bash_pid = -1;
     state->running = false;
+    state->stdin_flags = -1;
+    state->stdout_flags = -1;
+    state->splice_pipe[0] = -1;
+    state->splice_pipe[1] = -1;
+    uring_relay_clear(&state->uring);
     
     // Initialize configuration
     if (!config_init(&state->config)) {
@@ -63,8 +115,8 @@ bool aish_init(AishState *state) {
         return false;
     }
     
-    // Check if API key is available
-    if (state->config.openai_api_key == NULL) {
+    // Check if API key is available (local backends may not need one)
+    if (state->config.openai_api_key == NULL && state->config.backend == BACKEND_OPENAI) {
         fprintf(stderr, "Error: OpenAI API key not found in configuration\n");
         config_free(&state->config);
         return false;
@@ -85,14 +137,79 @@ bool aish_init(AishState *state) {
         return false;
     }
     
-    // Set up signal handling
-    g_state = state;
-    signal(SIGINT, aish_signal_handler);
-    signal(SIGTERM, aish_signal_handler);
+    // Initialize event loop and the queue of keystrokes waiting for bash
+    if (!event_loop_init(&state->loop)) {
+        fprintf(stderr, "Error: Failed to initialize event loop\n");
+        api_cleanup();
+        terminal_cleanup(&state->terminal);
+        config_free(&state->config);
+        return false;
+    }
+    
+    // API requests are driven by the same loop
+    if (!api_set_event_loop(&state->loop)) {
+        fprintf(stderr, "Error: Failed to initialize API\n");
+        api_cleanup();
+        event_loop_cleanup(&state->loop);
+        terminal_cleanup(&state->terminal);
+        config_free(&state->config);
+        return false;
+    }
+    
+    if (!ringbuf_init(&state->bash_input, BASH_INPUT_QUEUE_SIZE)) {
+        event_loop_cleanup(&state->loop);
+        api_cleanup();
+        terminal_cleanup(&state->terminal);
+        config_free(&state->config);
+        return false;
+    }
+    
+    // Initialize the output stage for the terminal
+    if (!output_init(&state->output, STDOUT_FILENO)) {
+        ringbuf_free(&state->bash_input);
+        event_loop_cleanup(&state->loop);
+        api_cleanup();
+        terminal_cleanup(&state->terminal);
+        config_free(&state->config);
+        return false;
+    }
+    
+    input_parser_init(&state->input_parser);
+    
+    // Set up signal handling: signals are read from the event loop
+    const int signals[] = { SIGINT, SIGTERM, SIGUSR1, SIGWINCH };
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        if (!event_loop_add_signal(&state->loop, signals[i], aish_signal_handler, state)) {
+            fprintf(stderr, "Error: Failed to set up signal handling\n");
+            aish_cleanup(state);
+            return false;
+        }
+    }
     
     return true;
 }
 
+/**
+ * @brief Event loop callback for the exit of the Bash process
+ */
+static void bash_exit_callback(pid_t pid, int status, void *userdata) {
+    AishState *state = (AishState *)userdata;
+    (void)pid;
+    
+    // Read the tail of the output synchronously rather than racing the ring
+    stop_uring(state);
+    
+    // Relay whatever bash printed last (e.g. "logout") before reporting
+    if (state->bash_source != NULL) {
+        aish_process_bash_output(state);
+    }
+    drain_all_output(state);
+    
+    fprintf(stderr, "Bash process has exited with status %d\r\n", WEXITSTATUS(status));
+    state->bash_pid = -1;
+    state->running = false;
+}
+
 bool aish_spawn_bash(AishState *state) {
     if (state == NULL) {
         return false;
@@ -120,6 +237,9 @@ bool aish_spawn_bash(AishState *state) {
     if (state->bash_pid == 0) {
         // Child process
         
+        // Undo the signal blocking the event loop relies on
+        event_loop_restore_signals(&state->loop);
+        
         // Set environment variables
         setenv("TERM", "xterm-256color", 1);
         
@@ -146,134 +266,407 @@ bool aish_spawn_bash(AishState *state) {
         return false;
     }
     
+    // Get notified through the event loop when bash exits
+    if (!event_loop_add_child(&state->loop, state->bash_pid, bash_exit_callback, state)) {
+        fprintf(stderr, "Error: Failed to watch bash process\n");
+        return false;
+    }
+    
     // Set the initial prompt
     terminal_update_prompt(&state->terminal, state->bash_master_fd);
     
     return true;
 }
 
+bool aish_write_stdout(AishState *state, const char *data, size_t len) {
+    if (state == NULL || data == NULL) {
+        return false;
+    }
+    
+    // Queued behind any bash output; written at the end of the loop iteration
+    return output_append(&state->output, data, len);
+}
+
 /**
- * @brief Process input in Bash mode
+ * @brief Update which events the relay waits for
+ * 
+ * The pty master is watched for writability only while keystrokes are
+ * queued for it, and stdin is not read while that queue is nearly full,
+ * so a paste larger than the pty can absorb is throttled at the source.
+ * The same applies to output: while the terminal is behind, the pty is
+ * not read, bash blocks in write(), and stdout is watched instead. With
+ * the io_uring relay the ring reads the pty and applies backpressure itself.
+ * 
+ * @param state The AISH state
+ */
+static void update_relay_interest(AishState *state) {
+    bool queued = ringbuf_used(&state->bash_input) > 0;
+    bool uring = uring_relay_active(&state->uring);
+    bool unflushed = output_pending(&state->output) > 0 || state->splice_pending > 0;
+    bool blocked = false;
+    
+    if (state->stdout_source != NULL) {
+        // Spliced output must not overtake bytes still in the queue
+        blocked = !output_can_fill(&state->output) || state->splice_pending > 0 ||
+                  (state->passthrough && state->splice_pipe[0] != -1 && unflushed);
+        event_loop_modify_fd(&state->loop, state->stdout_source, unflushed ? EVENT_WRITE : 0);
+    }
+    output_set_stalled(&state->output, blocked);
+    
+    if (state->bash_source != NULL) {
+        event_loop_modify_fd(&state->loop, state->bash_source,
+                             (blocked || uring ? 0 : EVENT_READ) | (queued ? EVENT_WRITE : 0));
+    }
+    
+    if (state->stdin_source != NULL) {
+        bool room = ringbuf_space(&state->bash_input) >= STDIN_READ_SIZE + BASH_INPUT_SLACK;
+        event_loop_modify_fd(&state->loop, state->stdin_source, room ? EVENT_READ : 0);
+    }
+}
+
+/**
+ * @brief Record how long the current stdin chunk took to reach the pty
+ * 
+ * @param state The AISH state
+ */
+static void note_input_written(AishState *state) {
+    if (state->input_unwritten) {
+        histogram_record(&state->input_latency, event_now_us() - state->input_read_us);
+        state->input_unwritten = false;
+    }
+}
+
+/**
+ * @brief Write queued keystrokes to bash until the pty would block
  * 
  * @param state The AISH state
- * @param input The input string
- * @param input_len The length of the input string
  * @return true if successful, false otherwise
  */
-bool process_bash_input(AishState *state, const char *input, size_t input_len) {
-    if (state == NULL || input == NULL || input_len == 0) {
-        return false;
+static bool flush_bash_input(AishState *state) {
+    while (ringbuf_used(&state->bash_input) > 0) {
+        ssize_t written = ringbuf_write_fd(&state->bash_input, state->bash_master_fd);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            fprintf(stderr, "Error: Failed to write input to bash: %s\n", strerror(errno));
+            return false;
+        }
+        note_input_written(state);
     }
     
-    // In Bash mode, forward the input to bash
-    if (write(state->bash_master_fd, input, input_len) == -1) {
-        fprintf(stderr, "Error: Failed to write input to bash: %s\n", strerror(errno));
+    update_relay_interest(state);
+    return true;
+}
+
+bool aish_write_bash(AishState *state, const char *data, size_t len) {
+    if (state == NULL || data == NULL || state->bash_master_fd == -1) {
         return false;
     }
     
-    // Write a newline to execute the command
-    if (write(state->bash_master_fd, "\n", 1) == -1) {
-        fprintf(stderr, "Error: Failed to write newline to bash: %s\n", strerror(errno));
+    // Write straight through unless earlier input is still queued
+    if (ringbuf_used(&state->bash_input) == 0) {
+        while (len > 0) {
+            ssize_t written = write(state->bash_master_fd, data, len);
+            if (written > 0) {
+                data += written;
+                len -= (size_t)written;
+                note_input_written(state);
+            } else if (written == -1 && errno == EINTR) {
+                continue;
+            } else if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                fprintf(stderr, "Error: Failed to write input to bash: %s\n", strerror(errno));
+                return false;
+            }
+        }
+        
+        if (len == 0) {
+            return true;
+        }
+    }
+    
+    // The pty is full: queue the rest and wait for it to become writable
+    if (ringbuf_write(&state->bash_input, data, len) < len) {
+        fprintf(stderr, "Error: Input queue for bash is full\n");
+        update_relay_interest(state);
         return false;
     }
     
+    update_relay_interest(state);
     return true;
 }
 
 /**
- * @brief Process a single character of input in Chat mode
+ * @brief Process input in Bash mode
  * 
  * @param state The AISH state
- * @param c The character to process
+ * @param input The input string
+ * @param input_len The length of the input string
+ * @return true if successful, false otherwise
+ */
+bool process_bash_input(AishState *state, const char *input, size_t input_len) {
+    if (state == NULL || input == NULL || input_len == 0) {
+        return false;
+    }
+    
+    // In Bash mode, forward the input to bash followed by a newline to execute it
+    return aish_write_bash(state, input, input_len) && aish_write_bash(state, "\n", 1);
+}
+
+/**
+ * @brief Process a keystroke token in Chat mode
+ * 
+ * @param state The AISH state
+ * @param token The token to process
  * @param input_buffer The input buffer
  * @param input_pos Pointer to the current position in the input buffer
  * @return true if successful, false otherwise
  */
-bool process_chat_keypress(AishState *state, char c, char *input_buffer, size_t *input_pos) {
-    if (state == NULL || input_buffer == NULL || input_pos == NULL) {
+bool process_chat_keys(AishState *state, const InputToken *token, char *input_buffer, size_t *input_pos) {
+    if (state == NULL || token == NULL || input_buffer == NULL || input_pos == NULL) {
         return false;
     }
     
-    if (c == '\r' || c == '\n') {
+    // Ctrl+C abandons a pending request, or else the query being typed
+    if (token->type == INPUT_TOKEN_INTERRUPT) {
+        bool cancelled = chat_cancel_request(state);
+        *input_pos = 0;
+        if (!cancelled) {
+            chat_drop_speculations(state);
+            aish_write_stdout(state, "^C\r\n", 4);
+        }
+        display_prompt(state);
+        return true;
+    }
+    
+    // Other keys typed while a request is pending are ignored
+    if (state->chat_request != NULL) {
+        return true;
+    }
+    
+    switch (token->type) {
+    case INPUT_TOKEN_ENTER: {
         // Enter key - process the input
         input_buffer[*input_pos] = '\0';
         
         // Echo a newline
         const char *newline = "\r\n";
-        if (write(STDOUT_FILENO, newline, strlen(newline)) == -1) {
+        if (!aish_write_stdout(state, newline, strlen(newline))) {
             fprintf(stderr, "Error: Failed to write newline: %s\n", strerror(errno));
             return false;
         }
         
-        // Process the input (send to OpenAI API)
-        process_chat_input(state, input_buffer, *input_pos);
+        // Send the input to the OpenAI API; the prompt comes back when it answers.
+        // The position is reset first, as an offered command sets it for Bash mode
+        size_t input_len = *input_pos;
         *input_pos = 0;
+        bool started = process_chat_input(state, input_buffer, input_len);
         
-        // Display the prompt
-        display_prompt(state);
-    } else if (c == 127 || c == '\b') {
+        if (!started) {
+            display_prompt(state);
+        }
+        break;
+    }
+    case INPUT_TOKEN_BACKSPACE:
         // Backspace - delete the last character
         if (*input_pos > 0) {
             (*input_pos)--;
             // Echo the backspace
             const char *backspace = "\b \b";
-            if (write(STDOUT_FILENO, backspace, 3) == -1) {
+            if (!aish_write_stdout(state, backspace, 3)) {
                 fprintf(stderr, "Error: Failed to write backspace: %s\n", strerror(errno));
                 return false;
             }
+            chat_note_edit(state);
         }
-    } else {
-        // Regular character - add to buffer
-        if (*input_pos < INPUT_BUFFER_SIZE - 1) {
-            input_buffer[(*input_pos)++] = c;
-            
-            // Echo the character
-            if (write(STDOUT_FILENO, &c, 1) == -1) {
-                fprintf(stderr, "Error: Failed to echo character: %s\n", strerror(errno));
-                return false;
-            }
+        break;
+    case INPUT_TOKEN_TEXT: {
+        // Regular characters - add as many as fit to the buffer
+        size_t room = INPUT_BUFFER_SIZE - 1 - *input_pos;
+        size_t len = (token->len < room) ? token->len : room;
+        if (len == 0) {
+            break;
+        }
+        
+        memcpy(input_buffer + *input_pos, token->data, len);
+        *input_pos += len;
+        chat_note_edit(state);
+        
+        // Echo the characters with a single write
+        if (!aish_write_stdout(state, token->data, len)) {
+            fprintf(stderr, "Error: Failed to echo characters: %s\n", strerror(errno));
+            return false;
         }
+        break;
+    }
+    case INPUT_TOKEN_PASTE_START:
+        state->terminal.paste_start = *input_pos;
+        break;
+    case INPUT_TOKEN_PASTE: {
+        // Pasted text goes into the buffer now and is echoed once at the end;
+        // line breaks and other control bytes become spaces in a one-line query
+        size_t room = INPUT_BUFFER_SIZE - 1 - *input_pos;
+        size_t len = (token->len < room) ? token->len : room;
+        for (size_t i = 0; i < len; i++) {
+            unsigned char c = (unsigned char)token->data[i];
+            input_buffer[*input_pos + i] = (c < 0x20 || c == 127) ? ' ' : (char)c;
+        }
+        *input_pos += len;
+        break;
+    }
+    case INPUT_TOKEN_PASTE_END: {
+        size_t start = state->terminal.paste_start;
+        if (start < *input_pos &&
+            !aish_write_stdout(state, input_buffer + start, *input_pos - start)) {
+            fprintf(stderr, "Error: Failed to echo pasted text: %s\n", strerror(errno));
+            return false;
+        }
+        state->terminal.paste_start = *input_pos;
+        chat_note_edit(state);
+        break;
+    }
+    default:
+        // Cursor keys and other escape sequences are not supported while editing a query
+        break;
     }
     
     return true;
 }
 
 /**
- * @brief Process a single character of input in Bash mode
+ * @brief Track a keystroke token forwarded in Bash mode
  * 
- * @param state The AISH state
- * @param c The character to process
- * @param input_buffer The input buffer
+ * The bytes themselves are written to bash by the caller in batches; this
+ * only keeps the line position used for Tab-at-line-start detection.
+ * 
+ * @param token The token that was forwarded
  * @param input_pos Pointer to the current position in the input buffer
- * @return true if successful, false otherwise
  */
-bool process_bash_keypress(AishState *state, char c, char *input_buffer, size_t *input_pos) {
-    if (state == NULL || input_buffer == NULL || input_pos == NULL) {
-        return false;
-    }
-    
-    // In Bash mode, forward all keypresses directly to bash
-    // (except Tab at start of line, which was handled above)
-    if (write(state->bash_master_fd, &c, 1) == -1) {
-        fprintf(stderr, "Error: Failed to write character to bash: %s\n", strerror(errno));
-        return false;
-    }
-    
-    // Update input buffer for Tab key detection
-    if (c == '\r' || c == '\n') {
+static void track_bash_keys(const InputToken *token, size_t *input_pos) {
+    switch (token->type) {
+    case INPUT_TOKEN_ENTER:
+    case INPUT_TOKEN_INTERRUPT:
         *input_pos = 0;
-    } else if (c == 127 || c == '\b') {
-        // Backspace - update input buffer position
+        break;
+    case INPUT_TOKEN_PASTE_START:
+    case INPUT_TOKEN_PASTE_END:
+        break;
+    case INPUT_TOKEN_PASTE: {
+        // Without bracketed paste in readline, pasted line breaks run commands;
+        // count only what follows the last one (harmless approximation otherwise)
+        size_t tail = token->len;
+        while (tail > 0 && token->data[tail - 1] != '\r' && token->data[tail - 1] != '\n') {
+            tail--;
+        }
+        *input_pos = (tail > 0) ? token->len - tail : *input_pos + token->len;
+        if (*input_pos > INPUT_BUFFER_SIZE - 1) {
+            *input_pos = INPUT_BUFFER_SIZE - 1;
+        }
+        break;
+    }
+    case INPUT_TOKEN_BACKSPACE:
         if (*input_pos > 0) {
             (*input_pos)--;
         }
-    } else {
-        if (*input_pos < INPUT_BUFFER_SIZE - 1) {
-            input_buffer[(*input_pos)++] = c;
+        break;
+    default:
+        *input_pos += token->len;
+        if (*input_pos > INPUT_BUFFER_SIZE - 1) {
+            *input_pos = INPUT_BUFFER_SIZE - 1;
         }
+        break;
     }
+}
+
+/**
+ * @brief Process a chunk of user input
+ * 
+ * Consecutive keystrokes in Bash mode are forwarded with one write; only a
+ * mode toggle or a switch to Chat mode splits the run. A bracketed paste
+ * arrives as paste tokens, so Tabs inside it never toggle the mode, and in
+ * Bash mode it joins the run like typed text. The paste markers themselves
+ * are only passed on if readline enabled bracketed paste.
+ * 
+ * @param state The AISH state
+ * @param data The bytes read from stdin
+ * @param len Number of bytes read
+ * @return true if successful, false if bash could not take the input
+ */
+static bool process_input_chunk(AishState *state, const char *data, size_t len) {
+    TerminalState *term = &state->terminal;
+    const char *run = NULL;
+    size_t run_len = 0;
+    size_t offset = 0;
     
-    return true;
+    while (offset < len) {
+        InputToken token;
+        offset += input_parser_next(&state->input_parser, data + offset, len - offset, &token);
+        
+        if (token.len == 0) {
+            // Held back by the parser; it comes out with a later token
+            continue;
+        }
+        
+        if (token.type == INPUT_TOKEN_TAB && state->chat_request == NULL &&
+            terminal_process_key(term, '\t', term->buffer_pos)) {
+            // Mode was toggled: send what came before the Tab, then reset input buffer
+            if (run_len > 0) {
+                if (!aish_write_bash(state, run, run_len)) {
+                    return false;
+                }
+                run_len = 0;
+            }
+            term->buffer_pos = 0;
+            
+            // Display the appropriate prompt based on the current mode
+            display_prompt(state);
+            state->toggle_us = state->input_read_us;
+            
+            // Connect to the API while the request is being typed
+            if (terminal_get_mode(term) == MODE_CHAT) {
+                api_prewarm(&state->config);
+            } else {
+                chat_drop_speculations(state);
+            }
+            continue;
+        }
+        
+        if (terminal_get_mode(term) == MODE_BASH) {
+            bool marker = (token.type == INPUT_TOKEN_PASTE_START || token.type == INPUT_TOKEN_PASTE_END);
+            bool drop = marker && !term->app_paste;
+            
+            // Extend the pending run while tokens are contiguous in the chunk
+            if (run_len > 0 && (drop || run + run_len != token.data)) {
+                if (!aish_write_bash(state, run, run_len)) {
+                    return false;
+                }
+                run_len = 0;
+            }
+            if (drop) {
+                continue;
+            }
+            if (run_len == 0) {
+                run = token.data;
+            }
+            run_len += token.len;
+            track_bash_keys(&token, &term->buffer_pos);
+        } else {
+            if (run_len > 0) {
+                if (!aish_write_bash(state, run, run_len)) {
+                    return false;
+                }
+                run_len = 0;
+            }
+            process_chat_keys(state, &token, term->input_buffer, &term->buffer_pos);
+        }
+    }
+    
+    return run_len == 0 || aish_write_bash(state, run, run_len);
 }
 
 bool aish_process_input(AishState *state, const char *input, size_t input_len) {
@@ -289,37 +682,630 @@ bool aish_process_input(AishState *state, const char *input, size_t input_len) {
     }
 }
 
-bool aish_process_bash_output(AishState *state) {
-    if (state == NULL || state->bash_master_fd == -1) {
-        return false;
+/**
+ * @brief Handle EOF on the pty master
+ * 
+ * EOF (EIO on Linux) means the slave side is closed, so bash has exited;
+ * the exit itself is reported by bash_exit_callback.
+ * 
+ * @param state The AISH state
+ */
+static void handle_bash_eof(AishState *state) {
+    event_loop_remove(&state->loop, state->bash_source);
+    state->bash_source = NULL;
+}
+
+/**
+ * @brief Track whether a program other than bash owns the pty
+ * 
+ * While a full-screen or long-running program is in the foreground, its
+ * input and output are relayed untouched: Tab and Chat mode only make sense
+ * at the bash prompt.
+ * 
+ * @param state The AISH state
+ */
+static void update_passthrough(AishState *state) {
+    state->owner_checked_ms = event_now_ms();
+    pid_t foreground = tcgetpgrp(state->bash_master_fd);
+    bool passthrough = (foreground > 0 && foreground != state->bash_pid);
+    
+    if (passthrough == state->passthrough) {
+        return;
     }
     
+    state->passthrough = passthrough;
+    if (passthrough) {
+        // Keystrokes now belong to the foreground program; app_paste keeps
+        // following its output (readline turned bracketed paste off before
+        // running it)
+        state->terminal.current_mode = MODE_BASH;
+        chat_drop_speculations(state);
+    } else {
+        // Back at the bash prompt with a fresh line. Spliced output may
+        // have hidden the program switching bracketed paste off: turn it
+        // back on, and drop markers until readline asks for them again
+        state->terminal.buffer_pos = 0;
+        state->terminal.app_paste = false;
+        state->terminal.paste_reset = true;
+        input_parser_init(&state->input_parser);
+    }
+}
+
+/**
+ * @brief Re-check the pty owner on output, at most every OWNER_RECHECK_MS
+ * 
+ * Output can wake the loop thousands of times a second, while the owner
+ * only changes when a program starts or exits. A change that falls inside
+ * the interval is caught by the next output or keystroke.
+ * 
+ * @param state The AISH state
+ */
+static void recheck_passthrough(AishState *state) {
+    if (event_now_ms() - state->owner_checked_ms >= OWNER_RECHECK_MS) {
+        update_passthrough(state);
+    }
+}
+
+#if defined(__linux__)
+/**
+ * @brief Give up on splice() and move any bytes already in the pipe by copying
+ * 
+ * @param state The AISH state
+ * @return true if successful, false otherwise
+ */
+static bool disable_splice(AishState *state) {
     char buffer[BUFFER_SIZE];
     ssize_t bytes_read;
+    bool ok = true;
+    
+    while ((bytes_read = read(state->splice_pipe[0], buffer, sizeof(buffer))) > 0) {
+        if (!aish_write_stdout(state, buffer, (size_t)bytes_read)) {
+            fprintf(stderr, "Error: Failed to write bash output to stdout: %s\n", strerror(errno));
+            ok = false;
+            break;
+        }
+    }
     
-    // Read output from bash
-    bytes_read = read(state->bash_master_fd, buffer, BUFFER_SIZE - 1);
+    close(state->splice_pipe[0]);
+    close(state->splice_pipe[1]);
+    state->splice_pipe[0] = -1;
+    state->splice_pipe[1] = -1;
+    state->splice_pending = 0;
     
-    if (bytes_read > 0) {
-        // Write output to stdout
-        buffer[bytes_read] = '\0';
-        if (write(STDOUT_FILENO, buffer, bytes_read) == -1) {
+    return ok;
+}
+
+/**
+ * @brief Move bytes left in the splice pipe to stdout until it would block
+ * 
+ * @param state The AISH state
+ * @return true if successful (bytes may remain in the pipe), false otherwise
+ */
+static bool drain_splice_pipe(AishState *state) {
+    while (state->splice_pending > 0) {
+        ssize_t written = splice(state->splice_pipe[0], NULL, STDOUT_FILENO, NULL,
+                                 state->splice_pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (written > 0) {
+            state->splice_pending -= (size_t)written;
+            histogram_record(&state->output_latency, event_now_us() - state->splice_read_us);
+        } else if (written == -1 && errno == EINTR) {
+            continue;
+        } else if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else if (written == -1 && errno == EINVAL) {
+            // Stdout does not accept splice (e.g. opened with O_APPEND)
+            return disable_splice(state);
+        } else {
             fprintf(stderr, "Error: Failed to write bash output to stdout: %s\n", strerror(errno));
             return false;
         }
-    } else if (bytes_read == -1 && errno != EAGAIN) {
-        // Error reading from bash
-        fprintf(stderr, "Error: Failed to read from bash: %s\n", strerror(errno));
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Relay bash output to stdout through a pipe without copying it to userspace
+ * 
+ * Stops reading the pty as soon as stdout would block; the rest of the pipe
+ * is written from the stdout callback.
+ * 
+ * @param state The AISH state
+ * @return true if successful (or splice is unsupported and the pipe was closed), false otherwise
+ */
+static bool splice_bash_output(AishState *state) {
+    // Anything queued earlier must reach the terminal first
+    if (!output_flush(&state->output)) {
+        fprintf(stderr, "Error: Failed to write bash output to stdout: %s\n", strerror(errno));
         return false;
-    } else if (bytes_read == 0) {
-        // EOF - bash has exited
-        fprintf(stderr, "Bash process has exited\n");
-        state->running = false;
+    }
+    if (output_pending(&state->output) > 0) {
+        return true;
+    }
+    
+    for (;;) {
+        // Leftovers from an earlier round go first; stop while stdout is full
+        if (!drain_splice_pipe(state)) {
+            return false;
+        }
+        if (state->splice_pending > 0 || state->splice_pipe[0] == -1) {
+            return true;
+        }
+        
+        ssize_t moved = splice(state->bash_master_fd, NULL, state->splice_pipe[1], NULL,
+                               SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        
+        if (moved == 0 || (moved == -1 && errno == EIO)) {
+            handle_bash_eof(state);
+            return true;
+        } else if (moved == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            if (errno == EINVAL) {
+                // The kernel cannot splice from a pty; use the copy path
+                return disable_splice(state);
+            }
+            fprintf(stderr, "Error: Failed to read from bash: %s\n", strerror(errno));
+            return false;
+        }
+        
+        state->splice_pending = (size_t)moved;
+        state->splice_read_us = event_now_us();
+    }
+}
+#endif
+
+/**
+ * @brief Reap io_uring completions and react to what the pty reported
+ * 
+ * @param state The AISH state
+ * @return true if successful, false otherwise
+ */
+static bool relay_uring_output(AishState *state) {
+    if (!uring_relay_process(&state->uring)) {
+        fprintf(stderr, "Error: Failed to write bash output to stdout: %s\n", strerror(errno));
+        return false;
+    }
+    
+    if (state->uring.bytes_read > 0) {
+        recheck_passthrough(state);
+    }
+    
+    if (state->uring.read_error != 0) {
+        fprintf(stderr, "Warning: io_uring read failed (%s), using epoll relay\r\n",
+                strerror(state->uring.read_error));
+        stop_uring(state);
+    } else if (state->uring.eof) {
+        handle_bash_eof(state);
     }
     
     return true;
 }
 
+bool aish_process_bash_output(AishState *state) {
+    if (state == NULL || state->bash_master_fd == -1) {
+        return false;
+    }
+    
+    if (uring_relay_active(&state->uring)) {
+        return relay_uring_output(state);
+    }
+    
+    recheck_passthrough(state);
+    
+#if defined(__linux__)
+    if (state->passthrough && state->splice_pipe[0] != -1) {
+        if (!splice_bash_output(state)) {
+            return false;
+        }
+        // Done unless splice turned out to be unsupported
+        if (state->splice_pipe[0] != -1 || !state->running) {
+            return true;
+        }
+    }
+#endif
+    
+    // The pty is watched edge-triggered, so read until it would block;
+    // the data is written out once the loop iteration is done
+    for (;;) {
+        ssize_t bytes_read = output_fill(&state->output, state->bash_master_fd);
+        
+        if (bytes_read > 0) {
+            continue;
+        } else if (bytes_read == 0 || (bytes_read == -1 && errno == EIO)) {
+            handle_bash_eof(state);
+            return true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == ENOBUFS) {
+            // Queue is full: write what the terminal takes right now
+            if (!output_flush(&state->output)) {
+                fprintf(stderr, "Error: Failed to write bash output to stdout: %s\n", strerror(errno));
+                return false;
+            }
+            if (!output_can_fill(&state->output)) {
+                if (state->stdout_source == NULL) {
+                    // Stdout cannot be polled by the loop; wait for it here
+                    output_wait_writable(&state->output);
+                    continue;
+                }
+                // Leave the rest in the pty until stdout catches up
+                update_relay_interest(state);
+                return true;
+            }
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        } else {
+            // Error reading from bash
+            fprintf(stderr, "Error: Failed to read from bash: %s\n", strerror(errno));
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Print one latency histogram as percentiles
+ * 
+ * @param name What was timed
+ * @param hist The histogram
+ */
+static void report_latency(const char *name, const Histogram *hist) {
+    fprintf(stderr, "[AISH stats] latency %s: %llu samples, p50 %lluus, p90 %lluus, "
+            "p99 %lluus, max %lluus\r\n",
+            name, (unsigned long long)hist->count,
+            (unsigned long long)histogram_percentile(hist, 50.0),
+            (unsigned long long)histogram_percentile(hist, 90.0),
+            (unsigned long long)histogram_percentile(hist, 99.0),
+            (unsigned long long)hist->max);
+}
+
+/**
+ * @brief Print relay statistics to stderr
+ * 
+ * @param state The AISH state
+ */
+static void report_stats(AishState *state) {
+    OutputRates rates;
+    output_sample_rates(&state->output, &rates);
+    const OutputStats *totals = &state->output.stats;
+    
+    fprintf(stderr, "\r\n[AISH stats] output over %.1fs: %.2f MB/s in, %.2f MB/s out, "
+            "%.0f reads/s, %.0f writes/s\r\n",
+            rates.seconds, rates.bytes_in / 1e6, rates.bytes_out / 1e6, rates.reads, rates.writes);
+    fprintf(stderr, "[AISH stats] output totals: %llu bytes in, %llu bytes out, %llu reads, "
+            "%llu writes, read size %zu\r\n",
+            (unsigned long long)totals->bytes_in, (unsigned long long)totals->bytes_out,
+            (unsigned long long)totals->reads, (unsigned long long)totals->writes,
+            state->output.read_size);
+    fprintf(stderr, "[AISH stats] output queue: %zu bytes pending, %llu max, %llu stalls, "
+            "%llu ms stalled\r\n",
+            output_pending(&state->output) + state->splice_pending,
+            (unsigned long long)totals->max_pending, (unsigned long long)totals->stalls,
+            (unsigned long long)totals->stall_ms);
+    
+    if (uring_relay_active(&state->uring)) {
+        const UringStats *ring = &state->uring.stats;
+        fprintf(stderr, "[AISH stats] io_uring: %llu enters, %llu submissions, %llu completions, "
+                "%llu read arms, multishot %s, fixed buffers %s\r\n",
+                (unsigned long long)ring->enters, (unsigned long long)ring->submissions,
+                (unsigned long long)ring->completions, (unsigned long long)ring->rearms,
+                state->uring.multishot ? "yes" : "no", state->uring.fixed ? "yes" : "no");
+    }
+    
+    report_latency("stdin->pty", &state->input_latency);
+    report_latency("pty->stdout", &state->output_latency);
+    report_latency("tab->prompt", &state->toggle_latency);
+    
+    const ApiStats *api = api_get_stats();
+    fprintf(stderr, "[AISH stats] api: %llu requests, %llu on a pre-warmed connection "
+            "(%llu pre-warms), %.1f ms of connection setup saved\r\n",
+            (unsigned long long)api->requests, (unsigned long long)api->warm_requests,
+            (unsigned long long)api->prewarms, (double)api->saved_us / 1000.0);
+    fprintf(stderr, "[AISH stats] api hedging: %llu hedges for %llu requests, %llu won, "
+            "%llu over budget\r\n",
+            (unsigned long long)api->hedges, (unsigned long long)api->sent,
+            (unsigned long long)api->hedge_wins, (unsigned long long)api->hedges_skipped);
+    fprintf(stderr, "[AISH stats] api memory: %llu arenas holding %llu bytes, peak %llu bytes "
+            "per request\r\n",
+            (unsigned long long)api->arenas, (unsigned long long)api->arena_bytes,
+            (unsigned long long)api->arena_peak);
+    uint64_t lookups = api->cache_hits + api->cache_misses;
+    fprintf(stderr, "[AISH stats] api cache: %llu hits, %llu misses (%.1f%% hits), %llu stored, "
+            "%llu entries, %llu bytes, %llu evicted, %llu compactions\r\n",
+            (unsigned long long)api->cache_hits, (unsigned long long)api->cache_misses,
+            (lookups > 0) ? 100.0 * (double)api->cache_hits / (double)lookups : 0.0,
+            (unsigned long long)api->cache_stores, (unsigned long long)api->cache_entries,
+            (unsigned long long)api->cache_bytes, (unsigned long long)api->cache_evictions,
+            (unsigned long long)api->cache_compactions);
+    fprintf(stderr, "[AISH stats] api cache sharing: %llu lookups retried, %llu waited for the lock, "
+            "%llu repairs, %llu stores skipped while locked\r\n",
+            (unsigned long long)api->cache_read_retries, (unsigned long long)api->cache_locked_reads,
+            (unsigned long long)api->cache_recoveries, (unsigned long long)api->cache_busy_stores);
+    fprintf(stderr, "[AISH stats] api similar: %llu offered, %llu not found, %llu indexed\r\n",
+            (unsigned long long)api->similar_offers, (unsigned long long)api->similar_misses,
+            (unsigned long long)api->similar_entries);
+    report_latency("api build", &api->build);
+    report_latency("api first byte", &api->first_byte);
+    report_latency("api parse", &api->parse);
+    report_latency("api answer", &api->latency);
+    report_latency("api cache lookup", &api->cache_lookup);
+    report_latency("api similar lookup", &api->similar_lookup);
+    fprintf(stderr, "[AISH stats] speculation: %llu sent, %llu used, %llu wasted\r\n",
+            (unsigned long long)state->speculations_sent, (unsigned long long)state->speculations_used,
+            (unsigned long long)state->speculations_wasted);
+}
+
+/**
+ * @brief Check whether the output observer sees what the pty prints
+ * 
+ * Output relayed with splice() never passes through AISH.
+ * 
+ * @param state The AISH state
+ * @return true if observed, false otherwise
+ */
+static bool output_observed(const AishState *state) {
+#if defined(__linux__)
+    return !state->passthrough || uring_relay_active(&state->uring) || state->splice_pipe[0] == -1;
+#else
+    (void)state;
+    return true;
+#endif
+}
+
+/**
+ * @brief Forward input to a program other than bash
+ * 
+ * Bytes go through untouched, except that bracketed paste markers are
+ * removed when the program was seen not to enable bracketed paste (the
+ * outer terminal sends them because AISH keeps the mode on). While its
+ * output is spliced, AISH cannot tell, so the markers are kept: a
+ * program that asked for them must get them.
+ * 
+ * @param state The AISH state
+ * @param data The bytes read from stdin
+ * @param len Number of bytes read
+ * @return true if successful, false if the program could not take the input
+ */
+static bool forward_passthrough_input(AishState *state, const char *data, size_t len) {
+    InputParser *parser = &state->input_parser;
+    const char *run = NULL;
+    size_t run_len = 0;
+    size_t offset = 0;
+    
+    bool quiet = (parser->state == INPUT_STATE_GROUND || parser->state == INPUT_STATE_PASTE) &&
+                 parser->paste_match == 0;
+    if (state->terminal.app_paste || !output_observed(state) || (quiet && memchr(data, '\033', len) == NULL)) {
+        return aish_write_bash(state, data, len);
+    }
+    
+    while (offset < len) {
+        InputToken token;
+        offset += input_parser_next(parser, data + offset, len - offset, &token);
+        
+        bool drop = (token.type == INPUT_TOKEN_PASTE_START || token.type == INPUT_TOKEN_PASTE_END);
+        if (run_len > 0 && (drop || run + run_len != token.data)) {
+            if (!aish_write_bash(state, run, run_len)) {
+                return false;
+            }
+            run_len = 0;
+        }
+        if (drop || token.len == 0) {
+            continue;
+        }
+        if (run_len == 0) {
+            run = token.data;
+        }
+        run_len += token.len;
+    }
+    
+    return run_len == 0 || aish_write_bash(state, run, run_len);
+}
+
+/**
+ * @brief Output observer: follow the bracketed paste mode of the program behind the pty
+ */
+static void observe_bash_output(void *ctx, const char *data, size_t len) {
+    AishState *state = (AishState *)ctx;
+    terminal_track_output(&state->terminal, data, len);
+}
+
+/**
+ * @brief Event loop callback for user input on stdin
+ */
+static void stdin_callback(int fd, uint32_t events, void *userdata) {
+    AishState *state = (AishState *)userdata;
+    (void)events;
+    
+    char buffer[STDIN_READ_SIZE];
+    
+    // Edge-triggered: consume everything that is available, unless bash
+    // has stopped accepting input and the loop no longer wants stdin
+    while (state->running && (state->stdin_source->events & EVENT_READ)) {
+        ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+        
+        if (bytes_read > 0) {
+            // Keystrokes still queued for the pty keep their original time
+            if (!state->input_unwritten) {
+                state->input_read_us = event_now_us();
+                state->input_unwritten = true;
+            }
+            
+            // Only Tab and Chat mode keystrokes are intercepted, so only then
+            // does it matter whether bash still owns the pty; in passthrough
+            // every keystroke checks, since the output path may have missed
+            // the program exiting
+            if (state->passthrough || terminal_get_mode(&state->terminal) == MODE_CHAT ||
+                memchr(buffer, '\t', (size_t)bytes_read) != NULL) {
+                update_passthrough(state);
+            }
+            
+            bool forwarded;
+            if (state->passthrough) {
+                // A program other than bash owns the pty: no interception
+                forwarded = forward_passthrough_input(state, buffer, (size_t)bytes_read);
+            } else {
+                forwarded = process_input_chunk(state, buffer, (size_t)bytes_read);
+            }
+            if (!forwarded) {
+                fprintf(stderr, "Error: Failed to forward input to bash, rest of the chunk dropped\r\n");
+            }
+            
+            // Chat mode keys never reach the pty; do not time them
+            if (ringbuf_used(&state->bash_input) == 0) {
+                state->input_unwritten = false;
+            }
+        } else if (bytes_read == 0) {
+            // EOF on stdin - nothing more to relay
+            state->running = false;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "Error: Failed to read from stdin: %s\n", strerror(errno));
+                state->running = false;
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Write all pending output, waiting for the terminal as needed
+ * 
+ * @param state The AISH state
+ * @return true if successful, false otherwise
+ */
+static bool drain_all_output(AishState *state) {
+#if defined(__linux__)
+    while (state->splice_pending > 0) {
+        if (!drain_splice_pipe(state)) {
+            return false;
+        }
+        if (state->splice_pending > 0) {
+            output_wait_writable(&state->output);
+        }
+    }
+#endif
+    
+    return output_drain(&state->output);
+}
+
+/**
+ * @brief Event loop callback for stdout becoming writable again
+ */
+static void stdout_callback(int fd, uint32_t events, void *userdata) {
+    AishState *state = (AishState *)userdata;
+    (void)fd;
+    (void)events;
+    
+#if defined(__linux__)
+    if (state->splice_pending > 0 && !drain_splice_pipe(state)) {
+        state->running = false;
+        return;
+    }
+#endif
+    
+    if (!output_flush(&state->output)) {
+        fprintf(stderr, "Error: Failed to write to stdout: %s\n", strerror(errno));
+        state->running = false;
+        return;
+    }
+    
+    update_relay_interest(state);
+}
+
+/**
+ * @brief Watch stdout for writability if the loop can poll it
+ * 
+ * @param state The AISH state
+ */
+static void watch_stdout(AishState *state) {
+    struct stat stdout_stat;
+    
+    // Regular files and /dev/null cannot be polled; output is then written blocking
+    if (state->stdout_source == NULL && fstat(STDOUT_FILENO, &stdout_stat) == 0 &&
+        (isatty(STDOUT_FILENO) || S_ISFIFO(stdout_stat.st_mode) || S_ISSOCK(stdout_stat.st_mode))) {
+        state->stdout_source = event_loop_add_fd(&state->loop, STDOUT_FILENO, 0,
+                                                 stdout_callback, state);
+    }
+}
+
+/**
+ * @brief Event loop callback for io_uring completions
+ */
+static void uring_callback(int fd, uint32_t events, void *userdata) {
+    AishState *state = (AishState *)userdata;
+    (void)fd;
+    (void)events;
+    
+    if (!relay_uring_output(state)) {
+        state->running = false;
+    }
+}
+
+/**
+ * @brief Switch the output relay to io_uring if the kernel supports it
+ * 
+ * @param state The AISH state
+ */
+static void start_uring(AishState *state) {
+    if (!uring_relay_init(&state->uring, state->bash_master_fd, &state->output)) {
+        fprintf(stderr, "Warning: io_uring relay unavailable (%s), using epoll\r\n", strerror(errno));
+        return;
+    }
+    
+    state->uring_source = event_loop_add_fd(&state->loop, state->uring.fd, EVENT_READ,
+                                            uring_callback, state);
+    if (state->uring_source == NULL) {
+        uring_relay_free(&state->uring);
+        return;
+    }
+    
+    // The ring waits for the terminal itself
+    event_loop_remove(&state->loop, state->stdout_source);
+    state->stdout_source = NULL;
+    update_relay_interest(state);
+}
+
+/**
+ * @brief Hand the output relay back to epoll
+ * 
+ * @param state The AISH state
+ */
+static void stop_uring(AishState *state) {
+    if (!uring_relay_active(&state->uring)) {
+        return;
+    }
+    
+    event_loop_remove(&state->loop, state->uring_source);
+    state->uring_source = NULL;
+    uring_relay_free(&state->uring);
+    
+    watch_stdout(state);
+    update_relay_interest(state);
+}
+
+/**
+ * @brief Event loop callback for output on the pty master
+ */
+static void bash_output_callback(int fd, uint32_t events, void *userdata) {
+    AishState *state = (AishState *)userdata;
+    (void)fd;
+    
+    if ((events & EVENT_WRITE) && !flush_bash_input(state)) {
+        state->running = false;
+        return;
+    }
+    
+    if ((events & (EVENT_READ | EVENT_HANGUP | EVENT_ERROR)) && !aish_process_bash_output(state)) {
+        state->running = false;
+    }
+}
+
 int aish_run(AishState *state) {
     if (state == NULL) {
         return EXIT_FAILURE;
@@ -331,99 +1317,114 @@ int aish_run(AishState *state) {
         return EXIT_FAILURE;
     }
     
+    // Stdin is watched edge-triggered and drained, so it must not block
+    state->stdin_flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+    if (state->stdin_flags == -1 ||
+        fcntl(STDIN_FILENO, F_SETFL, state->stdin_flags | O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error: Failed to set stdin non-blocking: %s\n", strerror(errno));
+        terminal_disable_raw_mode(&state->terminal);
+        return EXIT_FAILURE;
+    }
+    
+    // A slow terminal must not stall the loop; stdout is watched for
+    // writability whenever output is queued. On a tty this is usually the
+    // same open file as stdin, but stdout may have been redirected.
+    state->stdout_flags = fcntl(STDOUT_FILENO, F_GETFL, 0);
+    if (state->stdout_flags != -1) {
+        fcntl(STDOUT_FILENO, F_SETFL, state->stdout_flags | O_NONBLOCK);
+    }
+    watch_stdout(state);
+    
+    // Register event sources
+    state->stdin_source = event_loop_add_fd(&state->loop, STDIN_FILENO, EVENT_READ,
+                                            stdin_callback, state);
+    state->bash_source = event_loop_add_fd(&state->loop, state->bash_master_fd, EVENT_READ,
+                                           bash_output_callback, state);
+    if (state->stdin_source == NULL || state->bash_source == NULL) {
+        fprintf(stderr, "Error: Failed to register event sources\n");
+        if (state->stdout_flags != -1) {
+            fcntl(STDOUT_FILENO, F_SETFL, state->stdout_flags);
+        }
+        fcntl(STDIN_FILENO, F_SETFL, state->stdin_flags);
+        terminal_disable_raw_mode(&state->terminal);
+        return EXIT_FAILURE;
+    }
+    
+    if (state->config.relay == RELAY_IO_URING) {
+        start_uring(state);
+    }
+    
+#if defined(__linux__)
+    // Pipe used to splice output while another program owns the pty (the
+    // io_uring relay handles that case itself)
+    if (uring_relay_active(&state->uring) ||
+        pipe2(state->splice_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        state->splice_pipe[0] = -1;
+        state->splice_pipe[1] = -1;
+    }
+#endif
+    
+    // Keep bracketed paste on so pastes can be told apart from typing
+    output_set_observer(&state->output, observe_bash_output, state);
+    output_set_latency(&state->output, &state->output_latency);
+    aish_write_stdout(state, TERMINAL_PASTE_ON, strlen(TERMINAL_PASTE_ON));
+    
     // Set running flag
     state->running = true;
     
-    // Main loop
-    char input_buffer[INPUT_BUFFER_SIZE];
-    size_t input_pos = 0;
-    
     // Use write instead of fprintf to ensure proper formatting
     const char *welcome_msg = "AISH - AI Shell v0.1\r\n";
     write(STDERR_FILENO, welcome_msg, strlen(welcome_msg));
     const char *help_msg = "Press Tab when the input is empty to toggle between Bash and Chat modes.\r\n";
     write(STDERR_FILENO, help_msg, strlen(help_msg));
     
+    // Main loop
     while (state->running) {
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(STDIN_FILENO, &read_fds);
-        FD_SET(state->bash_master_fd, &read_fds);
-        
-        int max_fd = (STDIN_FILENO > state->bash_master_fd) ? STDIN_FILENO : state->bash_master_fd;
-        
-        // Wait for input or output
-        int ready = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
-        
-        if (ready == -1) {
-            if (errno == EINTR) {
-                // Interrupted by signal, check if we should exit
-                if (!state->running) {
-                    break;
-                }
-                continue;
-            }
-            
-            fprintf(stderr, "Error: select() failed: %s\n", strerror(errno));
+        if (event_loop_run_once(&state->loop, -1) == -1) {
             break;
         }
         
-        // Check for input from user
-        if (FD_ISSET(STDIN_FILENO, &read_fds)) {
-            char c;
-            ssize_t bytes_read = read(STDIN_FILENO, &c, 1);
-            
-            if (bytes_read > 0) {
-                // Process the keypress
-                
-                if (terminal_process_key(&state->terminal, c, input_pos)) {
-                    // Mode was toggled, reset input buffer
-                    input_pos = 0;
-                    
-                    // Note: terminal_process_key already toggled the mode, so we don't need to call terminal_toggle_mode
-                    // terminal_toggle_mode(&state->terminal, state->bash_master_fd);
-                    
-                    // Display the appropriate prompt based on the current mode
-                    display_prompt(state);
-                    
-                    continue;
-                }
-                
-                // Process the keypress based on the current mode
-                if (terminal_get_mode(&state->terminal) == MODE_BASH) {
-                    // Process the keypress in Bash mode
-                    process_bash_keypress(state, c, input_buffer, &input_pos);
-                } else {
-                    // Process the keypress in Chat mode
-                    process_chat_keypress(state, c, input_buffer, &input_pos);
-                }
-            } else if (bytes_read == -1 && errno != EAGAIN) {
-                fprintf(stderr, "Error: Failed to read from stdin: %s\n", strerror(errno));
-                break;
-            }
+        // A program behind the pty switched bracketed paste off; turn it back on
+        if (state->terminal.paste_reset) {
+            state->terminal.paste_reset = false;
+            aish_write_stdout(state, TERMINAL_PASTE_ON, strlen(TERMINAL_PASTE_ON));
         }
         
-        // Check for output from bash
-        if (FD_ISSET(state->bash_master_fd, &read_fds)) {
-            if (!aish_process_bash_output(state)) {
-                break;
-            }
+        // Write everything queued during this iteration at once; whatever
+        // the terminal cannot take yet waits for the stdout callback
+        if (!output_flush(&state->output)) {
+            fprintf(stderr, "Error: Failed to write to stdout: %s\n", strerror(errno));
+            break;
         }
-        
-        // Check if bash process has exited
-        int status;
-        pid_t result = waitpid(state->bash_pid, &status, WNOHANG);
-        
-        if (result == state->bash_pid) {
-            fprintf(stderr, "Bash process has exited with status %d\n", WEXITSTATUS(status));
-            state->running = false;
-        } else if (result == -1) {
-            fprintf(stderr, "Error: waitpid() failed: %s\n", strerror(errno));
+        if (state->stdout_source == NULL && !uring_relay_active(&state->uring) &&
+            !output_drain(&state->output)) {
+            fprintf(stderr, "Error: Failed to write to stdout: %s\n", strerror(errno));
             break;
         }
+        if (state->toggle_us != 0 && output_pending(&state->output) == 0) {
+            histogram_record(&state->toggle_latency, event_now_us() - state->toggle_us);
+            state->toggle_us = 0;
+        }
+        update_relay_interest(state);
     }
     
-    // Disable raw mode
+    aish_write_stdout(state, TERMINAL_PASTE_OFF, strlen(TERMINAL_PASTE_OFF));
+    drain_all_output(state);
+    output_set_stalled(&state->output, false);
+    stop_uring(state);
+    
+    event_loop_remove(&state->loop, state->stdin_source);
+    event_loop_remove(&state->loop, state->bash_source);
+    event_loop_remove(&state->loop, state->stdout_source);
+    state->stdin_source = NULL;
+    state->bash_source = NULL;
+    state->stdout_source = NULL;
+    
+    // Restore stdout and stdin flags and disable raw mode
+    if (state->stdout_flags != -1) {
+        fcntl(STDOUT_FILENO, F_SETFL, state->stdout_flags);
+    }
+    fcntl(STDIN_FILENO, F_SETFL, state->stdin_flags);
     terminal_disable_raw_mode(&state->terminal);
     
     return EXIT_SUCCESS;
@@ -438,26 +1439,50 @@ void aish_cleanup(AishState *state) {
     terminal_cleanup(&state->terminal);
     
     // Clean up API
+    chat_drop_speculations(state);
+    free(state->offered_query);
     api_cleanup();
     
+    // Clean up event loop
+    event_loop_cleanup(&state->loop);
+    uring_relay_free(&state->uring);
+    ringbuf_free(&state->bash_input);
+    output_free(&state->output);
+    
     // Clean up configuration
     config_free(&state->config);
     
+    // Close the splice pipe if it's open
+    if (state->splice_pipe[0] != -1) {
+        close(state->splice_pipe[0]);
+        close(state->splice_pipe[1]);
+        state->splice_pipe[0] = -1;
+        state->splice_pipe[1] = -1;
+    }
+    
     // Close bash master fd if it's open
     if (state->bash_master_fd != -1) {
         close(state->bash_master_fd);
         state->bash_master_fd = -1;
     }
     
-    // Reset global state
-    g_state = NULL;
 }
 
 int main(int argc, char *argv[]) {
-    (void)argc; // Suppress unused parameter warning
-    (void)argv; // Suppress unused parameter warning
     AishState state;
     int exit_code = EXIT_FAILURE;
+    RelayBackend relay = RELAY_EPOLL;
+    bool relay_set = false;
+    
+    // Parse command-line options
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--relay=", 8) == 0 && config_parse_relay(argv[i] + 8, &relay)) {
+            relay_set = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--relay=epoll|io_uring]\n", argv[0]);
+            return exit_code;
+        }
+    }
     
     // Initialize AISH
     if (!aish_init(&state)) {
@@ -465,6 +1490,11 @@ int main(int argc, char *argv[]) {
         return exit_code;
     }
     
+    // The command line overrides the configuration file
+    if (relay_set) {
+        state.config.relay = relay;
+    }
+    
     // Spawn bash process
     if (!aish_spawn_bash(&state)) {
         fprintf(stderr, "Error: Failed to spawn bash process\n");
@@ -9,10 +9,32 @@
 #include "config.h"
 #include "terminal.h"
 #include "api.h"
+#include "event.h"
+#include "input.h"
+#include "ringbuf.h"
+#include "output.h"
+#include "uring.h"
+#include "histogram.h"
 #include <stdbool.h>
 #include <termios.h>
 #include <sys/types.h>
 
+#define CHAT_MAX_SPECULATIONS 4    /**< Speculative chat requests kept at most */
+
+/**
+ * @struct Speculation
+ * @brief A chat request sent while the query was still being typed
+ */
+typedef struct {
+    char *text;             /**< Query it was sent for, NULL if the slot is free */
+    ApiRequest *request;    /**< Request in flight, NULL once answered */
+    ApiResponse response;   /**< The answer, once it has arrived */
+    bool success;           /**< The answer held a command */
+    bool adopted;           /**< Enter was pressed on this query before it was answered */
+    uint64_t sent_ms;       /**< When it was sent */
+    void *state;            /**< The AishState it belongs to */
+} Speculation;
+
 /**
  * @struct AishState
  * @brief Structure to hold the state of the AISH program
@@ -23,6 +45,38 @@ typedef struct {
     pid_t bash_pid;             /**< PID of the spawned Bash process */
     int bash_master_fd;         /**< Master file descriptor for pty */
     bool running;               /**< Flag indicating if the program is running */
+    EventLoop loop;             /**< Event loop driving the relay */
+    EventSource *stdin_source;  /**< Loop registration for stdin */
+    EventSource *bash_source;   /**< Loop registration for the pty master */
+    EventSource *stdout_source; /**< Loop registration for stdout (NULL if not pollable) */
+    int stdin_flags;            /**< Original stdin file status flags */
+    int stdout_flags;           /**< Original stdout file status flags */
+    InputParser input_parser;   /**< Keystroke tokenizer state */
+    RingBuffer bash_input;      /**< Input waiting for the pty to accept it */
+    bool passthrough;           /**< A program other than bash owns the pty */
+    uint64_t owner_checked_ms;  /**< When the pty's foreground process group was last read */
+    int splice_pipe[2];         /**< Pipe for zero-copy output relay (-1 if unused) */
+    size_t splice_pending;      /**< Bytes in the splice pipe waiting for stdout */
+    OutputBuffer output;        /**< Queue of everything written to the terminal */
+    UringRelay uring;           /**< io_uring output relay (inactive on the epoll backend) */
+    EventSource *uring_source;  /**< Loop registration for the io_uring completion queue */
+    uint64_t input_read_us;     /**< When the stdin chunk being handled was read */
+    bool input_unwritten;       /**< Bytes of that chunk have not reached the pty yet */
+    uint64_t splice_read_us;    /**< When the bytes in the splice pipe were read */
+    uint64_t toggle_us;         /**< When a Tab that toggled the mode was read, 0 once redrawn */
+    Histogram input_latency;    /**< Stdin read to pty write, in microseconds */
+    Histogram output_latency;   /**< Pty read to stdout write, in microseconds */
+    Histogram toggle_latency;   /**< Tab read to redrawn prompt written, in microseconds */
+    ApiRequest *chat_request;   /**< Chat request in flight, NULL if none */
+    EventSource *status_timer;  /**< Redraws the status line while a request is pending */
+    uint64_t chat_started_ms;   /**< When the chat request was sent */
+    unsigned status_frame;      /**< Spinner frame to show next */
+    Speculation speculations[CHAT_MAX_SPECULATIONS]; /**< Speculative chat requests */
+    EventSource *speculate_timer; /**< Fires once typing in Chat mode pauses */
+    uint64_t speculations_sent; /**< Speculative requests sent */
+    uint64_t speculations_used; /**< Speculative answers used when Enter was pressed */
+    uint64_t speculations_wasted; /**< Speculative requests cancelled or never used */
+    char *offered_query;        /**< Query last offered a similar query's answer; sent if asked again */
 } AishState;
 
 /**
@@ -59,20 +113,46 @@ int aish_run(AishState *state);
  */
 bool aish_process_input(AishState *state, const char *input, size_t input_len);
 
+/**
+ * @brief Send bytes to the Bash process
+ * 
+ * Writes immediately when possible and queues whatever the pty cannot
+ * accept yet, preserving order with earlier input.
+ * 
+ * @param state Pointer to AishState structure
+ * @param data Bytes to send
+ * @param len Number of bytes to send
+ * @return true if the bytes were written or queued, false otherwise
+ */
+bool aish_write_bash(AishState *state, const char *data, size_t len);
+
+/**
+ * @brief Write bytes to the user's terminal
+ * 
+ * @param state Pointer to AishState structure
+ * @param data Bytes to write
+ * @param len Number of bytes to write
+ * @return true if all bytes were written, false otherwise (errno is set)
+ */
+bool aish_write_stdout(AishState *state, const char *data, size_t len);
+
 /**
  * @brief Process Bash output
  * 
+ * Drains the pty master until it would block.
+ * 
  * @param state Pointer to AishState structure
  * @return true if processing was successful, false otherwise
  */
 bool aish_process_bash_output(AishState *state);
 
 /**
- * @brief Handle signals
+ * @brief Handle signals delivered through the event loop
  * 
  * @param signal Signal number
+ * @param userdata Pointer to AishState structure
  */
-void aish_signal_handler(int signal);
+void aish_signal_handler(int signal, void *userdata);
 
 /**
  * @brief Clean up AISH state and free resources
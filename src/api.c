@@ -4,26 +4,60 @@
  */
 
 #include "api.h"
+#include "arena.h"
+#include "netcache.h"
+#include "backend.h"
+#include "respcache.h"
+#include "simindex.h"
+#include "statedir.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <curl/curl.h>
 
-
-/* 
- * Include json-c header
- * On some systems, this might be in a different location.
- * If you get a compilation error, try changing this to match your system.
- */
-#include <json-c/json.h>
-
-#define OPENAI_API_URL "https://api.openai.com/v1/chat/completions"
 #define USER_AGENT "AISH/0.1"
 #define MAX_RESPONSE_SIZE (1024 * 1024) // 1MB max response size
+#define MIN_RESPONSE_BUFFER 4096        // Response buffer reserved before the high-water mark is known
+#define KEEPALIVE_IDLE_S 30L       // TCP keepalive probes start after this idle time
+#define KEEPALIVE_INTERVAL_S 15L   // and repeat at this interval
+#define MAX_CONNECTION_AGE_S 600L  // Idle connections older than this are not reused
+#define HEDGE_MIN_SAMPLES 20       // First-byte times needed before the adaptive delay is used
+#define HEDGE_PERCENTILE 95.0      // Adaptive delay: this percentile of first-byte times
+#define RESPONSE_CACHE_NAME "response-cache" // Base name of the response cache files
+#define SIMILAR_INDEX_NAME "response-cache.sim" // Similarity index of the cached queries
+#define SIMILAR_CANDIDATES 4       // Similar queries tried, in case some answers are gone
+#define MAX_SPARE_REQUESTS 8       // Finished requests kept, with their easy handles, for reuse
+#define IDLE_WORK_MS 1000          // Saving and cache upkeep wait this long after the last answer
 
 // Static variables
-static CURL *curl_handle = NULL;
+static CURLM *multi_handle = NULL;
+static CURLSH *share_handle = NULL;
+static NetCache net_cache;
+static bool net_cache_dirty = false;     // net_cache changed since it was last saved
 static struct curl_slist *headers = NULL;
+static const ApiBackend *backend = NULL;
+static char *api_url = NULL;
+static char *unix_socket = NULL;
+static RequestTemplate request_template;   // Request body without the user's input
+static RequestBuffer request_body;          // Body of the latest request, reused
+static EventLoop *event_loop = NULL;
+static EventSource *timer_source = NULL;
+static EventSource *idle_source = NULL;  // Saves the network cache and tidies the response cache once idle
+static ApiStats stats;
+static ApiRequest *prewarm_request = NULL;
+static bool prewarmed = false;           // A pre-warm finished since the last request
+static uint64_t last_setup_us = 0;       // Connection setup time of the last new connection
+static Arena *spare_arenas = NULL;       // Arenas of finished requests, reset for the next ones
+static ApiRequest *spare_requests = NULL; // Finished requests, each keeping its easy handle
+static size_t spare_request_count = 0;   // Length of spare_requests
+static CURL *spare_easy = NULL;          // Easy handle of a transfer retired while its hedge ran
+static size_t response_high_water = 0;   // Largest response buffer a request has needed
+static RespCache response_cache;         // Answers to earlier queries
+static bool cache_enabled = false;       // response_cache is open
+static uint64_t cache_context = 0;       // Hash of everything but the query that shapes the answer
+static SimIndex similar_index;           // Cached queries by similarity
+static bool similar_enabled = false;     // similar_index is open
+static double similar_threshold = 0.0;   // Least similarity of a query whose answer is offered
 
 // Structure to hold response data
 typedef struct {
@@ -32,252 +66,1427 @@ typedef struct {
     size_t capacity;
 } ResponseData;
 
+// Where the command scanner is in the message content
+typedef enum {
+    SCAN_KEY,       // Looking for "command"
+    SCAN_COLON,     // After the key, expecting ':'
+    SCAN_VALUE,     // After the colon, expecting the opening quote
+    SCAN_STRING,    // Inside the command string
+    SCAN_ESCAPE,    // After a backslash in the string
+    SCAN_UNICODE,   // Inside a \uXXXX escape
+    SCAN_DONE       // The command string has been closed
+} ScanState;
+
+// Finds the "command" string in message content that arrives in pieces
+typedef struct {
+    ScanState state;
+    size_t matched;         // Bytes of the key matched so far
+    unsigned codepoint;     // Value of a \u escape being read
+    int hex_digits;         // Hex digits of it read so far
+    unsigned high_half;     // High surrogate waiting for its low half, 0 if none
+    ResponseData command;   // Decoded command text
+} CommandScanner;
+
+// A request in flight
+struct ApiRequest {
+    CURL *easy;                 // Transfer handle
+    Arena *arena;               // Buffers and strings of the request, NULL for a pre-warm
+    ResponseData response_data; // Body received so far (or the partial SSE line)
+    bool streaming;             // Body is an SSE stream being parsed as it arrives
+    bool body_checked;          // Streaming was decided on the first body bytes
+    bool stream_requested;      // The request asked for a stream
+    bool prewarm;               // Only opens a connection for later requests
+    bool first_byte;            // The request (or its hedge) has started answering
+    uint64_t sent_us;           // When the request was sent
+    uint64_t parse_us;          // Time spent parsing the answer so far
+    char *body;                 // Request body; curl sends it from here
+    size_t body_len;            // Length of the body
+    char *cache_key;            // Key to store the answer under, NULL if not cached
+    size_t cache_key_len;       // Length of the key
+    size_t cache_query;         // Offset of the query in the key
+    int hedge_budget;           // Hedges allowed per 100 requests
+    EventSource *hedge_timer;   // Sends the hedge if no answer has started by then
+    ApiRequest *hedge;          // Duplicate of this request, NULL if none
+    ApiRequest *primary;        // For a hedge: the request it duplicates
+    ApiRequest *leader;         // Transfer whose command is shown as it streams in
+    ResponseData content;       // Message content streamed so far
+    CommandScanner scanner;     // Picks the command out of the content
+    ApiCallback callback;       // Run when the transfer is done
+    ApiProgress progress;       // Run as the command streams in, may be NULL
+    void *userdata;             // Callback argument
+    ApiRequest *prev;           // Neighbours in the list of requests in flight
+    ApiRequest *next;
+};
+
+static ApiRequest *requests = NULL;
+
+static const char COMMAND_KEY[] = "\"command\"";
+
 /**
- * @brief Callback function for libcurl to handle API response data
+ * @brief Append bytes to a response buffer, keeping it NUL-terminated
+ * 
+ * @param arena Arena the buffer was carved from
+ * @return true if successful, false if the buffer would exceed MAX_RESPONSE_SIZE or memory ran out
  */
-static size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
-    size_t real_size = size * nmemb;
-    ResponseData *response = (ResponseData *)userdata;
-    
+static bool buffer_append(Arena *arena, ResponseData *buffer, const char *data, size_t len) {
     // Check if we're about to exceed the maximum response size
-    if (response->size + real_size > MAX_RESPONSE_SIZE) {
+    if (buffer->size + len > MAX_RESPONSE_SIZE) {
         fprintf(stderr, "Error: Response size exceeds maximum allowed size\n");
-        return 0; // This will cause curl to report an error
+        return false;
     }
     
     // Check if we need to resize the buffer
-    if (response->size + real_size >= response->capacity) {
+    if (buffer->data == NULL || buffer->size + len >= buffer->capacity) {
         // Calculate new capacity (double the current size)
-        size_t new_capacity = response->capacity * 2;
-        if (new_capacity < response->size + real_size + 1) {
-            new_capacity = response->size + real_size + 1;
+        size_t new_capacity = buffer->capacity * 2;
+        if (new_capacity < buffer->size + len + 1) {
+            new_capacity = buffer->size + len + 1;
         }
         
-        // Resize the buffer
-        char *new_data = (char *)realloc(response->data, new_capacity);
+        // Resize the buffer (in place if it is the arena's newest allocation)
+        char *new_data = (char *)arena_grow(arena, buffer->data, buffer->capacity, new_capacity);
         if (new_data == NULL) {
             fprintf(stderr, "Error: Memory allocation failed for API response\n");
-            return 0; // This will cause curl to report an error
+            return false;
         }
         
-        response->data = new_data;
-        response->capacity = new_capacity;
+        buffer->data = new_data;
+        buffer->capacity = new_capacity;
     }
     
     // Copy the data to the buffer
-    memcpy(response->data + response->size, ptr, real_size);
-    response->size += real_size;
-    response->data[response->size] = '\0';
+    memcpy(buffer->data + buffer->size, data, len);
+    buffer->size += len;
+    buffer->data[buffer->size] = '\0';
+    
+    return true;
+}
+
+/**
+ * @brief Append a Unicode code point to the command as UTF-8
+ */
+static bool append_codepoint(Arena *arena, ResponseData *buffer, unsigned cp) {
+    char utf8[4];
+    size_t len;
+    
+    if (cp < 0x80) {
+        utf8[0] = (char)cp;
+        len = 1;
+    } else if (cp < 0x800) {
+        utf8[0] = (char)(0xC0 | (cp >> 6));
+        utf8[1] = (char)(0x80 | (cp & 0x3F));
+        len = 2;
+    } else if (cp < 0x10000) {
+        utf8[0] = (char)(0xE0 | (cp >> 12));
+        utf8[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (cp & 0x3F));
+        len = 3;
+    } else {
+        utf8[0] = (char)(0xF0 | (cp >> 18));
+        utf8[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (cp & 0x3F));
+        len = 4;
+    }
+    
+    return buffer_append(arena, buffer, utf8, len);
+}
+
+/**
+ * @brief Replace a high surrogate that was not followed by a \u low one with U+FFFD
+ */
+static bool flush_surrogate(Arena *arena, CommandScanner *scanner) {
+    if (scanner->high_half == 0) {
+        return true;
+    }
+    
+    scanner->high_half = 0;
+    return append_codepoint(arena, &scanner->command, 0xFFFD);
+}
+
+/**
+ * @brief Decode the code unit of a complete \u escape into the command
+ * 
+ * Surrogate pairs are combined and lone halves become U+FFFD, as in
+ * jscan_unescape().
+ */
+static bool append_unit(Arena *arena, CommandScanner *scanner, unsigned unit) {
+    if (unit >= 0xD800 && unit <= 0xDBFF) {
+        // Held until the next escape shows whether the low half follows
+        if (!flush_surrogate(arena, scanner)) {
+            return false;
+        }
+        scanner->high_half = unit;
+        return true;
+    }
+    
+    if (unit >= 0xDC00 && unit <= 0xDFFF) {
+        unsigned high = scanner->high_half;
+        scanner->high_half = 0;
+        unsigned cp = (high != 0) ? 0x10000 + ((high - 0xD800) << 10) + (unit - 0xDC00) : 0xFFFD;
+        return append_codepoint(arena, &scanner->command, cp);
+    }
+    
+    return flush_surrogate(arena, scanner) && append_codepoint(arena, &scanner->command, unit);
+}
+
+/**
+ * @brief Feed more message content to the command scanner
+ * 
+ * @return true if successful, false on allocation failure or a malformed \u escape
+ */
+static bool scan_command(Arena *arena, CommandScanner *scanner, const char *data, size_t len) {
+    for (size_t i = 0; i < len && scanner->state != SCAN_DONE; i++) {
+        char c = data[i];
+        char decoded = 0;
+        
+        switch (scanner->state) {
+        case SCAN_KEY:
+            if (c == COMMAND_KEY[scanner->matched]) {
+                scanner->matched++;
+                if (scanner->matched == sizeof(COMMAND_KEY) - 1) {
+                    scanner->state = SCAN_COLON;
+                }
+            } else {
+                scanner->matched = (c == '"') ? 1 : 0;
+            }
+            break;
+        case SCAN_COLON:
+        case SCAN_VALUE:
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                break;
+            }
+            if (scanner->state == SCAN_COLON && c == ':') {
+                scanner->state = SCAN_VALUE;
+            } else if (scanner->state == SCAN_VALUE && c == '"') {
+                scanner->state = SCAN_STRING;
+            } else {
+                // Not "command": "..." after all
+                scanner->state = SCAN_KEY;
+                scanner->matched = (c == '"') ? 1 : 0;
+            }
+            break;
+        case SCAN_STRING:
+            if (c == '\\') {
+                scanner->state = SCAN_ESCAPE;
+            } else if (!flush_surrogate(arena, scanner)) {
+                return false;
+            } else if (c == '"') {
+                scanner->state = SCAN_DONE;
+            } else if (!buffer_append(arena, &scanner->command, &c, 1)) {
+                return false;
+            }
+            break;
+        case SCAN_ESCAPE:
+            scanner->state = SCAN_STRING;
+            if (c != 'u' && !flush_surrogate(arena, scanner)) {
+                return false;
+            }
+            switch (c) {
+            case 'n': decoded = '\n'; break;
+            case 't': decoded = '\t'; break;
+            case 'r': decoded = '\r'; break;
+            case 'b': decoded = '\b'; break;
+            case 'f': decoded = '\f'; break;
+            case 'u':
+                scanner->state = SCAN_UNICODE;
+                scanner->codepoint = 0;
+                scanner->hex_digits = 0;
+                break;
+            default: decoded = c; break; // \" \\ \/
+            }
+            if (decoded != 0 && !buffer_append(arena, &scanner->command, &decoded, 1)) {
+                return false;
+            }
+            break;
+        case SCAN_UNICODE: {
+            unsigned digit;
+            if (c >= '0' && c <= '9') {
+                digit = (unsigned)(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                digit = (unsigned)(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                digit = (unsigned)(c - 'A' + 10);
+            } else {
+                fprintf(stderr, "Error: Invalid \\u escape in the streamed answer\n");
+                return false;
+            }
+            scanner->codepoint = scanner->codepoint * 16 + digit;
+            if (++scanner->hex_digits == 4) {
+                scanner->state = SCAN_STRING;
+                if (!append_unit(arena, scanner, scanner->codepoint)) {
+                    return false;
+                }
+            }
+            break;
+        }
+        case SCAN_DONE:
+            break;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * @brief Handle one "data:" line of the SSE stream
+ * 
+ * @return true to keep receiving, false once the command is complete or on error
+ */
+static bool handle_event(ApiRequest *request, char *payload) {
+    if (strcmp(payload, "[DONE]") == 0) {
+        return true;
+    }
+    
+    // The text is decoded in place in the line buffer
+    uint64_t start_us = event_now_us();
+    const char *text;
+    size_t text_len;
+    
+    bool keep_going = true;
+    if (backend->stream_chunk(payload, strlen(payload), &text, &text_len)) {
+        size_t before = request->scanner.command.size;
+        keep_going = buffer_append(request->arena, &request->content, text, text_len) &&
+                     scan_command(request->arena, &request->scanner, text, text_len);
+        
+        // With a hedge in flight, only one of the two is shown
+        ApiRequest *owner = (request->primary != NULL) ? request->primary : request;
+        if (owner->leader == NULL) {
+            owner->leader = request;
+        }
+        if (keep_going && owner->progress != NULL && owner->leader == request &&
+            request->scanner.command.size > before) {
+            owner->progress(request->scanner.command.data, request->scanner.command.size,
+                            owner->userdata);
+        }
+        
+        // The rest of the answer is of no use: stop paying for it
+        if (request->scanner.state == SCAN_DONE) {
+            keep_going = false;
+        }
+    }
+    
+    request->parse_us += event_now_us() - start_us;
+    return keep_going;
+}
+
+/**
+ * @brief Record the time to first byte and call off the hedge timer
+ */
+static void note_first_byte(ApiRequest *request) {
+    ApiRequest *owner = (request->primary != NULL) ? request->primary : request;
+    if (owner->first_byte || owner->prewarm) {
+        return;
+    }
+    
+    owner->first_byte = true;
+    histogram_record(&stats.first_byte, event_now_us() - owner->sent_us);
+    if (owner->hedge_timer != NULL) {
+        event_loop_set_timer(event_loop, owner->hedge_timer, 0, 0);
+    }
+}
+
+/**
+ * @brief Callback function for libcurl to handle API response data
+ */
+static size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    size_t real_size = size * nmemb;
+    ApiRequest *request = (ApiRequest *)userdata;
+    
+    // Only a successful response to a streamed request is an SSE stream;
+    // errors come back as one JSON document
+    if (!request->body_checked) {
+        long http_code = 0;
+        curl_easy_getinfo(request->easy, CURLINFO_RESPONSE_CODE, &http_code);
+        request->streaming = request->stream_requested && http_code == 200 &&
+                             real_size > 0 && ptr[0] != '{';
+        request->body_checked = true;
+        note_first_byte(request);
+    }
+    
+    // A pre-warm only wanted the connection
+    if (request->arena == NULL) {
+        return real_size;
+    }
+    
+    if (!buffer_append(request->arena, &request->response_data, ptr, real_size)) {
+        return 0; // This will cause curl to report an error
+    }
+    if (!request->streaming) {
+        return real_size;
+    }
+    
+    // Handle every complete line; the partial last line stays buffered
+    ResponseData *line = &request->response_data;
+    size_t start = 0;
+    char *newline;
+    while ((newline = memchr(line->data + start, '\n', line->size - start)) != NULL) {
+        *newline = '\0';
+        if (newline > line->data + start && newline[-1] == '\r') {
+            newline[-1] = '\0';
+        }
+        
+        char *text = line->data + start;
+        start = (size_t)(newline - line->data) + 1;
+        if (strncmp(text, "data:", 5) != 0) {
+            continue; // Blank separators, comments and other fields
+        }
+        
+        text += 5;
+        if (*text == ' ') {
+            text++;
+        }
+        if (!handle_event(request, text)) {
+            return 0; // Done (or failed): abort the transfer
+        }
+    }
+    
+    memmove(line->data, line->data + start, line->size - start);
+    line->size -= start;
+    line->data[line->size] = '\0';
     
     return real_size;
 }
 
+/**
+ * @brief Open the response cache
+ * 
+ * Answers depend on the backend, the endpoint and the rest of the request
+ * body (model, system prompt, parameters); their hash goes into every key.
+ * AISH works without the cache if it cannot be opened, and without the
+ * similarity index.
+ */
+static void open_cache(const Config *config) {
+    char *path = statedir_path(RESPONSE_CACHE_NAME);
+    int64_t ttl_s = (config->cache_ttl_s > 0) ? config->cache_ttl_s : 0;
+    // Both limits are positive: config_load() replaces others with the defaults
+    uint64_t max_bytes = (uint64_t)config->cache_max_kb * 1024;
+    uint32_t max_entries = (uint32_t)config->cache_max_entries;
+    
+    cache_enabled = path != NULL && respcache_open(&response_cache, path, ttl_s, max_bytes, max_entries);
+    free(path);
+    if (!cache_enabled) {
+        fprintf(stderr, "Warning: The response cache could not be opened, answers will not be cached\n");
+        return;
+    }
+    
+    const char *parts[] = { backend->name, api_url, request_template.prefix, request_template.suffix };
+    cache_context = 0;
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        cache_context = cache_context * 31 + respcache_hash(parts[i], strlen(parts[i]) + 1);
+    }
+    
+    if (config->cache_similarity > 0.0) {
+        path = statedir_path(SIMILAR_INDEX_NAME);
+        similar_enabled = path != NULL && simindex_open(&similar_index, path, max_entries);
+        free(path);
+        if (!similar_enabled) {
+            fprintf(stderr, "Warning: The similarity index could not be opened, only exact repeats are cached\n");
+        }
+        similar_threshold = (config->cache_similarity < 1.0) ? config->cache_similarity : 1.0;
+    }
+}
+
+/**
+ * @brief Build the cache key of a query
+ * 
+ * The key is the context hash, the scope and the query with its spacing
+ * normalized: leading and trailing blanks dropped, runs of blanks made
+ * one space, and trailing '.', '?' and '!' removed.
+ * 
+ * @param arena Where the key is allocated
+ * @param user_input The query
+ * @param scope Extra key text, may be NULL
+ * @param len Set to the length of the key
+ * @param query Set to the offset of the query in the key; what comes
+ *              before is the same for all the queries it may be matched with
+ * @return The key, or NULL if out of memory
+ */
+static char *cache_key(Arena *arena, const char *user_input, const char *scope, size_t *len,
+                       size_t *query) {
+    if (scope == NULL) {
+        scope = "";
+    }
+    size_t size = 16 + 1 + strlen(scope) + 1 + strlen(user_input) + 1;
+    char *key = (char *)arena_alloc(arena, size);
+    if (key == NULL) {
+        return NULL;
+    }
+    
+    size_t pos = (size_t)snprintf(key, size, "%016llx\n%s\n", (unsigned long long)cache_context, scope);
+    size_t start = pos;
+    bool blank = false;
+    for (const char *p = user_input; *p != '\0'; p++) {
+        if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+            blank = pos > start;
+            continue;
+        }
+        if (blank) {
+            key[pos++] = ' ';
+            blank = false;
+        }
+        key[pos++] = *p;
+    }
+    while (pos > start && (key[pos - 1] == '.' || key[pos - 1] == '?' || key[pos - 1] == '!')) {
+        pos--;
+    }
+    key[pos] = '\0';
+    
+    *len = pos;
+    *query = start;
+    return key;
+}
+
 bool api_init(const Config *config) {
-    if (config == NULL || config->openai_api_key == NULL) {
-        fprintf(stderr, "Error: Invalid configuration or missing API key\n");
+    if (config == NULL) {
+        fprintf(stderr, "Error: Invalid configuration\n");
+        return false;
+    }
+    
+    backend = backend_get(config->backend);
+    if (backend->needs_api_key && config->openai_api_key == NULL) {
+        fprintf(stderr, "Error: The %s backend needs an API key\n", backend->name);
+        return false;
+    }
+    
+    if (!backend->build_template(config, &request_template)) {
+        return false;
+    }
+    
+    api_url = backend_url(config);
+    if (api_url == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for the API URL\n");
         return false;
     }
+    if (config->unix_socket != NULL) {
+        unix_socket = strdup(config->unix_socket);
+        if (unix_socket == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for the API URL\n");
+            return false;
+        }
+    }
+    
+    if (config->cache) {
+        open_cache(config);
+    }
     
     // Initialize libcurl
     curl_global_init(CURL_GLOBAL_DEFAULT);
-    curl_handle = curl_easy_init();
-    if (curl_handle == NULL) {
+    multi_handle = curl_multi_init();
+    if (multi_handle == NULL) {
         fprintf(stderr, "Error: Failed to initialize libcurl\n");
         return false;
     }
     
+    // DNS results and TLS sessions are shared by all transfers and saved
+    // across launches
+    share_handle = curl_share_init();
+    if (share_handle == NULL) {
+        fprintf(stderr, "Error: Failed to initialize libcurl\n");
+        return false;
+    }
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    if (!netcache_load(&net_cache, share_handle)) {
+        fprintf(stderr, "Error: Memory allocation failed for the network cache\n");
+        return false;
+    }
+    
     // Set up headers
     headers = curl_slist_append(NULL, "Content-Type: application/json");
     
-    // Create Authorization header with API key
-    char auth_header[1024];
-    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", config->openai_api_key);
-    headers = curl_slist_append(headers, auth_header);
+    // Create Authorization header with API key (local servers may not need one)
+    if (config->openai_api_key != NULL) {
+        char auth_header[1024];
+        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", config->openai_api_key);
+        headers = curl_slist_append(headers, auth_header);
+    }
     
     return true;
 }
 
-bool api_send_request(const char *user_input, const Config *config, ApiResponse *response) {
-    if (curl_handle == NULL || user_input == NULL || config == NULL || response == NULL) {
+/**
+ * @brief Extract the command from a finished transfer
+ * 
+ * @param result Outcome of the transfer
+ * @param http_code HTTP status of the response
+ * @param body Response body (decoded in place)
+ * @param arena Where the command and error strings are allocated
+ * @param response Pointer to ApiResponse structure to populate
+ * @return true if a command was extracted, false otherwise (response->error is set)
+ */
+static bool parse_response(CURLcode result, long http_code, ResponseData *body, Arena *arena,
+                           ApiResponse *response) {
+    // Check for errors
+    if (result != CURLE_OK) {
+        response->error = arena_strdup(arena, curl_easy_strerror(result));
         return false;
     }
     
-    // Initialize response structure
-    response->command = NULL;
-    response->is_valid = false;
-    response->error = NULL;
-    
-    // Create JSON request body
-    struct json_object *request_obj = json_object_new_object();
-    struct json_object *messages_array = json_object_new_array();
-    
-    // Add system message
-    struct json_object *system_msg = json_object_new_object();
-    json_object_object_add(system_msg, "role", json_object_new_string("system"));
-    json_object_object_add(system_msg, "content", 
-                          json_object_new_string("You are a CLI assistant that translates natural language to valid Bash commands. Always return structured JSON output with a 'command' field containing the bash command. Example: {\"command\": \"ls -la\"}"));
-    json_object_array_add(messages_array, system_msg);
-    
-    // Add user message
-    struct json_object *user_msg = json_object_new_object();
-    json_object_object_add(user_msg, "role", json_object_new_string("user"));
-    json_object_object_add(user_msg, "content", json_object_new_string(user_input));
-    json_object_array_add(messages_array, user_msg);
-    
-    // Add messages array to request
-    json_object_object_add(request_obj, "messages", messages_array);
-    
-    // Add model
-    json_object_object_add(request_obj, "model", json_object_new_string(config->openai_model));
-    
-    // Add temperature
-    json_object_object_add(request_obj, "temperature", json_object_new_double(config->temperature));
-    
-    // Add max_tokens
-    json_object_object_add(request_obj, "max_tokens", json_object_new_int(config->max_tokens));
-    
-    // Add response format
-    struct json_object *response_format = json_object_new_object();
-    json_object_object_add(response_format, "type", json_object_new_string("json_object"));
-    json_object_object_add(request_obj, "response_format", response_format);
-    
-    // Convert JSON object to string
-    const char *request_str = json_object_to_json_string(request_obj);
-    
-    // Set up curl request
-    curl_easy_setopt(curl_handle, CURLOPT_URL, OPENAI_API_URL);
-    curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, USER_AGENT);
-    curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, request_str);
-    curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, 30L); // 30 second timeout
-    
-    // Set up response handling
-    ResponseData response_data;
-    response_data.data = (char *)malloc(4096); // Initial 4KB buffer
-    if (response_data.data == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed for API response\n");
-        json_object_put(request_obj);
+    // Check HTTP response code
+    if (http_code != 200) {
+        response->error = (char *)arena_alloc(arena, 100);
+        if (response->error != NULL) {
+            snprintf(response->error, 100, "HTTP error %ld", http_code);
+        }
         return false;
     }
     
-    response_data.size = 0;
-    response_data.capacity = 4096;
-    response_data.data[0] = '\0';
+    return backend->parse_response(body->data, body->size, arena, response);
+}
+
+/**
+ * @brief Take an arena for a new request
+ * 
+ * Arenas of finished requests are reused; a new one starts as large as
+ * the most memory a request has needed so far.
+ * 
+ * @return The arena, or NULL if out of memory
+ */
+static Arena *acquire_arena(void) {
+    Arena *arena = spare_arenas;
+    if (arena != NULL) {
+        spare_arenas = arena->next;
+        arena->next = NULL;
+        return arena;
+    }
     
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &response_data);
+    arena = (Arena *)malloc(sizeof(Arena));
+    if (arena == NULL || !arena_init(arena, (size_t)stats.arena_peak)) {
+        free(arena);
+        return NULL;
+    }
+    stats.arenas++;
+    return arena;
+}
+
+/**
+ * @brief Reset a request's arena and keep it for the next request
+ */
+static void release_arena(Arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
     
-    // Perform the request
-    CURLcode res = curl_easy_perform(curl_handle);
+    if (arena->used > stats.arena_peak) {
+        stats.arena_peak = arena->used;
+    }
+    arena_reset(arena);
+    arena->next = spare_arenas;
+    spare_arenas = arena;
+}
+
+/**
+ * @brief Take a zeroed request with an easy handle for a new transfer
+ * 
+ * Finished requests are reused with their easy handles, reset to the
+ * defaults, so a request costs neither an allocation nor curl_easy_init()
+ * once a few have run.
+ * 
+ * @return The request, or NULL if out of memory
+ */
+static ApiRequest *acquire_request(void) {
+    ApiRequest *request = spare_requests;
+    CURL *easy = NULL;
+    if (request != NULL) {
+        spare_requests = request->next;
+        spare_request_count--;
+        easy = request->easy;
+    } else {
+        request = (ApiRequest *)malloc(sizeof(ApiRequest));
+        if (request == NULL) {
+            return NULL;
+        }
+    }
+    memset(request, 0, sizeof(ApiRequest));
     
-    // Clean up request object
-    json_object_put(request_obj);
+    if (easy == NULL && spare_easy != NULL) {
+        easy = spare_easy;
+        spare_easy = NULL;
+    }
+    if (easy != NULL) {
+        curl_easy_reset(easy);
+    } else {
+        easy = curl_easy_init();
+    }
+    if (easy == NULL) {
+        free(request);
+        return NULL;
+    }
     
-    // Check for errors
-    if (res != CURLE_OK) {
-        fprintf(stderr, "Error: API request failed: %s\n", curl_easy_strerror(res));
-        response->error = strdup(curl_easy_strerror(res));
-        free(response_data.data);
-        return false;
+    request->easy = easy;
+    return request;
+}
+
+/**
+ * @brief Release a request's arena and keep the request for the next one
+ * 
+ * The request must be out of the list of requests in flight (or never in
+ * it) and its easy handle out of the multi handle.
+ */
+static void recycle_request(ApiRequest *request) {
+    release_arena(request->arena);
+    request->arena = NULL;
+    
+    if (spare_request_count < MAX_SPARE_REQUESTS) {
+        request->next = spare_requests;
+        spare_requests = request;
+        spare_request_count++;
+        return;
+    }
+    if (request->easy != NULL) {
+        curl_easy_cleanup(request->easy);
+    }
+    free(request);
+}
+
+/**
+ * @brief Keep an easy handle that is done with its transfer for a later one
+ */
+static void release_easy(CURL *easy) {
+    curl_multi_remove_handle(multi_handle, easy);
+    if (spare_easy == NULL) {
+        spare_easy = easy;
+    } else {
+        curl_easy_cleanup(easy);
+    }
+}
+
+/**
+ * @brief Unlink a request and release everything it holds
+ */
+static void free_request(ApiRequest *request) {
+    // A request takes its hedge with it; a hedge lets go of its request
+    if (request->hedge != NULL) {
+        free_request(request->hedge);
+    }
+    if (request->primary != NULL) {
+        request->primary->hedge = NULL;
+        if (request->primary->leader == request) {
+            request->primary->leader = NULL;
+        }
+    }
+    if (request->hedge_timer != NULL) {
+        event_loop_remove(event_loop, request->hedge_timer);
     }
     
-    // Get HTTP response code
-    long http_code = 0;
-    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_code);
+    if (request->easy != NULL) {
+        curl_multi_remove_handle(multi_handle, request->easy);
+    }
     
-    // Check HTTP response code
-    if (http_code != 200) {
-        fprintf(stderr, "Error: API returned HTTP code %ld\n", http_code);
-        response->error = (char *)malloc(100);
-        if (response->error != NULL) {
-            snprintf(response->error, 100, "HTTP error %ld", http_code);
+    if (request->prev != NULL) {
+        request->prev->next = request->next;
+    } else {
+        requests = request->next;
+    }
+    if (request->next != NULL) {
+        request->next->prev = request->prev;
+    }
+    
+    if (request == prewarm_request) {
+        prewarm_request = NULL;
+    }
+    
+    if (request->response_data.capacity > response_high_water) {
+        response_high_water = request->response_data.capacity;
+    }
+    recycle_request(request);
+}
+
+/**
+ * @brief Stop a request's own transfer while its hedge carries on
+ * 
+ * The request stays allocated (and in the list) because the caller still
+ * holds it; it is freed when the hedge finishes or it is cancelled.
+ */
+static void retire_transfer(ApiRequest *request) {
+    release_easy(request->easy);
+    request->easy = NULL;
+    if (request->leader == request) {
+        request->leader = NULL;
+    }
+}
+
+/**
+ * @brief Account for the connection a finished transfer used
+ * 
+ * @return false if the transfer was a pre-warm, true otherwise
+ */
+static bool note_connection(ApiRequest *request, CURLcode result) {
+    long connects = 0;
+    curl_off_t connect_us = 0;
+    curl_off_t app_connect_us = 0;
+    
+    curl_easy_getinfo(request->easy, CURLINFO_NUM_CONNECTS, &connects);
+    if (connects > 0) {
+        // TCP connect (and TLS handshake for https) this transfer waited for
+        curl_easy_getinfo(request->easy, CURLINFO_CONNECT_TIME_T, &connect_us);
+        curl_easy_getinfo(request->easy, CURLINFO_APPCONNECT_TIME_T, &app_connect_us);
+        last_setup_us = (uint64_t)(app_connect_us > connect_us ? app_connect_us : connect_us);
+        
+        // Keep the address and TLS session for the next launch (over a Unix
+        // socket the "address" is the socket path); the file is written
+        // once idle, not before the answer is shown
+        char *url = NULL;
+        char *address = NULL;
+        curl_easy_getinfo(request->easy, CURLINFO_EFFECTIVE_URL, &url);
+        curl_easy_getinfo(request->easy, CURLINFO_PRIMARY_IP, &address);
+        if (unix_socket == NULL) {
+            netcache_note_address(&net_cache, url, address);
         }
-        free(response_data.data);
-        return false;
+        net_cache_dirty = true;
+    } else if (result == CURLE_COULDNT_CONNECT && unix_socket == NULL) {
+        // A saved address may be out of date: resolve from now on
+        netcache_forget_addresses(&net_cache);
+        net_cache_dirty = true;
+    }
+    if (net_cache_dirty) {
+        event_loop_set_timer(event_loop, idle_source, IDLE_WORK_MS, 0);
     }
     
-    // Parse JSON response
-    struct json_object *json_response = json_tokener_parse(response_data.data);
-    if (json_response == NULL) {
-        fprintf(stderr, "Error: Failed to parse API response as JSON\n");
-        response->error = strdup("Failed to parse API response");
-        free(response_data.data);
+    if (request->prewarm) {
+        // Only credit connections the pre-warm actually opened
+        if (connects > 0) {
+            prewarmed = true;
+        }
         return false;
     }
     
-    // Extract command from response
-    struct json_object *choices_array;
-    if (!json_object_object_get_ex(json_response, "choices", &choices_array) ||
-        json_object_get_type(choices_array) != json_type_array ||
-        json_object_array_length(choices_array) == 0) {
+    stats.requests++;
+    if (connects == 0 && prewarmed) {
+        stats.warm_requests++;
+        stats.saved_us += last_setup_us;
+    }
+    prewarmed = false;
+    return true;
+}
+
+/**
+ * @brief Event loop callback for the idle timer
+ * 
+ * Saves the network cache and runs the response cache's evictions and
+ * compactions. Put off while a request is in flight; upkeep is also put
+ * off while another process holds the cache's lock.
+ */
+static void idle_ready(int fd, uint32_t events, void *userdata) {
+    (void)fd;
+    (void)events;
+    (void)userdata;
+    
+    if (requests != NULL) {
+        event_loop_set_timer(event_loop, idle_source, IDLE_WORK_MS, 0);
+        return;
+    }
+    
+    if (net_cache_dirty) {
+        netcache_save(&net_cache, share_handle);
+        net_cache_dirty = false;
+    }
+    if (cache_enabled && respcache_needs_upkeep(&response_cache) && !respcache_upkeep(&response_cache)) {
+        event_loop_set_timer(event_loop, idle_source, IDLE_WORK_MS, 0);
+    }
+}
+
+/**
+ * @brief Cache an answer, and index its query by similarity
+ * 
+ * Never waits for another process: the answer is not cached if one is
+ * changing the cache. Evictions and compactions are left to the idle
+ * timer, off the path of the answer.
+ * 
+ * @param key Cache key of the query
+ * @param key_len Length of the key
+ * @param query Offset of the query in the key
+ * @param command The answer
+ */
+static void store_answer(const char *key, size_t key_len, size_t query, const char *command) {
+    uint8_t signature[SIMINDEX_HASHES];
+    
+    if (!respcache_put(&response_cache, key, key_len, command, strlen(command))) {
+        return;
+    }
+    stats.cache_stores++;
+    if (respcache_needs_upkeep(&response_cache)) {
+        event_loop_set_timer(event_loop, idle_source, IDLE_WORK_MS, 0);
+    }
+    
+    if (similar_enabled && simindex_signature(key + query, key_len - query, signature)) {
+        simindex_add(&similar_index, respcache_hash(key, query), respcache_hash(key, key_len), signature);
+    }
+}
+
+/**
+ * @brief Hand every finished transfer to its callback
+ */
+static void check_finished(void) {
+    CURLMsg *msg;
+    int pending;
+    
+    while ((msg = curl_multi_info_read(multi_handle, &pending)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+        
+        ApiRequest *request = NULL;
+        long http_code = 0;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&request);
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &http_code);
+        
+        if (!note_connection(request, msg->data.result)) {
+            // A pre-warm has no callback; its connection stays in curl's cache
+            free_request(request);
+            continue;
+        }
+        
+        // The response's strings are carved from the request's arena
+        ApiResponse response;
+        response.command = NULL;
+        response.is_valid = false;
+        response.error = NULL;
+        uint64_t parse_start_us = event_now_us();
+        bool success;
+        if (request->scanner.state == SCAN_DONE) {
+            // Cut off on purpose once the command was complete
+            response.command = arena_strndup(request->arena, request->scanner.command.data != NULL ?
+                                             request->scanner.command.data : "",
+                                             request->scanner.command.size);
+            response.is_valid = api_validate_command(response.command);
+            success = true;
+        } else if (request->streaming && msg->data.result == CURLE_OK) {
+            // The stream ended without a "command" string: use the content as is
+            char empty[] = "";
+            backend_extract_command(request->content.data != NULL ? request->content.data : empty,
+                                    request->content.size, request->arena, &response);
+            success = true;
+        } else {
+            success = parse_response(msg->data.result, http_code, &request->response_data,
+                                     request->arena, &response);
+        }
+        request->parse_us += event_now_us() - parse_start_us;
+        
+        // With a hedge, the first valid answer wins; a failure only counts
+        // once the other transfer has failed too
+        ApiRequest *owner = (request->primary != NULL) ? request->primary : request;
+        bool other_running = (request == owner) ? owner->hedge != NULL : owner->easy != NULL;
+        if (other_running && !(success && response.is_valid)) {
+            if (request == owner) {
+                retire_transfer(request);
+            } else {
+                free_request(request);
+            }
+            continue;
+        }
+        
+        histogram_record(&stats.latency, event_now_us() - owner->sent_us);
+        histogram_record(&stats.parse, request->parse_us);
+        if (request != owner) {
+            stats.hedge_wins++;
+        }
+        
+        // The answer is cached once the callback has run, so the command
+        // never waits for an eviction or compaction; the key moves to the
+        // winner's arena if the owner's is about to go
+        char *key = NULL;
+        size_t key_len = owner->cache_key_len;
+        size_t query = owner->cache_query;
+        if (success && response.is_valid && owner->cache_key != NULL) {
+            key = (request == owner) ? owner->cache_key : arena_strndup(request->arena, owner->cache_key, key_len);
+        }
         
-        fprintf(stderr, "Error: Invalid API response format (missing choices array)\n");
-        response->error = strdup("Invalid API response format");
-        json_object_put(json_response);
-        free(response_data.data);
+        // The callback may start another request; this one is gone by then,
+        // but the arena holding the response is only reset afterwards
+        ApiCallback callback = owner->callback;
+        void *userdata = owner->userdata;
+        Arena *arena = request->arena;
+        request->arena = NULL;
+        free_request(owner);
+        
+        callback(&response, success, userdata);
+        if (key != NULL) {
+            store_answer(key, key_len, query, response.command);
+        }
+        release_arena(arena);
+    }
+}
+
+/**
+ * @brief Event loop callback for activity on one of curl's sockets
+ */
+static void socket_ready(int fd, uint32_t events, void *userdata) {
+    (void)userdata;
+    int flags = 0;
+    int running;
+    
+    if (events & EVENT_READ) {
+        flags |= CURL_CSELECT_IN;
+    }
+    if (events & EVENT_WRITE) {
+        flags |= CURL_CSELECT_OUT;
+    }
+    if (events & EVENT_ERROR) {
+        flags |= CURL_CSELECT_ERR;
+    }
+    
+    curl_multi_socket_action(multi_handle, fd, flags, &running);
+    check_finished();
+}
+
+/**
+ * @brief Event loop callback for curl's timeout
+ */
+static void timer_ready(int fd, uint32_t events, void *userdata) {
+    (void)fd;
+    (void)events;
+    (void)userdata;
+    int running;
+    
+    curl_multi_socket_action(multi_handle, CURL_SOCKET_TIMEOUT, 0, &running);
+    check_finished();
+}
+
+/**
+ * @brief Called by curl to say which sockets to wait on
+ */
+static int socket_callback(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp) {
+    (void)easy;
+    (void)userp;
+    EventSource *source = (EventSource *)socketp;
+    
+    if (what == CURL_POLL_REMOVE) {
+        event_loop_remove(event_loop, source);
+        return 0;
+    }
+    
+    // Level-triggered: curl does not promise to read a socket dry
+    uint32_t events = EVENT_LEVEL;
+    if (what & CURL_POLL_IN) {
+        events |= EVENT_READ;
+    }
+    if (what & CURL_POLL_OUT) {
+        events |= EVENT_WRITE;
+    }
+    
+    if (source == NULL) {
+        source = event_loop_add_fd(event_loop, fd, events, socket_ready, NULL);
+        if (source == NULL) {
+            return -1;
+        }
+        curl_multi_assign(multi_handle, fd, source);
+    } else if (!event_loop_modify_fd(event_loop, source, events)) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Called by curl to (re)arm its single timeout
+ */
+static int timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    (void)multi;
+    (void)userp;
+    
+    // A zero delay would disarm the timer; 1 ms is as good as immediate
+    uint64_t delay = (timeout_ms < 0) ? 0 : (timeout_ms == 0) ? 1 : (uint64_t)timeout_ms;
+    return event_loop_set_timer(event_loop, timer_source, delay, 0) ? 0 : -1;
+}
+
+bool api_set_event_loop(EventLoop *loop) {
+    if (multi_handle == NULL || loop == NULL) {
         return false;
     }
     
-    struct json_object *first_choice = json_object_array_get_idx(choices_array, 0);
-    struct json_object *message_obj;
-    if (!json_object_object_get_ex(first_choice, "message", &message_obj)) {
-        fprintf(stderr, "Error: Invalid API response format (missing message)\n");
-        response->error = strdup("Invalid API response format");
-        json_object_put(json_response);
-        free(response_data.data);
+    event_loop = loop;
+    timer_source = event_loop_add_timer(loop, 0, 0, timer_ready, NULL);
+    if (timer_source == NULL) {
+        return false;
+    }
+    idle_source = event_loop_add_timer(loop, 0, 0, idle_ready, NULL);
+    if (idle_source == NULL) {
         return false;
     }
     
-    struct json_object *content_obj;
-    if (!json_object_object_get_ex(message_obj, "content", &content_obj)) {
-        fprintf(stderr, "Error: Invalid API response format (missing content)\n");
-        response->error = strdup("Invalid API response format");
-        json_object_put(json_response);
-        free(response_data.data);
+    curl_multi_setopt(multi_handle, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(multi_handle, CURLMOPT_TIMERFUNCTION, timer_callback);
+    return true;
+}
+
+/**
+ * @brief Set the options shared by every transfer and hand it to curl
+ * 
+ * The request is freed if it cannot be started.
+ * 
+ * @param request Request with its easy handle created
+ * @return true if successful, false otherwise
+ */
+static bool start_request(ApiRequest *request) {
+    curl_easy_setopt(request->easy, CURLOPT_URL, api_url);
+    curl_easy_setopt(request->easy, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(request->easy, CURLOPT_USERAGENT, USER_AGENT);
+    curl_easy_setopt(request->easy, CURLOPT_TIMEOUT, 30L); // 30 second timeout
+    curl_easy_setopt(request->easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(request->easy, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(request->easy, CURLOPT_WRITEDATA, request);
+    curl_easy_setopt(request->easy, CURLOPT_PRIVATE, request);
+    curl_easy_setopt(request->easy, CURLOPT_SHARE, share_handle);
+    
+    // A Unix socket replaces name resolution altogether
+    if (unix_socket != NULL) {
+        curl_easy_setopt(request->easy, CURLOPT_UNIX_SOCKET_PATH, unix_socket);
+    } else {
+        curl_easy_setopt(request->easy, CURLOPT_RESOLVE, netcache_resolve(&net_cache));
+    }
+    
+    // Keep connections usable across the pauses of someone typing
+    curl_easy_setopt(request->easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(request->easy, CURLOPT_TCP_KEEPIDLE, KEEPALIVE_IDLE_S);
+    curl_easy_setopt(request->easy, CURLOPT_TCP_KEEPINTVL, KEEPALIVE_INTERVAL_S);
+    curl_easy_setopt(request->easy, CURLOPT_MAXAGE_CONN, MAX_CONNECTION_AGE_S);
+    
+    // Link it in before curl can call back into check_finished()
+    request->next = requests;
+    if (requests != NULL) {
+        requests->prev = request;
+    }
+    requests = request;
+    
+    if (curl_multi_add_handle(multi_handle, request->easy) != CURLM_OK) {
+        fprintf(stderr, "Error: Failed to start API request\n");
+        free_request(request);
         return false;
     }
     
-    const char *content_str = json_object_get_string(content_obj);
+    return true;
+}
+
+/**
+ * @brief How long to wait for the first byte before hedging
+ * 
+ * @return Delay in milliseconds, 0 if hedging is off
+ */
+static uint64_t hedge_delay_ms(const Config *config) {
+    if (config->hedge_ms <= 0 || config->hedge_budget <= 0) {
+        return 0;
+    }
     
-    // Debug: Print the content string to see what the API is returning
-    // fprintf(stderr, "API Response Content: %s\n", content_str);
+    // Once enough requests were seen, hedge only the slowest few
+    if (config->hedge_adaptive && stats.first_byte.count >= HEDGE_MIN_SAMPLES) {
+        uint64_t delay = histogram_percentile(&stats.first_byte, HEDGE_PERCENTILE) / 1000;
+        return (delay > 0) ? delay : 1;
+    }
     
-    // Parse the content as JSON to extract the command
-    struct json_object *command_json = json_tokener_parse(content_str);
-    if (command_json != NULL) {
-        // Content is valid JSON
-        struct json_object *command_obj;
-        if (json_object_object_get_ex(command_json, "command", &command_obj)) {
-            // If the command field exists, use it
-            const char *command_str = json_object_get_string(command_obj);
-            response->command = strdup(command_str);
-        } else {
-            // If the command field doesn't exist, use the content string directly
-            fprintf(stderr, "Warning: Command field not found in API response JSON, using content directly\n");
-            response->command = strdup(content_str);
+    return (uint64_t)config->hedge_ms;
+}
+
+/**
+ * @brief Event loop callback for the hedge timer: send a duplicate request
+ */
+static void hedge_ready(int fd, uint32_t events, void *userdata) {
+    (void)fd;
+    (void)events;
+    ApiRequest *request = (ApiRequest *)userdata;
+    
+    if (request->first_byte || request->hedge != NULL || request->easy == NULL) {
+        return;
+    }
+    
+    // Hard cap on the extra spend: hedges per 100 requests sent
+    if ((stats.hedges + 1) * 100 > stats.sent * (uint64_t)request->hedge_budget) {
+        stats.hedges_skipped++;
+        return;
+    }
+    
+    ApiRequest *hedge = acquire_request();
+    if (hedge == NULL) {
+        return;
+    }
+    hedge->arena = acquire_arena();
+    hedge->body = (hedge->arena != NULL) ? arena_strndup(hedge->arena, request->body, request->body_len) : NULL;
+    if (hedge->body == NULL) {
+        recycle_request(hedge);
+        return;
+    }
+    
+    hedge->body_len = request->body_len;
+    hedge->stream_requested = request->stream_requested;
+    hedge->primary = request;
+    hedge->sent_us = event_now_us();
+    curl_easy_setopt(hedge->easy, CURLOPT_POSTFIELDSIZE, (long)hedge->body_len);
+    curl_easy_setopt(hedge->easy, CURLOPT_POSTFIELDS, hedge->body);
+    
+    request->hedge = hedge;
+    if (!start_request(hedge)) {
+        return;
+    }
+    stats.hedges++;
+}
+
+ApiRequest *api_send_request(const char *user_input, const char *scope, const Config *config,
+                             ApiCallback callback, ApiProgress progress, void *userdata) {
+    if (multi_handle == NULL || timer_source == NULL || user_input == NULL || config == NULL ||
+        callback == NULL) {
+        return NULL;
+    }
+    
+    ApiRequest *request = acquire_request();
+    if (request == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for API request\n");
+        return NULL;
+    }
+    
+    // Set up response handling, with room for the largest response seen so far
+    size_t reserve = (response_high_water > MIN_RESPONSE_BUFFER) ? response_high_water : MIN_RESPONSE_BUFFER;
+    request->arena = acquire_arena();
+    if (request->arena != NULL) {
+        request->response_data.data = (char *)arena_alloc(request->arena, reserve);
+    }
+    uint64_t build_start_us = event_now_us();
+    bool built = backend_render_request(&request_template, user_input, &request_body);
+    histogram_record(&stats.build, event_now_us() - build_start_us);
+    
+    // request_body is reused by the next request, so the body the transfer
+    // (and a hedge) sends lives in the arena
+    if (built && request->response_data.data != NULL) {
+        request->body = arena_strndup(request->arena, request_body.data, request_body.size);
+        request->body_len = request_body.size;
+    }
+    if (request->body == NULL) {
+        fprintf(stderr, "Error: Failed to set up API request\n");
+        recycle_request(request);
+        return NULL;
+    }
+    
+    request->response_data.size = 0;
+    request->response_data.capacity = reserve;
+    request->response_data.data[0] = '\0';
+    if (cache_enabled) {
+        request->cache_key = cache_key(request->arena, user_input, scope, &request->cache_key_len,
+                                       &request->cache_query);
+    }
+    request->stream_requested = config->stream;
+    request->callback = callback;
+    request->progress = progress;
+    request->userdata = userdata;
+    request->sent_us = event_now_us();
+    
+    // Set up curl request (the body is not copied again)
+    curl_easy_setopt(request->easy, CURLOPT_POSTFIELDSIZE, (long)request->body_len);
+    curl_easy_setopt(request->easy, CURLOPT_POSTFIELDS, request->body);
+    
+    // Send a duplicate if the answer has not started after the hedge delay
+    uint64_t delay_ms = hedge_delay_ms(config);
+    if (delay_ms > 0) {
+        request->hedge_budget = config->hedge_budget;
+        request->hedge_timer = event_loop_add_timer(event_loop, delay_ms, 0, hedge_ready, request);
+    }
+    
+    if (!start_request(request)) {
+        return NULL;
+    }
+    
+    stats.sent++;
+    return request;
+}
+
+bool api_cached_response(const char *user_input, const char *scope, ApiResponse *response) {
+    if (!cache_enabled || user_input == NULL || response == NULL) {
+        return false;
+    }
+    
+    // The key only lives for the lookup
+    uint64_t start_us = event_now_us();
+    Arena *arena = acquire_arena();
+    size_t key_len = 0;
+    size_t query = 0;
+    char *key = (arena != NULL) ? cache_key(arena, user_input, scope, &key_len, &query) : NULL;
+    char *command = NULL;
+    bool hit = key != NULL && respcache_get(&response_cache, key, key_len, &command, NULL);
+    release_arena(arena);
+    histogram_record(&stats.cache_lookup, event_now_us() - start_us);
+    
+    if (!hit) {
+        stats.cache_misses++;
+        return false;
+    }
+    
+    stats.cache_hits++;
+    response->command = command;
+    response->is_valid = api_validate_command(command);
+    response->error = NULL;
+    return true;
+}
+
+/**
+ * @brief Check a stored command for bytes that would act on the line editor
+ * 
+ * An offered command is put on bash's line to be reviewed: a newline would
+ * run it at once, a Tab would trigger completion, and escape sequences
+ * could rewrite what is shown.
+ */
+static bool has_control_chars(const char *text) {
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++) {
+        if (*p < 0x20 || *p == 0x7F) {
+            return true;
         }
-        json_object_put(command_json);
-    } else {
-        // Content is not valid JSON, try to extract a command from it directly
-        fprintf(stderr, "Warning: API response is not valid JSON, attempting to extract command\n");
-        
-        // For now, just use the content string directly
-        response->command = strdup(content_str);
-        
-        // TODO: Implement more sophisticated command extraction
-        // For example, look for patterns like "The command is: ls -la"
+    }
+    return false;
+}
+
+/**
+ * @brief Take the answer to a similar query from the cache
+ * 
+ * The query's answer must still be cached, valid, and for the same
+ * numbers and word order (whose changes barely show in a signature).
+ * Its text must be as similar as the threshold asks, not just its
+ * signature. Neither the command nor the question may hold control
+ * characters, since both are shown and the command goes on bash's line
+ * before anyone has read it.
+ * 
+ * @param key Key of the query looked up
+ * @param query Offset of the query in the key
+ * @param match A similar query
+ * @param response Filled in if the answer is taken
+ * @param question Set to the similar query if the answer is taken
+ * @param similarity Set to the similarity of the two queries' texts
+ * @return true if the answer was taken, false otherwise
+ */
+static bool take_similar(const char *key, size_t query, const SimIndexMatch *match, ApiResponse *response,
+                         char **question, double *similarity) {
+    char *stored_key = NULL;
+    char *command = NULL;
+    
+    if (!respcache_get_hash(&response_cache, match->key, &stored_key, &command, NULL)) {
+        simindex_remove(&similar_index, match); // Evicted from the cache
+        return false;
+    }
+    
+    size_t stored_len = strlen(stored_key);
+    bool usable = stored_len >= query && memcmp(stored_key, key, query) == 0 &&
+                  simindex_same_numbers(stored_key + query, key + query) &&
+                  simindex_same_order(stored_key + query, key + query) && api_validate_command(command) &&
+                  !has_control_chars(command) && !has_control_chars(stored_key + query);
+    if (usable) {
+        *similarity = simindex_text_similarity(stored_key + query, stored_len - query, key + query,
+                                               strlen(key + query));
+        usable = *similarity >= similar_threshold;
+    }
+    if (!usable) {
+        free(stored_key);
+        free(command);
+        return false;
+    }
+    
+    memmove(stored_key, stored_key + query, stored_len - query + 1);
+    *question = stored_key;
+    response->command = command;
+    response->is_valid = true;
+    response->error = NULL;
+    return true;
+}
+
+bool api_similar_response(const char *user_input, const char *scope, ApiResponse *response,
+                          char **question, double *similarity) {
+    if (!similar_enabled || user_input == NULL || response == NULL || question == NULL) {
+        return false;
+    }
+    
+    uint64_t start_us = event_now_us();
+    Arena *arena = acquire_arena();
+    size_t key_len = 0;
+    size_t query = 0;
+    char *key = (arena != NULL) ? cache_key(arena, user_input, scope, &key_len, &query) : NULL;
+    uint8_t signature[SIMINDEX_HASHES];
+    SimIndexMatch matches[SIMILAR_CANDIDATES];
+    size_t count = 0;
+    if (key != NULL && simindex_signature(key + query, key_len - query, signature)) {
+        count = simindex_find(&similar_index, respcache_hash(key, query), signature, similar_threshold,
+                              matches, SIMILAR_CANDIDATES);
+    }
+    
+    bool found = false;
+    double exact = 0.0;
+    for (size_t i = 0; i < count && !found; i++) {
+        found = take_similar(key, query, &matches[i], response, question, &exact);
+    }
+    if (found && similarity != NULL) {
+        *similarity = exact;
+    }
+    release_arena(arena);
+    histogram_record(&stats.similar_lookup, event_now_us() - start_us);
+    
+    if (!found) {
+        stats.similar_misses++;
+        return false;
+    }
+    stats.similar_offers++;
+    return true;
+}
+
+bool api_prewarm(const Config *config) {
+    if (multi_handle == NULL || timer_source == NULL || config == NULL) {
+        return false;
     }
     
-    // Validate the command
-    response->is_valid = api_validate_command(response->command);
+    // One is enough: it leaves a connection in curl's cache
+    if (prewarm_request != NULL) {
+        return true;
+    }
+    
+    ApiRequest *request = acquire_request();
+    if (request == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for API request\n");
+        return false;
+    }
     
-    // Clean up
-    json_object_put(json_response);
-    free(response_data.data);
+    // A HEAD request is the cheapest exchange that connects, completes the
+    // TLS handshake and returns the connection to the cache
+    request->prewarm = true;
+    curl_easy_setopt(request->easy, CURLOPT_NOBODY, 1L);
+    
+    if (!start_request(request)) {
+        return false;
+    }
     
+    prewarm_request = request;
+    stats.prewarms++;
     return true;
 }
 
+const ApiStats *api_get_stats(void) {
+    // Memory held now: spare arenas and those of requests in flight
+    stats.arena_bytes = 0;
+    for (Arena *arena = spare_arenas; arena != NULL; arena = arena->next) {
+        stats.arena_bytes += arena->held;
+    }
+    for (ApiRequest *request = requests; request != NULL; request = request->next) {
+        if (request->arena != NULL) {
+            stats.arena_bytes += request->arena->held;
+        }
+    }
+    
+    if (cache_enabled) {
+        stats.cache_entries = respcache_entries(&response_cache);
+        stats.cache_bytes = respcache_log_bytes(&response_cache, NULL);
+        stats.cache_evictions = response_cache.evictions;
+        stats.cache_compactions = response_cache.compactions;
+        stats.cache_read_retries = response_cache.read_retries;
+        stats.cache_locked_reads = response_cache.locked_reads;
+        stats.cache_recoveries = response_cache.recoveries;
+        stats.cache_busy_stores = response_cache.busy_puts;
+    }
+    if (similar_enabled) {
+        stats.similar_entries = simindex_entries(&similar_index);
+    }
+    
+    return &stats;
+}
+
+void api_cancel_request(ApiRequest *request) {
+    if (request != NULL) {
+        free_request(request);
+    }
+}
+
 bool api_validate_command(const char *command) {
     if (command == NULL) {
         return false;
@@ -319,16 +1528,76 @@ void api_free_response(ApiResponse *response) {
 }
 
 void api_cleanup(void) {
+    // Abandon requests still in flight
+    while (requests != NULL) {
+        free_request(requests);
+    }
+    while (spare_requests != NULL) {
+        ApiRequest *next = spare_requests->next;
+        curl_easy_cleanup(spare_requests->easy);
+        free(spare_requests);
+        spare_requests = next;
+    }
+    spare_request_count = 0;
+    if (spare_easy != NULL) {
+        curl_easy_cleanup(spare_easy);
+        spare_easy = NULL;
+    }
+    while (spare_arenas != NULL) {
+        Arena *next = spare_arenas->next;
+        arena_free(spare_arenas);
+        free(spare_arenas);
+        spare_arenas = next;
+    }
+    
     // Clean up curl resources
+    if (multi_handle != NULL) {
+        curl_multi_cleanup(multi_handle);
+        multi_handle = NULL;
+    }
+    
     if (headers != NULL) {
         curl_slist_free_all(headers);
         headers = NULL;
     }
     
-    if (curl_handle != NULL) {
-        curl_easy_cleanup(curl_handle);
-        curl_handle = NULL;
+    // The share outlives every easy handle that used it
+    if (share_handle != NULL) {
+        netcache_save(&net_cache, share_handle);
+        curl_share_cleanup(share_handle);
+        share_handle = NULL;
+    }
+    netcache_free(&net_cache);
+    
+    if (cache_enabled) {
+        // Upkeep the timer had not got to yet
+        if (respcache_needs_upkeep(&response_cache)) {
+            respcache_upkeep(&response_cache);
+        }
+        respcache_close(&response_cache);
+        cache_enabled = false;
+    }
+    if (similar_enabled) {
+        simindex_close(&similar_index);
+        similar_enabled = false;
+    }
+    
+    backend_free_template(&request_template);
+    backend_free_buffer(&request_body);
+    free(api_url);
+    api_url = NULL;
+    free(unix_socket);
+    unix_socket = NULL;
+    
+    if (idle_source != NULL) {
+        event_loop_remove(event_loop, idle_source);
+        idle_source = NULL;
+    }
+    if (timer_source != NULL) {
+        event_loop_remove(event_loop, timer_source);
+        timer_source = NULL;
     }
+    event_loop = NULL;
     
     curl_global_cleanup();
 }
@@ -1,13 +1,21 @@
 /**
  * @file api.h
  * @brief OpenAI API integration for AISH (AI Shell)
+ * 
+ * Requests run on the curl multi interface: curl's sockets and timeout are
+ * registered with the AISH event loop, so a request in flight never blocks
+ * keystrokes or bash output, and its result arrives through a callback.
  */
 
 #ifndef API_H
 #define API_H
 
 #include "config.h"
+#include "event.h"
+#include "histogram.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /**
  * @struct ApiResponse
@@ -19,6 +27,44 @@ typedef struct {
     char *error;        /**< Error message if any */
 } ApiResponse;
 
+/**
+ * @struct ApiStats
+ * @brief Request counters and latencies for the session
+ */
+typedef struct {
+    uint64_t sent;           /**< Requests sent (not counting hedges) */
+    uint64_t requests;       /**< Transfers finished, hedges included */
+    uint64_t warm_requests;  /**< Requests that reused a pre-warmed connection */
+    uint64_t prewarms;       /**< Pre-warms started */
+    uint64_t saved_us;       /**< Connection setup time those requests did not wait for */
+    uint64_t hedges;         /**< Duplicate requests sent */
+    uint64_t hedge_wins;     /**< Requests answered by their duplicate */
+    uint64_t hedges_skipped; /**< Duplicates not sent because of the budget */
+    uint64_t arenas;         /**< Request arenas created (as many as requests were ever in flight at once) */
+    uint64_t arena_bytes;    /**< Memory the arenas hold now, in bytes */
+    uint64_t arena_peak;     /**< Most arena memory one request used, in bytes */
+    uint64_t cache_hits;     /**< Queries answered from the response cache */
+    uint64_t cache_misses;   /**< Cache lookups that found nothing */
+    uint64_t cache_stores;   /**< Answers added to the cache */
+    uint64_t cache_evictions; /**< Entries evicted by this process */
+    uint64_t cache_compactions; /**< Cache log compactions done by this process */
+    uint64_t cache_read_retries; /**< Lock-free cache lookups retried after another process's change */
+    uint64_t cache_locked_reads; /**< Cache lookups that waited for the lock */
+    uint64_t cache_recoveries; /**< Cache tables repaired after a process died changing them */
+    uint64_t cache_busy_stores; /**< Answers not cached because another process held the lock */
+    uint64_t cache_entries;  /**< Entries in the cache */
+    uint64_t cache_bytes;    /**< Size of the cache log, in bytes */
+    Histogram cache_lookup;  /**< Time of a cache lookup, in microseconds */
+    uint64_t similar_offers; /**< Answers to similar queries offered */
+    uint64_t similar_misses; /**< Similarity lookups that found nothing usable */
+    uint64_t similar_entries; /**< Queries in the similarity index */
+    Histogram similar_lookup; /**< Time of a similarity lookup, in microseconds */
+    Histogram build;         /**< Time to build a request body, in microseconds */
+    Histogram first_byte;    /**< Request sent to first byte of the answer, in microseconds */
+    Histogram parse;         /**< Time spent parsing an answer (all of its stream events), in microseconds */
+    Histogram latency;       /**< Request sent to answer handed to the callback, in microseconds */
+} ApiStats;
+
 /**
  * @brief Initialize API module
  * 
@@ -28,14 +74,124 @@ typedef struct {
 bool api_init(const Config *config);
 
 /**
- * @brief Send user input to OpenAI API and get command response
+ * @brief Callback invoked when a request finishes
+ * 
+ * The response's strings live in the request's arena, which is reset when
+ * the callback returns: copy whatever must outlive it.
+ * 
+ * @param response Result of the request (error is set on failure)
+ * @param success true if a command was extracted, false otherwise
+ * @param userdata Opaque pointer given to api_send_request()
+ */
+typedef void (*ApiCallback)(ApiResponse *response, bool success, void *userdata);
+
+/**
+ * @brief Callback invoked as a streamed command arrives
+ * 
+ * @param command The command decoded so far (NUL-terminated, grows between calls)
+ * @param len Length of the command so far
+ * @param userdata Opaque pointer given to api_send_request()
+ */
+typedef void (*ApiProgress)(const char *command, size_t len, void *userdata);
+
+/**
+ * @brief A request in flight
+ */
+typedef struct ApiRequest ApiRequest;
+
+/**
+ * @brief Drive requests from an event loop
+ * 
+ * Must be called once before the first request.
+ * 
+ * @param loop Event loop that will wait on curl's sockets and timeout
+ * @return true if successful, false otherwise
+ */
+bool api_set_event_loop(EventLoop *loop);
+
+/**
+ * @brief Start sending user input to the OpenAI API
+ * 
+ * Returns immediately; the callback runs from the event loop once the
+ * request has finished, failed or timed out. With config->stream set the
+ * response is parsed as it arrives and the transfer is cut off as soon as
+ * the "command" string is complete. With config->hedge_ms set, a duplicate
+ * is sent if no answer has started after that delay (within the
+ * config->hedge_budget cap); the first valid answer wins and the other
+ * transfer is cancelled.
+ * 
+ * With the response cache on (config->cache), a valid answer is stored
+ * under the query and scope for api_cached_response().
  * 
  * @param user_input The user's natural language input
+ * @param scope Also part of the cache key (such as the working directory), may be NULL
  * @param config Pointer to Config structure with API settings
- * @param response Pointer to ApiResponse structure to populate
- * @return true if API request was successful, false otherwise
+ * @param callback Callback to run with the result
+ * @param progress Callback to run as the command streams in (may be NULL)
+ * @param userdata Opaque callback argument
+ * @return The request, or NULL if it could not be started
  */
-bool api_send_request(const char *user_input, const Config *config, ApiResponse *response);
+ApiRequest *api_send_request(const char *user_input, const char *scope, const Config *config,
+                             ApiCallback callback, ApiProgress progress, void *userdata);
+
+/**
+ * @brief Look up the answer to a query in the response cache
+ * 
+ * Queries match if they only differ in spacing and trailing punctuation,
+ * and were asked of the same backend, endpoint, model and prompt. Takes a
+ * few tens of microseconds and never touches the network.
+ * 
+ * @param user_input The user's natural language input
+ * @param scope As given to api_send_request(), may be NULL
+ * @param response Filled in on a hit; free with api_free_response()
+ * @return true on a hit, false on a miss or with the cache off
+ */
+bool api_cached_response(const char *user_input, const char *scope, ApiResponse *response);
+
+/**
+ * @brief Look up the answer to a similar query in the response cache
+ * 
+ * With config->cache_similarity set, queries whose answers are cached are
+ * also indexed by similarity (see simindex.h), and the answer of the most
+ * similar one at least that alike is returned. It answers a different
+ * question, so it should be offered rather than run. Takes tens of
+ * microseconds however many queries are cached.
+ * 
+ * @param user_input The user's natural language input
+ * @param scope As given to api_send_request(), may be NULL
+ * @param response Filled in on a hit; free with api_free_response()
+ * @param question Set to the similar query on a hit (must be freed by caller)
+ * @param similarity Set to its similarity on a hit (may be NULL)
+ * @return true on a hit, false on a miss or with the index off
+ */
+bool api_similar_response(const char *user_input, const char *scope, ApiResponse *response,
+                          char **question, double *similarity);
+
+/**
+ * @brief Open a connection to the API host ahead of a request
+ * 
+ * Starts a HEAD request in the background so that DNS, TCP and TLS setup
+ * are done while the user is still typing; the next request reuses the
+ * connection. Does nothing if a pre-warm is already in flight.
+ * 
+ * @param config Pointer to Config structure with API settings
+ * @return true if a pre-warm is in flight, false otherwise
+ */
+bool api_prewarm(const Config *config);
+
+/**
+ * @brief Get the connection reuse counters
+ * 
+ * @return Counters for the session so far
+ */
+const ApiStats *api_get_stats(void);
+
+/**
+ * @brief Abandon a request without running its callback
+ * 
+ * @param request Request returned by api_send_request() (NULL is ignored)
+ */
+void api_cancel_request(ApiRequest *request);
 
 /**
  * @brief Validate a command before execution
@@ -48,6 +204,10 @@ bool api_validate_command(const char *command);
 /**
  * @brief Free resources allocated for API response
  * 
+ * Only for a response whose strings were allocated with malloc(), such as
+ * a copy kept past the callback; responses handed to an ApiCallback are
+ * released with their request.
+ * 
  * @param response Pointer to ApiResponse structure to free
  */
 void api_free_response(ApiResponse *response);
@@ -0,0 +1,194 @@
+/**
+ * @file arena.c
+ * @brief Implementation of the request arena for AISH
+ */
+
+#include "arena.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16          // Enough for any type on the platforms AISH runs on
+#define ARENA_MIN_BLOCK 4096    // Smallest block worth a malloc()
+
+struct ArenaBlock {
+    ArenaBlock *next;   // Older block
+    size_t size;        // Bytes of storage after the header
+    size_t used;        // Bytes carved from it
+    size_t last;        // Offset of the most recent allocation
+};
+
+// Storage starts after the header, aligned like every allocation
+#define BLOCK_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define BLOCK_DATA(block) ((char *)(block) + BLOCK_HEADER)
+
+/**
+ * @brief Round a size up to the alignment of allocations
+ *
+ * @return The rounded size, or 0 if it would overflow
+ */
+static size_t align_up(size_t size) {
+    if (size > SIZE_MAX - ARENA_ALIGN) {
+        return 0;
+    }
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/**
+ * @brief Add a block of at least min_size bytes in front of the others
+ *
+ * Blocks at least double the storage held, so a request that outgrows its
+ * arena needs few of them.
+ *
+ * @return The block, or NULL if out of memory
+ */
+static ArenaBlock *add_block(Arena *arena, size_t min_size) {
+    size_t size = (min_size > arena->held) ? min_size : arena->held;
+    if (size < ARENA_MIN_BLOCK) {
+        size = ARENA_MIN_BLOCK;
+    }
+    if (size > SIZE_MAX - BLOCK_HEADER) {
+        return NULL;
+    }
+
+    ArenaBlock *block = (ArenaBlock *)malloc(BLOCK_HEADER + size);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    block->next = arena->blocks;
+    block->size = size;
+    block->used = 0;
+    block->last = 0;
+    arena->blocks = block;
+    arena->held += size;
+    return block;
+}
+
+/**
+ * @brief Count bytes handed out, keeping the peak up to date
+ */
+static void note_used(Arena *arena, size_t size) {
+    arena->used += size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+}
+
+/**
+ * @brief Free every block
+ */
+static void free_blocks(Arena *arena) {
+    while (arena->blocks != NULL) {
+        ArenaBlock *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    arena->held = 0;
+}
+
+bool arena_init(Arena *arena, size_t capacity) {
+    if (arena == NULL) {
+        return false;
+    }
+
+    arena->blocks = NULL;
+    arena->used = 0;
+    arena->peak = 0;
+    arena->held = 0;
+    arena->next = NULL;
+
+    if (add_block(arena, align_up(capacity)) == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for arena\n");
+        return false;
+    }
+
+    return true;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size_t aligned = align_up(size);
+    if (aligned == 0 && size != 0) {
+        return NULL;
+    }
+
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->size - block->used < aligned) {
+        block = add_block(arena, aligned);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    block->last = block->used;
+    block->used += aligned;
+    note_used(arena, aligned);
+    return BLOCK_DATA(block) + block->last;
+}
+
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+    if (new_size <= old_size) {
+        return ptr;
+    }
+
+    // The newest allocation can take the rest of its block
+    ArenaBlock *block = arena->blocks;
+    size_t aligned = align_up(new_size);
+    if (aligned == 0) {
+        return NULL;
+    }
+    if ((char *)ptr == BLOCK_DATA(block) + block->last && block->size - block->last >= aligned) {
+        note_used(arena, block->last + aligned - block->used);
+        block->used = block->last + aligned;
+        return ptr;
+    }
+
+    void *copy = arena_alloc(arena, new_size);
+    if (copy != NULL) {
+        memcpy(copy, ptr, old_size);
+    }
+    return copy;
+}
+
+char *arena_strndup(Arena *arena, const char *text, size_t len) {
+    char *copy = (char *)arena_alloc(arena, len + 1);
+    if (copy != NULL) {
+        memcpy(copy, text, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *text) {
+    return arena_strndup(arena, text, strlen(text));
+}
+
+void arena_reset(Arena *arena) {
+    arena->used = 0;
+    if (arena->blocks == NULL) {
+        return;
+    }
+
+    // Outgrown: one block that fits everything the arena has seen
+    if (arena->blocks->next != NULL) {
+        free_blocks(arena);
+        add_block(arena, arena->peak);
+        return;
+    }
+
+    arena->blocks->used = 0;
+    arena->blocks->last = 0;
+}
+
+void arena_free(Arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    free_blocks(arena);
+    arena->used = 0;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file arena.h
+ * @brief Bump allocator for the memory of one API request in AISH (AI Shell)
+ *
+ * Everything a request needs while it is in flight (response buffers,
+ * the decoded command, error messages) is carved from one arena and given
+ * back at once with arena_reset(). The arena keeps its storage across
+ * resets: once it has seen the largest request of a session, later ones
+ * are served without calling malloc() at all, and memory stays flat
+ * however long the session runs.
+ *
+ * Storage is a list of blocks. When a request outgrows the current block
+ * another is added; the next reset replaces them with a single block as
+ * large as the most the arena ever handed out (its peak).
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Block of arena storage
+ */
+typedef struct ArenaBlock ArenaBlock;
+
+/**
+ * @struct Arena
+ * @brief Storage that allocations are carved from until the next reset
+ */
+typedef struct Arena {
+    ArenaBlock *blocks;     /**< Blocks, the one being carved from first */
+    size_t used;            /**< Bytes handed out since the last reset */
+    size_t peak;            /**< Most bytes handed out between two resets */
+    size_t held;            /**< Bytes of storage held in blocks */
+    struct Arena *next;     /**< Link for a list of spare arenas kept by the owner */
+} Arena;
+
+/**
+ * @brief Initialize an arena
+ *
+ * @param arena Pointer to Arena structure to initialize
+ * @param capacity Size of the first block (a small default if 0)
+ * @return true if initialization was successful, false otherwise
+ */
+bool arena_init(Arena *arena, size_t capacity);
+
+/**
+ * @brief Carve memory from an arena
+ *
+ * The memory is aligned for any type and stays valid until the next
+ * reset; it cannot be freed on its own.
+ *
+ * @param arena Pointer to Arena structure
+ * @param size Number of bytes
+ * @return The memory, or NULL if out of memory
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * @brief Resize memory carved from an arena, like realloc()
+ *
+ * The most recent allocation grows in place while its block has room;
+ * anything else is copied to new memory and the old bytes are only
+ * reclaimed by the next reset.
+ *
+ * @param arena Pointer to Arena structure
+ * @param ptr Memory from arena_alloc() or arena_grow(), or NULL
+ * @param old_size Its current size
+ * @param new_size Size wanted
+ * @return The memory (ptr or a copy), or NULL if out of memory (ptr is untouched)
+ */
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * @brief Copy a string into an arena
+ *
+ * @param arena Pointer to Arena structure
+ * @param text String to copy
+ * @param len Bytes of it to copy
+ * @return NUL-terminated copy, or NULL if out of memory
+ */
+char *arena_strndup(Arena *arena, const char *text, size_t len);
+
+/**
+ * @brief Copy a NUL-terminated string into an arena
+ *
+ * @param arena Pointer to Arena structure
+ * @param text String to copy
+ * @return The copy, or NULL if out of memory
+ */
+char *arena_strdup(Arena *arena, const char *text);
+
+/**
+ * @brief Give back everything carved from an arena
+ *
+ * The storage is kept for the next allocations; if more than one block
+ * was needed, they are replaced by a single block of the arena's peak.
+ *
+ * @param arena Pointer to Arena structure
+ */
+void arena_reset(Arena *arena);
+
+/**
+ * @brief Free an arena's storage
+ *
+ * @param arena Pointer to Arena structure
+ */
+void arena_free(Arena *arena);
+
+#endif /* ARENA_H */
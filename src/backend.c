@@ -0,0 +1,329 @@
+/**
+ * @file backend.c
+ * @brief Implementation of the model backends for AISH
+ */
+
+#include "backend.h"
+#include "jscan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Include json-c header
+ * On some systems, this might be in a different location.
+ * If you get a compilation error, try changing this to match your system.
+ */
+#include <json-c/json.h>
+
+#define OPENAI_API_URL "https://api.openai.com/v1/chat/completions"
+#define DEFAULT_BASE_URL "http://localhost:8080/v1"
+#define CHAT_PATH "/chat/completions"
+#define INPUT_PLACEHOLDER "@@AISH_USER_INPUT@@"  // Stands in for the user's input in a template
+
+/**
+ * @brief Split a rendered body into a template around the input placeholder
+ */
+static bool split_template(const char *body, RequestTemplate *tmpl) {
+    static const char quoted[] = "\"" INPUT_PLACEHOLDER "\"";
+    const char *gap = strstr(body, quoted);
+    if (gap == NULL || strstr(gap + 1, quoted) != NULL) {
+        fprintf(stderr, "Error: Failed to render the request template\n");
+        return false;
+    }
+
+    // Keep the quotes around the input in the template
+    tmpl->prefix_len = (size_t)(gap - body) + 1;
+    tmpl->prefix = strndup(body, tmpl->prefix_len);
+    const char *suffix = gap + sizeof(quoted) - 2;
+    tmpl->suffix_len = strlen(suffix);
+    tmpl->suffix = strdup(suffix);
+    if (tmpl->prefix == NULL || tmpl->suffix == NULL) {
+        backend_free_template(tmpl);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Render the template of a chat-completions request body
+ *
+ * @param json_mode Ask for a JSON object answer (response_format)
+ */
+static bool build_chat_template(const Config *config, bool json_mode, RequestTemplate *tmpl) {
+    // Create JSON request body
+    struct json_object *request_obj = json_object_new_object();
+    struct json_object *messages_array = json_object_new_array();
+
+    // Add system message
+    struct json_object *system_msg = json_object_new_object();
+    json_object_object_add(system_msg, "role", json_object_new_string("system"));
+    json_object_object_add(system_msg, "content",
+                          json_object_new_string("You are a CLI assistant that translates natural language to valid Bash commands. Always return structured JSON output with a 'command' field containing the bash command. Example: {\"command\": \"ls -la\"}"));
+    json_object_array_add(messages_array, system_msg);
+
+    // Add user message
+    struct json_object *user_msg = json_object_new_object();
+    json_object_object_add(user_msg, "role", json_object_new_string("user"));
+    json_object_object_add(user_msg, "content", json_object_new_string(INPUT_PLACEHOLDER));
+    json_object_array_add(messages_array, user_msg);
+
+    // Add messages array to request
+    json_object_object_add(request_obj, "messages", messages_array);
+
+    // Add model
+    json_object_object_add(request_obj, "model", json_object_new_string(config->openai_model));
+
+    // Add temperature
+    json_object_object_add(request_obj, "temperature", json_object_new_double(config->temperature));
+
+    // Add max_tokens
+    json_object_object_add(request_obj, "max_tokens", json_object_new_int(config->max_tokens));
+
+    // Add response format (not every compatible server accepts it)
+    if (json_mode) {
+        struct json_object *response_format = json_object_new_object();
+        json_object_object_add(response_format, "type", json_object_new_string("json_object"));
+        json_object_object_add(request_obj, "response_format", response_format);
+    }
+
+    // Ask for the answer as it is generated
+    if (config->stream) {
+        json_object_object_add(request_obj, "stream", json_object_new_boolean(1));
+    }
+
+    // Convert JSON object to string and cut it at the user's input
+    bool ok = split_template(json_object_to_json_string(request_obj), tmpl);
+    json_object_put(request_obj);
+    return ok;
+}
+
+/**
+ * @brief Make sure a request buffer can hold size more bytes
+ */
+static bool reserve(RequestBuffer *buffer, size_t size) {
+    if (size < buffer->capacity) {
+        return true;
+    }
+
+    size_t capacity = (buffer->capacity > 0) ? buffer->capacity : 1024;
+    while (capacity <= size) {
+        capacity *= 2;
+    }
+    char *data = (char *)realloc(buffer->data, capacity);
+    if (data == NULL) {
+        return false;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+bool backend_render_request(const RequestTemplate *tmpl, const char *user_input, RequestBuffer *buffer) {
+    static const char hex[] = "0123456789abcdef";
+    size_t input_len = strlen(user_input);
+
+    // Every input byte takes at most six bytes escaped (\u00XX)
+    if (!reserve(buffer, tmpl->prefix_len + input_len * 6 + tmpl->suffix_len)) {
+        return false;
+    }
+
+    char *out = buffer->data;
+    memcpy(out, tmpl->prefix, tmpl->prefix_len);
+    out += tmpl->prefix_len;
+
+    const char *run = user_input;
+    for (const char *in = user_input; *in != '\0'; in++) {
+        unsigned char c = (unsigned char)*in;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        // Copy the plain bytes before this one in one go
+        memcpy(out, run, (size_t)(in - run));
+        out += in - run;
+        run = in + 1;
+
+        *out++ = '\\';
+        switch (c) {
+        case '"': *out++ = '"'; break;
+        case '\\': *out++ = '\\'; break;
+        case '\n': *out++ = 'n'; break;
+        case '\r': *out++ = 'r'; break;
+        case '\t': *out++ = 't'; break;
+        case '\b': *out++ = 'b'; break;
+        case '\f': *out++ = 'f'; break;
+        default:
+            *out++ = 'u';
+            *out++ = '0';
+            *out++ = '0';
+            *out++ = hex[c >> 4];
+            *out++ = hex[c & 0xf];
+            break;
+        }
+    }
+    size_t tail = input_len - (size_t)(run - user_input);
+    memcpy(out, run, tail);
+    out += tail;
+
+    memcpy(out, tmpl->suffix, tmpl->suffix_len + 1);
+    buffer->size = (size_t)(out - buffer->data) + tmpl->suffix_len;
+    return true;
+}
+
+void backend_free_template(RequestTemplate *tmpl) {
+    free(tmpl->prefix);
+    free(tmpl->suffix);
+    tmpl->prefix = NULL;
+    tmpl->suffix = NULL;
+    tmpl->prefix_len = 0;
+    tmpl->suffix_len = 0;
+}
+
+void backend_free_buffer(RequestBuffer *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+/**
+ * @brief Tell whether text starts like a JSON object
+ */
+static bool looks_like_object(const char *text, size_t len) {
+    size_t i = 0;
+    while (i < len && (text[i] == ' ' || text[i] == '\n' || text[i] == '\r' || text[i] == '\t')) {
+        i++;
+    }
+    return i < len && text[i] == '{';
+}
+
+void backend_extract_command(char *content, size_t len, Arena *arena, ApiResponse *response) {
+    // The content is normally JSON like {"command": "ls -la"}; the command
+    // is decoded in place, so only the copy handed back is allocated
+    char *command;
+    size_t command_len;
+    JScanValue value;
+    if (jscan_string(content, len, "command", &command, &command_len)) {
+        response->command = arena_strndup(arena, command, command_len);
+    } else if (jscan_find(content, len, "command", &value) && value.type != JSCAN_STRING) {
+        // Not a string (a number, say): use its JSON text
+        response->command = arena_strndup(arena, value.start, value.len);
+    } else if (looks_like_object(content, len)) {
+        // If the command field doesn't exist, use the content string directly
+        fprintf(stderr, "Warning: Command field not found in API response JSON, using content directly\n");
+        response->command = arena_strndup(arena, content, len);
+    } else {
+        // Content is not valid JSON, try to extract a command from it directly
+        fprintf(stderr, "Warning: API response is not valid JSON, attempting to extract command\n");
+
+        // For now, just use the content string directly
+        response->command = arena_strndup(arena, content, len);
+
+        // TODO: Implement more sophisticated command extraction
+        // For example, look for patterns like "The command is: ls -la"
+    }
+
+    // Validate the command
+    response->is_valid = api_validate_command(response->command);
+}
+
+/**
+ * @brief Extract the command from a chat-completions answer
+ *
+ * One pass over the body finds choices[0].message.content, which is
+ * decoded in place; everything else in the answer (usage, logprobs) is
+ * skipped without being parsed.
+ */
+static bool parse_chat_response(char *body, size_t len, Arena *arena, ApiResponse *response) {
+    char *content;
+    size_t content_len;
+    if (jscan_string(body, len, "choices.0.message.content", &content, &content_len)) {
+        backend_extract_command(content, content_len, arena, response);
+        return true;
+    }
+
+    // Say what is missing (only failures take the extra passes)
+    JScanValue value;
+    if (!looks_like_object(body, len)) {
+        fprintf(stderr, "Error: Failed to parse API response as JSON\n");
+        response->error = arena_strdup(arena, "Failed to parse API response");
+        return false;
+    }
+    if (!jscan_find(body, len, "choices.0", &value)) {
+        fprintf(stderr, "Error: Invalid API response format (missing choices array)\n");
+    } else if (!jscan_find(body, len, "choices.0.message", &value)) {
+        fprintf(stderr, "Error: Invalid API response format (missing message)\n");
+    } else {
+        fprintf(stderr, "Error: Invalid API response format (missing content)\n");
+    }
+    response->error = arena_strdup(arena, "Invalid API response format");
+    return false;
+}
+
+/**
+ * @brief Find the delta text of a chat-completions stream event
+ */
+static bool chat_stream_chunk(char *data, size_t len, const char **text, size_t *text_len) {
+    // Each event is a chunk like {"choices":[{"delta":{"content":"..."}}]}
+    char *content;
+    if (!jscan_string(data, len, "choices.0.delta.content", &content, text_len) || *text_len == 0) {
+        return false;
+    }
+    *text = content;
+    return true;
+}
+
+/**
+ * @brief Render the request template for api.openai.com
+ */
+static bool openai_build_template(const Config *config, RequestTemplate *tmpl) {
+    return build_chat_template(config, true, tmpl);
+}
+
+/**
+ * @brief Render the request template for an OpenAI-compatible server
+ */
+static bool compatible_build_template(const Config *config, RequestTemplate *tmpl) {
+    return build_chat_template(config, false, tmpl);
+}
+
+static const ApiBackend openai_backend = {
+    "openai",
+    true,
+    openai_build_template,
+    parse_chat_response,
+    chat_stream_chunk
+};
+
+static const ApiBackend compatible_backend = {
+    "openai-compatible",
+    false,
+    compatible_build_template,
+    parse_chat_response,
+    chat_stream_chunk
+};
+
+const ApiBackend *backend_get(ModelBackend backend) {
+    return (backend == BACKEND_OPENAI_COMPATIBLE) ? &compatible_backend : &openai_backend;
+}
+
+char *backend_url(const Config *config) {
+    if (config->backend == BACKEND_OPENAI) {
+        return strdup(OPENAI_API_URL);
+    }
+
+    // The base URL ends in the API version, like OpenAI's https://api.openai.com/v1
+    const char *base = (config->base_url != NULL) ? config->base_url : DEFAULT_BASE_URL;
+    size_t base_len = strlen(base);
+    while (base_len > 0 && base[base_len - 1] == '/') {
+        base_len--;
+    }
+
+    size_t len = base_len + strlen(CHAT_PATH) + 1;
+    char *url = (char *)malloc(len);
+    if (url != NULL) {
+        snprintf(url, len, "%.*s%s", (int)base_len, base, CHAT_PATH);
+    }
+    return url;
+}
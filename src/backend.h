@@ -0,0 +1,142 @@
+/**
+ * @file backend.h
+ * @brief Model backends for AISH (AI Shell)
+ *
+ * A backend knows the request and response shapes of one kind of model
+ * service; api.c owns the transport (curl, SSE framing, hedging) and calls
+ * through this table. The URL comes from backend_url(); a Unix socket
+ * (Config unix_socket) can carry any backend's traffic.
+ *
+ * Request bodies only differ in the user's input, so a backend renders the
+ * rest once into a RequestTemplate and each request is the template with
+ * the escaped input spliced in (backend_render_request()), written into a
+ * buffer that is reused from one request to the next.
+ */
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "api.h"
+#include "arena.h"
+#include "config.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @struct RequestTemplate
+ * @brief A request body rendered once, with a gap for the user's input
+ */
+typedef struct {
+    char *prefix;       /**< Body up to the opening quote of the user's input */
+    size_t prefix_len;  /**< Length of prefix */
+    char *suffix;       /**< Body from the closing quote on */
+    size_t suffix_len;  /**< Length of suffix */
+} RequestTemplate;
+
+/**
+ * @struct RequestBuffer
+ * @brief Buffer request bodies are rendered into, reused across requests
+ */
+typedef struct {
+    char *data;         /**< NUL-terminated body */
+    size_t size;        /**< Length of the body */
+    size_t capacity;    /**< Bytes allocated */
+} RequestBuffer;
+
+/**
+ * @struct ApiBackend
+ * @brief Operations of a model backend
+ */
+typedef struct {
+    const char *name;       /**< Name used in the configuration file */
+    bool needs_api_key;     /**< Requests are refused without an API key */
+
+    /**
+     * @brief Render the constant part of every request body
+     *
+     * @param config Configuration (model, temperature, streaming, ...)
+     * @param tmpl Filled in; free with backend_free_template()
+     * @return true if successful, false otherwise
+     */
+    bool (*build_template)(const Config *config, RequestTemplate *tmpl);
+
+    /**
+     * @brief Extract the command from a complete (non-streamed) answer
+     *
+     * @param body Response body of a successful request (decoded in place)
+     * @param len Length of the body
+     * @param arena Where the command and error strings are allocated
+     * @param response Filled in; response->error is set on failure
+     * @return true if a command was extracted, false otherwise
+     */
+    bool (*parse_response)(char *body, size_t len, Arena *arena, ApiResponse *response);
+
+    /**
+     * @brief Find the new message text in one streamed event
+     *
+     * @param data Payload of one SSE "data:" line (decoded in place)
+     * @param len Length of the payload
+     * @param text Set to the text, a view into data
+     * @param text_len Set to its length
+     * @return true if the event carries text, false otherwise
+     */
+    bool (*stream_chunk)(char *data, size_t len, const char **text, size_t *text_len);
+} ApiBackend;
+
+/**
+ * @brief Get the operations of a backend
+ *
+ * @param backend Backend selected in the configuration
+ * @return The backend's table (never NULL)
+ */
+const ApiBackend *backend_get(ModelBackend backend);
+
+/**
+ * @brief Get the chat endpoint URL of the configured backend
+ *
+ * @param config Configuration (backend and base_url)
+ * @return The URL (free with free()), or NULL if memory ran out
+ */
+char *backend_url(const Config *config);
+
+/**
+ * @brief Render a request body for the user's input
+ *
+ * The input is JSON-escaped straight into the buffer; once the buffer has
+ * grown to fit the longest input so far, this allocates nothing.
+ *
+ * @param tmpl Template from the backend's build_template
+ * @param user_input The user's natural language input
+ * @param buffer Buffer to render into (previous contents are replaced)
+ * @return true if successful, false if memory ran out
+ */
+bool backend_render_request(const RequestTemplate *tmpl, const char *user_input, RequestBuffer *buffer);
+
+/**
+ * @brief Free a request template
+ *
+ * @param tmpl Pointer to RequestTemplate structure
+ */
+void backend_free_template(RequestTemplate *tmpl);
+
+/**
+ * @brief Free a request buffer
+ *
+ * @param buffer Pointer to RequestBuffer structure
+ */
+void backend_free_buffer(RequestBuffer *buffer);
+
+/**
+ * @brief Take the command out of the model's message content
+ *
+ * The content is normally JSON with a "command" field; anything else is
+ * used as the command as-is. Sets response->is_valid.
+ *
+ * @param content Message content (decoded in place)
+ * @param len Length of the content
+ * @param arena Where the command is allocated
+ * @param response Pointer to ApiResponse structure to populate
+ */
+void backend_extract_command(char *content, size_t len, Arena *arena, ApiResponse *response);
+
+#endif /* BACKEND_H */
@@ -7,72 +7,500 @@
 #include "aish.h"
 #include "api.h"
 #include "terminal.h"
+#include "prompt.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+
+#define STATUS_INTERVAL_MS 100
+#define STATUS_PREFIX "\r\033[2K[AISH] "
 
 /**
- * @brief Process input in Chat mode
+ * @brief Redraw the status line of a pending request
  * 
  * @param state The AISH state
- * @param input The input string
- * @param input_len The length of the input string
- * @return true if successful, false otherwise
  */
-bool process_chat_input(AishState *state, const char *input, size_t input_len) {
-    if (state == NULL || input == NULL || input_len == 0) {
-        return false;
+static void draw_status(AishState *state) {
+    static const char spinner[] = "|/-\\";
+    char line[96];
+    double seconds = (double)(event_now_ms() - state->chat_started_ms) / 1000.0;
+    
+    int len = snprintf(line, sizeof(line), "\r\033[2K[AISH] Waiting for the model %c %.1fs",
+                       spinner[state->status_frame++ % 4], seconds);
+    if (len > 0) {
+        aish_write_stdout(state, line, (size_t)len);
+    }
+}
+
+/**
+ * @brief Event loop callback for the status line timer
+ */
+static void status_callback(int fd, uint32_t events, void *userdata) {
+    (void)fd;
+    (void)events;
+    draw_status((AishState *)userdata);
+}
+
+/**
+ * @brief Show a streamed command as it arrives
+ * 
+ * Replaces the spinner. Only the tail that fits on one line is shown, so
+ * the status line can still be taken down with a single erase.
+ * 
+ * @param command The command so far
+ * @param len Length of the command so far
+ * @param userdata The AISH state
+ */
+static void chat_progress_callback(const char *command, size_t len, void *userdata) {
+    AishState *state = (AishState *)userdata;
+    char line[512];
+    size_t width = 80;
+    struct winsize ws;
+    
+    event_loop_set_timer(&state->loop, state->status_timer, 0, 0);
+    
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+        width = ws.ws_col;
+    }
+    
+    size_t prefix_len = sizeof(STATUS_PREFIX) - 1;
+    // Leave the last column free so the cursor never wraps
+    size_t room = (width > sizeof("[AISH] ")) ? width - sizeof("[AISH] ") : 0;
+    if (room > sizeof(line) - prefix_len) {
+        room = sizeof(line) - prefix_len;
+    }
+    if (len > room) {
+        command += len - room;
+        len = room;
     }
     
-    // Process input as a natural language query
-    ApiResponse response;
+    memcpy(line, STATUS_PREFIX, prefix_len);
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)command[i];
+        line[prefix_len + i] = (c < 0x20 || c == 0x7f) ? ' ' : (char)c;
+    }
+    aish_write_stdout(state, line, prefix_len + len);
+}
+
+/**
+ * @brief Run the command the API answered with
+ * 
+ * @param response The API response
+ * @param success true if a command was extracted
+ * @param userdata The AISH state
+ */
+static void chat_response_callback(ApiResponse *response, bool success, void *userdata) {
+    AishState *state = (AishState *)userdata;
+    
+    state->chat_request = NULL;
+    event_loop_set_timer(&state->loop, state->status_timer, 0, 0);
     
-    // Send request to OpenAI API
-    if (!api_send_request(input, &state->config, &response)) {
+    // Take the status line down before any message goes to stderr
+    aish_write_stdout(state, "\r\033[2K", 5);
+    output_drain(&state->output);
+    
+    if (!success) {
         fprintf(stderr, "Error: Failed to send API request\n");
-        if (response.error != NULL) {
-            fprintf(stderr, "API Error: %s\n", response.error);
+        if (response->error != NULL) {
+            fprintf(stderr, "API Error: %s\n", response->error);
         }
-        api_free_response(&response);
-        return false;
+        display_prompt(state);
+        return;
     }
     
     // Check if we got a valid command
-    if (!response.is_valid || response.command == NULL) {
+    if (!response->is_valid || response->command == NULL) {
         fprintf(stderr, "Error: Invalid command received from API\n");
-        api_free_response(&response);
-        return false;
+        display_prompt(state);
+        return;
     }
     
-    // Display the command with proper formatting
-    const char *cmd_prefix = "\r\n[AISH: Generated command] ";
-    //write(STDERR_FILENO, cmd_prefix, strlen(cmd_prefix));
-    //write(STDERR_FILENO, response.command, strlen(response.command));
-    const char *cmd_suffix = "\r\n";
-    //write(STDERR_FILENO, cmd_suffix, strlen(cmd_suffix));
+    // Write the command to the bash process, followed by a newline to execute it
+    if (!aish_write_bash(state, response->command, strlen(response->command)) ||
+        !aish_write_bash(state, "\n", 1)) {
+        fprintf(stderr, "Error: Failed to write command to bash\n");
+        display_prompt(state);
+        return;
+    }
     
-    // Write the command to the bash process
-    if (write(state->bash_master_fd, response.command, strlen(response.command)) == -1) {
-        fprintf(stderr, "Error: Failed to write command to bash: %s\n", strerror(errno));
-        api_free_response(&response);
+    // Switch back to Bash mode
+    // Note: We'll set the mode directly instead of calling terminal_toggle_mode
+    state->terminal.current_mode = MODE_BASH;
+    display_prompt(state);
+}
+
+/**
+ * @brief Offer the answer to a similar query
+ * 
+ * The command is put on bash's command line without running it: Enter
+ * runs it, and it can be edited or cleared first.
+ * 
+ * @param state The AISH state
+ * @param response The cached response
+ * @param question The query it answers
+ * @param similarity How alike the two queries are
+ */
+static void offer_similar(AishState *state, const ApiResponse *response, const char *question,
+                          double similarity) {
+    aish_write_stdout(state, "\r\033[2K", 5);
+    output_drain(&state->output);
+    fprintf(stderr, "[AISH] Answer to a similar question (\"%s\", %.0f%% alike), Enter runs it\n",
+            question, similarity * 100.0);
+    
+    // The prompt comes from the newline sent to bash, the command after it;
+    // Tab completes it like typed text instead of toggling the mode
+    size_t len = strlen(response->command);
+    state->terminal.current_mode = MODE_BASH;
+    display_prompt(state);
+    if (!aish_write_bash(state, response->command, len)) {
+        fprintf(stderr, "Error: Failed to write command to bash\n");
+        return;
+    }
+    state->terminal.buffer_pos = len;
+}
+
+/**
+ * @brief Release a speculation slot, cancelling its request if still in flight
+ * 
+ * @param spec The slot
+ */
+static void free_speculation(Speculation *spec) {
+    api_cancel_request(spec->request);
+    api_free_response(&spec->response);
+    free(spec->text);
+    spec->text = NULL;
+    spec->request = NULL;
+    spec->success = false;
+    spec->adopted = false;
+}
+
+/**
+ * @brief Find the speculation for a query and drop every other one
+ * 
+ * @param state The AISH state
+ * @param input The query Enter was pressed on
+ * @param input_len Its length
+ * @return The matching slot (still held), or NULL if there is none
+ */
+static Speculation *take_speculation(AishState *state, const char *input, size_t input_len) {
+    Speculation *hit = NULL;
+    
+    for (int i = 0; i < CHAT_MAX_SPECULATIONS; i++) {
+        Speculation *spec = &state->speculations[i];
+        if (spec->text == NULL) {
+            continue;
+        }
+        
+        if (hit == NULL && strlen(spec->text) == input_len && memcmp(spec->text, input, input_len) == 0) {
+            hit = spec;
+            state->speculations_used++;
+        } else {
+            free_speculation(spec);
+            state->speculations_wasted++;
+        }
+    }
+    
+    event_loop_set_timer(&state->loop, state->speculate_timer, 0, 0);
+    return hit;
+}
+
+/**
+ * @brief Keep the answer to a speculative request, or run it if Enter was already pressed
+ * 
+ * @param response The API response
+ * @param success true if a command was extracted
+ * @param userdata The speculation slot
+ */
+static void speculation_callback(ApiResponse *response, bool success, void *userdata) {
+    Speculation *spec = (Speculation *)userdata;
+    AishState *state = (AishState *)spec->state;
+    
+    spec->request = NULL;
+    if (spec->adopted) {
+        free_speculation(spec);
+        chat_response_callback(response, success, state);
+        return;
+    }
+    
+    spec->success = success;
+    spec->response.is_valid = response->is_valid;
+    spec->response.command = (response->command != NULL) ? strdup(response->command) : NULL;
+    spec->response.error = (response->error != NULL) ? strdup(response->error) : NULL;
+}
+
+/**
+ * @brief Show a speculative command as it streams in once Enter was pressed
+ */
+static void speculation_progress(const char *command, size_t len, void *userdata) {
+    Speculation *spec = (Speculation *)userdata;
+    if (spec->adopted) {
+        chat_progress_callback(command, len, spec->state);
+    }
+}
+
+/**
+ * @brief Get the scope cached answers are kept under
+ * 
+ * With cache_cwd set, the working directory of the shell, so answers that
+ * depend on where they were asked are not reused elsewhere.
+ * 
+ * @param state The AISH state
+ * @param buffer Where the directory is written
+ * @param size Size of the buffer
+ * @return The scope, or NULL for none
+ */
+static const char *cache_scope(AishState *state, char *buffer, size_t size) {
+    if (!state->config.cache_cwd || state->bash_pid <= 0) {
+        return NULL;
+    }
+    
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/%d/cwd", (int)state->bash_pid);
+    ssize_t len = readlink(link, buffer, size - 1);
+    if (len < 0) {
+        return NULL;
+    }
+    buffer[len] = '\0';
+    return buffer;
+}
+
+/**
+ * @brief Send the query typed so far after a pause in typing
+ * 
+ * @param state The AISH state
+ */
+static void speculate(AishState *state) {
+    TerminalState *term = &state->terminal;
+    size_t len = term->buffer_pos;
+    int max_in_flight = state->config.speculate_max;
+    if (max_in_flight < 1 || max_in_flight > CHAT_MAX_SPECULATIONS) {
+        max_in_flight = (max_in_flight < 1) ? 1 : CHAT_MAX_SPECULATIONS;
+    }
+    
+    // Nothing worth asking about yet
+    size_t start = 0;
+    while (start < len && term->input_buffer[start] == ' ') {
+        start++;
+    }
+    if (start == len || terminal_get_mode(term) != MODE_CHAT || state->chat_request != NULL) {
+        return;
+    }
+    
+    // Find a free slot and count what is in flight; the oldest request is
+    // replaced once the limit is reached, the oldest answer once all are taken
+    Speculation *slot = NULL;
+    Speculation *oldest_request = NULL;
+    Speculation *oldest_answer = NULL;
+    int in_flight = 0;
+    for (int i = 0; i < CHAT_MAX_SPECULATIONS; i++) {
+        Speculation *spec = &state->speculations[i];
+        if (spec->text == NULL) {
+            slot = (slot != NULL) ? slot : spec;
+            continue;
+        }
+        if (strlen(spec->text) == len && memcmp(spec->text, term->input_buffer, len) == 0) {
+            return; // Already asked
+        }
+        if (spec->request != NULL) {
+            in_flight++;
+            if (oldest_request == NULL || spec->sent_ms < oldest_request->sent_ms) {
+                oldest_request = spec;
+            }
+        } else if (oldest_answer == NULL || spec->sent_ms < oldest_answer->sent_ms) {
+            oldest_answer = spec;
+        }
+    }
+    
+    if (in_flight >= max_in_flight) {
+        slot = oldest_request;
+    } else if (slot == NULL) {
+        slot = oldest_answer;
+    }
+    if (slot->text != NULL) {
+        free_speculation(slot);
+        state->speculations_wasted++;
+    }
+    
+    slot->text = strndup(term->input_buffer, len);
+    if (slot->text == NULL) {
+        return;
+    }
+    
+    slot->state = state;
+    slot->sent_ms = event_now_ms();
+    
+    // Nothing to send if the answer is cached
+    char scope_buffer[PATH_MAX];
+    const char *scope = cache_scope(state, scope_buffer, sizeof(scope_buffer));
+    if (api_cached_response(slot->text, scope, &slot->response)) {
+        slot->success = true;
+        return;
+    }
+    
+    slot->request = api_send_request(slot->text, scope, &state->config, speculation_callback,
+                                     speculation_progress, slot);
+    if (slot->request == NULL) {
+        free_speculation(slot);
+        return;
+    }
+    
+    state->speculations_sent++;
+}
+
+/**
+ * @brief Event loop callback for the typing pause timer
+ */
+static void speculate_callback(int fd, uint32_t events, void *userdata) {
+    (void)fd;
+    (void)events;
+    speculate((AishState *)userdata);
+}
+
+/**
+ * @brief Process input in Chat mode
+ * 
+ * Starts the API request and returns; the command runs from
+ * chat_response_callback() and a status line is shown meanwhile.
+ * 
+ * @param state The AISH state
+ * @param input The input string
+ * @param input_len The length of the input string
+ * @return true if the request was started, false otherwise
+ */
+bool process_chat_input(AishState *state, const char *input, size_t input_len) {
+    if (state == NULL || input == NULL || input_len == 0 || state->chat_request != NULL) {
         return false;
     }
     
-    // Write a newline to execute the command
-    if (write(state->bash_master_fd, "\n", 1) == -1) {
-        fprintf(stderr, "Error: Failed to write newline to bash: %s\n", strerror(errno));
+    if (state->status_timer == NULL) {
+        state->status_timer = event_loop_add_timer(&state->loop, 0, 0, status_callback, state);
+        if (state->status_timer == NULL) {
+            return false;
+        }
+    }
+    
+    // A speculative request for this very query may already be answered or on its way
+    Speculation *hit = take_speculation(state, input, input_len);
+    if (hit != NULL && hit->request == NULL && !hit->success) {
+        // It failed (timeout, server error, no command): ask again instead of replaying that
+        free_speculation(hit);
+        state->speculations_used--;
+        state->speculations_wasted++;
+        hit = NULL;
+    }
+    if (hit != NULL && hit->request == NULL) {
+        ApiResponse response = hit->response;
+        hit->response.command = NULL;
+        hit->response.error = NULL;
+        free_speculation(hit);
+        
+        chat_response_callback(&response, true, state);
         api_free_response(&response);
-        return false;
+        return true;
     }
     
-    // Clean up
-    api_free_response(&response);
+    // Or the answer to an earlier session's query
+    char scope_buffer[PATH_MAX];
+    const char *scope = cache_scope(state, scope_buffer, sizeof(scope_buffer));
+    ApiResponse cached;
+    if (hit == NULL && api_cached_response(input, scope, &cached)) {
+        chat_response_callback(&cached, true, state);
+        api_free_response(&cached);
+        return true;
+    }
     
-    // Switch back to Bash mode
-    // Note: We'll set the mode directly instead of calling terminal_toggle_mode
-    state->terminal.current_mode = MODE_BASH;
+    // Or a similar one's, unless that was just offered for this same query
+    bool declined = state->offered_query != NULL && strcmp(state->offered_query, input) == 0;
+    free(state->offered_query);
+    state->offered_query = NULL;
+    char *question = NULL;
+    double similarity = 0.0;
+    if (hit == NULL && !declined && api_similar_response(input, scope, &cached, &question, &similarity)) {
+        offer_similar(state, &cached, question, similarity);
+        state->offered_query = strdup(input);
+        api_free_response(&cached);
+        free(question);
+        return true;
+    }
+    
+    if (hit != NULL) {
+        hit->adopted = true;
+        state->chat_request = hit->request;
+    } else {
+        // Send request to OpenAI API
+        state->chat_request = api_send_request(input, scope, &state->config, chat_response_callback,
+                                               chat_progress_callback, state);
+        if (state->chat_request == NULL) {
+            fprintf(stderr, "Error: Failed to send API request\n");
+            return false;
+        }
+    }
+    
+    state->chat_started_ms = event_now_ms();
+    state->status_frame = 0;
+    draw_status(state);
+    event_loop_set_timer(&state->loop, state->status_timer, STATUS_INTERVAL_MS, STATUS_INTERVAL_MS);
+    
+    return true;
+}
+
+void chat_note_edit(AishState *state) {
+    if (state == NULL || state->config.speculate_ms <= 0) {
+        return;
+    }
+    
+    if (state->speculate_timer == NULL) {
+        state->speculate_timer = event_loop_add_timer(&state->loop, 0, 0, speculate_callback, state);
+        if (state->speculate_timer == NULL) {
+            return;
+        }
+    }
+    
+    // Restart the pause on every edit
+    event_loop_set_timer(&state->loop, state->speculate_timer, (uint64_t)state->config.speculate_ms, 0);
+}
+
+void chat_drop_speculations(AishState *state) {
+    if (state == NULL) {
+        return;
+    }
+    
+    for (int i = 0; i < CHAT_MAX_SPECULATIONS; i++) {
+        Speculation *spec = &state->speculations[i];
+        if (spec->text != NULL && !spec->adopted) {
+            free_speculation(spec);
+            state->speculations_wasted++;
+        }
+    }
+    
+    event_loop_set_timer(&state->loop, state->speculate_timer, 0, 0);
+}
+
+bool chat_cancel_request(AishState *state) {
+    if (state == NULL || state->chat_request == NULL) {
+        return false;
+    }
+    
+    // An adopted speculation owns the request
+    Speculation *owner = NULL;
+    for (int i = 0; i < CHAT_MAX_SPECULATIONS; i++) {
+        if (state->speculations[i].adopted) {
+            owner = &state->speculations[i];
+        }
+    }
+    if (owner != NULL) {
+        free_speculation(owner);
+    } else {
+        api_cancel_request(state->chat_request);
+    }
     
+    state->chat_request = NULL;
+    event_loop_set_timer(&state->loop, state->status_timer, 0, 0);
+    const char *notice = "\r\033[2K[AISH] Request cancelled\r\n";
+    aish_write_stdout(state, notice, strlen(notice));
     return true;
 }
@@ -13,11 +13,43 @@
 /**
  * @brief Process input in Chat mode
  * 
+ * Sends the input to the API without waiting for the answer; the
+ * generated command is run from the event loop once it arrives.
+ * 
  * @param state The AISH state
  * @param input The input string
  * @param input_len The length of the input string
- * @return true if successful, false otherwise
+ * @return true if the request was started, false otherwise
  */
 bool process_chat_input(AishState *state, const char *input, size_t input_len);
 
+/**
+ * @brief Note that the query being typed in Chat mode changed
+ * 
+ * With speculation enabled (config speculate_ms), the query is sent in the
+ * background once typing pauses for that long; if Enter is pressed on the
+ * same text, process_chat_input() uses that answer or request.
+ * 
+ * @param state The AISH state
+ */
+void chat_note_edit(AishState *state);
+
+/**
+ * @brief Abandon the pending chat request
+ * 
+ * The transfer is removed from curl at once, so nothing more is waited
+ * for; the caller redraws the prompt.
+ * 
+ * @param state The AISH state
+ * @return true if a request was pending, false otherwise
+ */
+bool chat_cancel_request(AishState *state);
+
+/**
+ * @brief Cancel and forget all speculative requests
+ * 
+ * @param state The AISH state
+ */
+void chat_drop_speculations(AishState *state);
+
 #endif /* CHAT_H */
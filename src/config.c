@@ -21,6 +21,11 @@
 #define DEFAULT_MODEL "gpt-4-turbo"
 #define DEFAULT_TEMPERATURE 0.2
 #define DEFAULT_MAX_TOKENS 100
+#define DEFAULT_SPECULATE_MAX 1
+#define DEFAULT_HEDGE_BUDGET 10
+#define DEFAULT_CACHE_TTL_S (7 * 24 * 3600)
+#define DEFAULT_CACHE_MAX_KB 4096
+#define DEFAULT_CACHE_MAX_ENTRIES 3072
 
 /**
  * @brief Get the path to the configuration file
@@ -68,9 +73,25 @@ bool config_init(Config *config) {
     
     // Initialize with NULL/default values
     config->openai_api_key = NULL;
+    config->backend = BACKEND_OPENAI;
+    config->base_url = NULL;
+    config->unix_socket = NULL;
     config->openai_model = strdup(DEFAULT_MODEL);
     config->temperature = DEFAULT_TEMPERATURE;
     config->max_tokens = DEFAULT_MAX_TOKENS;
+    config->relay = RELAY_EPOLL;
+    config->stream = true;
+    config->speculate_ms = 0;
+    config->speculate_max = DEFAULT_SPECULATE_MAX;
+    config->hedge_ms = 0;
+    config->hedge_adaptive = false;
+    config->hedge_budget = DEFAULT_HEDGE_BUDGET;
+    config->cache = false;
+    config->cache_ttl_s = DEFAULT_CACHE_TTL_S;
+    config->cache_max_kb = DEFAULT_CACHE_MAX_KB;
+    config->cache_cwd = false;
+    config->cache_max_entries = DEFAULT_CACHE_MAX_ENTRIES;
+    config->cache_similarity = 0.0;
     
     // Check if memory allocation for model name succeeded
     if (config->openai_model == NULL) {
@@ -151,7 +172,39 @@ bool config_load(Config *config) {
                 return false;
             }
         }
-    } else {
+    }
+    
+    // Extract model backend (optional)
+    struct json_object *backend_obj;
+    if (json_object_object_get_ex(json_obj, "backend", &backend_obj)) {
+        const char *backend = json_object_get_string(backend_obj);
+        if (backend == NULL || !config_parse_backend(backend, &config->backend)) {
+            fprintf(stderr, "Warning: Unknown backend '%s' in configuration file, using openai\n",
+                    backend != NULL ? backend : "");
+        }
+    }
+    
+    // Extract endpoint settings (optional)
+    const char *endpoint_keys[] = { "base_url", "unix_socket" };
+    char **endpoint_values[] = { &config->base_url, &config->unix_socket };
+    for (size_t i = 0; i < sizeof(endpoint_keys) / sizeof(endpoint_keys[0]); i++) {
+        struct json_object *value_obj;
+        if (!json_object_object_get_ex(json_obj, endpoint_keys[i], &value_obj) ||
+            json_object_get_string(value_obj) == NULL) {
+            continue;
+        }
+        free(*endpoint_values[i]);
+        *endpoint_values[i] = strdup(json_object_get_string(value_obj));
+        if (*endpoint_values[i] == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for %s\n", endpoint_keys[i]);
+            json_object_put(json_obj);
+            free(config_path);
+            return false;
+        }
+    }
+    
+    // Only the OpenAI service requires an API key
+    if (config->openai_api_key == NULL && config->backend == BACKEND_OPENAI) {
         fprintf(stderr, "Error: 'openai_api_key' not found in configuration file\n");
         json_object_put(json_obj);
         free(config_path);
@@ -189,6 +242,72 @@ bool config_load(Config *config) {
         config->max_tokens = json_object_get_int(tokens_obj);
     }
     
+    // Extract relay backend (optional)
+    struct json_object *relay_obj;
+    if (json_object_object_get_ex(json_obj, "relay", &relay_obj)) {
+        const char *relay = json_object_get_string(relay_obj);
+        if (relay == NULL || !config_parse_relay(relay, &config->relay)) {
+            fprintf(stderr, "Warning: Unknown relay '%s' in configuration file, using epoll\n",
+                    relay != NULL ? relay : "");
+        }
+    }
+    
+    // Extract streaming (optional)
+    struct json_object *stream_obj;
+    if (json_object_object_get_ex(json_obj, "stream", &stream_obj)) {
+        config->stream = json_object_get_boolean(stream_obj);
+    }
+    
+    // Extract speculative requests (optional)
+    struct json_object *speculate_obj;
+    if (json_object_object_get_ex(json_obj, "speculate_ms", &speculate_obj)) {
+        config->speculate_ms = json_object_get_int(speculate_obj);
+    }
+    if (json_object_object_get_ex(json_obj, "speculate_max", &speculate_obj)) {
+        config->speculate_max = json_object_get_int(speculate_obj);
+    }
+    
+    // Extract request hedging (optional)
+    struct json_object *hedge_obj;
+    if (json_object_object_get_ex(json_obj, "hedge_ms", &hedge_obj)) {
+        config->hedge_ms = json_object_get_int(hedge_obj);
+    }
+    if (json_object_object_get_ex(json_obj, "hedge_adaptive", &hedge_obj)) {
+        config->hedge_adaptive = json_object_get_boolean(hedge_obj);
+    }
+    if (json_object_object_get_ex(json_obj, "hedge_budget", &hedge_obj)) {
+        config->hedge_budget = json_object_get_int(hedge_obj);
+    }
+    
+    // Extract the response cache (optional)
+    struct json_object *cache_obj;
+    if (json_object_object_get_ex(json_obj, "cache", &cache_obj)) {
+        config->cache = json_object_get_boolean(cache_obj);
+    }
+    if (json_object_object_get_ex(json_obj, "cache_ttl_s", &cache_obj)) {
+        config->cache_ttl_s = json_object_get_int(cache_obj);
+    }
+    if (json_object_object_get_ex(json_obj, "cache_max_kb", &cache_obj)) {
+        config->cache_max_kb = json_object_get_int(cache_obj);
+        if (config->cache_max_kb <= 0) {
+            fprintf(stderr, "Warning: cache_max_kb must be positive, using %d\n", DEFAULT_CACHE_MAX_KB);
+            config->cache_max_kb = DEFAULT_CACHE_MAX_KB;
+        }
+    }
+    if (json_object_object_get_ex(json_obj, "cache_cwd", &cache_obj)) {
+        config->cache_cwd = json_object_get_boolean(cache_obj);
+    }
+    if (json_object_object_get_ex(json_obj, "cache_max_entries", &cache_obj)) {
+        config->cache_max_entries = json_object_get_int(cache_obj);
+        if (config->cache_max_entries <= 0) {
+            fprintf(stderr, "Warning: cache_max_entries must be positive, using %d\n", DEFAULT_CACHE_MAX_ENTRIES);
+            config->cache_max_entries = DEFAULT_CACHE_MAX_ENTRIES;
+        }
+    }
+    if (json_object_object_get_ex(json_obj, "cache_similarity", &cache_obj)) {
+        config->cache_similarity = json_object_get_double(cache_obj);
+    }
+    
     // Clean up
     json_object_put(json_obj);
     free(config_path);
@@ -196,6 +315,30 @@ bool config_load(Config *config) {
     return true;
 }
 
+bool config_parse_relay(const char *name, RelayBackend *relay) {
+    if (strcmp(name, "epoll") == 0) {
+        *relay = RELAY_EPOLL;
+    } else if (strcmp(name, "io_uring") == 0) {
+        *relay = RELAY_IO_URING;
+    } else {
+        return false;
+    }
+    
+    return true;
+}
+
+bool config_parse_backend(const char *name, ModelBackend *backend) {
+    if (strcmp(name, "openai") == 0) {
+        *backend = BACKEND_OPENAI;
+    } else if (strcmp(name, "openai-compatible") == 0) {
+        *backend = BACKEND_OPENAI_COMPATIBLE;
+    } else {
+        return false;
+    }
+    
+    return true;
+}
+
 void config_free(Config *config) {
     if (config == NULL) {
         return;
@@ -211,4 +354,9 @@ void config_free(Config *config) {
         free(config->openai_model);
         config->openai_model = NULL;
     }
+    
+    free(config->base_url);
+    config->base_url = NULL;
+    free(config->unix_socket);
+    config->unix_socket = NULL;
 }
@@ -8,15 +8,49 @@
 
 #include <stdbool.h>
 
+/**
+ * @enum RelayBackend
+ * @brief How bash output is moved to the terminal
+ */
+typedef enum {
+    RELAY_EPOLL,             /**< read()/writev() (or splice) driven by epoll */
+    RELAY_IO_URING           /**< io_uring, falling back to RELAY_EPOLL if unavailable */
+} RelayBackend;
+
+/**
+ * @enum ModelBackend
+ * @brief Which service turns chat input into commands
+ */
+typedef enum {
+    BACKEND_OPENAI,          /**< api.openai.com (needs an API key) */
+    BACKEND_OPENAI_COMPATIBLE /**< Any chat-completions server at base_url, e.g. llama.cpp or vLLM */
+} ModelBackend;
+
 /**
  * @struct Config
  * @brief Structure to hold AISH configuration settings
  */
 typedef struct {
-    char *openai_api_key;    /**< OpenAI API key */
+    char *openai_api_key;    /**< OpenAI API key (optional for an OpenAI-compatible backend) */
+    ModelBackend backend;    /**< Model backend */
+    char *base_url;          /**< Base URL of an OpenAI-compatible backend (NULL = default) */
+    char *unix_socket;       /**< Reach the backend over this Unix socket instead of TCP (NULL = TCP) */
     char *openai_model;      /**< OpenAI model to use (e.g., "gpt-4-turbo") */
     double temperature;      /**< Temperature parameter for API requests */
     int max_tokens;          /**< Maximum tokens for API responses */
+    RelayBackend relay;      /**< Output relay backend */
+    bool stream;             /**< Stream responses and stop once the command is complete */
+    int speculate_ms;        /**< Typing pause before a speculative chat request, 0 = never */
+    int speculate_max;       /**< Speculative chat requests in flight at most */
+    int hedge_ms;            /**< Wait for the first byte before sending a duplicate request, 0 = never */
+    bool hedge_adaptive;     /**< Use the observed p95 time to first byte instead of hedge_ms */
+    int hedge_budget;        /**< Duplicate requests allowed per 100 requests */
+    bool cache;              /**< Answer repeated chat queries from the on-disk response cache */
+    int cache_ttl_s;         /**< Age after which a cached answer is not used, 0 = until evicted */
+    int cache_max_kb;        /**< Size of the cached answers kept at most, in KB (positive) */
+    bool cache_cwd;          /**< Key cached answers by bash's working directory too */
+    int cache_max_entries;   /**< Cached answers kept at most (positive) */
+    double cache_similarity; /**< Offer the answer to a query at least this similar, 0 = off */
 } Config;
 
 /**
@@ -35,6 +69,24 @@ bool config_init(Config *config);
  */
 bool config_load(Config *config);
 
+/**
+ * @brief Parse a relay backend name ("epoll" or "io_uring")
+ * 
+ * @param name Backend name
+ * @param relay Set to the parsed backend on success
+ * @return true if the name is known, false otherwise
+ */
+bool config_parse_relay(const char *name, RelayBackend *relay);
+
+/**
+ * @brief Parse a model backend name ("openai" or "openai-compatible")
+ * 
+ * @param name Backend name
+ * @param backend Set to the parsed backend on success
+ * @return true if the name is known, false otherwise
+ */
+bool config_parse_backend(const char *name, ModelBackend *backend);
+
 /**
  * @brief Free resources allocated for configuration
  * 
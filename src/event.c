@@ -0,0 +1,769 @@
+/**
+ * @file event.c
+ * @brief Implementation of the event loop for AISH
+ */
+
+#include "event.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#else
+#include <poll.h>
+#endif
+
+#define MAX_EVENTS_PER_WAIT 32
+
+uint64_t event_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+uint64_t event_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/**
+ * @brief Allocate a source and link it into the loop
+ */
+static EventSource *source_new(EventLoop *loop, int fd, uint32_t events,
+                               EventCallback callback, void *userdata) {
+    EventSource *source = (EventSource *)calloc(1, sizeof(EventSource));
+    if (source == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for event source\n");
+        return NULL;
+    }
+
+    source->fd = fd;
+    source->events = events;
+    source->callback = callback;
+    source->userdata = userdata;
+    source->next = loop->sources;
+    loop->sources = source;
+    loop->source_count++;
+
+    return source;
+}
+
+/**
+ * @brief Unlink a source from the live list
+ */
+static void source_unlink(EventLoop *loop, EventSource *source) {
+    EventSource **link = &loop->sources;
+    while (*link != NULL) {
+        if (*link == source) {
+            *link = source->next;
+            loop->source_count--;
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+/**
+ * @brief Free sources that were removed while callbacks were running
+ */
+static void collect_garbage(EventLoop *loop) {
+    while (loop->garbage != NULL) {
+        EventSource *next = loop->garbage->next;
+        free(loop->garbage);
+        loop->garbage = next;
+    }
+}
+
+static bool watch_signal(EventLoop *loop, int signo);
+static int open_pidfd(pid_t pid);
+
+/**
+ * @brief Set up the signal bookkeeping of a freshly initialized loop
+ */
+static void init_signals(EventLoop *loop) {
+    loop->signal_fd = -1;
+    sigemptyset(&loop->signal_mask);
+    sigprocmask(SIG_BLOCK, NULL, &loop->saved_mask);
+}
+
+/**
+ * @brief Stop watching a child, then report its exit
+ */
+static void finish_child(EventLoop *loop, EventChild *child, int status) {
+    EventChild **link = &loop->children;
+    while (*link != NULL && *link != child) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        *link = child->next;
+    }
+
+    if (child->source != NULL) {
+        int fd = child->source->fd;
+        event_loop_remove(loop, child->source);
+        close(fd);
+    }
+
+    child->callback(child->pid, status, child->userdata);
+    free(child);
+}
+
+/**
+ * @brief Reap children that are watched through SIGCHLD
+ */
+static void reap_children(EventLoop *loop) {
+    EventChild *child = loop->children;
+
+    while (child != NULL) {
+        int status;
+        if (child->source == NULL && waitpid(child->pid, &status, WNOHANG) == child->pid) {
+            finish_child(loop, child, status);
+            // The list changed underneath us; start over
+            child = loop->children;
+            continue;
+        }
+        child = child->next;
+    }
+}
+
+/**
+ * @brief Run the callback registered for a signal
+ */
+static void dispatch_signal(EventLoop *loop, int signo) {
+    if (signo <= 0 || signo >= EVENT_MAX_SIGNAL) {
+        return;
+    }
+
+    if (signo == SIGCHLD) {
+        reap_children(loop);
+    }
+
+    if (loop->signal_callbacks[signo] != NULL) {
+        loop->signal_callbacks[signo](signo, loop->signal_userdata[signo]);
+    }
+}
+
+/**
+ * @brief Event loop callback for a child's pidfd
+ */
+static void pidfd_callback(int fd, uint32_t events, void *userdata) {
+    EventChild *child = (EventChild *)userdata;
+    (void)fd;
+    (void)events;
+
+    int status;
+    if (waitpid(child->pid, &status, WNOHANG) == child->pid) {
+        finish_child(child->loop, child, status);
+    }
+}
+
+bool event_loop_add_signal(EventLoop *loop, int signo, EventSignalCallback callback, void *userdata) {
+    if (loop == NULL || signo <= 0 || signo >= EVENT_MAX_SIGNAL) {
+        return false;
+    }
+
+    if (!watch_signal(loop, signo)) {
+        return false;
+    }
+
+    loop->signal_callbacks[signo] = callback;
+    loop->signal_userdata[signo] = userdata;
+    return true;
+}
+
+bool event_loop_add_child(EventLoop *loop, pid_t pid, EventChildCallback callback, void *userdata) {
+    if (loop == NULL || pid <= 0 || callback == NULL) {
+        return false;
+    }
+
+    EventChild *child = (EventChild *)calloc(1, sizeof(EventChild));
+    if (child == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for child watch\n");
+        return false;
+    }
+
+    child->loop = loop;
+    child->pid = pid;
+    child->callback = callback;
+    child->userdata = userdata;
+
+    int fd = open_pidfd(pid);
+    if (fd != -1) {
+        child->source = event_loop_add_fd(loop, fd, EVENT_READ, pidfd_callback, child);
+        if (child->source == NULL) {
+            close(fd);
+        }
+    }
+
+    // Without a pidfd, fall back to reaping on SIGCHLD
+    if (child->source == NULL && !watch_signal(loop, SIGCHLD)) {
+        free(child);
+        return false;
+    }
+
+    child->next = loop->children;
+    loop->children = child;
+
+    // The child may have exited before we started watching it
+    if (child->source == NULL) {
+        reap_children(loop);
+    }
+
+    return true;
+}
+
+void event_loop_restore_signals(EventLoop *loop) {
+    if (loop == NULL) {
+        return;
+    }
+
+    for (int signo = 1; signo < EVENT_MAX_SIGNAL; signo++) {
+        if (sigismember(&loop->signal_mask, signo) == 1) {
+            signal(signo, SIG_DFL);
+        }
+    }
+    sigprocmask(SIG_SETMASK, &loop->saved_mask, NULL);
+}
+
+/**
+ * @brief Release signal and child watching resources
+ */
+static void cleanup_signals(EventLoop *loop) {
+    while (loop->children != NULL) {
+        EventChild *child = loop->children;
+        loop->children = child->next;
+        if (child->source != NULL) {
+            close(child->source->fd);
+        }
+        free(child);
+    }
+
+    if (loop->signal_fd != -1) {
+        close(loop->signal_fd);
+        loop->signal_fd = -1;
+    }
+
+    event_loop_restore_signals(loop);
+    sigemptyset(&loop->signal_mask);
+}
+
+#if defined(__linux__)
+
+static uint32_t to_epoll(uint32_t events) {
+    uint32_t mask = (events & EVENT_LEVEL) ? 0 : EPOLLET;
+    if (events & EVENT_READ) {
+        mask |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & EVENT_WRITE) {
+        mask |= EPOLLOUT;
+    }
+    return mask;
+}
+
+static uint32_t from_epoll(uint32_t mask) {
+    uint32_t events = 0;
+    if (mask & EPOLLIN) {
+        events |= EVENT_READ;
+    }
+    if (mask & EPOLLOUT) {
+        events |= EVENT_WRITE;
+    }
+    if (mask & (EPOLLHUP | EPOLLRDHUP)) {
+        events |= EVENT_HANGUP;
+    }
+    if (mask & EPOLLERR) {
+        events |= EVENT_ERROR;
+    }
+    return events;
+}
+
+bool event_loop_init(EventLoop *loop) {
+    if (loop == NULL) {
+        return false;
+    }
+
+    memset(loop, 0, sizeof(EventLoop));
+    init_signals(loop);
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd == -1) {
+        fprintf(stderr, "Error: Failed to create epoll instance: %s\n", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+EventSource *event_loop_add_fd(EventLoop *loop, int fd, uint32_t events,
+                               EventCallback callback, void *userdata) {
+    if (loop == NULL || fd < 0 || callback == NULL) {
+        return NULL;
+    }
+
+    EventSource *source = source_new(loop, fd, events, callback, userdata);
+    if (source == NULL) {
+        return NULL;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = to_epoll(events);
+    ev.data.ptr = source;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        fprintf(stderr, "Error: Failed to watch fd %d: %s\n", fd, strerror(errno));
+        source_unlink(loop, source);
+        free(source);
+        return NULL;
+    }
+
+    return source;
+}
+
+bool event_loop_modify_fd(EventLoop *loop, EventSource *source, uint32_t events) {
+    if (loop == NULL || source == NULL || source->is_timer || source->removed) {
+        return false;
+    }
+
+    if (source->events == events) {
+        return true;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = to_epoll(events);
+    ev.data.ptr = source;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &ev) == -1) {
+        fprintf(stderr, "Error: Failed to modify fd %d: %s\n", source->fd, strerror(errno));
+        return false;
+    }
+
+    source->events = events;
+    return true;
+}
+
+EventSource *event_loop_add_timer(EventLoop *loop, uint64_t initial_ms, uint64_t interval_ms,
+                                  EventCallback callback, void *userdata) {
+    if (loop == NULL || callback == NULL) {
+        return NULL;
+    }
+
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd == -1) {
+        fprintf(stderr, "Error: Failed to create timer: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    EventSource *source = event_loop_add_fd(loop, tfd, EVENT_READ, callback, userdata);
+    if (source == NULL) {
+        close(tfd);
+        return NULL;
+    }
+
+    source->is_timer = true;
+    if (!event_loop_set_timer(loop, source, initial_ms, interval_ms)) {
+        event_loop_remove(loop, source);
+        return NULL;
+    }
+
+    return source;
+}
+
+bool event_loop_set_timer(EventLoop *loop, EventSource *source, uint64_t initial_ms,
+                          uint64_t interval_ms) {
+    if (loop == NULL || source == NULL || !source->is_timer || source->removed) {
+        return false;
+    }
+
+    struct itimerspec spec;
+    spec.it_value.tv_sec = (time_t)(initial_ms / 1000u);
+    spec.it_value.tv_nsec = (long)(initial_ms % 1000u) * 1000000L;
+    spec.it_interval.tv_sec = (time_t)(interval_ms / 1000u);
+    spec.it_interval.tv_nsec = (long)(interval_ms % 1000u) * 1000000L;
+
+    if (timerfd_settime(source->fd, 0, &spec, NULL) == -1) {
+        fprintf(stderr, "Error: Failed to arm timer: %s\n", strerror(errno));
+        return false;
+    }
+
+    source->interval_ms = interval_ms;
+    return true;
+}
+
+void event_loop_remove(EventLoop *loop, EventSource *source) {
+    if (loop == NULL || source == NULL || source->removed) {
+        return;
+    }
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    if (source->is_timer) {
+        close(source->fd);
+    }
+
+    source_unlink(loop, source);
+    source->removed = true;
+    source->next = loop->garbage;
+    loop->garbage = source;
+}
+
+/**
+ * @brief Event loop callback for the signalfd
+ */
+static void signalfd_callback(int fd, uint32_t events, void *userdata) {
+    EventLoop *loop = (EventLoop *)userdata;
+    struct signalfd_siginfo info;
+    (void)events;
+
+    while (read(fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+        dispatch_signal(loop, (int)info.ssi_signo);
+    }
+}
+
+static bool watch_signal(EventLoop *loop, int signo) {
+    if (sigismember(&loop->signal_mask, signo) == 1) {
+        return true;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signo);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        fprintf(stderr, "Error: Failed to block signal %d: %s\n", signo, strerror(errno));
+        return false;
+    }
+    sigaddset(&loop->signal_mask, signo);
+
+    // Passing the existing fd updates its mask in place
+    int fd = signalfd(loop->signal_fd, &loop->signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Error: Failed to create signalfd: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (loop->signal_fd == -1) {
+        loop->signal_fd = fd;
+        loop->signal_source = event_loop_add_fd(loop, fd, EVENT_READ, signalfd_callback, loop);
+        if (loop->signal_source == NULL) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int open_pidfd(pid_t pid) {
+#if defined(SYS_pidfd_open)
+    // Linux 5.3+; older kernels fail with ENOSYS and use SIGCHLD instead
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+int event_loop_run_once(EventLoop *loop, int timeout_ms) {
+    if (loop == NULL) {
+        return -1;
+    }
+
+    struct epoll_event events[MAX_EVENTS_PER_WAIT];
+    int ready = epoll_wait(loop->epoll_fd, events, MAX_EVENTS_PER_WAIT, timeout_ms);
+
+    if (ready == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        fprintf(stderr, "Error: epoll_wait() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int dispatched = 0;
+    for (int i = 0; i < ready; i++) {
+        EventSource *source = (EventSource *)events[i].data.ptr;
+        if (source->removed) {
+            continue;
+        }
+
+        if (source->is_timer) {
+            // Acknowledge the expiry so the timerfd can fire again
+            uint64_t expirations;
+            if (read(source->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+                continue;
+            }
+        }
+
+        source->callback(source->fd, from_epoll(events[i].events), source->userdata);
+        dispatched++;
+    }
+
+    collect_garbage(loop);
+
+    return dispatched;
+}
+
+void event_loop_cleanup(EventLoop *loop) {
+    if (loop == NULL) {
+        return;
+    }
+
+    cleanup_signals(loop);
+    while (loop->sources != NULL) {
+        event_loop_remove(loop, loop->sources);
+    }
+    collect_garbage(loop);
+
+    if (loop->epoll_fd != -1) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+}
+
+#else /* poll() fallback */
+
+bool event_loop_init(EventLoop *loop) {
+    if (loop == NULL) {
+        return false;
+    }
+
+    memset(loop, 0, sizeof(EventLoop));
+    init_signals(loop);
+    loop->epoll_fd = -1;
+
+    return true;
+}
+
+EventSource *event_loop_add_fd(EventLoop *loop, int fd, uint32_t events,
+                               EventCallback callback, void *userdata) {
+    if (loop == NULL || fd < 0 || callback == NULL) {
+        return NULL;
+    }
+
+    return source_new(loop, fd, events, callback, userdata);
+}
+
+bool event_loop_modify_fd(EventLoop *loop, EventSource *source, uint32_t events) {
+    if (loop == NULL || source == NULL || source->is_timer || source->removed) {
+        return false;
+    }
+
+    source->events = events;
+    return true;
+}
+
+EventSource *event_loop_add_timer(EventLoop *loop, uint64_t initial_ms, uint64_t interval_ms,
+                                  EventCallback callback, void *userdata) {
+    if (loop == NULL || callback == NULL) {
+        return NULL;
+    }
+
+    EventSource *source = source_new(loop, -1, 0, callback, userdata);
+    if (source == NULL) {
+        return NULL;
+    }
+
+    source->is_timer = true;
+    event_loop_set_timer(loop, source, initial_ms, interval_ms);
+
+    return source;
+}
+
+bool event_loop_set_timer(EventLoop *loop, EventSource *source, uint64_t initial_ms,
+                          uint64_t interval_ms) {
+    if (loop == NULL || source == NULL || !source->is_timer || source->removed) {
+        return false;
+    }
+
+    source->deadline_ms = (initial_ms > 0) ? event_now_ms() + initial_ms : 0;
+    source->interval_ms = interval_ms;
+    return true;
+}
+
+void event_loop_remove(EventLoop *loop, EventSource *source) {
+    if (loop == NULL || source == NULL || source->removed) {
+        return;
+    }
+
+    source_unlink(loop, source);
+    source->removed = true;
+    source->next = loop->garbage;
+    loop->garbage = source;
+}
+
+// Write end of the self-pipe signals are forwarded to
+static int g_signal_pipe = -1;
+
+/**
+ * @brief Async signal handler: forward the signal number to the self-pipe
+ */
+static void forward_signal(int signo) {
+    int saved_errno = errno;
+    unsigned char byte = (unsigned char)signo;
+    if (write(g_signal_pipe, &byte, 1) == -1) {
+        // Pipe full: a wakeup is already pending
+    }
+    errno = saved_errno;
+}
+
+/**
+ * @brief Event loop callback for the self-pipe
+ */
+static void signal_pipe_callback(int fd, uint32_t events, void *userdata) {
+    EventLoop *loop = (EventLoop *)userdata;
+    unsigned char signals[64];
+    ssize_t count;
+    (void)events;
+
+    while ((count = read(fd, signals, sizeof(signals))) > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+            dispatch_signal(loop, signals[i]);
+        }
+    }
+}
+
+static bool watch_signal(EventLoop *loop, int signo) {
+    if (sigismember(&loop->signal_mask, signo) == 1) {
+        return true;
+    }
+
+    if (loop->signal_fd == -1) {
+        int fds[2];
+        if (pipe(fds) == -1) {
+            fprintf(stderr, "Error: Failed to create signal pipe: %s\n", strerror(errno));
+            return false;
+        }
+        for (int i = 0; i < 2; i++) {
+            fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+            fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        }
+        loop->signal_fd = fds[0];
+        g_signal_pipe = fds[1];
+        loop->signal_source = event_loop_add_fd(loop, fds[0], EVENT_READ, signal_pipe_callback, loop);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = forward_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(signo, &action, NULL) == -1) {
+        fprintf(stderr, "Error: Failed to watch signal %d: %s\n", signo, strerror(errno));
+        return false;
+    }
+
+    sigaddset(&loop->signal_mask, signo);
+    return true;
+}
+
+static int open_pidfd(pid_t pid) {
+    (void)pid;
+    return -1;
+}
+
+int event_loop_run_once(EventLoop *loop, int timeout_ms) {
+    if (loop == NULL) {
+        return -1;
+    }
+
+    struct pollfd fds[MAX_EVENTS_PER_WAIT];
+    EventSource *owners[MAX_EVENTS_PER_WAIT];
+    nfds_t nfds = 0;
+    uint64_t now = event_now_ms();
+
+    for (EventSource *s = loop->sources; s != NULL; s = s->next) {
+        if (s->is_timer) {
+            if (s->deadline_ms != 0) {
+                int until = (s->deadline_ms > now) ? (int)(s->deadline_ms - now) : 0;
+                if (timeout_ms < 0 || until < timeout_ms) {
+                    timeout_ms = until;
+                }
+            }
+        } else if (nfds < MAX_EVENTS_PER_WAIT && s->events != 0) {
+            fds[nfds].fd = s->fd;
+            fds[nfds].events = (short)(((s->events & EVENT_READ) ? POLLIN : 0) |
+                                       ((s->events & EVENT_WRITE) ? POLLOUT : 0));
+            fds[nfds].revents = 0;
+            owners[nfds++] = s;
+        }
+    }
+
+    int ready = poll(fds, nfds, timeout_ms);
+    if (ready == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        fprintf(stderr, "Error: poll() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int dispatched = 0;
+    for (nfds_t i = 0; i < nfds; i++) {
+        if (fds[i].revents == 0 || owners[i]->removed) {
+            continue;
+        }
+
+        uint32_t events = 0;
+        if (fds[i].revents & POLLIN) {
+            events |= EVENT_READ;
+        }
+        if (fds[i].revents & POLLOUT) {
+            events |= EVENT_WRITE;
+        }
+        if (fds[i].revents & POLLHUP) {
+            events |= EVENT_HANGUP;
+        }
+        if (fds[i].revents & (POLLERR | POLLNVAL)) {
+            events |= EVENT_ERROR;
+        }
+
+        owners[i]->callback(owners[i]->fd, events, owners[i]->userdata);
+        dispatched++;
+    }
+
+    now = event_now_ms();
+    EventSource *s = loop->sources;
+    while (s != NULL) {
+        if (!s->is_timer || s->deadline_ms == 0 || s->deadline_ms > now) {
+            s = s->next;
+            continue;
+        }
+
+        s->deadline_ms = (s->interval_ms > 0) ? now + s->interval_ms : 0;
+        s->callback(s->fd, EVENT_READ, s->userdata);
+        dispatched++;
+
+        // The callback may have removed sources; rescan, fired timers are re-armed past now
+        s = loop->sources;
+    }
+
+    collect_garbage(loop);
+
+    return dispatched;
+}
+
+void event_loop_cleanup(EventLoop *loop) {
+    if (loop == NULL) {
+        return;
+    }
+
+    cleanup_signals(loop);
+    while (loop->sources != NULL) {
+        event_loop_remove(loop, loop->sources);
+    }
+    collect_garbage(loop);
+
+    // The handlers are back to their defaults, so nothing writes here anymore
+    if (g_signal_pipe != -1) {
+        close(g_signal_pipe);
+        g_signal_pipe = -1;
+    }
+}
+
+#endif
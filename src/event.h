@@ -0,0 +1,238 @@
+/**
+ * @file event.h
+ * @brief Event loop for AISH (AI Shell)
+ *
+ * A single registration API for every event source the main loop waits on:
+ * file descriptors (stdin, the pty master, sockets), timers, signals and
+ * child process exits. On Linux the loop is backed by edge-triggered epoll,
+ * timerfd, signalfd and pidfd; elsewhere it falls back to poll() with
+ * software timers and a self-pipe for signals. Callbacks must drain their
+ * fd until EAGAIN, unless it was registered with EVENT_LEVEL.
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#define EVENT_READ   (1u << 0)  /**< Fd is readable */
+#define EVENT_WRITE  (1u << 1)  /**< Fd is writable */
+#define EVENT_HANGUP (1u << 2)  /**< Peer hung up */
+#define EVENT_ERROR  (1u << 3)  /**< Error condition on fd */
+#define EVENT_LEVEL  (1u << 4)  /**< Registration flag: level-triggered, need not drain the fd */
+
+#define EVENT_MAX_SIGNAL 65     /**< Signals numbered below this can be watched */
+
+/**
+ * @brief Callback invoked when an event source becomes ready
+ *
+ * @param fd The file descriptor of the source
+ * @param events Mask of EVENT_* flags that are ready
+ * @param userdata Opaque pointer given at registration
+ */
+typedef void (*EventCallback)(int fd, uint32_t events, void *userdata);
+
+/**
+ * @brief Callback invoked when a watched signal is delivered
+ *
+ * @param signo The signal number
+ * @param userdata Opaque pointer given at registration
+ */
+typedef void (*EventSignalCallback)(int signo, void *userdata);
+
+/**
+ * @brief Callback invoked when a watched child process exits
+ *
+ * @param pid The child's process ID (already reaped)
+ * @param status Exit status as returned by waitpid()
+ * @param userdata Opaque pointer given at registration
+ */
+typedef void (*EventChildCallback)(pid_t pid, int status, void *userdata);
+
+/**
+ * @struct EventSource
+ * @brief A registered file descriptor or timer
+ */
+typedef struct EventSource {
+    int fd;                     /**< Watched fd (timerfd for timers) */
+    uint32_t events;            /**< Requested EVENT_* mask */
+    EventCallback callback;     /**< Callback to run when ready */
+    void *userdata;             /**< Opaque callback argument */
+    bool is_timer;              /**< True if the source is a timer */
+    bool removed;               /**< Set once removed, freed after dispatch */
+    uint64_t deadline_ms;       /**< Next expiry (poll fallback timers only) */
+    uint64_t interval_ms;       /**< Re-arm interval, 0 for one-shot */
+    struct EventSource *next;   /**< Next source in the loop's list */
+} EventSource;
+
+/**
+ * @struct EventChild
+ * @brief A child process whose exit is being watched
+ */
+typedef struct EventChild {
+    struct EventLoop *loop;     /**< Loop the child is watched by */
+    pid_t pid;                  /**< Process ID of the child */
+    EventChildCallback callback;/**< Callback to run on exit */
+    void *userdata;             /**< Opaque callback argument */
+    EventSource *source;        /**< pidfd source (NULL if watched via SIGCHLD) */
+    struct EventChild *next;    /**< Next watched child */
+} EventChild;
+
+/**
+ * @struct EventLoop
+ * @brief Structure to hold the state of the event loop
+ */
+typedef struct EventLoop {
+    int epoll_fd;               /**< epoll instance (-1 on poll fallback) */
+    EventSource *sources;       /**< All live sources */
+    EventSource *garbage;       /**< Sources removed during dispatch */
+    unsigned source_count;      /**< Number of live sources */
+    int signal_fd;              /**< signalfd, or self-pipe read end (-1 if none) */
+    EventSource *signal_source; /**< Loop registration for signal_fd */
+    sigset_t signal_mask;       /**< Signals delivered through the loop */
+    sigset_t saved_mask;        /**< Signal mask before the loop took over */
+    EventSignalCallback signal_callbacks[EVENT_MAX_SIGNAL]; /**< Per-signal callbacks */
+    void *signal_userdata[EVENT_MAX_SIGNAL];                /**< Per-signal arguments */
+    EventChild *children;       /**< Watched child processes */
+} EventLoop;
+
+/**
+ * @brief Initialize an event loop
+ *
+ * @param loop Pointer to EventLoop structure to initialize
+ * @return true if initialization was successful, false otherwise
+ */
+bool event_loop_init(EventLoop *loop);
+
+/**
+ * @brief Register a file descriptor with the loop
+ *
+ * The fd should be non-blocking; on Linux it is watched edge-triggered
+ * unless EVENT_LEVEL is given.
+ *
+ * @param loop Pointer to EventLoop structure
+ * @param fd File descriptor to watch
+ * @param events Mask of EVENT_READ and/or EVENT_WRITE, plus EVENT_LEVEL if wanted
+ * @param callback Callback to run when the fd is ready
+ * @param userdata Opaque callback argument
+ * @return The new source, or NULL on failure
+ */
+EventSource *event_loop_add_fd(EventLoop *loop, int fd, uint32_t events,
+                               EventCallback callback, void *userdata);
+
+/**
+ * @brief Change the events a registered fd is watched for
+ *
+ * @param loop Pointer to EventLoop structure
+ * @param source Source returned by event_loop_add_fd
+ * @param events New mask of EVENT_READ and/or EVENT_WRITE (and EVENT_LEVEL)
+ * @return true if successful, false otherwise
+ */
+bool event_loop_modify_fd(EventLoop *loop, EventSource *source, uint32_t events);
+
+/**
+ * @brief Register a timer with the loop
+ *
+ * @param loop Pointer to EventLoop structure
+ * @param initial_ms Delay before the first expiry, 0 to create it disarmed
+ * @param interval_ms Period for repeating timers, 0 for one-shot
+ * @param callback Callback to run on expiry
+ * @param userdata Opaque callback argument
+ * @return The new source, or NULL on failure
+ */
+EventSource *event_loop_add_timer(EventLoop *loop, uint64_t initial_ms, uint64_t interval_ms,
+                                  EventCallback callback, void *userdata);
+
+/**
+ * @brief Re-arm or disarm a timer
+ *
+ * @param loop Pointer to EventLoop structure
+ * @param source Source returned by event_loop_add_timer
+ * @param initial_ms Delay before the next expiry, 0 to disarm
+ * @param interval_ms Period for repeating timers, 0 for one-shot
+ * @return true if successful, false otherwise
+ */
+bool event_loop_set_timer(EventLoop *loop, EventSource *source, uint64_t initial_ms,
+                          uint64_t interval_ms);
+
+/**
+ * @brief Deliver a signal through the loop instead of an async handler
+ *
+ * The signal is blocked and read from a signalfd, so it cannot race with
+ * the blocking wait. Registering a signal again replaces its callback.
+ *
+ * @param loop Pointer to EventLoop structure
+ * @param signo Signal number to watch
+ * @param callback Callback to run when the signal arrives
+ * @param userdata Opaque callback argument
+ * @return true if successful, false otherwise
+ */
+bool event_loop_add_signal(EventLoop *loop, int signo, EventSignalCallback callback, void *userdata);
+
+/**
+ * @brief Watch a child process and reap it when it exits
+ *
+ * Uses a pidfd where the kernel supports it, otherwise SIGCHLD.
+ *
+ * @param loop Pointer to EventLoop structure
+ * @param pid Process ID of the child
+ * @param callback Callback to run once the child has exited
+ * @param userdata Opaque callback argument
+ * @return true if successful, false otherwise
+ */
+bool event_loop_add_child(EventLoop *loop, pid_t pid, EventChildCallback callback, void *userdata);
+
+/**
+ * @brief Restore the signal mask and dispositions from before the loop
+ *
+ * Call in a forked child before exec so it does not inherit blocked signals.
+ *
+ * @param loop Pointer to EventLoop structure
+ */
+void event_loop_restore_signals(EventLoop *loop);
+
+/**
+ * @brief Unregister a source
+ *
+ * Safe to call from inside a callback, including for the source being
+ * dispatched. Timer fds are closed; other fds remain owned by the caller.
+ *
+ * @param loop Pointer to EventLoop structure
+ * @param source Source to remove (NULL is ignored)
+ */
+void event_loop_remove(EventLoop *loop, EventSource *source);
+
+/**
+ * @brief Wait for events and dispatch their callbacks once
+ *
+ * @param loop Pointer to EventLoop structure
+ * @param timeout_ms Maximum time to wait, -1 to wait indefinitely
+ * @return Number of callbacks dispatched, 0 on timeout or EINTR, -1 on error
+ */
+int event_loop_run_once(EventLoop *loop, int timeout_ms);
+
+/**
+ * @brief Get a monotonic timestamp in milliseconds
+ *
+ * @return Milliseconds since an arbitrary fixed point
+ */
+uint64_t event_now_ms(void);
+
+/**
+ * @brief Get a monotonic timestamp in microseconds
+ *
+ * @return Microseconds since the same fixed point as event_now_ms()
+ */
+uint64_t event_now_us(void);
+
+/**
+ * @brief Unregister all sources and release the loop
+ *
+ * @param loop Pointer to EventLoop structure
+ */
+void event_loop_cleanup(EventLoop *loop);
+
+#endif /* EVENT_H */
@@ -0,0 +1,86 @@
+/**
+ * @file histogram.c
+ * @brief Implementation of the log-linear latency histograms for AISH
+ */
+
+#include "histogram.h"
+#include <string.h>
+
+#define SUB_COUNT (1u << HISTOGRAM_SUB_BITS)
+#define MAX_VALUE ((UINT64_C(1) << HISTOGRAM_MAX_BITS) - 1)
+
+/**
+ * @brief Position of the highest set bit (value must not be 0)
+ */
+static unsigned highest_bit(uint64_t value) {
+#if defined(__GNUC__)
+    return 63u - (unsigned)__builtin_clzll(value);
+#else
+    unsigned bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static unsigned bucket_index(uint64_t value) {
+    // Values below two full steps are their own bucket
+    if (value < 2 * SUB_COUNT) {
+        return (unsigned)value;
+    }
+
+    unsigned shift = highest_bit(value) - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (unsigned)((value >> shift) & (SUB_COUNT - 1));
+}
+
+static uint64_t bucket_highest(unsigned index) {
+    if (index < 2 * SUB_COUNT) {
+        return index;
+    }
+
+    unsigned shift = index / SUB_COUNT - 1;
+    uint64_t lowest = (uint64_t)(SUB_COUNT + index % SUB_COUNT) << shift;
+    return lowest + (UINT64_C(1) << shift) - 1;
+}
+
+void histogram_reset(Histogram *hist) {
+    memset(hist, 0, sizeof(Histogram));
+}
+
+void histogram_record(Histogram *hist, uint64_t value) {
+    if (value > MAX_VALUE) {
+        value = MAX_VALUE;
+    }
+
+    hist->counts[bucket_index(value)]++;
+    hist->count++;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+uint64_t histogram_percentile(const Histogram *hist, double percentile) {
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    // Rank of the value that percentile of all values are at or below
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)hist->count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    } else if (rank > hist->count) {
+        rank = hist->count;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_highest(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+
+    return hist->max;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file histogram.h
+ * @brief Log-linear latency histograms for AISH (AI Shell)
+ *
+ * Values (microseconds) are counted in buckets that are exact below 32
+ * and split every power of two into 16 linear steps above that, so any
+ * percentile is within about 6% of the true value. Recording is a few
+ * integer operations and the histogram is a fixed-size array, cheap
+ * enough to time every keystroke and every write of a session.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS 4                        /**< log2 of the steps per power of two */
+#define HISTOGRAM_MAX_BITS 32                       /**< Larger values are clamped */
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+/**
+ * @struct Histogram
+ * @brief Counts of recorded values by bucket
+ */
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS]; /**< Values recorded per bucket */
+    uint64_t count;                     /**< Values recorded in total */
+    uint64_t max;                       /**< Largest value recorded */
+} Histogram;
+
+/**
+ * @brief Empty a histogram
+ *
+ * @param hist Pointer to Histogram structure
+ */
+void histogram_reset(Histogram *hist);
+
+/**
+ * @brief Record one value
+ *
+ * @param hist Pointer to Histogram structure
+ * @param value Value to record
+ */
+void histogram_record(Histogram *hist, uint64_t value);
+
+/**
+ * @brief Estimate a percentile
+ *
+ * @param hist Pointer to Histogram structure
+ * @param percentile Percentile between 0 and 100
+ * @return Highest value of the bucket holding the percentile (never above
+ *         the largest value recorded), 0 if the histogram is empty
+ */
+uint64_t histogram_percentile(const Histogram *hist, double percentile);
+
+#endif /* HISTOGRAM_H */
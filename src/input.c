@@ -0,0 +1,184 @@
+/**
+ * @file input.c
+ * @brief Implementation of the keystroke tokenizer for AISH
+ */
+
+#include "input.h"
+#include <string.h>
+
+#define KEY_TAB '\t'
+#define KEY_ESC '\033'
+#define KEY_DEL 127
+#define KEY_CTRL_C 3
+
+#define PASTE_START_PARAM 200
+#define PASTE_END_MARKER "\033[201~"
+#define PASTE_END_LEN (sizeof(PASTE_END_MARKER) - 1)
+#define CSI_PARAM_MAX 9999
+
+/**
+ * @brief Check whether a byte ends a run of plain text
+ */
+static bool is_special(unsigned char c) {
+    return c == KEY_TAB || c == '\r' || c == '\n' || c == '\b' || c == KEY_DEL || c == KEY_ESC ||
+           c == KEY_CTRL_C;
+}
+
+void input_parser_init(InputParser *parser) {
+    if (parser == NULL) {
+        return;
+    }
+
+    parser->state = INPUT_STATE_GROUND;
+    parser->csi_param = 0;
+    parser->paste_match = 0;
+}
+
+/**
+ * @brief Consume (part of) an escape sequence
+ */
+static size_t scan_escape(InputParser *parser, const unsigned char *p, size_t len) {
+    size_t i = 0;
+
+    while (i < len && parser->state != INPUT_STATE_GROUND && parser->state != INPUT_STATE_PASTE) {
+        unsigned char c = p[i++];
+
+        switch (parser->state) {
+        case INPUT_STATE_ESCAPE:
+            if (c == '[') {
+                parser->state = INPUT_STATE_CSI;
+                parser->csi_param = 0;
+            } else if (c == 'O') {
+                parser->state = INPUT_STATE_SS3;
+            } else {
+                // Two-byte sequence such as Alt+key
+                parser->state = INPUT_STATE_GROUND;
+            }
+            break;
+        case INPUT_STATE_CSI:
+            // Parameters and intermediates run until a final byte in 0x40-0x7E
+            if (c >= '0' && c <= '9' && parser->csi_param <= CSI_PARAM_MAX) {
+                parser->csi_param = parser->csi_param * 10 + (unsigned)(c - '0');
+            } else if (c >= 0x40 && c <= 0x7E) {
+                bool paste = (c == '~' && parser->csi_param == PASTE_START_PARAM);
+                parser->state = paste ? INPUT_STATE_PASTE : INPUT_STATE_GROUND;
+            }
+            break;
+        case INPUT_STATE_SS3:
+            parser->state = INPUT_STATE_GROUND;
+            break;
+        default:
+            parser->state = INPUT_STATE_GROUND;
+            break;
+        }
+    }
+
+    return i;
+}
+
+/**
+ * @brief Return pasted bytes up to the end marker
+ */
+static size_t scan_paste(InputParser *parser, const char *data, size_t len, InputToken *token) {
+    const char *marker = PASTE_END_MARKER;
+    size_t matched = parser->paste_match;
+    size_t i = 0;
+
+    token->type = INPUT_TOKEN_PASTE;
+    token->data = data;
+
+    // Plain pasted bytes up to the next ESC
+    if (matched == 0 && data[0] != KEY_ESC) {
+        const char *esc = memchr(data, KEY_ESC, len);
+        token->len = (esc != NULL) ? (size_t)(esc - data) : len;
+        return token->len;
+    }
+
+    while (i < len && matched + i < PASTE_END_LEN && data[i] == marker[matched + i]) {
+        i++;
+    }
+
+    if (matched + i == PASTE_END_LEN) {
+        // Always the whole marker, even if part of it was held back
+        parser->state = INPUT_STATE_GROUND;
+        parser->paste_match = 0;
+        token->type = INPUT_TOKEN_PASTE_END;
+        token->data = marker;
+        token->len = PASTE_END_LEN;
+        return i;
+    }
+
+    if (i == len) {
+        // The chunk ends inside what may be the end marker: hold it back
+        parser->paste_match = matched + i;
+        token->len = 0;
+        return i;
+    }
+
+    if (matched > 0) {
+        // What was held back turned out to be pasted text
+        parser->paste_match = 0;
+        token->data = marker;
+        token->len = matched;
+        return 0;
+    }
+
+    // A lone ESC inside the paste
+    token->len = 1;
+    return 1;
+}
+
+size_t input_parser_next(InputParser *parser, const char *data, size_t len, InputToken *token) {
+    const unsigned char *p = (const unsigned char *)data;
+
+    if (parser->state == INPUT_STATE_PASTE) {
+        return scan_paste(parser, data, len, token);
+    }
+
+    token->data = data;
+
+    // Continue an escape sequence left open by the previous chunk
+    if (parser->state != INPUT_STATE_GROUND) {
+        token->len = scan_escape(parser, p, len);
+        token->type = (parser->state == INPUT_STATE_PASTE) ? INPUT_TOKEN_PASTE_START : INPUT_TOKEN_ESCAPE;
+        return token->len;
+    }
+
+    switch (p[0]) {
+    case KEY_TAB:
+        token->type = INPUT_TOKEN_TAB;
+        token->len = 1;
+        return 1;
+    case '\r':
+    case '\n':
+        token->type = INPUT_TOKEN_ENTER;
+        token->len = 1;
+        return 1;
+    case '\b':
+    case KEY_DEL:
+        token->type = INPUT_TOKEN_BACKSPACE;
+        token->len = 1;
+        return 1;
+    case KEY_CTRL_C:
+        token->type = INPUT_TOKEN_INTERRUPT;
+        token->len = 1;
+        return 1;
+    case KEY_ESC:
+        parser->state = INPUT_STATE_ESCAPE;
+        token->len = 1 + scan_escape(parser, p + 1, len - 1);
+        token->type = (parser->state == INPUT_STATE_PASTE) ? INPUT_TOKEN_PASTE_START : INPUT_TOKEN_ESCAPE;
+        return token->len;
+    default:
+        break;
+    }
+
+    // Plain text: extend the run up to the next special byte
+    size_t i = 1;
+    while (i < len && !is_special(p[i])) {
+        i++;
+    }
+
+    token->type = INPUT_TOKEN_TEXT;
+    token->len = i;
+    return i;
+}
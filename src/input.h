@@ -0,0 +1,92 @@
+/**
+ * @file input.h
+ * @brief Keystroke tokenizer for AISH (AI Shell)
+ *
+ * Splits a chunk of raw terminal input into tokens: runs of plain bytes,
+ * the keys AISH reacts to (Tab, Enter, Backspace, Ctrl+C) and escape sequences.
+ * The parser keeps its state between chunks, so a sequence split across
+ * two reads is still recognized.
+ *
+ * Bracketed paste markers (ESC [ 200 ~ ... ESC [ 201 ~) are recognized too:
+ * everything between them comes back as paste tokens, so a pasted Tab or
+ * newline is never mistaken for a keystroke.
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @enum InputTokenType
+ * @brief Kinds of tokens produced by the parser
+ */
+typedef enum {
+    INPUT_TOKEN_TEXT,       /**< Run of plain bytes */
+    INPUT_TOKEN_TAB,        /**< Tab key */
+    INPUT_TOKEN_ENTER,      /**< Carriage return or newline */
+    INPUT_TOKEN_BACKSPACE,  /**< Backspace or DEL */
+    INPUT_TOKEN_INTERRUPT,  /**< Ctrl+C (the terminal is raw, so no SIGINT) */
+    INPUT_TOKEN_ESCAPE,     /**< Escape sequence (or part of one) */
+    INPUT_TOKEN_PASTE_START,/**< Bracketed paste start marker (or its tail) */
+    INPUT_TOKEN_PASTE,      /**< Run of pasted bytes */
+    INPUT_TOKEN_PASTE_END   /**< Bracketed paste end marker */
+} InputTokenType;
+
+/**
+ * @struct InputToken
+ * @brief A token, usually pointing into the chunk that was parsed
+ *
+ * Bytes held back because they might start a paste end marker are returned
+ * later from a static copy (as the marker, or as pasted text if it was not
+ * one), so data is not always inside the current chunk.
+ */
+typedef struct {
+    InputTokenType type;    /**< Kind of token */
+    const char *data;       /**< First byte of the token */
+    size_t len;             /**< Length of the token in bytes */
+} InputToken;
+
+/**
+ * @enum InputParserState
+ * @brief States of the keystroke state machine
+ */
+typedef enum {
+    INPUT_STATE_GROUND,     /**< Between keys */
+    INPUT_STATE_ESCAPE,     /**< After ESC */
+    INPUT_STATE_CSI,        /**< Inside ESC [ ... */
+    INPUT_STATE_SS3,        /**< After ESC O */
+    INPUT_STATE_PASTE       /**< Between bracketed paste markers */
+} InputParserState;
+
+/**
+ * @struct InputParser
+ * @brief Structure to hold the state of the keystroke parser
+ */
+typedef struct {
+    InputParserState state; /**< Current state */
+    unsigned csi_param;     /**< First numeric parameter of the current CSI sequence */
+    size_t paste_match;     /**< Bytes of a paste end marker seen at the end of the last chunk */
+} InputParser;
+
+/**
+ * @brief Initialize a keystroke parser
+ *
+ * @param parser Pointer to InputParser structure to initialize
+ */
+void input_parser_init(InputParser *parser);
+
+/**
+ * @brief Extract the next token from a chunk of input
+ *
+ * @param parser Pointer to InputParser structure
+ * @param data Remaining input bytes
+ * @param len Number of remaining input bytes (must be > 0)
+ * @param token Pointer to InputToken to fill
+ * @return Number of bytes consumed; this differs from token->len only while
+ *         a possible paste end marker is held back across chunks
+ */
+size_t input_parser_next(InputParser *parser, const char *data, size_t len, InputToken *token);
+
+#endif /* INPUT_H */
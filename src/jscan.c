@@ -0,0 +1,374 @@
+/**
+ * @file jscan.c
+ * @brief Implementation of the single-pass JSON scanner for AISH
+ */
+
+#include "jscan.h"
+#include <string.h>
+
+/**
+ * @brief Skip whitespace
+ */
+static const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * @brief Skip a string
+ *
+ * @param p The opening quote
+ * @return The byte after the closing quote, or NULL if the string is not closed
+ */
+static const char *skip_string(const char *p, const char *end) {
+    p++;
+    for (;;) {
+        const char *quote = memchr(p, '"', (size_t)(end - p));
+        if (quote == NULL) {
+            return NULL;
+        }
+
+        // The quote is escaped if an odd number of backslashes precede it
+        const char *slash = quote;
+        while (slash > p && slash[-1] == '\\') {
+            slash--;
+        }
+        if ((quote - slash) % 2 == 0) {
+            return quote + 1;
+        }
+        p = quote + 1;
+    }
+}
+
+/**
+ * @brief Skip an object or array, nested ones included
+ *
+ * @param p The opening brace or bracket
+ * @return The byte after the matching close, or NULL if there is none
+ */
+static const char *skip_container(const char *p, const char *end) {
+    size_t depth = 0;
+
+    while (p < end) {
+        switch (*p) {
+        case '"':
+            p = skip_string(p, end);
+            if (p == NULL) {
+                return NULL;
+            }
+            continue;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (--depth == 0) {
+                return p + 1;
+            }
+            break;
+        default:
+            break;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Skip a value, recording what it was
+ *
+ * @param p First byte of the value
+ * @param value Filled in if not NULL
+ * @return The byte after the value, or NULL if it is malformed
+ */
+static const char *scan_value(const char *p, const char *end, JScanValue *value) {
+    static const struct {
+        char first;
+        const char *text;
+        JScanType type;
+    } literals[] = {
+        { 't', "true", JSCAN_TRUE },
+        { 'f', "false", JSCAN_FALSE },
+        { 'n', "null", JSCAN_NULL }
+    };
+    const char *next;
+    JScanType type;
+
+    if (p >= end) {
+        return NULL;
+    }
+
+    if (*p == '"') {
+        next = skip_string(p, end);
+        if (next != NULL && value != NULL) {
+            value->type = JSCAN_STRING;
+            value->start = p + 1;
+            value->len = (size_t)(next - p) - 2;
+        }
+        return next;
+    }
+
+    if (*p == '{' || *p == '[') {
+        type = (*p == '{') ? JSCAN_OBJECT : JSCAN_ARRAY;
+        next = skip_container(p, end);
+    } else if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        type = JSCAN_NUMBER;
+        next = p + 1;
+        while (next < end && ((*next >= '0' && *next <= '9') || *next == '.' || *next == 'e' ||
+                              *next == 'E' || *next == '+' || *next == '-')) {
+            next++;
+        }
+    } else {
+        next = NULL;
+        type = JSCAN_NULL;
+        for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+            size_t len = strlen(literals[i].text);
+            if (*p == literals[i].first && (size_t)(end - p) >= len && memcmp(p, literals[i].text, len) == 0) {
+                type = literals[i].type;
+                next = p + len;
+                break;
+            }
+        }
+    }
+
+    if (next != NULL && value != NULL) {
+        value->type = type;
+        value->start = p;
+        value->len = (size_t)(next - p);
+    }
+    return next;
+}
+
+/**
+ * @brief Move to the member of an object with the given key
+ *
+ * @param p The opening brace
+ * @return The member's value, or NULL if there is no such member
+ */
+static const char *find_member(const char *p, const char *end, const char *key, size_t key_len) {
+    p = skip_space(p + 1, end);
+    if (p < end && *p == '}') {
+        return NULL;
+    }
+
+    while (p < end && *p == '"') {
+        const char *name = p + 1;
+        p = skip_string(p, end);
+        if (p == NULL) {
+            return NULL;
+        }
+        size_t name_len = (size_t)(p - name) - 1;
+
+        p = skip_space(p, end);
+        if (p >= end || *p != ':') {
+            return NULL;
+        }
+        p = skip_space(p + 1, end);
+        if (name_len == key_len && memcmp(name, key, key_len) == 0) {
+            return p;
+        }
+
+        p = scan_value(p, end, NULL);
+        if (p == NULL) {
+            return NULL;
+        }
+        p = skip_space(p, end);
+        if (p >= end || *p != ',') {
+            return NULL; // '}' (no such member) or malformed
+        }
+        p = skip_space(p + 1, end);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Move to the element of an array with the given index
+ *
+ * @param p The opening bracket
+ * @return The element, or NULL if the array is shorter
+ */
+static const char *find_element(const char *p, const char *end, size_t index) {
+    p = skip_space(p + 1, end);
+    if (p < end && *p == ']') {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < index; i++) {
+        p = scan_value(p, end, NULL);
+        if (p == NULL) {
+            return NULL;
+        }
+        p = skip_space(p, end);
+        if (p >= end || *p != ',') {
+            return NULL;
+        }
+        p = skip_space(p + 1, end);
+    }
+    return p;
+}
+
+bool jscan_find(const char *json, size_t len, const char *path, JScanValue *value) {
+    const char *end = json + len;
+    const char *p = skip_space(json, end);
+
+    while (*path != '\0') {
+        const char *dot = strchr(path, '.');
+        size_t segment_len = (dot != NULL) ? (size_t)(dot - path) : strlen(path);
+
+        if (p < end && *p == '{') {
+            p = find_member(p, end, path, segment_len);
+        } else if (p < end && *p == '[') {
+            size_t index = 0;
+            for (size_t i = 0; i < segment_len; i++) {
+                if (path[i] < '0' || path[i] > '9') {
+                    return false;
+                }
+                index = index * 10 + (size_t)(path[i] - '0');
+            }
+            p = (segment_len > 0) ? find_element(p, end, index) : NULL;
+        } else {
+            return false;
+        }
+        if (p == NULL) {
+            return false;
+        }
+
+        path += segment_len;
+        if (*path == '.') {
+            path++;
+        }
+    }
+
+    return scan_value(p, end, value) != NULL;
+}
+
+/**
+ * @brief Read the four hex digits of a \u escape
+ *
+ * @return The code unit, or -1 if the digits are invalid
+ */
+static long read_hex4(const char *p, const char *end) {
+    long unit = 0;
+
+    if (end - p < 4) {
+        return -1;
+    }
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        unit <<= 4;
+        if (c >= '0' && c <= '9') {
+            unit |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            unit |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            unit |= c - 'A' + 10;
+        } else {
+            return -1;
+        }
+    }
+    return unit;
+}
+
+/**
+ * @brief Write a code point as UTF-8
+ *
+ * @return The byte after the encoding
+ */
+static char *put_utf8(char *out, unsigned long code) {
+    if (code < 0x80) {
+        *out++ = (char)code;
+    } else if (code < 0x800) {
+        *out++ = (char)(0xc0 | (code >> 6));
+        *out++ = (char)(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        *out++ = (char)(0xe0 | (code >> 12));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (code & 0x3f));
+    } else {
+        *out++ = (char)(0xf0 | (code >> 18));
+        *out++ = (char)(0x80 | ((code >> 12) & 0x3f));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (code & 0x3f));
+    }
+    return out;
+}
+
+bool jscan_unescape(char *text, size_t *len) {
+    const char *end = text + *len;
+    const char *in = memchr(text, '\\', *len);
+    if (in == NULL) {
+        return true; // Nothing to decode, the common case
+    }
+
+    char *out = text + (in - text);
+    while (in < end) {
+        if (*in != '\\') {
+            // Copy the run up to the next escape in one go
+            const char *slash = memchr(in, '\\', (size_t)(end - in));
+            size_t run = (size_t)(((slash != NULL) ? slash : end) - in);
+            memmove(out, in, run);
+            out += run;
+            in += run;
+            continue;
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        char c = in[1];
+        in += 2;
+        switch (c) {
+        case '"': *out++ = '"'; break;
+        case '\\': *out++ = '\\'; break;
+        case '/': *out++ = '/'; break;
+        case 'b': *out++ = '\b'; break;
+        case 'f': *out++ = '\f'; break;
+        case 'n': *out++ = '\n'; break;
+        case 'r': *out++ = '\r'; break;
+        case 't': *out++ = '\t'; break;
+        case 'u': {
+            long unit = read_hex4(in, end);
+            if (unit < 0) {
+                return false;
+            }
+            in += 4;
+
+            unsigned long code = (unsigned long)unit;
+            if (unit >= 0xd800 && unit <= 0xdbff) {
+                // A high surrogate should be followed by an escaped low one
+                long low = (end - in >= 6 && in[0] == '\\' && in[1] == 'u') ? read_hex4(in + 2, end) : -1;
+                if (low >= 0xdc00 && low <= 0xdfff) {
+                    code = 0x10000 + (((unsigned long)unit - 0xd800) << 10) + ((unsigned long)low - 0xdc00);
+                    in += 6;
+                } else {
+                    code = 0xfffd;
+                }
+            } else if (unit >= 0xdc00 && unit <= 0xdfff) {
+                code = 0xfffd;
+            }
+            out = put_utf8(out, code);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    *len = (size_t)(out - text);
+    return true;
+}
+
+bool jscan_string(char *json, size_t len, const char *path, char **text, size_t *text_len) {
+    JScanValue value;
+
+    if (!jscan_find(json, len, path, &value) || value.type != JSCAN_STRING) {
+        return false;
+    }
+
+    *text = json + (value.start - json);
+    *text_len = value.len;
+    return jscan_unescape(*text, text_len);
+}
@@ -0,0 +1,86 @@
+/**
+ * @file jscan.h
+ * @brief Single-pass JSON scanner for AISH (AI Shell)
+ *
+ * Finds one value in a JSON document by its path, like
+ * "choices.0.message.content", in one pass and without building a tree:
+ * members and elements off the path are skipped without being decoded,
+ * so large "usage" or "logprobs" payloads cost little more than a read
+ * of their bytes. Values are returned as views into the caller's buffer,
+ * and strings can be decoded in place (decoding never makes them longer).
+ *
+ * The scanner checks the structure it walks through but not the parts it
+ * skips; it is meant for picking values out of API responses, not for
+ * validating documents.
+ */
+
+#ifndef JSCAN_H
+#define JSCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @enum JScanType
+ * @brief Kind of a JSON value
+ */
+typedef enum {
+    JSCAN_STRING,
+    JSCAN_NUMBER,
+    JSCAN_OBJECT,
+    JSCAN_ARRAY,
+    JSCAN_TRUE,
+    JSCAN_FALSE,
+    JSCAN_NULL
+} JScanType;
+
+/**
+ * @struct JScanValue
+ * @brief A value found in a document
+ */
+typedef struct {
+    JScanType type;     /**< Kind of value */
+    const char *start;  /**< Strings: the text between the quotes, still escaped; others: the whole value */
+    size_t len;         /**< Length of that text */
+} JScanValue;
+
+/**
+ * @brief Find a value by path
+ *
+ * The path is a list of object keys and array indexes separated by dots;
+ * an empty path is the document itself. Keys are compared with their
+ * escaped form in the document and cannot contain dots.
+ *
+ * @param json Document
+ * @param len Length of the document
+ * @param path Path to the value
+ * @param value Filled in with the value if found
+ * @return true if the value was found, false if it is missing or the document is malformed on the way to it
+ */
+bool jscan_find(const char *json, size_t len, const char *path, JScanValue *value);
+
+/**
+ * @brief Decode the escapes of a string in place
+ *
+ * \uXXXX escapes (and surrogate pairs) become UTF-8; a lone surrogate
+ * becomes U+FFFD.
+ *
+ * @param text String contents (JScanValue start of a string), overwritten with the decoded text
+ * @param len Length of the contents; set to the decoded length
+ * @return true if successful, false on an invalid escape
+ */
+bool jscan_unescape(char *text, size_t *len);
+
+/**
+ * @brief Find a string by path and decode it in place
+ *
+ * @param json Document, modified where the string is
+ * @param len Length of the document
+ * @param path Path to the string
+ * @param text Set to the decoded text (not NUL-terminated)
+ * @param text_len Set to its length
+ * @return true if a string was found and decoded, false otherwise
+ */
+bool jscan_string(char *json, size_t len, const char *path, char **text, size_t *text_len);
+
+#endif /* JSCAN_H */
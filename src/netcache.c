@@ -0,0 +1,362 @@
+/**
+ * @file netcache.c
+ * @brief Implementation of the DNS and TLS session cache for AISH
+ */
+
+#include "netcache.h"
+#include "statedir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_FILE_NAME "net-cache"
+#define CACHE_HEADER "# aish net-cache v1"
+#define ADDRESS_TTL_S 3600  // Saved addresses are trusted for an hour
+
+// TLS session export/import appeared in libcurl 8.12
+#if LIBCURL_VERSION_NUM >= 0x080c00
+#define NETCACHE_TLS 1
+#endif
+
+#ifdef NETCACHE_TLS
+/**
+ * @brief Write bytes as lowercase hex ("-" if there are none)
+ */
+static void write_hex(FILE *file, const unsigned char *data, size_t len) {
+    if (len == 0) {
+        fputc('-', file);
+    }
+    for (size_t i = 0; i < len; i++) {
+        fprintf(file, "%02x", data[i]);
+    }
+}
+
+/**
+ * @brief Decode a hex field in place
+ *
+ * @return Number of bytes decoded, or (size_t)-1 if the field is not hex
+ */
+static size_t decode_hex(char *text) {
+    if (strcmp(text, "-") == 0) {
+        return 0;
+    }
+
+    size_t len = strlen(text);
+    if (len % 2 != 0) {
+        return (size_t)-1;
+    }
+
+    for (size_t i = 0; i < len / 2; i++) {
+        unsigned value;
+        if (sscanf(text + 2 * i, "%2x", &value) != 1) {
+            return (size_t)-1;
+        }
+        ((unsigned char *)text)[i] = (unsigned char)value;
+    }
+    return len / 2;
+}
+
+/**
+ * @brief Import one saved TLS session
+ *
+ * @param easy Easy handle attached to the share
+ * @param fields Remainder of the line: valid_until key shmac sdata
+ * @return true if the session was imported, false otherwise
+ */
+static bool load_session(CURL *easy, char *fields) {
+    char *save;
+    char *valid = strtok_r(fields, " ", &save);
+    char *key = strtok_r(NULL, " ", &save);
+    char *shmac = strtok_r(NULL, " ", &save);
+    char *sdata = strtok_r(NULL, " \n", &save);
+    if (valid == NULL || key == NULL || shmac == NULL || sdata == NULL) {
+        return false;
+    }
+
+    long long valid_until = strtoll(valid, NULL, 10);
+    if (valid_until > 0 && valid_until <= (long long)time(NULL)) {
+        return false;
+    }
+
+    size_t key_len = decode_hex(key);
+    size_t shmac_len = decode_hex(shmac);
+    size_t sdata_len = decode_hex(sdata);
+    if (key_len == (size_t)-1 || key_len == 0 || shmac_len == (size_t)-1 || sdata_len == (size_t)-1) {
+        return false;
+    }
+    key[key_len] = '\0';
+
+    return curl_easy_ssls_import(easy, key,
+                                 (const unsigned char *)shmac, shmac_len,
+                                 (const unsigned char *)sdata, sdata_len) == CURLE_OK;
+}
+
+/**
+ * @brief Called by curl for every TLS session in the share
+ */
+static CURLcode save_session(CURL *easy, void *userptr, const char *session_key,
+                             const unsigned char *shmac, size_t shmac_len,
+                             const unsigned char *sdata, size_t sdata_len,
+                             curl_off_t valid_until, int ietf_tls_id, const char *alpn,
+                             size_t earlydata_max) {
+    (void)easy;
+    (void)ietf_tls_id;
+    (void)alpn;
+    (void)earlydata_max;
+    FILE *file = (FILE *)userptr;
+
+    fprintf(file, "tls %lld ", (long long)valid_until);
+    write_hex(file, (const unsigned char *)session_key,
+              session_key != NULL ? strlen(session_key) : 0);
+    fputc(' ', file);
+    write_hex(file, shmac, shmac_len);
+    fputc(' ', file);
+    write_hex(file, sdata, sdata_len);
+    fputc('\n', file);
+
+    return CURLE_OK;
+}
+#endif
+
+/**
+ * @brief Rebuild the address list of the cache from a saved "addr" line
+ */
+static void load_address(NetCache *cache, char *fields, int64_t now) {
+    char *save;
+    char *expires = strtok_r(fields, " ", &save);
+    char *host_port = strtok_r(NULL, " ", &save);
+    char *address = strtok_r(NULL, " \n", &save);
+    if (expires == NULL || host_port == NULL || address == NULL ||
+        cache->address_count == NETCACHE_MAX_ADDRESSES) {
+        return;
+    }
+
+    NetCacheAddress *entry = &cache->addresses[cache->address_count];
+    entry->expires = strtoll(expires, NULL, 10);
+    if (entry->expires <= now ||
+        strlen(host_port) >= sizeof(entry->host_port) || strlen(address) >= sizeof(entry->address)) {
+        return;
+    }
+    strcpy(entry->host_port, host_port);
+    strcpy(entry->address, address);
+    cache->address_count++;
+}
+
+/**
+ * @brief Turn the loaded addresses into CURLOPT_RESOLVE entries
+ *
+ * @return true if successful, false if memory ran out
+ */
+static bool build_resolve(NetCache *cache) {
+    char line[sizeof(cache->addresses[0].host_port) + sizeof(cache->addresses[0].address) + 4];
+
+    for (size_t i = 0; i < cache->address_count; i++) {
+        const NetCacheAddress *entry = &cache->addresses[i];
+
+        // "+" lets the entry time out of curl's DNS cache like a real lookup
+        bool ipv6 = strchr(entry->address, ':') != NULL;
+        snprintf(line, sizeof(line), ipv6 ? "+%s:[%s]" : "+%s:%s", entry->host_port, entry->address);
+        struct curl_slist *resolve = curl_slist_append(cache->resolve, line);
+        if (resolve == NULL) {
+            return false;
+        }
+        cache->resolve = resolve;
+
+        snprintf(line, sizeof(line), "-%s", entry->host_port);
+        struct curl_slist *unresolve = curl_slist_append(cache->unresolve, line);
+        if (unresolve == NULL) {
+            return false;
+        }
+        cache->unresolve = unresolve;
+    }
+
+    return true;
+}
+
+bool netcache_load(NetCache *cache, CURLSH *share) {
+    memset(cache, 0, sizeof(NetCache));
+
+    cache->path = statedir_path(CACHE_FILE_NAME);
+    if (cache->path == NULL) {
+        return true;
+    }
+
+    FILE *file = fopen(cache->path, "r");
+    if (file == NULL) {
+        return true;
+    }
+
+#ifdef NETCACHE_TLS
+    // Sessions are imported through an easy handle into its share
+    CURL *easy = curl_easy_init();
+    if (easy != NULL) {
+        curl_easy_setopt(easy, CURLOPT_SHARE, share);
+    }
+#else
+    (void)share;
+#endif
+
+    int64_t now = (int64_t)time(NULL);
+    char *line = NULL;
+    size_t capacity = 0;
+    bool header = true;
+    while (getline(&line, &capacity, file) != -1) {
+        if (header) {
+            // Ignore files written in another format
+            if (strncmp(line, CACHE_HEADER, strlen(CACHE_HEADER)) != 0) {
+                break;
+            }
+            header = false;
+        } else if (strncmp(line, "addr ", 5) == 0) {
+            load_address(cache, line + 5, now);
+#ifdef NETCACHE_TLS
+        } else if (strncmp(line, "tls ", 4) == 0 && easy != NULL) {
+            if (load_session(easy, line + 4)) {
+                cache->sessions_loaded++;
+            }
+#endif
+        }
+    }
+
+    free(line);
+    fclose(file);
+#ifdef NETCACHE_TLS
+    if (easy != NULL) {
+        curl_easy_cleanup(easy);
+    }
+#endif
+
+    return build_resolve(cache);
+}
+
+struct curl_slist *netcache_resolve(const NetCache *cache) {
+    return cache->stale ? cache->unresolve : cache->resolve;
+}
+
+void netcache_note_address(NetCache *cache, const char *url, const char *address) {
+    if (cache->path == NULL || url == NULL || address == NULL || *address == '\0') {
+        return;
+    }
+
+    CURLU *parsed = curl_url();
+    char *host = NULL;
+    char *port = NULL;
+    if (parsed == NULL || curl_url_set(parsed, CURLUPART_URL, url, 0) != CURLUE_OK ||
+        curl_url_get(parsed, CURLUPART_HOST, &host, 0) != CURLUE_OK ||
+        curl_url_get(parsed, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) != CURLUE_OK) {
+        curl_free(host);
+        curl_url_cleanup(parsed);
+        return;
+    }
+
+    char host_port[sizeof(cache->addresses[0].host_port)];
+    int len = snprintf(host_port, sizeof(host_port), "%s:%s", host, port);
+    curl_free(host);
+    curl_free(port);
+    curl_url_cleanup(parsed);
+    if (len < 0 || (size_t)len >= sizeof(host_port) || strlen(address) >= sizeof(cache->addresses[0].address)) {
+        return;
+    }
+
+    // Replace the entry for the host, or the one closest to expiring
+    NetCacheAddress *entry = NULL;
+    for (size_t i = 0; i < cache->address_count; i++) {
+        if (strcmp(cache->addresses[i].host_port, host_port) == 0) {
+            entry = &cache->addresses[i];
+            break;
+        }
+    }
+    if (entry == NULL && cache->address_count < NETCACHE_MAX_ADDRESSES) {
+        entry = &cache->addresses[cache->address_count++];
+    }
+    if (entry == NULL) {
+        entry = &cache->addresses[0];
+        for (size_t i = 1; i < cache->address_count; i++) {
+            if (cache->addresses[i].expires < entry->expires) {
+                entry = &cache->addresses[i];
+            }
+        }
+    }
+
+    strcpy(entry->host_port, host_port);
+    strcpy(entry->address, address);
+    entry->expires = (int64_t)time(NULL) + ADDRESS_TTL_S;
+    cache->dirty = true;
+}
+
+void netcache_forget_addresses(NetCache *cache) {
+    if (cache->resolve == NULL || cache->stale) {
+        return;
+    }
+
+    cache->stale = true;
+    cache->address_count = 0;
+    cache->dirty = true;
+}
+
+bool netcache_save(NetCache *cache, CURLSH *share) {
+    if (cache->path == NULL || !cache->dirty) {
+        return true;
+    }
+
+    if (!statedir_make_parent(cache->path)) {
+        return false;
+    }
+
+    // Write a new file and move it over the old one; it holds session secrets
+    size_t tmp_len = strlen(cache->path) + 5;
+    char *tmp_path = (char *)malloc(tmp_len);
+    if (tmp_path == NULL) {
+        return false;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", cache->path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE *file = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    if (file == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(tmp_path);
+        return false;
+    }
+
+    fprintf(file, "%s\n", CACHE_HEADER);
+    int64_t now = (int64_t)time(NULL);
+    for (size_t i = 0; i < cache->address_count; i++) {
+        const NetCacheAddress *entry = &cache->addresses[i];
+        if (entry->expires > now) {
+            fprintf(file, "addr %lld %s %s\n", (long long)entry->expires, entry->host_port, entry->address);
+        }
+    }
+
+#ifdef NETCACHE_TLS
+    CURL *easy = curl_easy_init();
+    if (easy != NULL) {
+        curl_easy_setopt(easy, CURLOPT_SHARE, share);
+        curl_easy_ssls_export(easy, save_session, file);
+        curl_easy_cleanup(easy);
+    }
+#else
+    (void)share;
+#endif
+
+    bool ok = (fclose(file) == 0 && rename(tmp_path, cache->path) == 0);
+    if (!ok) {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+
+    cache->dirty = !ok;
+    return ok;
+}
+
+void netcache_free(NetCache *cache) {
+    curl_slist_free_all(cache->resolve);
+    curl_slist_free_all(cache->unresolve);
+    free(cache->path);
+    memset(cache, 0, sizeof(NetCache));
+}
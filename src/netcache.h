@@ -0,0 +1,102 @@
+/**
+ * @file netcache.h
+ * @brief DNS and TLS session state kept across AISH (AI Shell) launches
+ *
+ * Resolved API addresses and TLS session tickets are saved to
+ * $XDG_STATE_HOME/aish/net-cache (~/.local/state/aish by default) and
+ * loaded into the curl share handle at startup, so the first request of a
+ * new AISH skips the DNS lookup and resumes the TLS session instead of
+ * doing a full handshake. TLS sessions can only be saved with libcurl
+ * 8.12 or newer built with session export support; addresses are always
+ * saved.
+ */
+
+#ifndef NETCACHE_H
+#define NETCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <curl/curl.h>
+
+#define NETCACHE_MAX_ADDRESSES 8    /**< Hosts remembered at most */
+
+/**
+ * @struct NetCacheAddress
+ * @brief A resolved host
+ */
+typedef struct {
+    char host_port[272];    /**< "host:port" */
+    char address[64];       /**< Numeric address it resolved to */
+    int64_t expires;        /**< Unix time after which it is not used */
+} NetCacheAddress;
+
+/**
+ * @struct NetCache
+ * @brief Cached network state of the session
+ */
+typedef struct {
+    char *path;                                 /**< Cache file, NULL if unknown */
+    NetCacheAddress addresses[NETCACHE_MAX_ADDRESSES]; /**< Known addresses */
+    size_t address_count;                       /**< Entries used in addresses */
+    struct curl_slist *resolve;                 /**< CURLOPT_RESOLVE entries loaded at startup */
+    struct curl_slist *unresolve;               /**< Entries that take them out again */
+    bool stale;                                 /**< A loaded address failed: stop using them */
+    size_t sessions_loaded;                     /**< TLS sessions imported at startup */
+    bool dirty;                                 /**< Something changed since the last save */
+} NetCache;
+
+/**
+ * @brief Load the cache file into a share handle
+ *
+ * Fresh addresses become CURLOPT_RESOLVE entries (see netcache_resolve())
+ * and TLS sessions are imported into the share. A missing or unreadable
+ * file just leaves the cache empty.
+ *
+ * @param cache Pointer to NetCache structure to initialize
+ * @param share Share handle with DNS and TLS session sharing enabled
+ * @return true if successful, false if memory ran out
+ */
+bool netcache_load(NetCache *cache, CURLSH *share);
+
+/**
+ * @brief Get the CURLOPT_RESOLVE list for a new transfer
+ *
+ * @param cache Pointer to NetCache structure
+ * @return The list, or NULL if there is nothing to set
+ */
+struct curl_slist *netcache_resolve(const NetCache *cache);
+
+/**
+ * @brief Remember the address a transfer connected to
+ *
+ * @param cache Pointer to NetCache structure
+ * @param url URL of the transfer
+ * @param address Numeric address of the connection
+ */
+void netcache_note_address(NetCache *cache, const char *url, const char *address);
+
+/**
+ * @brief Stop using the loaded addresses after one failed to connect
+ *
+ * @param cache Pointer to NetCache structure
+ */
+void netcache_forget_addresses(NetCache *cache);
+
+/**
+ * @brief Write the cache file if anything changed
+ *
+ * @param cache Pointer to NetCache structure
+ * @param share Share handle holding the TLS sessions to save
+ * @return true if successful (or nothing to do), false otherwise
+ */
+bool netcache_save(NetCache *cache, CURLSH *share);
+
+/**
+ * @brief Free resources held by the cache
+ *
+ * @param cache Pointer to NetCache structure
+ */
+void netcache_free(NetCache *cache);
+
+#endif /* NETCACHE_H */
@@ -0,0 +1,308 @@
+/**
+ * @file output.c
+ * @brief Implementation of the coalescing output stage for AISH
+ */
+
+#include "output.h"
+#include "event.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#define OUTPUT_QUEUE_SIZE (256 * 1024)
+#define MIN_READ_SIZE (4 * 1024)
+#define MAX_READ_SIZE (64 * 1024)
+#define OUTPUT_RESERVE (16 * 1024) // kept free for prompts and echo
+
+bool output_init(OutputBuffer *out, int fd) {
+    if (out == NULL) {
+        return false;
+    }
+
+    memset(out, 0, sizeof(OutputBuffer));
+    if (!ringbuf_init(&out->ring, OUTPUT_QUEUE_SIZE)) {
+        return false;
+    }
+
+    out->fd = fd;
+    out->read_size = MIN_READ_SIZE;
+    out->last_sample_ms = event_now_ms();
+
+    return true;
+}
+
+bool output_can_fill(const OutputBuffer *out) {
+    return ringbuf_space(&out->ring) > OUTPUT_RESERVE;
+}
+
+/**
+ * @brief Remember when the len bytes just queued were read
+ */
+static void note_source(OutputBuffer *out, size_t len) {
+    if (out->latency == NULL) {
+        return;
+    }
+
+    size_t end = out->ring.tail;
+    if (out->mark_count == OUTPUT_MARKS) {
+        // Out of marks: the newest one absorbs these bytes
+        out->marks[(out->mark_head + OUTPUT_MARKS - 1) % OUTPUT_MARKS].end = end;
+        return;
+    }
+
+    OutputMark *mark = &out->marks[(out->mark_head + out->mark_count) % OUTPUT_MARKS];
+    mark->start = end >= len ? end - len : 0;
+    mark->end = end;
+    mark->read_us = event_now_us();
+    out->mark_count++;
+}
+
+/**
+ * @brief Record the wait of the oldest source bytes in a write ending at ring position to
+ */
+static void note_written(OutputBuffer *out, size_t to) {
+    if (out->mark_count == 0) {
+        return;
+    }
+
+    OutputMark *oldest = &out->marks[out->mark_head];
+    if (to > oldest->start) {
+        histogram_record(out->latency, event_now_us() - oldest->read_us);
+    }
+
+    // Positions rewind when the queue empties, and then every mark is done
+    if (ringbuf_used(&out->ring) == 0) {
+        out->mark_count = 0;
+        return;
+    }
+    while (out->mark_count > 0 && out->marks[out->mark_head].end <= to) {
+        out->mark_head = (out->mark_head + 1) % OUTPUT_MARKS;
+        out->mark_count--;
+    }
+}
+
+/**
+ * @brief Track the deepest the queue has been
+ */
+static void note_depth(OutputBuffer *out) {
+    uint64_t pending = ringbuf_used(&out->ring);
+    if (pending > out->stats.max_pending) {
+        out->stats.max_pending = pending;
+    }
+}
+
+ssize_t output_fill(OutputBuffer *out, int src_fd) {
+    size_t want = out->read_size;
+
+    if (!output_can_fill(out)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    size_t space = ringbuf_space(&out->ring) - OUTPUT_RESERVE;
+    if (want > space) {
+        want = space;
+    }
+
+    ssize_t bytes_read = ringbuf_read_fd(&out->ring, src_fd, want);
+    if (bytes_read <= 0) {
+        return bytes_read;
+    }
+
+    out->stats.bytes_in += (uint64_t)bytes_read;
+    out->stats.reads++;
+    note_depth(out);
+    note_source(out, (size_t)bytes_read);
+
+    if (out->observer != NULL) {
+        // The bytes just read end at the tail and may wrap around
+        size_t offset = (out->ring.tail - (size_t)bytes_read) & (out->ring.capacity - 1);
+        size_t first = out->ring.capacity - offset;
+        if (first > (size_t)bytes_read) {
+            first = (size_t)bytes_read;
+        }
+        out->observer(out->observer_ctx, out->ring.data + offset, first);
+        if (first < (size_t)bytes_read) {
+            out->observer(out->observer_ctx, out->ring.data, (size_t)bytes_read - first);
+        }
+    }
+
+    // Grow while reads come back full, shrink when output trickles
+    if ((size_t)bytes_read == out->read_size && out->read_size < MAX_READ_SIZE) {
+        out->read_size *= 2;
+    } else if ((size_t)bytes_read < out->read_size / 4 && out->read_size > MIN_READ_SIZE) {
+        out->read_size /= 2;
+    }
+
+    return bytes_read;
+}
+
+bool output_fill_data(OutputBuffer *out, const char *data, size_t len) {
+    if (!output_append(out, data, len)) {
+        return false;
+    }
+
+    out->stats.bytes_in += (uint64_t)len;
+    out->stats.reads++;
+    note_source(out, len);
+
+    if (out->observer != NULL) {
+        out->observer(out->observer_ctx, data, len);
+    }
+    return true;
+}
+
+bool output_append(OutputBuffer *out, const char *data, size_t len) {
+    while (len > 0) {
+        size_t queued = ringbuf_write(&out->ring, data, len);
+        data += queued;
+        len -= queued;
+        note_depth(out);
+
+        if (len == 0) {
+            break;
+        }
+
+        // The queue is full even with the reserve used up: the terminal is
+        // not reading at all, so waiting for it is the only option left
+        if (!output_flush(out)) {
+            return false;
+        }
+        if (ringbuf_space(&out->ring) == 0) {
+            output_wait_writable(out);
+        }
+    }
+
+    return true;
+}
+
+void output_wait_writable(const OutputBuffer *out) {
+    if (out->writer != NULL) {
+        out->writer->wait(out->writer->ctx);
+        return;
+    }
+
+    struct pollfd pfd = { .fd = out->fd, .events = POLLOUT, .revents = 0 };
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR) {
+        continue;
+    }
+}
+
+void output_set_writer(OutputBuffer *out, const OutputWriter *writer) {
+    out->writer = writer;
+    out->in_flight = 0;
+}
+
+void output_set_latency(OutputBuffer *out, Histogram *latency) {
+    out->latency = latency;
+    out->mark_count = 0;
+}
+
+void output_set_observer(OutputBuffer *out, OutputObserver observer, void *ctx) {
+    out->observer = observer;
+    out->observer_ctx = ctx;
+}
+
+bool output_complete(OutputBuffer *out, ssize_t result) {
+    out->in_flight = 0;
+
+    if (result < 0) {
+        errno = (int)-result;
+        return false;
+    }
+
+    size_t from = out->ring.head;
+    ringbuf_consume(&out->ring, (size_t)result);
+    out->stats.bytes_out += (uint64_t)result;
+    out->stats.writes++;
+    note_written(out, from + (size_t)result);
+    return true;
+}
+
+bool output_flush(OutputBuffer *out) {
+    if (out->writer != NULL) {
+        // One write in flight at a time; the rest goes when it completes
+        const char *data;
+        size_t len = ringbuf_peek(&out->ring, &data);
+        if (out->in_flight > 0 || len == 0) {
+            return true;
+        }
+        if (!out->writer->submit(out->writer->ctx, data, len)) {
+            return false;
+        }
+        out->in_flight = len;
+        return true;
+    }
+
+    while (ringbuf_used(&out->ring) > 0) {
+        size_t from = out->ring.head;
+        ssize_t written = ringbuf_write_fd(&out->ring, out->fd);
+
+        if (written > 0) {
+            out->stats.bytes_out += (uint64_t)written;
+            out->stats.writes++;
+            note_written(out, from + (size_t)written);
+        } else if (written == -1 && errno == EINTR) {
+            continue;
+        } else if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool output_drain(OutputBuffer *out) {
+    for (;;) {
+        if (!output_flush(out)) {
+            return false;
+        }
+        if (ringbuf_used(&out->ring) == 0) {
+            return true;
+        }
+        output_wait_writable(out);
+    }
+}
+
+void output_set_stalled(OutputBuffer *out, bool stalled) {
+    if (stalled && out->stall_start_ms == 0) {
+        out->stall_start_ms = event_now_ms();
+        out->stats.stalls++;
+    } else if (!stalled && out->stall_start_ms != 0) {
+        out->stats.stall_ms += event_now_ms() - out->stall_start_ms;
+        out->stall_start_ms = 0;
+    }
+}
+
+size_t output_pending(const OutputBuffer *out) {
+    return ringbuf_used(&out->ring);
+}
+
+void output_sample_rates(OutputBuffer *out, OutputRates *rates) {
+    uint64_t now = event_now_ms();
+    double seconds = (double)(now - out->last_sample_ms) / 1000.0;
+
+    if (seconds <= 0.0) {
+        seconds = 0.001;
+    }
+
+    rates->seconds = seconds;
+    rates->bytes_in = (double)(out->stats.bytes_in - out->last_stats.bytes_in) / seconds;
+    rates->bytes_out = (double)(out->stats.bytes_out - out->last_stats.bytes_out) / seconds;
+    rates->reads = (double)(out->stats.reads - out->last_stats.reads) / seconds;
+    rates->writes = (double)(out->stats.writes - out->last_stats.writes) / seconds;
+
+    out->last_stats = out->stats;
+    out->last_sample_ms = now;
+}
+
+void output_free(OutputBuffer *out) {
+    if (out == NULL) {
+        return;
+    }
+
+    ringbuf_free(&out->ring);
+}
@@ -0,0 +1,255 @@
+/**
+ * @file output.h
+ * @brief Coalescing output stage for AISH (AI Shell)
+ *
+ * Everything AISH shows on the terminal (bash output, prompts, echo) is
+ * queued in one ring buffer and written with writev() once per event loop
+ * iteration, so a scrolling build log costs a few large writes instead of
+ * one write per pty read. Reads from the pty grow in size while they keep
+ * coming back full and shrink again when output slows down.
+ *
+ * The terminal fd is non-blocking and the queue is bounded: when it fills,
+ * the caller stops reading the pty (see output_can_fill) so the kernel
+ * pushes back on bash while keystrokes keep flowing.
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "ringbuf.h"
+#include "histogram.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @struct OutputStats
+ * @brief Counters kept by the output stage
+ */
+typedef struct {
+    uint64_t bytes_in;      /**< Bytes read from the pty */
+    uint64_t bytes_out;     /**< Bytes written to the terminal */
+    uint64_t reads;         /**< read() calls on the pty that returned data */
+    uint64_t writes;        /**< writev() calls on the terminal */
+    uint64_t max_pending;   /**< Highest queue depth seen, in bytes */
+    uint64_t stalls;        /**< Times reading the pty was paused */
+    uint64_t stall_ms;      /**< Total time reading the pty was paused */
+} OutputStats;
+
+/**
+ * @struct OutputRates
+ * @brief Per-second rates derived from two OutputStats snapshots
+ */
+typedef struct {
+    double bytes_in;        /**< Bytes read per second */
+    double bytes_out;       /**< Bytes written per second */
+    double reads;           /**< Reads per second */
+    double writes;          /**< Writes per second */
+    double seconds;         /**< Length of the measured interval */
+} OutputRates;
+
+/**
+ * @struct OutputWriter
+ * @brief Asynchronous replacement for writev() on the destination fd
+ *
+ * submit() starts writing one contiguous run of the queue and reports the
+ * outcome later through output_complete(); wait() blocks until a submitted
+ * write has been reported. Used by the io_uring relay.
+ */
+typedef struct {
+    bool (*submit)(void *ctx, const char *data, size_t len); /**< Start a write */
+    void (*wait)(void *ctx);                                 /**< Wait for a completion */
+    void *ctx;                                               /**< Opaque callback argument */
+} OutputWriter;
+
+/**
+ * @brief Callback shown every byte read from the source (not prompts or echo)
+ *
+ * @param ctx Opaque pointer given to output_set_observer()
+ * @param data Bytes just queued
+ * @param len Number of bytes
+ */
+typedef void (*OutputObserver)(void *ctx, const char *data, size_t len);
+
+#define OUTPUT_MARKS 32   /**< Queued reads timed individually for the latency histogram */
+
+/**
+ * @struct OutputMark
+ * @brief Queue positions of bytes read from the source at one time
+ */
+typedef struct {
+    size_t start;       /**< Ring position of the first byte */
+    size_t end;         /**< Ring position after the last byte */
+    uint64_t read_us;   /**< When they were read */
+} OutputMark;
+
+/**
+ * @struct OutputBuffer
+ * @brief Structure to hold the state of the output stage
+ */
+typedef struct {
+    RingBuffer ring;            /**< Bytes waiting to be written */
+    int fd;                     /**< Destination fd (the terminal) */
+    size_t read_size;           /**< Current adaptive read size */
+    OutputStats stats;          /**< Running totals */
+    OutputStats last_stats;     /**< Totals at the previous rate sample */
+    uint64_t last_sample_ms;    /**< Time of the previous rate sample */
+    uint64_t stall_start_ms;    /**< When the current stall began, 0 if not stalled */
+    const OutputWriter *writer; /**< Asynchronous writer, NULL to use writev() */
+    size_t in_flight;           /**< Bytes submitted to the writer and not yet reported */
+    OutputObserver observer;    /**< Sees source bytes as they are queued, may be NULL */
+    void *observer_ctx;         /**< Opaque observer argument */
+    Histogram *latency;         /**< Read-to-write times of source bytes, may be NULL */
+    OutputMark marks[OUTPUT_MARKS]; /**< Source reads still (partly) queued, oldest first */
+    unsigned mark_head;         /**< Index of the oldest mark */
+    unsigned mark_count;        /**< Number of marks */
+} OutputBuffer;
+
+/**
+ * @brief Initialize the output stage
+ *
+ * @param out Pointer to OutputBuffer structure to initialize
+ * @param fd Destination file descriptor
+ * @return true if initialization was successful, false otherwise
+ */
+bool output_init(OutputBuffer *out, int fd);
+
+/**
+ * @brief Read once from a file descriptor into the queue
+ *
+ * Uses the current adaptive read size, capped by the free space minus a
+ * reserve kept for prompts and echo.
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @param src_fd File descriptor to read from
+ * @return Bytes read, 0 on EOF, -1 on error (errno is set; ENOBUFS if the queue is full)
+ */
+ssize_t output_fill(OutputBuffer *out, int src_fd);
+
+/**
+ * @brief Queue bytes that were read from the source by other means
+ *
+ * Counts them like output_fill() would; the caller must have checked
+ * output_can_fill().
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @param data Bytes read from the source
+ * @param len Number of bytes
+ * @return true if successful, false otherwise
+ */
+bool output_fill_data(OutputBuffer *out, const char *data, size_t len);
+
+/**
+ * @brief Check whether the queue has room for another read
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @return true if output_fill would accept data, false if the queue is full
+ */
+bool output_can_fill(const OutputBuffer *out);
+
+/**
+ * @brief Queue bytes for the terminal
+ *
+ * Only if the queue is completely full does this wait for the terminal.
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @param data Bytes to queue
+ * @param len Number of bytes to queue
+ * @return true if successful, false otherwise
+ */
+bool output_append(OutputBuffer *out, const char *data, size_t len);
+
+/**
+ * @brief Write queued bytes until the terminal would block
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @return true if successful (bytes may remain queued), false on error (errno is set)
+ */
+bool output_flush(OutputBuffer *out);
+
+/**
+ * @brief Write all queued bytes, waiting for the terminal as needed
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @return true if successful, false otherwise (errno is set)
+ */
+bool output_drain(OutputBuffer *out);
+
+/**
+ * @brief Route writes through an asynchronous writer
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @param writer Writer to use, or NULL to go back to writev() (nothing may be in flight)
+ */
+void output_set_writer(OutputBuffer *out, const OutputWriter *writer);
+
+/**
+ * @brief Watch bytes read from the source as they are queued
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @param observer Callback, or NULL to stop watching
+ * @param ctx Opaque callback argument
+ */
+void output_set_observer(OutputBuffer *out, OutputObserver observer, void *ctx);
+
+/**
+ * @brief Time how long source bytes wait between being read and written
+ *
+ * Each write that includes source bytes records how long the oldest of
+ * them waited. When many small reads are queued at once, the newest ones
+ * share a timestamp with an older one, which can only overstate the wait.
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @param latency Histogram to record into (microseconds), or NULL to stop
+ */
+void output_set_latency(OutputBuffer *out, Histogram *latency);
+
+/**
+ * @brief Report the result of a write started by the writer
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @param result Bytes written, or a negative errno value
+ * @return true if successful, false if the write failed (errno is set)
+ */
+bool output_complete(OutputBuffer *out, ssize_t result);
+
+/**
+ * @brief Block until the destination fd can accept more data
+ *
+ * @param out Pointer to OutputBuffer structure
+ */
+void output_wait_writable(const OutputBuffer *out);
+
+/**
+ * @brief Record whether reading the source is paused for backpressure
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @param stalled true while the caller is not reading because of a full queue
+ */
+void output_set_stalled(OutputBuffer *out, bool stalled);
+
+/**
+ * @brief Get the number of bytes waiting to be written
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @return Number of queued bytes
+ */
+size_t output_pending(const OutputBuffer *out);
+
+/**
+ * @brief Compute rates since the previous sample and start a new interval
+ *
+ * @param out Pointer to OutputBuffer structure
+ * @param rates Pointer to OutputRates structure to fill
+ */
+void output_sample_rates(OutputBuffer *out, OutputRates *rates);
+
+/**
+ * @brief Free the output stage
+ *
+ * @param out Pointer to OutputBuffer structure
+ */
+void output_free(OutputBuffer *out);
+
+#endif /* OUTPUT_H */
@@ -26,7 +26,7 @@ bool display_prompt(AishState *state) {
     // Clear the current line
     const char *clear_line = "\r\033[2K"; // Carriage return + clear entire line
     
-    if (write(STDOUT_FILENO, clear_line, strlen(clear_line)) == -1) {
+    if (!aish_write_stdout(state, clear_line, strlen(clear_line))) {
         fprintf(stderr, "Error: Failed to write clear line: %s\n", strerror(errno));
         return false;
     }
@@ -35,15 +35,15 @@ bool display_prompt(AishState *state) {
     if (terminal_get_mode(&state->terminal) == MODE_CHAT) {
         const char *prompt = terminal_get_prompt(&state->terminal);
         
-        if (write(STDOUT_FILENO, prompt, strlen(prompt)) == -1) {
+        if (!aish_write_stdout(state, prompt, strlen(prompt))) {
             fprintf(stderr, "Error: Failed to write prompt: %s\n", strerror(errno));
             return false;
         }
     } else {
         // In Bash mode, send a newline to trigger Bash to display its prompt
         // We'll use a simple newline character to avoid any special characters
-        if (write(state->bash_master_fd, "\n", 1) == -1) {
-            fprintf(stderr, "Error: Failed to write newline to bash: %s\n", strerror(errno));
+        if (!aish_write_bash(state, "\n", 1)) {
+            fprintf(stderr, "Error: Failed to write newline to bash\n");
             return false;
         }
     }
@@ -0,0 +1,1062 @@
+/**
+ * @file respcache.c
+ * @brief Implementation of the persistent response cache for AISH
+ */
+
+#include "respcache.h"
+#include "statedir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define INDEX_MAGIC "AISHRC01"
+#define INDEX_VERSION 2
+#define SLOT_EMPTY 0                    // Hash of a slot never used
+#define SLOT_DELETED 1                  // Hash of a slot whose entry was removed
+#define MAX_RECORD (64 * 1024)          // Larger records are not stored
+#define EVICT_SLACK 8                   // Eviction frees an extra 1/8 of the limits; stores tidy up
+                                        // themselves only 1/8 past them
+#define COMPACT_MIN_BYTES (64 * 1024)   // Smaller logs are never compacted
+#define MIN_SLOTS 64                    // Slots in the smallest table
+#define READ_ATTEMPTS 16                // Lock-free tries of a lookup before it waits for the lock
+
+struct RespCacheHeader {
+    char magic[8];          // INDEX_MAGIC
+    uint32_t version;       // INDEX_VERSION
+    uint32_t slot_count;    // Slots in the table (power of two)
+    uint64_t sequence;      // Odd while a writer changes the table (seqlock)
+    uint32_t retired;       // Set once another file replaced this one
+    uint32_t reserved;
+    uint64_t log_bytes;     // End of the log: where the next record goes
+    uint64_t live_bytes;    // Bytes of the records that slots point to
+    uint64_t entries;       // Slots in use
+    uint64_t tombstones;    // Slots marked SLOT_DELETED
+    uint64_t clock;         // Ticks once per use, for LRU
+    uint64_t generation;    // Ticks each time the log is replaced
+};
+
+struct RespCacheSlot {
+    uint64_t hash;          // Key hash, or SLOT_EMPTY / SLOT_DELETED
+    uint64_t offset;        // Record in the log
+    int64_t created;        // Unix time the value was stored
+    uint64_t last_used;     // Clock at the last use
+    uint32_t length;        // Record length
+    uint32_t reserved;
+};
+
+// Start of a record in the log, followed by the key and the value
+typedef struct {
+    uint64_t hash;
+    uint32_t key_len;
+    uint32_t value_len;
+} RecordHeader;
+
+// A slot and its last use, for sorting by age
+typedef struct {
+    uint64_t last_used;
+    uint32_t index;
+} SlotAge;
+
+uint64_t respcache_hash(const char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Move a key hash off the two reserved slot values
+ */
+static uint64_t slot_hash(uint64_t hash) {
+    return (hash > SLOT_DELETED) ? hash : hash + 2;
+}
+
+/**
+ * @brief Hash a key, avoiding the two reserved slot values
+ */
+static uint64_t hash_key(const char *key, size_t len) {
+    return slot_hash(respcache_hash(key, len));
+}
+
+/**
+ * @brief Take or drop the lock on the index
+ */
+static bool lock_index(RespCache *cache, int operation) {
+    while (flock(cache->index_fd, operation) != 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Read exactly len bytes at an offset
+ */
+static bool read_at(int fd, void *buffer, size_t len, uint64_t offset) {
+    char *p = (char *)buffer;
+    while (len > 0) {
+        ssize_t bytes = pread(fd, p, len, (off_t)offset);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            return false;
+        }
+        p += bytes;
+        len -= (size_t)bytes;
+        offset += (uint64_t)bytes;
+    }
+    return true;
+}
+
+/**
+ * @brief Write exactly len bytes at an offset
+ */
+static bool write_at(int fd, const void *buffer, size_t len, uint64_t offset) {
+    const char *p = (const char *)buffer;
+    while (len > 0) {
+        ssize_t bytes = pwrite(fd, p, len, (off_t)offset);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            return false;
+        }
+        p += bytes;
+        len -= (size_t)bytes;
+        offset += (uint64_t)bytes;
+    }
+    return true;
+}
+
+/**
+ * @brief Size of an index file with a given number of slots
+ */
+static size_t index_size(uint32_t slot_count) {
+    return sizeof(RespCacheHeader) + (size_t)slot_count * sizeof(RespCacheSlot);
+}
+
+/**
+ * @brief Slots in a table for a given entry limit
+ *
+ * A quarter of the slots stay free, so probe sequences remain short.
+ */
+static uint32_t slots_for(uint32_t max_entries) {
+    uint64_t wanted = (uint64_t)max_entries + max_entries / 3 + 1;
+    uint32_t slot_count = MIN_SLOTS;
+    while (slot_count < wanted && slot_count < (UINT32_C(1) << 31)) {
+        slot_count <<= 1;
+    }
+    return slot_count;
+}
+
+/**
+ * @brief Check that a slot's record lies within the log
+ */
+static bool slot_in_log(const RespCacheSlot *slot, uint64_t log_bytes) {
+    return slot->length >= sizeof(RecordHeader) && slot->length <= MAX_RECORD &&
+           slot->offset + slot->length <= log_bytes;
+}
+
+/**
+ * @brief Put a live slot in the first free place of its probe sequence
+ */
+static void insert_slot(RespCache *cache, const RespCacheSlot *slot) {
+    uint32_t mask = cache->slot_count - 1;
+    uint32_t index = (uint32_t)(slot->hash & mask);
+    while (cache->slots[index].hash != SLOT_EMPTY) {
+        index = (index + 1) & mask;
+    }
+    cache->slots[index] = *slot;
+}
+
+/**
+ * @brief Start changing the table
+ *
+ * Called with the lock held. Lookups that overlap the change see the
+ * sequence move and retry. A writer that dies before end_write() leaves
+ * it odd; the next process to take the lock repairs the table.
+ */
+static void begin_write(RespCache *cache) {
+    __atomic_store_n(&cache->header->sequence, cache->header->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Finish changing the table
+ */
+static void end_write(RespCache *cache) {
+    __atomic_store_n(&cache->header->sequence, cache->header->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Note the sequence before a lock-free read
+ *
+ * @return The sequence, odd if a change is under way
+ */
+static uint64_t begin_read(const RespCache *cache) {
+    return __atomic_load_n(&cache->header->sequence, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Check that no change overlapped a lock-free read
+ */
+static bool end_read(const RespCache *cache, uint64_t sequence) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&cache->header->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+/**
+ * @brief Advance the LRU clock, which lookups also do without the lock
+ */
+static uint64_t tick(RespCache *cache) {
+    return __atomic_add_fetch(&cache->header->clock, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Repair the table if a writer died while changing it
+ *
+ * Called with the lock held, so an odd sequence can only be left by a
+ * dead process. Entries whose record is not within the log are dropped
+ * and the counts are taken again; records are checked on every read
+ * anyway.
+ */
+static void recover(RespCache *cache) {
+    RespCacheHeader *header = cache->header;
+    if ((header->sequence & 1) == 0) {
+        return;
+    }
+
+    uint64_t entries = 0, live_bytes = 0, tombstones = 0;
+    for (uint32_t i = 0; i < cache->slot_count; i++) {
+        RespCacheSlot *slot = &cache->slots[i];
+        if (slot->hash > SLOT_DELETED && !slot_in_log(slot, header->log_bytes)) {
+            slot->hash = SLOT_DELETED;
+        }
+        if (slot->hash == SLOT_DELETED) {
+            tombstones++;
+        } else if (slot->hash != SLOT_EMPTY) {
+            entries++;
+            live_bytes += slot->length;
+        }
+    }
+    header->entries = entries;
+    header->live_bytes = live_bytes;
+    header->tombstones = tombstones;
+    end_write(cache);
+    cache->recoveries++;
+}
+
+/**
+ * @brief Map the index file open in index_fd
+ */
+static bool map_index(RespCache *cache, uint32_t slot_count) {
+    size_t size = index_size(slot_count);
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->index_fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    cache->header = (RespCacheHeader *)map;
+    cache->slots = (RespCacheSlot *)((char *)map + sizeof(RespCacheHeader));
+    cache->slot_count = slot_count;
+    cache->map_size = size;
+    return true;
+}
+
+/**
+ * @brief Copy the entries of an old, smaller index into the new one
+ */
+static bool carry_over(RespCache *cache, int old_fd, uint32_t old_slot_count) {
+    size_t size = index_size(old_slot_count);
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, old_fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    // Checked like recover() does, in case a writer died while changing it
+    const RespCacheHeader *old = (const RespCacheHeader *)map;
+    const RespCacheSlot *slots = (const RespCacheSlot *)((const char *)map + sizeof(RespCacheHeader));
+    RespCacheHeader *header = cache->header;
+    header->log_bytes = old->log_bytes;
+    header->clock = old->clock;
+    header->generation = old->generation;
+    for (uint32_t i = 0; i < old_slot_count; i++) {
+        if (slots[i].hash > SLOT_DELETED && slot_in_log(&slots[i], old->log_bytes)) {
+            insert_slot(cache, &slots[i]);
+            header->entries++;
+            header->live_bytes += slots[i].length;
+        }
+    }
+
+    munmap(map, size);
+    return true;
+}
+
+/**
+ * @brief Replace the index open in index_fd with a new file
+ *
+ * The new index is built in a temporary file and renamed over the old
+ * one, which is never truncated: other processes may have it mapped. The
+ * entries of a valid old index are carried over; otherwise the log is
+ * emptied. The old file is then marked retired, and processes using it
+ * move to the new one. Called with the lock on the old index held;
+ * returns with the lock on the new one held.
+ *
+ * @param old_slot_count Slots of the old index, 0 if it is not valid
+ * @param old_readable Whether the old file holds a whole header
+ */
+static bool replace_index(RespCache *cache, uint32_t old_slot_count, bool old_readable) {
+    size_t tmp_len = strlen(cache->index_path) + 5;
+    char *tmp_path = (char *)malloc(tmp_len);
+    if (tmp_path == NULL) {
+        return false;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", cache->index_path);
+
+    int old_fd = cache->index_fd;
+    uint32_t slot_count = slots_for(cache->max_entries);
+    cache->index_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool ok = cache->index_fd >= 0 && lock_index(cache, LOCK_EX) &&
+              ftruncate(cache->index_fd, (off_t)index_size(slot_count)) == 0 && map_index(cache, slot_count);
+    if (ok) {
+        // The file is all zeros: only the header needs filling in
+        memcpy(cache->header->magic, INDEX_MAGIC, sizeof(cache->header->magic));
+        cache->header->version = INDEX_VERSION;
+        cache->header->slot_count = slot_count;
+        if (old_slot_count > 0) {
+            ok = carry_over(cache, old_fd, old_slot_count);
+        } else {
+            ok = truncate(cache->log_path, 0) == 0 || errno == ENOENT;
+        }
+    }
+    ok = ok && rename(tmp_path, cache->index_path) == 0;
+
+    if (ok) {
+        // A file too short to hold a header gets a whole one, so it reads as retired
+        RespCacheHeader retired;
+        memset(&retired, 0, sizeof(retired));
+        retired.retired = 1;
+        if (old_readable) {
+            write_at(old_fd, &retired.retired, sizeof(retired.retired), offsetof(RespCacheHeader, retired));
+        } else {
+            write_at(old_fd, &retired, sizeof(retired), 0);
+        }
+        close(old_fd);
+    } else {
+        if (cache->header != NULL) {
+            munmap(cache->header, cache->map_size);
+            cache->header = NULL;
+            cache->slots = NULL;
+        }
+        if (cache->index_fd >= 0) {
+            close(cache->index_fd);
+            unlink(tmp_path);
+        }
+        cache->index_fd = old_fd;
+    }
+
+    free(tmp_path);
+    return ok;
+}
+
+/**
+ * @brief Open and map the index, replacing it if it will not do
+ *
+ * An index that is damaged, from another version or smaller than the
+ * entry limit needs is replaced. One that another process replaced
+ * meanwhile is followed to its new file. Returns with the lock held.
+ */
+static bool attach_index(RespCache *cache) {
+    for (;;) {
+        cache->index_fd = open(cache->index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (cache->index_fd < 0) {
+            return false;
+        }
+        if (!lock_index(cache, LOCK_EX)) {
+            break;
+        }
+
+        RespCacheHeader header;
+        struct stat st;
+        bool readable = fstat(cache->index_fd, &st) == 0 && (size_t)st.st_size >= sizeof(header) &&
+                        read_at(cache->index_fd, &header, sizeof(header), 0);
+        if (readable && header.retired) {
+            close(cache->index_fd); // Also drops the lock
+            continue;
+        }
+
+        bool valid = readable && memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+                     header.version == INDEX_VERSION && header.slot_count >= MIN_SLOTS &&
+                     (header.slot_count & (header.slot_count - 1)) == 0 &&
+                     (size_t)st.st_size == index_size(header.slot_count);
+
+        // A larger table than the limit needs, made by another process, is kept
+        if (valid && header.slot_count >= slots_for(cache->max_entries)) {
+            if (!map_index(cache, header.slot_count)) {
+                break;
+            }
+            recover(cache);
+            return true;
+        }
+        if (replace_index(cache, valid ? header.slot_count : 0, readable)) {
+            return true;
+        }
+        break;
+    }
+
+    close(cache->index_fd);
+    cache->index_fd = -1;
+    return false;
+}
+
+/**
+ * @brief Move to the index that replaced a retired one
+ *
+ * Returns with the lock held.
+ */
+static bool reattach(RespCache *cache) {
+    munmap(cache->header, cache->map_size);
+    cache->header = NULL;
+    cache->slots = NULL;
+    close(cache->index_fd);
+    cache->index_fd = -1;
+    return attach_index(cache);
+}
+
+/**
+ * @brief Reopen the log if another process replaced it
+ */
+static bool refresh_log(RespCache *cache) {
+    uint64_t generation = __atomic_load_n(&cache->header->generation, __ATOMIC_RELAXED);
+    if (cache->log_generation == generation) {
+        return true;
+    }
+
+    int fd = open(cache->log_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    close(cache->log_fd);
+    cache->log_fd = fd;
+    cache->log_generation = generation;
+    return true;
+}
+
+/**
+ * @brief Take the lock to change the cache
+ *
+ * Follows a retired index to its replacement, repairs the table if the
+ * last writer died while changing it, and reopens the log if another
+ * process replaced it.
+ *
+ * @param wait Whether to wait for another process holding the lock
+ * @return true with the lock held, false otherwise (errno is EWOULDBLOCK if it was busy)
+ */
+static bool lock_for_write(RespCache *cache, bool wait) {
+    if (cache->header == NULL || !lock_index(cache, wait ? LOCK_EX : LOCK_EX | LOCK_NB)) {
+        return false;
+    }
+    if (cache->header->retired) {
+        lock_index(cache, LOCK_UN);
+        if (!reattach(cache)) {
+            return false;
+        }
+    }
+
+    recover(cache);
+    if (!refresh_log(cache)) {
+        lock_index(cache, LOCK_UN);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Read a slot's record if it holds the given key
+ *
+ * @param key The key, or NULL to accept the record whatever its key
+ * @return The record (must be freed by caller), NULL if the key differs or the record is unreadable
+ */
+static char *read_record(RespCache *cache, const RespCacheSlot *slot, const char *key, size_t key_len) {
+    if (slot->length < sizeof(RecordHeader) + key_len ||
+        !slot_in_log(slot, __atomic_load_n(&cache->header->log_bytes, __ATOMIC_RELAXED))) {
+        return NULL;
+    }
+
+    char *record = (char *)malloc((size_t)slot->length + 1);
+    if (record == NULL) {
+        return NULL;
+    }
+
+    RecordHeader header;
+    if (read_at(cache->log_fd, record, slot->length, slot->offset)) {
+        memcpy(&header, record, sizeof(header));
+        if (header.hash == slot->hash && (key == NULL || header.key_len == key_len) &&
+            sizeof(header) + (size_t)header.key_len + header.value_len == slot->length &&
+            (key == NULL || memcmp(record + sizeof(header), key, key_len) == 0)) {
+            return record;
+        }
+    }
+
+    free(record);
+    return NULL;
+}
+
+/**
+ * @brief Remove an entry
+ */
+static void delete_slot(RespCache *cache, RespCacheSlot *slot) {
+    cache->header->live_bytes -= slot->length;
+    cache->header->entries--;
+    cache->header->tombstones++;
+    slot->hash = SLOT_DELETED;
+}
+
+/**
+ * @brief Sort slot ages oldest first
+ */
+static int compare_age(const void *a, const void *b) {
+    uint64_t age_a = ((const SlotAge *)a)->last_used;
+    uint64_t age_b = ((const SlotAge *)b)->last_used;
+    return (age_a > age_b) - (age_a < age_b);
+}
+
+/**
+ * @brief Raise a limit by 1/slack of itself
+ *
+ * @param slack 0 for the limit itself
+ */
+static uint64_t with_slack(uint64_t limit, uint64_t slack) {
+    return (slack > 0) ? limit + limit / slack : limit;
+}
+
+/**
+ * @brief Check whether one more entry of length bytes would break the limits
+ */
+static bool too_full(const RespCache *cache, uint64_t length, uint64_t slack) {
+    uint64_t max_entries = (cache->max_entries > 0) ? cache->max_entries : 1;
+    return cache->header->entries + 1 > with_slack(max_entries, slack) ||
+           cache->header->live_bytes + length > with_slack(cache->max_bytes, slack);
+}
+
+/**
+ * @brief Check whether the log, with length more bytes, is due for compaction
+ */
+static bool log_too_long(const RespCache *cache, uint64_t length, uint64_t slack) {
+    uint64_t log_bytes = cache->header->log_bytes + length;
+    return log_bytes > with_slack(2 * cache->max_bytes, slack) && log_bytes > COMPACT_MIN_BYTES;
+}
+
+/**
+ * @brief Check whether deleted slots are due to be cleared out
+ *
+ * They lengthen every probe that crosses them.
+ */
+static bool too_many_tombstones(const RespCache *cache, uint64_t slack) {
+    return cache->header->tombstones > with_slack(cache->slot_count / 8, slack);
+}
+
+/**
+ * @brief Evict entries until one more of length bytes fits
+ *
+ * Expired entries go first, then the least recently used ones, down to
+ * 1/8 below the limits so that eviction does not run on every insert.
+ * Called with the lock held; the table only changes once the victims are
+ * chosen.
+ */
+static void make_room(RespCache *cache, uint64_t length) {
+    RespCacheHeader *header = cache->header;
+    uint64_t max_entries = (cache->max_entries > 0) ? cache->max_entries : 1;
+
+    uint64_t target_entries = max_entries - max_entries / EVICT_SLACK - 1;
+    uint64_t target_bytes = cache->max_bytes - cache->max_bytes / EVICT_SLACK;
+    target_bytes = (target_bytes > length) ? target_bytes - length : 0;
+
+    SlotAge *ages = (SlotAge *)malloc(cache->slot_count * sizeof(SlotAge));
+    if (ages == NULL) {
+        return;
+    }
+
+    // Expired entries sort first, as if never used
+    int64_t now = (int64_t)time(NULL);
+    size_t count = 0;
+    for (uint32_t i = 0; i < cache->slot_count; i++) {
+        RespCacheSlot *slot = &cache->slots[i];
+        if (slot->hash <= SLOT_DELETED) {
+            continue;
+        }
+        bool expired = cache->ttl_s > 0 && now - slot->created >= cache->ttl_s;
+        ages[count].last_used = expired ? 0 : slot->last_used;
+        ages[count].index = i;
+        count++;
+    }
+
+    qsort(ages, count, sizeof(SlotAge), compare_age);
+    begin_write(cache);
+    for (size_t i = 0; i < count; i++) {
+        bool over = header->entries > target_entries || header->live_bytes > target_bytes;
+        if (!over && ages[i].last_used != 0) {
+            break;
+        }
+        delete_slot(cache, &cache->slots[ages[i].index]);
+        cache->evictions++;
+    }
+    end_write(cache);
+
+    free(ages);
+}
+
+/**
+ * @brief Rebuild the table without its deleted slots
+ *
+ * Called with the lock held, inside a change.
+ */
+static void rehash(RespCache *cache) {
+    RespCacheSlot *live = (RespCacheSlot *)malloc(cache->slot_count * sizeof(RespCacheSlot));
+    if (live == NULL) {
+        return;
+    }
+
+    size_t count = 0;
+    for (uint32_t i = 0; i < cache->slot_count; i++) {
+        if (cache->slots[i].hash > SLOT_DELETED) {
+            live[count++] = cache->slots[i];
+        }
+    }
+
+    memset(cache->slots, 0, cache->slot_count * sizeof(RespCacheSlot));
+    for (size_t i = 0; i < count; i++) {
+        insert_slot(cache, &live[i]);
+    }
+    cache->header->tombstones = 0;
+
+    free(live);
+}
+
+/**
+ * @brief Copy the live records to a new log and switch to it
+ *
+ * Called with the lock held. The copy is made before the table changes,
+ * so lookups only wait for the switch. Nothing changes if it fails.
+ */
+static bool compact(RespCache *cache) {
+    RespCacheHeader *header = cache->header;
+    size_t tmp_len = strlen(cache->log_path) + 5;
+    char *tmp_path = (char *)malloc(tmp_len);
+    uint64_t *offsets = (uint64_t *)malloc(cache->slot_count * sizeof(uint64_t));
+    char *record = (char *)malloc(MAX_RECORD);
+    int fd = -1;
+    bool ok = tmp_path != NULL && offsets != NULL && record != NULL;
+
+    if (ok) {
+        snprintf(tmp_path, tmp_len, "%s.tmp", cache->log_path);
+        fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        ok = fd >= 0;
+    }
+
+    // Unreadable records are dropped with their entries at the switch
+    uint64_t end = 0;
+    for (uint32_t i = 0; ok && i < cache->slot_count; i++) {
+        RespCacheSlot *slot = &cache->slots[i];
+        offsets[i] = UINT64_MAX;
+        if (slot->hash <= SLOT_DELETED || slot->length > MAX_RECORD ||
+            !read_at(cache->log_fd, record, slot->length, slot->offset)) {
+            continue;
+        }
+        offsets[i] = end;
+        ok = write_at(fd, record, slot->length, end);
+        end += slot->length;
+    }
+
+    // The generation moves first: a writer dying after the rename leaves
+    // other processes reopening the log
+    if (ok) {
+        begin_write(cache);
+        header->generation++;
+        ok = rename(tmp_path, cache->log_path) == 0;
+        if (ok) {
+            for (uint32_t i = 0; i < cache->slot_count; i++) {
+                RespCacheSlot *slot = &cache->slots[i];
+                if (slot->hash > SLOT_DELETED && offsets[i] == UINT64_MAX) {
+                    delete_slot(cache, slot);
+                } else if (slot->hash > SLOT_DELETED) {
+                    slot->offset = offsets[i];
+                }
+            }
+            header->log_bytes = end;
+        } else {
+            header->generation--;
+        }
+        end_write(cache);
+    }
+
+    if (ok) {
+        close(cache->log_fd);
+        cache->log_fd = fd;
+        cache->log_generation = header->generation;
+        cache->compactions++;
+    } else {
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (tmp_path != NULL) {
+            unlink(tmp_path);
+        }
+    }
+
+    free(tmp_path);
+    free(offsets);
+    free(record);
+    return ok;
+}
+
+/**
+ * @brief Evict, compact and rehash as far as the limits call for
+ *
+ * Called with the lock held.
+ *
+ * @param length Bytes of a record about to be stored, 0 for none
+ * @param slack Only act once a limit is exceeded by 1/slack of itself, 0 to act at the limits
+ */
+static void tidy(RespCache *cache, uint64_t length, uint64_t slack) {
+    if (too_full(cache, length, slack)) {
+        make_room(cache, length);
+    }
+    if (log_too_long(cache, length, slack)) {
+        compact(cache);
+    }
+    if (too_many_tombstones(cache, slack)) {
+        begin_write(cache);
+        rehash(cache);
+        end_write(cache);
+    }
+}
+
+bool respcache_open(RespCache *cache, const char *path, int64_t ttl_s, uint64_t max_bytes,
+                    uint32_t max_entries) {
+    memset(cache, 0, sizeof(RespCache));
+    cache->index_fd = -1;
+    cache->log_fd = -1;
+    cache->ttl_s = ttl_s;
+    cache->max_bytes = max_bytes;
+    cache->max_entries = max_entries;
+
+    size_t path_len = strlen(path) + 5;
+    cache->index_path = (char *)malloc(path_len);
+    cache->log_path = (char *)malloc(path_len);
+    if (cache->index_path == NULL || cache->log_path == NULL) {
+        respcache_close(cache);
+        return false;
+    }
+    snprintf(cache->index_path, path_len, "%s.idx", path);
+    snprintf(cache->log_path, path_len, "%s.log", path);
+
+    if (!statedir_make_parent(cache->index_path) || !attach_index(cache)) {
+        respcache_close(cache);
+        return false;
+    }
+
+    // Opened under the lock, so no compaction replaces it unnoticed
+    cache->log_fd = open(cache->log_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    cache->log_generation = cache->header->generation;
+    lock_index(cache, LOCK_UN);
+    if (cache->log_fd < 0) {
+        respcache_close(cache);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Probe the table for the record of a key
+ *
+ * Safe without the lock: the caller checks that no change overlapped it.
+ *
+ * @param hash Slot hash of the key
+ * @param key The key, or NULL to go by the hash alone
+ * @param found Set to a copy of the record's slot
+ * @param position Set to the position of that slot
+ * @return The record (must be freed by caller), or NULL on a miss
+ */
+static char *probe(RespCache *cache, uint64_t hash, const char *key, size_t key_len, RespCacheSlot *found,
+                   uint32_t *position) {
+    if (!refresh_log(cache)) {
+        return NULL;
+    }
+
+    uint32_t mask = cache->slot_count - 1;
+    for (uint32_t i = 0, index = (uint32_t)(hash & mask); i <= mask; i++, index = (index + 1) & mask) {
+        RespCacheSlot slot = cache->slots[index];
+        if (slot.hash == SLOT_EMPTY) {
+            break;
+        }
+        char *record = (slot.hash == hash) ? read_record(cache, &slot, key, key_len) : NULL;
+        if (record != NULL) {
+            *found = slot;
+            *position = index;
+            return record;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find the live record of a key
+ *
+ * A hit counts as a use for eviction.
+ *
+ * @param hash Slot hash of the key
+ * @param key The key, or NULL to go by the hash alone
+ * @return The record (must be freed by caller), or NULL on a miss
+ */
+static char *find_record(RespCache *cache, uint64_t hash, const char *key, size_t key_len) {
+    if (cache->header == NULL) {
+        return NULL;
+    }
+    if (__atomic_load_n(&cache->header->retired, __ATOMIC_RELAXED)) {
+        if (!reattach(cache)) {
+            return NULL;
+        }
+        lock_index(cache, LOCK_UN);
+    }
+
+    // No lock: a read that overlapped a change is thrown away and retried
+    char *record = NULL;
+    RespCacheSlot slot;
+    uint32_t position = 0;
+    bool consistent = false;
+    for (int attempt = 0; attempt < READ_ATTEMPTS && !consistent; attempt++) {
+        uint64_t generation = cache->log_generation;
+        uint64_t sequence = begin_read(cache);
+        if ((sequence & 1) == 0) {
+            record = probe(cache, hash, key, key_len, &slot, &position);
+            consistent = end_read(cache, sequence);
+        }
+        if (!consistent) {
+            free(record);
+            record = NULL;
+            cache->log_generation = generation; // A log opened meanwhile may be the wrong one
+            cache->read_retries++;
+            sched_yield();
+        }
+    }
+
+    // A long change, or a writer that died in one: wait for the lock,
+    // which repairs the table if need be
+    if (!consistent) {
+        cache->locked_reads++;
+        if (!lock_for_write(cache, true)) {
+            return NULL;
+        }
+        record = probe(cache, hash, key, key_len, &slot, &position);
+        lock_index(cache, LOCK_UN);
+    }
+
+    if (record != NULL && cache->ttl_s > 0 && (int64_t)time(NULL) - slot.created >= cache->ttl_s) {
+        free(record); // Expired: evicted by a later insert
+        record = NULL;
+    }
+
+    // Uses race with other processes' and at worst misorder two of them
+    if (record != NULL) {
+        __atomic_store_n(&cache->slots[position].last_used, tick(cache), __ATOMIC_RELAXED);
+    }
+    return record;
+}
+
+/**
+ * @brief Turn a record into its NUL-terminated value
+ *
+ * The value moves to the front of the record it was read with.
+ */
+static void take_value(char *record, char **value, size_t *value_len) {
+    RecordHeader header;
+    memcpy(&header, record, sizeof(header));
+    memmove(record, record + sizeof(header) + header.key_len, header.value_len);
+    record[header.value_len] = '\0';
+    *value = record;
+    if (value_len != NULL) {
+        *value_len = header.value_len;
+    }
+}
+
+bool respcache_get(RespCache *cache, const char *key, size_t key_len, char **value, size_t *value_len) {
+    char *record = find_record(cache, hash_key(key, key_len), key, key_len);
+    if (record == NULL) {
+        return false;
+    }
+
+    take_value(record, value, value_len);
+    return true;
+}
+
+bool respcache_get_hash(RespCache *cache, uint64_t hash, char **key, char **value, size_t *value_len) {
+    char *record = find_record(cache, slot_hash(hash), NULL, 0);
+    if (record == NULL) {
+        return false;
+    }
+
+    if (key != NULL) {
+        RecordHeader header;
+        memcpy(&header, record, sizeof(header));
+        *key = strndup(record + sizeof(header), header.key_len);
+        if (*key == NULL) {
+            free(record);
+            return false;
+        }
+    }
+    take_value(record, value, value_len);
+    return true;
+}
+
+bool respcache_put(RespCache *cache, const char *key, size_t key_len, const char *value, size_t value_len) {
+    if (sizeof(RecordHeader) + key_len + value_len > MAX_RECORD) {
+        return false;
+    }
+    if (!lock_for_write(cache, false)) {
+        if (errno == EWOULDBLOCK) {
+            cache->busy_puts++;
+        }
+        return false;
+    }
+
+    // Upkeep normally keeps the cache within its limits; a store only
+    // tidies up itself when that has fallen well behind
+    RespCacheHeader *header = cache->header;
+    uint64_t length = sizeof(RecordHeader) + key_len + value_len;
+    tidy(cache, length, EVICT_SLACK);
+
+    // Find the key, or the first free slot on its probe sequence
+    uint64_t hash = hash_key(key, key_len);
+    uint32_t mask = cache->slot_count - 1;
+    RespCacheSlot *existing = NULL;
+    RespCacheSlot *free_slot = NULL;
+    for (uint32_t i = 0, index = (uint32_t)(hash & mask); i <= mask; i++, index = (index + 1) & mask) {
+        RespCacheSlot *slot = &cache->slots[index];
+        if (slot->hash == SLOT_EMPTY) {
+            free_slot = (free_slot != NULL) ? free_slot : slot;
+            break;
+        }
+        if (slot->hash == SLOT_DELETED) {
+            free_slot = (free_slot != NULL) ? free_slot : slot;
+        } else if (slot->hash == hash) {
+            char *record = read_record(cache, slot, key, key_len);
+            if (record != NULL) {
+                free(record);
+                existing = slot;
+                break;
+            }
+        }
+    }
+
+    // Append the record; an entry only points at it once it is complete
+    RecordHeader record = { hash, (uint32_t)key_len, (uint32_t)value_len };
+    struct iovec iov[3] = {
+        { &record, sizeof(record) },
+        { (void *)key, key_len },
+        { (void *)value, value_len }
+    };
+    bool ok = (existing != NULL || free_slot != NULL) &&
+              pwritev(cache->log_fd, iov, 3, (off_t)header->log_bytes) == (ssize_t)length;
+
+    if (ok) {
+        begin_write(cache);
+        RespCacheSlot *slot = existing;
+        if (slot != NULL) {
+            header->live_bytes -= slot->length;
+        } else {
+            slot = free_slot;
+            if (slot->hash == SLOT_DELETED) {
+                header->tombstones--;
+            }
+            header->entries++;
+        }
+        slot->offset = header->log_bytes;
+        slot->length = (uint32_t)length;
+        slot->created = (int64_t)time(NULL);
+        slot->last_used = tick(cache);
+        slot->hash = hash;
+        header->live_bytes += length;
+        header->log_bytes += length;
+        end_write(cache);
+    }
+
+    lock_index(cache, LOCK_UN);
+    return ok;
+}
+
+bool respcache_needs_upkeep(const RespCache *cache) {
+    // Read without the lock: a stale answer only moves the upkeep
+    return cache->header != NULL && (too_full(cache, 0, 0) || log_too_long(cache, 0, 0) ||
+                                     too_many_tombstones(cache, 0));
+}
+
+bool respcache_upkeep(RespCache *cache) {
+    if (!lock_for_write(cache, false)) {
+        return false;
+    }
+
+    tidy(cache, 0, 0);
+    lock_index(cache, LOCK_UN);
+    return true;
+}
+
+bool respcache_compact(RespCache *cache) {
+    if (!lock_for_write(cache, true)) {
+        return false;
+    }
+
+    bool ok = compact(cache);
+    lock_index(cache, LOCK_UN);
+    return ok;
+}
+
+uint64_t respcache_entries(const RespCache *cache) {
+    return (cache->header != NULL) ? cache->header->entries : 0;
+}
+
+uint64_t respcache_log_bytes(const RespCache *cache, uint64_t *live_bytes) {
+    if (live_bytes != NULL) {
+        *live_bytes = (cache->header != NULL) ? cache->header->live_bytes : 0;
+    }
+    return (cache->header != NULL) ? cache->header->log_bytes : 0;
+}
+
+void respcache_close(RespCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    if (cache->header != NULL) {
+        munmap(cache->header, cache->map_size);
+        cache->header = NULL;
+        cache->slots = NULL;
+    }
+    if (cache->index_fd >= 0) {
+        close(cache->index_fd);
+        cache->index_fd = -1;
+    }
+    if (cache->log_fd >= 0) {
+        close(cache->log_fd);
+        cache->log_fd = -1;
+    }
+    free(cache->index_path);
+    cache->index_path = NULL;
+    free(cache->log_path);
+    cache->log_path = NULL;
+}
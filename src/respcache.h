@@ -0,0 +1,200 @@
+/**
+ * @file respcache.h
+ * @brief Persistent cache of chat answers for AISH (AI Shell)
+ *
+ * Answers are kept on disk in two files:
+ *
+ * - an index, mapped into memory: a header and a fixed-size open
+ *   addressing table (linear probing) of 64-bit key hashes, each pointing
+ *   at a record in the log, with its creation time and last use;
+ * - a log that records are only ever appended to. A record holds the full
+ *   key, which is compared on lookup, and the value.
+ *
+ * A lookup is a probe of the mapped table and one pread() of the record,
+ * a few microseconds however many entries there are. The table has room
+ * for the entry limit given at open time plus a third, or more if another
+ * process asked for a higher limit. Entries older than the TTL are not
+ * returned. Once the cache reaches the entry or byte limit, the least
+ * recently used entries (expired ones first) are evicted. Once the log
+ * holds twice the byte limit, it is compacted: live records are copied to
+ * a new log that replaces the old one. Both are left to
+ * respcache_upkeep(), which the caller runs when it is idle; a store only
+ * does them itself once the cache is 1/8 past its limits.
+ *
+ * Several AISH processes share the files, so an answer stored by one is
+ * found by all the others. Changes take a flock() on the index and bump
+ * a sequence number in it (a seqlock) before and after changing the
+ * table. Lookups take no lock: they read the table and the record, then
+ * retry if the sequence moved meanwhile. After a few retries they wait
+ * for the lock instead. Stores and upkeep never wait: they give up if
+ * another process holds the lock. A process that dies while changing
+ * the table leaves the sequence odd; the next one to take the lock drops
+ * the entries whose records are not in the log and counts the rest
+ * again. A process reopens the log when another one has compacted it.
+ *
+ * Damaged or foreign index files, and ones too small for the entry
+ * limit, are replaced by a new file renamed over them, never truncated
+ * in place: other processes may still have them mapped. Entries of a
+ * valid index carry over to a larger one. The old file is marked
+ * retired, and the processes using it move to the new one.
+ */
+
+#ifndef RESPCACHE_H
+#define RESPCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Index header and slot layouts (in respcache.c)
+ */
+typedef struct RespCacheHeader RespCacheHeader;
+typedef struct RespCacheSlot RespCacheSlot;
+
+/**
+ * @struct RespCache
+ * @brief An open response cache
+ */
+typedef struct {
+    char *index_path;           /**< Index file */
+    char *log_path;             /**< Value log file */
+    int index_fd;               /**< Index, also the lock (-1 if closed) */
+    int log_fd;                 /**< Log, opened for reading and appending (-1 if closed) */
+    RespCacheHeader *header;    /**< Mapped index */
+    RespCacheSlot *slots;       /**< Its table */
+    uint32_t slot_count;        /**< Slots in the table */
+    size_t map_size;            /**< Bytes mapped */
+    uint64_t log_generation;    /**< Compaction count the log was opened at */
+    int64_t ttl_s;              /**< Entries older than this are not returned, 0 = kept until evicted */
+    uint64_t max_bytes;         /**< Live record bytes kept at most */
+    uint32_t max_entries;       /**< Entries kept at most */
+    uint64_t evictions;         /**< Entries evicted by this process */
+    uint64_t compactions;       /**< Log compactions done by this process */
+    uint64_t read_retries;      /**< Lookups by this process retried after overlapping a change */
+    uint64_t locked_reads;      /**< Lookups by this process that waited for the lock */
+    uint64_t recoveries;        /**< Tables repaired by this process after a writer died */
+    uint64_t busy_puts;         /**< Stores by this process given up because another held the lock */
+} RespCache;
+
+/**
+ * @brief Hash bytes the way keys are hashed (64-bit FNV-1a)
+ *
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ * @return The hash
+ */
+uint64_t respcache_hash(const char *data, size_t len);
+
+/**
+ * @brief Open (or create) a cache
+ *
+ * @param cache Pointer to RespCache structure to initialize
+ * @param path Base path: the files are path.idx and path.log
+ * @param ttl_s Age after which entries are not returned, 0 for none
+ * @param max_bytes Live record bytes kept at most
+ * @param max_entries Entries kept at most
+ * @return true if successful, false otherwise (the cache is then closed)
+ */
+bool respcache_open(RespCache *cache, const char *path, int64_t ttl_s, uint64_t max_bytes,
+                    uint32_t max_entries);
+
+/**
+ * @brief Look up a key
+ *
+ * A hit counts as a use for eviction.
+ *
+ * @param cache Pointer to RespCache structure
+ * @param key Key bytes
+ * @param key_len Length of the key
+ * @param value Set to a NUL-terminated copy of the value on a hit (must be freed by caller)
+ * @param value_len Set to its length on a hit (may be NULL)
+ * @return true on a hit, false otherwise
+ */
+bool respcache_get(RespCache *cache, const char *key, size_t key_len, char **value, size_t *value_len);
+
+/**
+ * @brief Look up a key by its hash alone
+ *
+ * For indexes that only keep hashes (respcache_hash() of the key). A hit
+ * counts as a use for eviction.
+ *
+ * @param cache Pointer to RespCache structure
+ * @param hash Hash of the key
+ * @param key Set to a NUL-terminated copy of the key on a hit (must be freed by caller, may be NULL)
+ * @param value Set to a NUL-terminated copy of the value on a hit (must be freed by caller)
+ * @param value_len Set to its length on a hit (may be NULL)
+ * @return true on a hit, false otherwise
+ */
+bool respcache_get_hash(RespCache *cache, uint64_t hash, char **key, char **value, size_t *value_len);
+
+/**
+ * @brief Store a value, replacing any value under the same key
+ *
+ * Does not wait for another process holding the lock: the value is then
+ * not stored, and busy_puts counts it.
+ *
+ * @param cache Pointer to RespCache structure
+ * @param key Key bytes
+ * @param key_len Length of the key
+ * @param value Value bytes
+ * @param value_len Length of the value
+ * @return true if stored, false otherwise
+ */
+bool respcache_put(RespCache *cache, const char *key, size_t key_len, const char *value, size_t value_len);
+
+/**
+ * @brief Check whether the cache has reached a limit that respcache_upkeep() enforces
+ *
+ * Takes no lock.
+ *
+ * @param cache Pointer to RespCache structure
+ * @return true if upkeep is due, false otherwise
+ */
+bool respcache_needs_upkeep(const RespCache *cache);
+
+/**
+ * @brief Evict, compact the log and clear out deleted slots as the limits call for
+ *
+ * Does not wait for another process holding the lock.
+ *
+ * @param cache Pointer to RespCache structure
+ * @return true if done, false if the lock was busy or could not be taken
+ */
+bool respcache_upkeep(RespCache *cache);
+
+/**
+ * @brief Rewrite the log with only the live records
+ *
+ * Done automatically as the log grows; exposed for tools and benchmarks.
+ *
+ * @param cache Pointer to RespCache structure
+ * @return true if successful, false otherwise
+ */
+bool respcache_compact(RespCache *cache);
+
+/**
+ * @brief Get the number of entries
+ *
+ * @param cache Pointer to RespCache structure
+ * @return Entries in the index (expired ones included until evicted)
+ */
+uint64_t respcache_entries(const RespCache *cache);
+
+/**
+ * @brief Get the size of the log
+ *
+ * @param cache Pointer to RespCache structure
+ * @param live_bytes Set to the bytes of live records (may be NULL)
+ * @return Bytes in the log file
+ */
+uint64_t respcache_log_bytes(const RespCache *cache, uint64_t *live_bytes);
+
+/**
+ * @brief Close a cache
+ *
+ * @param cache Pointer to RespCache structure
+ */
+void respcache_close(RespCache *cache);
+
+#endif /* RESPCACHE_H */
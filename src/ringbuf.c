@@ -0,0 +1,159 @@
+/**
+ * @file ringbuf.c
+ * @brief Implementation of the byte ring buffer for AISH
+ */
+
+#include "ringbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+bool ringbuf_init(RingBuffer *ring, size_t capacity) {
+    if (ring == NULL || capacity == 0) {
+        return false;
+    }
+
+    // Round up to a power of two so positions can be masked
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring->data = (char *)malloc(size);
+    if (ring->data == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for ring buffer\n");
+        return false;
+    }
+
+    ring->capacity = size;
+    ring->head = 0;
+    ring->tail = 0;
+
+    return true;
+}
+
+size_t ringbuf_used(const RingBuffer *ring) {
+    return ring->tail - ring->head;
+}
+
+size_t ringbuf_space(const RingBuffer *ring) {
+    return ring->capacity - (ring->tail - ring->head);
+}
+
+/**
+ * @brief Describe up to two contiguous regions starting at a position
+ */
+static int ring_regions(const RingBuffer *ring, size_t pos, size_t len, struct iovec iov[2]) {
+    size_t offset = pos & (ring->capacity - 1);
+    size_t first = ring->capacity - offset;
+
+    if (first > len) {
+        first = len;
+    }
+
+    iov[0].iov_base = ring->data + offset;
+    iov[0].iov_len = first;
+    if (first == len) {
+        return 1;
+    }
+
+    iov[1].iov_base = ring->data;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+size_t ringbuf_write(RingBuffer *ring, const char *data, size_t len) {
+    size_t space = ringbuf_space(ring);
+    if (len > space) {
+        len = space;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    struct iovec iov[2];
+    int count = ring_regions(ring, ring->tail, len, iov);
+    memcpy(iov[0].iov_base, data, iov[0].iov_len);
+    if (count == 2) {
+        memcpy(iov[1].iov_base, data + iov[0].iov_len, iov[1].iov_len);
+    }
+
+    ring->tail += len;
+    return len;
+}
+
+ssize_t ringbuf_read_fd(RingBuffer *ring, int fd, size_t max_len) {
+    size_t len = ringbuf_space(ring);
+    if (len > max_len) {
+        len = max_len;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    struct iovec iov[2];
+    int count = ring_regions(ring, ring->tail, len, iov);
+    ssize_t bytes_read = readv(fd, iov, count);
+    if (bytes_read > 0) {
+        ring->tail += (size_t)bytes_read;
+    }
+
+    return bytes_read;
+}
+
+ssize_t ringbuf_write_fd(RingBuffer *ring, int fd) {
+    size_t len = ringbuf_used(ring);
+    if (len == 0) {
+        return 0;
+    }
+
+    struct iovec iov[2];
+    int count = ring_regions(ring, ring->head, len, iov);
+    ssize_t bytes_written = writev(fd, iov, count);
+    if (bytes_written > 0) {
+        ring->head += (size_t)bytes_written;
+    }
+
+    // Rewind positions when empty so writes stay contiguous
+    if (ring->head == ring->tail) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+
+    return bytes_written;
+}
+
+size_t ringbuf_peek(const RingBuffer *ring, const char **data) {
+    size_t len = ringbuf_used(ring);
+    size_t offset = ring->head & (ring->capacity - 1);
+
+    if (len > ring->capacity - offset) {
+        len = ring->capacity - offset;
+    }
+
+    *data = ring->data + offset;
+    return len;
+}
+
+void ringbuf_consume(RingBuffer *ring, size_t len) {
+    ring->head += len;
+
+    // Rewind positions when empty so writes stay contiguous
+    if (ring->head == ring->tail) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+}
+
+void ringbuf_free(RingBuffer *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    free(ring->data);
+    ring->data = NULL;
+    ring->capacity = 0;
+    ring->head = 0;
+    ring->tail = 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file ringbuf.h
+ * @brief Byte ring buffer for AISH (AI Shell)
+ *
+ * A fixed-capacity FIFO of bytes used to queue data between file
+ * descriptors. Data moves in and out with readv()/writev() so a wrapped
+ * buffer still costs a single system call.
+ */
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @struct RingBuffer
+ * @brief Structure to hold a byte ring buffer
+ */
+typedef struct {
+    char *data;         /**< Backing storage */
+    size_t capacity;    /**< Size of the storage in bytes (power of two) */
+    size_t head;        /**< Total bytes consumed (read position) */
+    size_t tail;        /**< Total bytes produced (write position) */
+} RingBuffer;
+
+/**
+ * @brief Initialize a ring buffer
+ *
+ * @param ring Pointer to RingBuffer structure to initialize
+ * @param capacity Requested capacity, rounded up to a power of two
+ * @return true if initialization was successful, false otherwise
+ */
+bool ringbuf_init(RingBuffer *ring, size_t capacity);
+
+/**
+ * @brief Get the number of queued bytes
+ *
+ * @param ring Pointer to RingBuffer structure
+ * @return Number of bytes waiting to be consumed
+ */
+size_t ringbuf_used(const RingBuffer *ring);
+
+/**
+ * @brief Get the free space in the ring
+ *
+ * @param ring Pointer to RingBuffer structure
+ * @return Number of bytes that can still be queued
+ */
+size_t ringbuf_space(const RingBuffer *ring);
+
+/**
+ * @brief Copy bytes into the ring
+ *
+ * @param ring Pointer to RingBuffer structure
+ * @param data Bytes to queue
+ * @param len Number of bytes to queue
+ * @return Number of bytes queued (less than len if the ring is full)
+ */
+size_t ringbuf_write(RingBuffer *ring, const char *data, size_t len);
+
+/**
+ * @brief Read from a file descriptor into the ring's free space
+ *
+ * @param ring Pointer to RingBuffer structure
+ * @param fd File descriptor to read from
+ * @param max_len Maximum number of bytes to read
+ * @return Bytes read, 0 on EOF, -1 on error (errno is set)
+ */
+ssize_t ringbuf_read_fd(RingBuffer *ring, int fd, size_t max_len);
+
+/**
+ * @brief Write queued bytes to a file descriptor and consume them
+ *
+ * @param ring Pointer to RingBuffer structure
+ * @param fd File descriptor to write to
+ * @return Bytes written, -1 on error (errno is set)
+ */
+ssize_t ringbuf_write_fd(RingBuffer *ring, int fd);
+
+/**
+ * @brief Get the oldest contiguous run of queued bytes without consuming it
+ *
+ * @param ring Pointer to RingBuffer structure
+ * @param data Set to the start of the run
+ * @return Length of the run (0 if the ring is empty)
+ */
+size_t ringbuf_peek(const RingBuffer *ring, const char **data);
+
+/**
+ * @brief Drop bytes from the front of the ring after they were written elsewhere
+ *
+ * @param ring Pointer to RingBuffer structure
+ * @param len Number of bytes to drop (at most ringbuf_used())
+ */
+void ringbuf_consume(RingBuffer *ring, size_t len);
+
+/**
+ * @brief Free the ring's storage
+ *
+ * @param ring Pointer to RingBuffer structure
+ */
+void ringbuf_free(RingBuffer *ring);
+
+#endif /* RINGBUF_H */
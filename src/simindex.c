@@ -0,0 +1,755 @@
+/**
+ * @file simindex.c
+ * @brief Implementation of the similarity index of cached chat queries for AISH
+ */
+
+#include "simindex.h"
+#include "statedir.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INDEX_MAGIC "AISHSI01"
+#define INDEX_VERSION 3
+#define BAND_ROWS (SIMINDEX_HASHES / SIMINDEX_BANDS)
+#define MIN_CAPACITY 64             // Entries in the smallest ring
+#define MAX_TOKENS 64               // Later tokens of a query are ignored
+#define MAX_NORMALIZED 512          // Longest normalized query
+#define SHINGLE 3                   // Characters in an n-gram
+#define MAX_CANONICAL 8             // Longest spelling a synonym is folded into
+
+struct SimIndexHeader {
+    char magic[8];          // INDEX_MAGIC
+    uint32_t version;       // INDEX_VERSION
+    uint32_t capacity;      // Entries in the ring (power of two)
+    uint64_t serial;        // Serial of the newest entry
+    uint64_t entries;       // Entries in use
+    uint32_t retired;       // Set once another file replaced this one
+    uint32_t reserved;
+};
+
+struct SimIndexEntry {
+    uint64_t serial;                    // Order of addition, 0 if unused
+    uint64_t group;                     // Group the query belongs to
+    uint64_t key;                       // Key it was added with
+    uint8_t signature[SIMINDEX_HASHES]; // Its signature
+};
+
+/**
+ * @brief Words dropped from queries
+ */
+static const char *const stop_words[] = {
+    "a", "an", "and", "any", "are", "at", "by", "can", "could", "current", "do",
+    "for", "from", "give", "how", "i", "in", "inside", "is", "it", "me", "my", "of", "on", "please",
+    "some", "that", "the", "these", "this", "those", "to", "what", "which", "with", "you"
+};
+
+/**
+ * @brief Words folded into one spelling
+ */
+static const struct {
+    const char *word;
+    const char *canonical;
+} synonyms[] = {
+    { "show", "list" }, { "display", "list" }, { "print", "list" }, { "ls", "list" },
+    { "search", "find" }, { "locate", "find" }, { "look", "find" },
+    { "delete", "remove" }, { "erase", "remove" }, { "rm", "remove" },
+    { "big", "large" }, { "bigger", "large" }, { "biggest", "large" }, { "larger", "large" },
+    { "largest", "large" }, { "huge", "large" },
+    { "smaller", "small" }, { "smallest", "small" }, { "tiny", "small" },
+    { "newest", "recent" }, { "latest", "recent" }, { "newer", "recent" },
+    { "oldest", "old" }, { "older", "old" },
+    { "directory", "dir" }, { "directories", "dir" }, { "folder", "dir" }, { "here", "dir" },
+    { "cwd", "dir" }, { "pwd", "dir" }, { "every", "all" }
+};
+
+/**
+ * @brief Prefixes that turn a word into its opposite ("compress", "decompress")
+ */
+static const char *const negations[] = { "de", "dis", "non", "un" };
+
+static uint64_t hash_multipliers[SIMINDEX_HASHES];  // Hash functions of the signature:
+static uint64_t hash_addends[SIMINDEX_HASHES];      // (m * x + a) >> 32
+static bool hashes_ready = false;
+
+/**
+ * @brief Step a splitmix64 generator
+ */
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Draw the hash functions; the same every run, as signatures are saved
+ */
+static void init_hashes(void) {
+    uint64_t state = 0x41495348ULL; // "AISH"
+    for (int i = 0; i < SIMINDEX_HASHES; i++) {
+        hash_multipliers[i] = splitmix64(&state) | 1;
+        hash_addends[i] = splitmix64(&state);
+    }
+    hashes_ready = true;
+}
+
+/**
+ * @brief Fold a token into its normalized form
+ *
+ * @param token The token, lowercased
+ * @param len Its length
+ * @param out Written with the normalized token
+ * @return Length of the normalized token, 0 if the token is dropped
+ */
+static size_t normalize_token(const char *token, size_t len, char *out) {
+    for (size_t i = 0; i < sizeof(stop_words) / sizeof(stop_words[0]); i++) {
+        if (strlen(stop_words[i]) == len && memcmp(stop_words[i], token, len) == 0) {
+            return 0;
+        }
+    }
+
+    // Plurals ("files", not "process" or "status") unless the word itself is known
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < sizeof(synonyms) / sizeof(synonyms[0]); i++) {
+            if (strlen(synonyms[i].word) == len && memcmp(synonyms[i].word, token, len) == 0) {
+                size_t canonical_len = strlen(synonyms[i].canonical);
+                memcpy(out, synonyms[i].canonical, canonical_len);
+                return canonical_len;
+            }
+        }
+        if (pass == 0 && len > 3 && token[len - 1] == 's' && token[len - 2] != 's' &&
+            token[len - 2] != 'u' && token[len - 2] != 'i') {
+            len--;
+        } else {
+            break;
+        }
+    }
+
+    memcpy(out, token, len);
+    return len;
+}
+
+/**
+ * @brief Reduce a query to its normalized tokens, separated by spaces
+ *
+ * Tokens are runs of letters, digits and non-ASCII bytes.
+ *
+ * @param out Written with the tokens, a space before each and one after the last
+ * @return Length written (1 if no tokens are left)
+ */
+static size_t normalize(const char *text, size_t len, char *out) {
+    char token[MAX_NORMALIZED];
+    size_t out_len = 0;
+    int tokens = 0;
+
+    out[out_len++] = ' ';
+    for (size_t i = 0; i < len && tokens < MAX_TOKENS;) {
+        unsigned char c = (unsigned char)text[i];
+        bool word = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+        if (!word) {
+            i++;
+            continue;
+        }
+
+        size_t token_len = 0;
+        for (; i < len && token_len < sizeof(token); i++) {
+            c = (unsigned char)text[i];
+            if (c >= 'A' && c <= 'Z') {
+                c = (unsigned char)(c - 'A' + 'a');
+            } else if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80)) {
+                break;
+            }
+            token[token_len++] = (char)c;
+        }
+
+        if (out_len + token_len + MAX_CANONICAL + 1 > MAX_NORMALIZED) {
+            break;
+        }
+        size_t normalized_len = normalize_token(token, token_len, out + out_len);
+        if (normalized_len > 0) {
+            out_len += normalized_len;
+            out[out_len++] = ' ';
+            tokens++;
+        }
+    }
+    return out_len;
+}
+
+/**
+ * @brief Order shingle hashes for qsort()
+ */
+static int compare_shingles(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Hash the distinct character 3-grams of a normalized query
+ *
+ * @param shingles Filled with the hashes, sorted, MAX_NORMALIZED at most
+ * @return Number of hashes, 0 if the query has no tokens
+ */
+static size_t shingle_set(const char *text, size_t len, uint64_t *shingles) {
+    char normalized[MAX_NORMALIZED];
+    size_t normalized_len = normalize(text, len, normalized);
+    if (normalized_len <= 1) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i + SHINGLE <= normalized_len; i++) {
+        uint64_t state = (uint64_t)(unsigned char)normalized[i] |
+                         (uint64_t)(unsigned char)normalized[i + 1] << 8 |
+                         (uint64_t)(unsigned char)normalized[i + 2] << 16;
+        shingles[count++] = splitmix64(&state);
+    }
+    qsort(shingles, count, sizeof(uint64_t), compare_shingles);
+
+    size_t distinct = 1;
+    for (size_t i = 1; i < count; i++) {
+        if (shingles[i] != shingles[distinct - 1]) {
+            shingles[distinct++] = shingles[i];
+        }
+    }
+    return distinct;
+}
+
+bool simindex_signature(const char *text, size_t len, uint8_t *signature) {
+    uint64_t shingles[MAX_NORMALIZED];
+    uint32_t minimums[SIMINDEX_HASHES];
+
+    if (!hashes_ready) {
+        init_hashes();
+    }
+    size_t count = shingle_set(text, len, shingles);
+    if (count == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < SIMINDEX_HASHES; i++) {
+        minimums[i] = UINT32_MAX;
+    }
+    for (size_t i = 0; i < count; i++) {
+        for (int j = 0; j < SIMINDEX_HASHES; j++) {
+            uint32_t value = (uint32_t)((hash_multipliers[j] * shingles[i] + hash_addends[j]) >> 32);
+            if (value < minimums[j]) {
+                minimums[j] = value;
+            }
+        }
+    }
+
+    for (int i = 0; i < SIMINDEX_HASHES; i++) {
+        signature[i] = (uint8_t)minimums[i];
+    }
+    return true;
+}
+
+double simindex_text_similarity(const char *a, size_t a_len, const char *b, size_t b_len) {
+    uint64_t a_shingles[MAX_NORMALIZED];
+    uint64_t b_shingles[MAX_NORMALIZED];
+    size_t a_count = shingle_set(a, a_len, a_shingles);
+    size_t b_count = shingle_set(b, b_len, b_shingles);
+    if (a_count == 0 || b_count == 0) {
+        return 0.0;
+    }
+
+    // Both sets are sorted: count the hashes they share in one merge
+    size_t shared = 0;
+    for (size_t i = 0, j = 0; i < a_count && j < b_count;) {
+        if (a_shingles[i] == b_shingles[j]) {
+            shared++;
+            i++;
+            j++;
+        } else if (a_shingles[i] < b_shingles[j]) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+    return (double)shared / (double)(a_count + b_count - shared);
+}
+
+double simindex_similarity(const uint8_t *a, const uint8_t *b) {
+    int equal = 0;
+    for (int i = 0; i < SIMINDEX_HASHES; i++) {
+        equal += (a[i] == b[i]);
+    }
+
+    // Unrelated bytes are equal one time in 256
+    double similarity = ((double)equal / SIMINDEX_HASHES - 1.0 / 256.0) / (1.0 - 1.0 / 256.0);
+    return (similarity > 0.0) ? similarity : 0.0;
+}
+
+/**
+ * @brief Move to the next run of digits
+ *
+ * @param len Set to the length of the run
+ * @return The run, or NULL if there are no more
+ */
+static const char *next_number(const char *p, size_t *len) {
+    while (*p != '\0' && (*p < '0' || *p > '9')) {
+        p++;
+    }
+    if (*p == '\0') {
+        return NULL;
+    }
+
+    *len = 0;
+    while (p[*len] >= '0' && p[*len] <= '9') {
+        (*len)++;
+    }
+    return p;
+}
+
+bool simindex_same_numbers(const char *a, const char *b) {
+    size_t a_len = 0, b_len = 0;
+    for (;;) {
+        a = next_number(a, &a_len);
+        b = next_number(b, &b_len);
+        if (a == NULL || b == NULL) {
+            return a == b;
+        }
+        if (a_len != b_len || memcmp(a, b, a_len) != 0) {
+            return false;
+        }
+        a += a_len;
+        b += b_len;
+    }
+}
+
+/**
+ * @brief Split a normalized query into its tokens
+ *
+ * @param normalized Output of normalize(), modified in place
+ * @param tokens Set to the tokens, MAX_TOKENS at most, each NUL-terminated
+ * @return Number of tokens
+ */
+static size_t split_tokens(char *normalized, size_t len, const char **tokens) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (normalized[i] == ' ') {
+            normalized[i] = '\0';
+        } else if (normalized[i - 1] == '\0') {
+            tokens[count++] = normalized + i;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Check whether a token list holds a token
+ */
+static bool has_token(const char *const *tokens, size_t count, const char *token) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(tokens[i], token) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Check whether one token is the other with a negating prefix
+ */
+static bool negates(const char *word, const char *other) {
+    size_t word_len = strlen(word);
+    size_t other_len = strlen(other);
+    for (size_t i = 0; i < sizeof(negations) / sizeof(negations[0]); i++) {
+        size_t prefix_len = strlen(negations[i]);
+        if (word_len == prefix_len + other_len && memcmp(word, negations[i], prefix_len) == 0 &&
+            strcmp(word + prefix_len, other) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool simindex_same_order(const char *a, const char *b) {
+    char a_normalized[MAX_NORMALIZED];
+    char b_normalized[MAX_NORMALIZED];
+    const char *a_tokens[MAX_TOKENS];
+    const char *b_tokens[MAX_TOKENS];
+    size_t a_count = split_tokens(a_normalized, normalize(a, strlen(a), a_normalized), a_tokens);
+    size_t b_count = split_tokens(b_normalized, normalize(b, strlen(b), b_normalized), b_tokens);
+
+    for (size_t i = 0; i < a_count; i++) {
+        for (size_t j = 0; j < b_count; j++) {
+            if (negates(a_tokens[i], b_tokens[j]) || negates(b_tokens[j], a_tokens[i])) {
+                return false;
+            }
+        }
+    }
+
+    // Walk the tokens both queries have, in each query's order; a
+    // repeated token counts where it first appears ("dir ... src dir")
+    size_t i = 0, j = 0;
+    for (;;) {
+        while (i < a_count && (!has_token(b_tokens, b_count, a_tokens[i]) || has_token(a_tokens, i, a_tokens[i]))) {
+            i++;
+        }
+        while (j < b_count && (!has_token(a_tokens, a_count, b_tokens[j]) || has_token(b_tokens, j, b_tokens[j]))) {
+            j++;
+        }
+        if (i == a_count || j == b_count) {
+            return i == a_count && j == b_count;
+        }
+        if (strcmp(a_tokens[i], b_tokens[j]) != 0) {
+            return false;
+        }
+        i++;
+        j++;
+    }
+}
+
+/**
+ * @brief Take or drop the lock on the index
+ */
+static bool lock_index(SimIndex *index, int operation) {
+    while (flock(index->fd, operation) != 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Size of an index file with a given capacity
+ */
+static size_t index_size(uint32_t capacity) {
+    return sizeof(SimIndexHeader) + (size_t)capacity * sizeof(SimIndexEntry) +
+           (size_t)SIMINDEX_BANDS * capacity * sizeof(uint32_t);
+}
+
+/**
+ * @brief Find the bucket of a band of a signature
+ *
+ * @return The bucket's SIMINDEX_WAYS slots, each an entry position plus one, or 0 if free
+ */
+static uint32_t *band_bucket(const SimIndex *index, int band, const uint8_t *signature) {
+    uint32_t bucket_count = index->header->capacity / SIMINDEX_WAYS;
+    uint64_t state = (uint64_t)band << 32;
+    for (int i = 0; i < BAND_ROWS; i++) {
+        state |= (uint64_t)signature[band * BAND_ROWS + i] << (8 * i);
+    }
+    uint32_t bucket = (uint32_t)splitmix64(&state) & (bucket_count - 1);
+    return index->buckets + ((size_t)band * bucket_count + bucket) * SIMINDEX_WAYS;
+}
+
+/**
+ * @brief Check whether an entry has the same band as a signature
+ */
+static bool same_band(const SimIndexEntry *entry, int band, const uint8_t *signature) {
+    return entry->serial != 0 &&
+           memcmp(entry->signature + band * BAND_ROWS, signature + band * BAND_ROWS, BAND_ROWS) == 0;
+}
+
+/**
+ * @brief Map an index file of a given capacity
+ */
+static bool map_index(SimIndex *index, uint32_t capacity) {
+    index->map_size = index_size(capacity);
+    void *map = mmap(NULL, index->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, index->fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    index->header = (SimIndexHeader *)map;
+    index->entries = (SimIndexEntry *)((char *)map + sizeof(SimIndexHeader));
+    index->buckets = (uint32_t *)(index->entries + capacity);
+    return true;
+}
+
+/**
+ * @brief Unmap the index and close its file (which drops the lock)
+ */
+static void detach_index(SimIndex *index) {
+    if (index->header != NULL) {
+        munmap(index->header, index->map_size);
+        index->header = NULL;
+        index->entries = NULL;
+        index->buckets = NULL;
+    }
+    if (index->fd >= 0) {
+        close(index->fd);
+        index->fd = -1;
+    }
+}
+
+/**
+ * @brief Replace the index open in index->fd with a new, empty file
+ *
+ * The new index is made in a temporary file and renamed over the old one,
+ * which is never truncated: other processes may have it mapped. The old
+ * file is then marked retired, and processes using it move to the new
+ * one. Called with the lock on the old index held; returns with the lock
+ * on the new one held.
+ *
+ * @param old_readable Whether the old file holds a whole header
+ */
+static bool replace_index(SimIndex *index, bool old_readable) {
+    size_t tmp_len = strlen(index->path) + 5;
+    char *tmp_path = (char *)malloc(tmp_len);
+    if (tmp_path == NULL) {
+        return false;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", index->path);
+
+    int old_fd = index->fd;
+    index->fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool ok = index->fd >= 0 && lock_index(index, LOCK_EX) &&
+              ftruncate(index->fd, (off_t)index_size(index->capacity)) == 0 && map_index(index, index->capacity);
+    if (ok) {
+        // The file is all zeros: only the header needs filling in
+        memcpy(index->header->magic, INDEX_MAGIC, sizeof(index->header->magic));
+        index->header->version = INDEX_VERSION;
+        index->header->capacity = index->capacity;
+    }
+    ok = ok && rename(tmp_path, index->path) == 0;
+
+    if (ok) {
+        // A file too short to hold a header gets a whole one, so it reads as retired
+        SimIndexHeader retired;
+        memset(&retired, 0, sizeof(retired));
+        retired.retired = 1;
+        if (old_readable) {
+            (void)!pwrite(old_fd, &retired.retired, sizeof(retired.retired), offsetof(SimIndexHeader, retired));
+        } else {
+            (void)!pwrite(old_fd, &retired, sizeof(retired), 0);
+        }
+        close(old_fd);
+    } else {
+        if (index->fd >= 0) {
+            unlink(tmp_path);
+        }
+        detach_index(index);
+        index->fd = old_fd;
+    }
+
+    free(tmp_path);
+    return ok;
+}
+
+/**
+ * @brief Open and map the index, replacing it if it is not valid
+ *
+ * A valid index is used at the capacity it was made with, since other
+ * processes may have it mapped. One that is missing, damaged or from
+ * another version is replaced, and one that another process replaced
+ * meanwhile is followed to its new file. Returns with the lock held.
+ */
+static bool attach_index(SimIndex *index) {
+    for (;;) {
+        index->fd = open(index->path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (index->fd < 0) {
+            return false;
+        }
+        if (!lock_index(index, LOCK_EX)) {
+            break;
+        }
+
+        SimIndexHeader header;
+        struct stat st;
+        bool readable = fstat(index->fd, &st) == 0 && (size_t)st.st_size >= sizeof(header) &&
+                        pread(index->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+        if (readable && header.retired) {
+            close(index->fd); // Also drops the lock
+            continue;
+        }
+
+        bool valid = readable && memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+                     header.version == INDEX_VERSION && header.capacity >= MIN_CAPACITY &&
+                     (header.capacity & (header.capacity - 1)) == 0 &&
+                     (size_t)st.st_size == index_size(header.capacity);
+        if (valid) {
+            if (!map_index(index, header.capacity)) {
+                break;
+            }
+            return true;
+        }
+        if (replace_index(index, readable)) {
+            return true;
+        }
+        break;
+    }
+
+    detach_index(index);
+    return false;
+}
+
+/**
+ * @brief Take the lock, first moving to the file that replaced a retired index
+ *
+ * After a move the lock is exclusive whatever was asked for.
+ */
+static bool lock_current(SimIndex *index, int operation) {
+    if (index->header == NULL || !lock_index(index, operation)) {
+        return false;
+    }
+    if (!index->header->retired) {
+        return true;
+    }
+
+    detach_index(index);
+    return attach_index(index);
+}
+
+bool simindex_open(SimIndex *index, const char *path, uint32_t capacity) {
+    memset(index, 0, sizeof(SimIndex));
+    index->fd = -1;
+
+    index->capacity = MIN_CAPACITY;
+    while (index->capacity < capacity && index->capacity < (UINT32_C(1) << 30)) {
+        index->capacity <<= 1;
+    }
+
+    index->path = strdup(path);
+    if (index->path == NULL || !statedir_make_parent(index->path) || !attach_index(index)) {
+        simindex_close(index);
+        return false;
+    }
+
+    lock_index(index, LOCK_UN);
+    return true;
+}
+
+bool simindex_add(SimIndex *index, uint64_t group, uint64_t key, const uint8_t *signature) {
+    if (!lock_current(index, LOCK_EX | LOCK_NB)) {
+        return false;
+    }
+
+    // The same query leaves the same signature, so it would share every band
+    uint32_t *ways = band_bucket(index, 0, signature);
+    for (int i = 0; i < SIMINDEX_WAYS; i++) {
+        const SimIndexEntry *entry = (ways[i] != 0) ? &index->entries[ways[i] - 1] : NULL;
+        if (entry != NULL && same_band(entry, 0, signature) && entry->group == group && entry->key == key) {
+            lock_index(index, LOCK_UN);
+            return true;
+        }
+    }
+
+    // The ring position of the oldest entry; pointers to it go stale
+    SimIndexHeader *header = index->header;
+    uint32_t position = (uint32_t)(header->serial % header->capacity);
+    SimIndexEntry *entry = &index->entries[position];
+    if (entry->serial == 0) {
+        header->entries++;
+    }
+    entry->serial = ++header->serial;
+    entry->group = group;
+    entry->key = key;
+    memcpy(entry->signature, signature, SIMINDEX_HASHES);
+
+    // Each band takes a free or stale way of its bucket, or the oldest one
+    for (int band = 0; band < SIMINDEX_BANDS; band++) {
+        ways = band_bucket(index, band, signature);
+        int chosen = 0;
+        uint64_t oldest = UINT64_MAX;
+        for (int i = 0; i < SIMINDEX_WAYS; i++) {
+            const SimIndexEntry *other = (ways[i] != 0) ? &index->entries[ways[i] - 1] : NULL;
+            if (other == NULL || other == entry || other->serial == 0 ||
+                band_bucket(index, band, other->signature) != ways) {
+                chosen = i;
+                break;
+            }
+            if (other->serial < oldest) {
+                oldest = other->serial;
+                chosen = i;
+            }
+        }
+        ways[chosen] = position + 1;
+    }
+
+    lock_index(index, LOCK_UN);
+    return true;
+}
+
+size_t simindex_find(SimIndex *index, uint64_t group, const uint8_t *signature, double threshold,
+                     SimIndexMatch *matches, size_t max_matches) {
+    if (max_matches == 0 || !lock_current(index, LOCK_SH)) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (int band = 0; band < SIMINDEX_BANDS; band++) {
+        const uint32_t *ways = band_bucket(index, band, signature);
+        for (int i = 0; i < SIMINDEX_WAYS; i++) {
+            if (ways[i] == 0) {
+                continue;
+            }
+            uint32_t position = ways[i] - 1;
+            const SimIndexEntry *entry = &index->entries[position];
+            if (entry->group != group || !same_band(entry, band, signature)) {
+                continue;
+            }
+            double similarity = simindex_similarity(entry->signature, signature);
+            if (similarity < threshold) {
+                continue;
+            }
+
+            // Found again through another band?
+            bool seen = false;
+            for (size_t j = 0; j < count && !seen; j++) {
+                seen = matches[j].entry == position;
+            }
+            if (seen) {
+                continue;
+            }
+
+            // Insert in order, the least similar falling off the end
+            size_t at = count;
+            while (at > 0 && matches[at - 1].similarity < similarity) {
+                at--;
+            }
+            if (at == max_matches) {
+                continue;
+            }
+            if (count < max_matches) {
+                count++;
+            }
+            memmove(&matches[at + 1], &matches[at], (count - 1 - at) * sizeof(SimIndexMatch));
+            matches[at].key = entry->key;
+            matches[at].similarity = similarity;
+            matches[at].entry = position;
+        }
+    }
+
+    lock_index(index, LOCK_UN);
+    return count;
+}
+
+void simindex_remove(SimIndex *index, const SimIndexMatch *match) {
+    if (!lock_current(index, LOCK_EX)) {
+        return;
+    }
+
+    // The match may come from a file that has been replaced since
+    SimIndexEntry *entry = (match->entry < index->header->capacity) ? &index->entries[match->entry] : NULL;
+    if (entry != NULL && entry->serial != 0 && entry->key == match->key) {
+        entry->serial = 0;
+        index->header->entries--;
+    }
+    lock_index(index, LOCK_UN);
+}
+
+uint64_t simindex_entries(const SimIndex *index) {
+    return (index->header != NULL) ? index->header->entries : 0;
+}
+
+void simindex_close(SimIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+
+    detach_index(index);
+    free(index->path);
+    index->path = NULL;
+}
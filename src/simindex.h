@@ -0,0 +1,183 @@
+/**
+ * @file simindex.h
+ * @brief Similarity index of cached chat queries for AISH (AI Shell)
+ *
+ * Finds earlier queries that say the same thing in other words, so their
+ * cached answers can be offered without asking the model again.
+ *
+ * A query is reduced to normalized tokens: lowercased, common filler
+ * words dropped, plurals and a small set of shell synonyms folded
+ * together ("show the largest files in this dir" and "list big files
+ * here" both become "list large file dir"). Its signature is a MinHash
+ * of the character 3-grams of those tokens: SIMINDEX_HASHES minimums
+ * under different hash functions, of which the low byte is kept. The
+ * share of equal bytes in two signatures estimates the Jaccard
+ * similarity of the two sets of 3-grams.
+ *
+ * The index is locality-sensitive hashing over those signatures, kept in
+ * a file mapped into memory. Signatures are cut into SIMINDEX_BANDS bands
+ * of four bytes; for every band a table of buckets (SIMINDEX_WAYS entries
+ * each) lists the entries with that band. Queries that share a band with
+ * an entry are compared with it, so a lookup looks at no more than
+ * SIMINDEX_BANDS * SIMINDEX_WAYS entries, however many are indexed.
+ * Pairs 70% alike share a band 99% of the time, pairs 30% alike 12%.
+ *
+ * Entries are written to a ring: once it is full, the oldest entry is
+ * replaced. A full bucket drops its oldest entry. Like the response
+ * cache, the file is shared by AISH processes under a flock().
+ */
+
+#ifndef SIMINDEX_H
+#define SIMINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIMINDEX_HASHES 64          /**< Bytes in a signature */
+#define SIMINDEX_BANDS 16           /**< Bands of a signature, SIMINDEX_HASHES / 4 */
+#define SIMINDEX_WAYS 8             /**< Entries per bucket */
+
+/**
+ * @brief Index header and entry layouts (in simindex.c)
+ */
+typedef struct SimIndexHeader SimIndexHeader;
+typedef struct SimIndexEntry SimIndexEntry;
+
+/**
+ * @struct SimIndex
+ * @brief An open similarity index
+ */
+typedef struct {
+    char *path;                 /**< Index file */
+    int fd;                     /**< Index, also the lock (-1 if closed) */
+    SimIndexHeader *header;     /**< Mapped index */
+    SimIndexEntry *entries;     /**< Its ring of entries */
+    uint32_t *buckets;          /**< Its bucket tables, SIMINDEX_BANDS of them */
+    size_t map_size;            /**< Bytes mapped */
+    uint32_t capacity;          /**< Entries a replacement file is made with */
+} SimIndex;
+
+/**
+ * @struct SimIndexMatch
+ * @brief An indexed query similar to the one looked up
+ */
+typedef struct {
+    uint64_t key;               /**< Key the entry was added with */
+    double similarity;          /**< Estimated Jaccard similarity, 0 to 1 */
+    uint32_t entry;             /**< Position of the entry, for simindex_remove() */
+} SimIndexMatch;
+
+/**
+ * @brief Compute the signature of a query
+ *
+ * @param text The query
+ * @param len Its length
+ * @param signature Filled with SIMINDEX_HASHES bytes
+ * @return true if the query has any tokens left after normalizing, false otherwise
+ */
+bool simindex_signature(const char *text, size_t len, uint8_t *signature);
+
+/**
+ * @brief Estimate the similarity of two queries from their signatures
+ *
+ * @return Estimated Jaccard similarity of their 3-grams, 0 to 1
+ */
+double simindex_similarity(const uint8_t *a, const uint8_t *b);
+
+/**
+ * @brief Compute the exact similarity of two queries
+ *
+ * What simindex_similarity() estimates, for checking a match against the
+ * text it was added for: estimates of queries that differ in one word of
+ * five stray above a threshold now and then.
+ *
+ * @return Jaccard similarity of their normalized 3-grams, 0 to 1
+ */
+double simindex_text_similarity(const char *a, size_t a_len, const char *b, size_t b_len);
+
+/**
+ * @brief Check that two queries mention the same numbers in the same order
+ *
+ * Numbers barely change a signature, but "older than 2 days" and "older
+ * than 20 days" need different commands.
+ *
+ * @return true if the numbers agree, false otherwise
+ */
+bool simindex_same_numbers(const char *a, const char *b);
+
+/**
+ * @brief Check that two queries name the words they share in the same order
+ *
+ * Order barely changes a signature, but "copy report.txt to backup" and
+ * "copy backup to report.txt" swap source and destination. Queries where
+ * a word of one is a word of the other with a negating prefix
+ * ("compress", "decompress") do not agree either.
+ *
+ * @return true if the order agrees, false otherwise
+ */
+bool simindex_same_order(const char *a, const char *b);
+
+/**
+ * @brief Open (or create) an index
+ *
+ * @param index Pointer to SimIndex structure to initialize
+ * @param path Index file
+ * @param capacity Entries kept (rounded up to a power of two) in a new file; an existing one keeps its own
+ * @return true if successful, false otherwise (the index is then closed)
+ */
+bool simindex_open(SimIndex *index, const char *path, uint32_t capacity);
+
+/**
+ * @brief Add a query
+ *
+ * Nothing changes if the same key is already indexed in the group. Does
+ * not wait for another process holding the lock: the query is then not
+ * indexed.
+ *
+ * @param index Pointer to SimIndex structure
+ * @param group Only queries of the same group are matched
+ * @param key What the query is found by elsewhere (such as a cache key hash)
+ * @param signature Its signature
+ * @return true if indexed, false otherwise
+ */
+bool simindex_add(SimIndex *index, uint64_t group, uint64_t key, const uint8_t *signature);
+
+/**
+ * @brief Find the indexed queries most similar to one
+ *
+ * @param index Pointer to SimIndex structure
+ * @param group Group of the query
+ * @param signature Its signature
+ * @param threshold Least similarity of a match
+ * @param matches Filled with the matches, most similar first
+ * @param max_matches Size of matches
+ * @return Number of matches
+ */
+size_t simindex_find(SimIndex *index, uint64_t group, const uint8_t *signature, double threshold,
+                     SimIndexMatch *matches, size_t max_matches);
+
+/**
+ * @brief Remove a match whose key turned out to be gone
+ *
+ * @param index Pointer to SimIndex structure
+ * @param match A match from simindex_find()
+ */
+void simindex_remove(SimIndex *index, const SimIndexMatch *match);
+
+/**
+ * @brief Get the number of entries
+ *
+ * @param index Pointer to SimIndex structure
+ * @return Entries in the ring
+ */
+uint64_t simindex_entries(const SimIndex *index);
+
+/**
+ * @brief Close an index
+ *
+ * @param index Pointer to SimIndex structure
+ */
+void simindex_close(SimIndex *index);
+
+#endif /* SIMINDEX_H */
@@ -0,0 +1,71 @@
+/**
+ * @file statedir.c
+ * @brief Implementation of the state directory lookup for AISH
+ */
+
+#include "statedir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <sys/stat.h>
+
+#define STATE_DIR_NAME "aish"
+
+char *statedir_path(const char *name) {
+    const char *base = getenv("XDG_STATE_HOME");
+    const char *suffix = "";
+
+    // The XDG spec says relative paths are to be ignored
+    if (base == NULL || base[0] != '/') {
+        base = getenv("HOME");
+        if (base == NULL || *base == '\0') {
+            struct passwd *pw = getpwuid(getuid());
+            base = (pw != NULL) ? pw->pw_dir : NULL;
+        }
+        suffix = "/.local/state";
+    }
+
+    if (base == NULL || *base == '\0') {
+        return NULL;
+    }
+
+    size_t len = strlen(base) + strlen(suffix) + strlen(STATE_DIR_NAME) + strlen(name) + 3;
+    char *path = (char *)malloc(len);
+    if (path != NULL) {
+        snprintf(path, len, "%s%s/%s/%s", base, suffix, STATE_DIR_NAME, name);
+    }
+    return path;
+}
+
+bool statedir_make_parent(const char *path) {
+    char *dir = strdup(path);
+    if (dir == NULL) {
+        return false;
+    }
+
+    char *last = strrchr(dir, '/');
+    if (last == NULL || last == dir) {
+        free(dir);
+        return true;
+    }
+    *last = '\0';
+
+    // Create each missing level in turn
+    bool ok = true;
+    for (char *slash = strchr(dir + 1, '/'); ok; slash = strchr(slash + 1, '/')) {
+        if (slash != NULL) {
+            *slash = '\0';
+        }
+        ok = (mkdir(dir, 0700) == 0 || errno == EEXIST);
+        if (slash == NULL) {
+            break;
+        }
+        *slash = '/';
+    }
+
+    free(dir);
+    return ok;
+}
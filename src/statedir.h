@@ -0,0 +1,30 @@
+/**
+ * @file statedir.h
+ * @brief Location of the files AISH (AI Shell) keeps across launches
+ *
+ * State lives in $XDG_STATE_HOME/aish, or ~/.local/state/aish when
+ * XDG_STATE_HOME is unset or not an absolute path.
+ */
+
+#ifndef STATEDIR_H
+#define STATEDIR_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Get the path of a file in the state directory
+ *
+ * @param name File name
+ * @return Dynamically allocated path (must be freed by caller), NULL if the directory is unknown or memory ran out
+ */
+char *statedir_path(const char *name);
+
+/**
+ * @brief Create the directories above a file, mode 0700
+ *
+ * @param path Path of the file
+ * @return true if its directory exists afterwards, false otherwise
+ */
+bool statedir_make_parent(const char *path);
+
+#endif /* STATEDIR_H */
@@ -13,6 +13,8 @@
 
 #define INITIAL_BUFFER_SIZE 1024
 #define TAB_KEY '\t'
+#define PASTE_MODE_PREFIX "\033[?2004"
+#define PASTE_MODE_PREFIX_LEN (sizeof(PASTE_MODE_PREFIX) - 1)
 
 bool terminal_init(TerminalState *term) {
     if (term == NULL) {
@@ -33,6 +35,10 @@ bool terminal_init(TerminalState *term) {
     
     term->buffer_pos = 0;
     term->input_buffer[0] = '\0';
+    term->paste_start = 0;
+    term->app_paste = false;
+    term->paste_reset = false;
+    term->paste_seq_match = 0;
     
     return true;
 }
@@ -90,6 +96,39 @@ void terminal_disable_raw_mode(TerminalState *term) {
     term->raw_mode_enabled = false;
 }
 
+void terminal_track_output(TerminalState *term, const char *data, size_t len) {
+    size_t i = 0;
+    
+    while (i < len) {
+        if (term->paste_seq_match == 0) {
+            // Output is mostly text; skip straight to the next escape
+            const char *esc = memchr(data + i, '\033', len - i);
+            if (esc == NULL) {
+                return;
+            }
+            i = (size_t)(esc - data) + 1;
+            term->paste_seq_match = 1;
+        } else if (term->paste_seq_match < PASTE_MODE_PREFIX_LEN) {
+            if (data[i] == PASTE_MODE_PREFIX[term->paste_seq_match]) {
+                term->paste_seq_match++;
+                i++;
+            } else {
+                // Not ours; look at this byte again as a possible ESC
+                term->paste_seq_match = 0;
+            }
+        } else {
+            if (data[i] == 'h') {
+                term->app_paste = true;
+            } else if (data[i] == 'l') {
+                term->app_paste = false;
+                term->paste_reset = true;
+            }
+            term->paste_seq_match = 0;
+            i++;
+        }
+    }
+}
+
 bool terminal_process_key(TerminalState *term, char key, size_t input_pos) {
     if (term == NULL) {
         return false;
@@ -10,6 +10,9 @@
 #include <stddef.h>
 #include <termios.h>
 
+#define TERMINAL_PASTE_ON "\033[?2004h"   /**< Enable bracketed paste */
+#define TERMINAL_PASTE_OFF "\033[?2004l"  /**< Disable bracketed paste */
+
 /**
  * @enum InputMode
  * @brief Enumeration of input modes for AISH
@@ -30,6 +33,10 @@ typedef struct {
     char *input_buffer;               /**< Buffer for user input */
     size_t buffer_size;               /**< Size of input buffer */
     size_t buffer_pos;                /**< Current position in input buffer */
+    size_t paste_start;               /**< Input buffer position where a Chat mode paste began */
+    bool app_paste;                   /**< Program behind the pty asked for bracketed paste */
+    bool paste_reset;                 /**< That program turned bracketed paste off on the terminal */
+    size_t paste_seq_match;           /**< Bytes of a paste mode sequence seen so far in its output */
 } TerminalState;
 
 /**
@@ -55,6 +62,19 @@ bool terminal_enable_raw_mode(TerminalState *term);
  */
 void terminal_disable_raw_mode(TerminalState *term);
 
+/**
+ * @brief Follow bracketed paste mode changes in output from the pty
+ * 
+ * Sets app_paste when the program enables bracketed paste and clears it
+ * (setting paste_reset) when it disables it. Sequences may be split
+ * across calls.
+ * 
+ * @param term Pointer to TerminalState structure
+ * @param data Output bytes on their way to the terminal
+ * @param len Number of bytes
+ */
+void terminal_track_output(TerminalState *term, const char *data, size_t len);
+
 /**
  * @brief Process a keypress and determine if mode should be toggled
  * 
@@ -0,0 +1,630 @@
+/**
+ * @file uring.c
+ * @brief Implementation of the io_uring relay backend for AISH
+ */
+
+#include "uring.h"
+#include <errno.h>
+#include <string.h>
+
+void uring_relay_clear(UringRelay *relay) {
+    memset(relay, 0, sizeof(UringRelay));
+    relay->fd = -1;
+    relay->src_fd = -1;
+    relay->dst_fd = -1;
+}
+
+bool uring_relay_active(const UringRelay *relay) {
+    return relay->fd != -1;
+}
+
+#if defined(__linux__)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 16
+#define URING_BGID 0
+#define URING_PROBE_OPS 256
+
+// Multishot read (Linux 6.7) is missing from older copies of the header;
+// the probe tells whether the running kernel has it
+#define URING_OP_READ_MULTISHOT 49
+
+enum {
+    URING_TAG_READ = 1,     /**< Read from the pty */
+    URING_TAG_WRITE,        /**< Write to the terminal */
+    URING_TAG_POLL_IN,      /**< Wait for the pty after EAGAIN */
+    URING_TAG_POLL_OUT,     /**< Wait for the terminal after EAGAIN */
+    URING_TAG_CANCEL        /**< Cancellation of the pty read */
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * @brief Publish queued SQEs to the kernel, optionally waiting for completions
+ */
+static bool submit(UringRelay *relay, unsigned wait_for) {
+    unsigned count = relay->sqe_tail - *relay->sq_tail;
+
+    if (count == 0 && wait_for == 0) {
+        return true;
+    }
+
+    __atomic_store_n(relay->sq_tail, relay->sqe_tail, __ATOMIC_RELEASE);
+
+    for (;;) {
+        int ret = sys_io_uring_enter(relay->fd, count, wait_for,
+                                     wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+        relay->stats.enters++;
+        if (ret >= 0) {
+            relay->stats.submissions += (uint64_t)ret;
+            return true;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+        if (wait_for > 0) {
+            // The SQEs went in before the wait was interrupted
+            count = 0;
+        }
+    }
+}
+
+/**
+ * @brief Hand out the next submission queue entry
+ */
+static struct io_uring_sqe *get_sqe(UringRelay *relay) {
+    unsigned head = __atomic_load_n(relay->sq_head, __ATOMIC_ACQUIRE);
+
+    if (relay->sqe_tail - head >= relay->sq_entries) {
+        if (!submit(relay, 0)) {
+            return NULL;
+        }
+        head = __atomic_load_n(relay->sq_head, __ATOMIC_ACQUIRE);
+        if (relay->sqe_tail - head >= relay->sq_entries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+
+    unsigned index = relay->sqe_tail & relay->sq_mask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)relay->sqes)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    relay->sq_array[index] = index;
+    relay->sqe_tail++;
+
+    return sqe;
+}
+
+/**
+ * @brief Give a provided buffer back to the kernel
+ */
+static void recycle_buffer(UringRelay *relay, uint16_t bid) {
+    struct io_uring_buf_ring *ring = (struct io_uring_buf_ring *)relay->buf_ring;
+    struct io_uring_buf *buf = &ring->bufs[relay->buf_tail & (URING_BUF_COUNT - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(relay->buffers + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+
+    relay->buf_tail++;
+    __atomic_store_n(&ring->tail, relay->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Wait for an fd with a poll request after the kernel said EAGAIN
+ */
+static bool arm_poll(UringRelay *relay, int fd, unsigned mask, uint64_t tag) {
+    struct io_uring_sqe *sqe = get_sqe(relay);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = mask;
+    sqe->user_data = tag;
+    return true;
+}
+
+/**
+ * @brief Submit a read on the pty unless one is outstanding or no buffer is free
+ */
+static bool arm_read(UringRelay *relay) {
+    if (relay->read_armed || relay->eof || relay->read_error != 0 || relay->stopping ||
+        relay->held_count == URING_BUF_COUNT) {
+        return true;
+    }
+
+    struct io_uring_sqe *sqe = get_sqe(relay);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    // The kernel picks a buffer from the group when data arrives; a
+    // multishot read then keeps posting completions until buffers run out
+    sqe->opcode = relay->multishot ? URING_OP_READ_MULTISHOT : IORING_OP_READ;
+    sqe->fd = relay->src_fd;
+    sqe->off = (uint64_t)-1;
+    sqe->len = relay->multishot ? 0 : URING_BUF_SIZE;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = URING_TAG_READ;
+
+    relay->read_armed = true;
+    relay->stats.rearms++;
+    return true;
+}
+
+/**
+ * @brief Queue the write recorded in pending_data/pending_len
+ */
+static bool queue_write(UringRelay *relay) {
+    struct io_uring_sqe *sqe = get_sqe(relay);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    sqe->opcode = relay->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = relay->dst_fd;
+    sqe->off = (uint64_t)-1;
+    sqe->addr = (uint64_t)(uintptr_t)relay->pending_data;
+    sqe->len = (uint32_t)relay->pending_len;
+    sqe->buf_index = 0;
+    sqe->user_data = URING_TAG_WRITE;
+    return true;
+}
+
+/**
+ * @brief Move held buffers into the output queue while it has room
+ */
+static void release_ready(UringRelay *relay) {
+    while (relay->held_count > 0 && output_can_fill(relay->out)) {
+        uint16_t bid = relay->held_bid[relay->held_head];
+        uint32_t len = relay->held_len[relay->held_head];
+
+        output_fill_data(relay->out, relay->buffers + (size_t)bid * URING_BUF_SIZE, len);
+        relay->bytes_read += len;
+        recycle_buffer(relay, bid);
+
+        relay->held_head = (relay->held_head + 1) % URING_BUF_COUNT;
+        relay->held_count--;
+    }
+}
+
+/**
+ * @brief Handle a completion of the pty read
+ */
+static void handle_read(UringRelay *relay, int res, unsigned flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        relay->read_armed = false;
+    }
+
+    if (res > 0) {
+        // Held in arrival order until the output queue can take it
+        unsigned slot = (relay->held_head + relay->held_count) % URING_BUF_COUNT;
+        relay->held_bid[slot] = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        relay->held_len[slot] = (uint32_t)res;
+        relay->held_count++;
+        release_ready(relay);
+        return;
+    }
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        recycle_buffer(relay, (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+
+    if (res == 0 || res == -EIO) {
+        relay->eof = true;
+    } else if (res == -EAGAIN) {
+        // The pty is non-blocking: wait for it, then read again
+        if (arm_poll(relay, relay->src_fd, POLLIN, URING_TAG_POLL_IN)) {
+            relay->read_armed = true;
+        }
+    } else if (res != -ENOBUFS && res != -EINTR && res != -ECANCELED) {
+        // ENOBUFS: every buffer is held; the read is re-armed once one is free
+        relay->read_error = -res;
+    }
+}
+
+/**
+ * @brief Handle a completion of a write to the terminal
+ */
+static void handle_write(UringRelay *relay, int res) {
+    if (res == -EAGAIN) {
+        // Retried from the same spot once the terminal is writable
+        if (!arm_poll(relay, relay->dst_fd, POLLOUT, URING_TAG_POLL_OUT)) {
+            relay->write_error = errno;
+        }
+        return;
+    }
+
+    if (res == -EINTR) {
+        // io-wq workers can be interrupted mid-write; just issue it again
+        if (!queue_write(relay)) {
+            relay->write_error = errno;
+        }
+        return;
+    }
+
+    relay->pending_len = 0;
+    if (!output_complete(relay->out, res)) {
+        relay->write_error = errno;
+        return;
+    }
+
+    // Room was freed: take held reads first, then start the next write
+    release_ready(relay);
+    if (!output_flush(relay->out)) {
+        relay->write_error = errno;
+    }
+}
+
+bool uring_relay_process(UringRelay *relay) {
+    unsigned head = *relay->cq_head;
+
+    relay->bytes_read = 0;
+    relay->in_process = true;
+
+    for (;;) {
+        unsigned tail = __atomic_load_n(relay->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+
+        struct io_uring_cqe *cqe = &((struct io_uring_cqe *)relay->cqes)[head & relay->cq_mask];
+        uint64_t tag = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+
+        head++;
+        __atomic_store_n(relay->cq_head, head, __ATOMIC_RELEASE);
+        relay->stats.completions++;
+
+        switch (tag) {
+        case URING_TAG_READ:
+            handle_read(relay, res, flags);
+            break;
+        case URING_TAG_WRITE:
+            handle_write(relay, res);
+            break;
+        case URING_TAG_POLL_IN:
+            relay->read_armed = false;
+            break;
+        case URING_TAG_POLL_OUT:
+            if (!queue_write(relay)) {
+                relay->write_error = errno;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    release_ready(relay);
+    arm_read(relay);
+    relay->in_process = false;
+
+    if (!submit(relay, 0) && relay->write_error == 0) {
+        relay->write_error = errno;
+    }
+    if (relay->write_error != 0) {
+        errno = relay->write_error;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief OutputWriter hook: start writing a run of the output queue
+ */
+static bool writer_submit(void *ctx, const char *data, size_t len) {
+    UringRelay *relay = (UringRelay *)ctx;
+
+    if (relay->write_error != 0) {
+        errno = relay->write_error;
+        return false;
+    }
+
+    relay->pending_data = data;
+    relay->pending_len = len;
+    if (!queue_write(relay)) {
+        return false;
+    }
+
+    // Inside uring_relay_process() everything goes in one io_uring_enter()
+    return relay->in_process || submit(relay, 0);
+}
+
+/**
+ * @brief OutputWriter hook: block until something completes
+ */
+static void writer_wait(void *ctx) {
+    UringRelay *relay = (UringRelay *)ctx;
+
+    if (relay->write_error != 0 || !submit(relay, 1)) {
+        return;
+    }
+    uring_relay_process(relay);
+}
+
+/**
+ * @brief Map the submission and completion rings
+ */
+static bool map_rings(UringRelay *relay, const struct io_uring_params *params) {
+    relay->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    relay->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        if (relay->cq_ring_size > relay->sq_ring_size) {
+            relay->sq_ring_size = relay->cq_ring_size;
+        }
+        relay->cq_ring_size = relay->sq_ring_size;
+    }
+
+    relay->sq_ring = mmap(NULL, relay->sq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, relay->fd, IORING_OFF_SQ_RING);
+    if (relay->sq_ring == MAP_FAILED) {
+        relay->sq_ring = NULL;
+        return false;
+    }
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        relay->cq_ring = relay->sq_ring;
+    } else {
+        relay->cq_ring = mmap(NULL, relay->cq_ring_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, relay->fd, IORING_OFF_CQ_RING);
+        if (relay->cq_ring == MAP_FAILED) {
+            relay->cq_ring = NULL;
+            return false;
+        }
+    }
+
+    relay->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    relay->sqes = mmap(NULL, relay->sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, relay->fd, IORING_OFF_SQES);
+    if (relay->sqes == MAP_FAILED) {
+        relay->sqes = NULL;
+        return false;
+    }
+
+    char *sq = (char *)relay->sq_ring;
+    char *cq = (char *)relay->cq_ring;
+    relay->sq_head = (unsigned *)(sq + params->sq_off.head);
+    relay->sq_tail = (unsigned *)(sq + params->sq_off.tail);
+    relay->sq_array = (unsigned *)(sq + params->sq_off.array);
+    relay->sq_mask = *(unsigned *)(sq + params->sq_off.ring_mask);
+    relay->sq_entries = params->sq_entries;
+    relay->sqe_tail = *relay->sq_tail;
+    relay->cq_head = (unsigned *)(cq + params->cq_off.head);
+    relay->cq_tail = (unsigned *)(cq + params->cq_off.tail);
+    relay->cq_mask = *(unsigned *)(cq + params->cq_off.ring_mask);
+    relay->cqes = cq + params->cq_off.cqes;
+
+    return true;
+}
+
+/**
+ * @brief Check which operations the kernel supports
+ */
+static bool probe_ops(UringRelay *relay) {
+    size_t size = sizeof(struct io_uring_probe) + URING_PROBE_OPS * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+    if (probe == NULL) {
+        return false;
+    }
+
+    bool ok = false;
+    if (sys_io_uring_register(relay->fd, IORING_REGISTER_PROBE, probe, URING_PROBE_OPS) == 0) {
+        const unsigned required[] = { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_WRITE_FIXED,
+                                      IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL };
+        ok = true;
+        for (size_t i = 0; i < sizeof(required) / sizeof(required[0]); i++) {
+            unsigned op = required[i];
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                ok = false;
+            }
+        }
+        relay->multishot = URING_OP_READ_MULTISHOT <= probe->last_op &&
+                           (probe->ops[URING_OP_READ_MULTISHOT].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    free(probe);
+    if (!ok) {
+        errno = EOPNOTSUPP;
+    }
+    return ok;
+}
+
+/**
+ * @brief Register the provided buffer ring pty reads land in
+ */
+static bool setup_buffers(UringRelay *relay) {
+    size_t ring_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+
+    relay->buf_ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (relay->buf_ring == MAP_FAILED) {
+        relay->buf_ring = NULL;
+        return false;
+    }
+
+    relay->buffers = (char *)malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (relay->buffers == NULL) {
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)relay->buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BGID;
+    if (sys_io_uring_register(relay->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        return false;
+    }
+
+    for (uint16_t bid = 0; bid < URING_BUF_COUNT; bid++) {
+        recycle_buffer(relay, bid);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Release everything set up so far
+ */
+static void teardown(UringRelay *relay) {
+    int saved_errno = errno;
+
+    if (relay->fd != -1) {
+        close(relay->fd);
+    }
+    if (relay->sqes != NULL) {
+        munmap(relay->sqes, relay->sqes_size);
+    }
+    if (relay->cq_ring != NULL && relay->cq_ring != relay->sq_ring) {
+        munmap(relay->cq_ring, relay->cq_ring_size);
+    }
+    if (relay->sq_ring != NULL) {
+        munmap(relay->sq_ring, relay->sq_ring_size);
+    }
+    if (relay->buf_ring != NULL) {
+        munmap(relay->buf_ring, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    }
+    free(relay->buffers);
+
+    uring_relay_clear(relay);
+    errno = saved_errno;
+}
+
+bool uring_relay_init(UringRelay *relay, int src_fd, OutputBuffer *out) {
+    struct io_uring_params params;
+
+    uring_relay_clear(relay);
+    memset(&params, 0, sizeof(params));
+
+    relay->fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (relay->fd == -1) {
+        return false;
+    }
+
+    if (!map_rings(relay, &params) || !probe_ops(relay) || !setup_buffers(relay)) {
+        teardown(relay);
+        return false;
+    }
+
+    // Registering the output queue lets writes skip the per-call page
+    // lookup; plain writes still work if the kernel refuses
+    struct iovec iov = { .iov_base = out->ring.data, .iov_len = out->ring.capacity };
+    relay->fixed = sys_io_uring_register(relay->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    relay->src_fd = src_fd;
+    relay->dst_fd = out->fd;
+    relay->out = out;
+    relay->writer.submit = writer_submit;
+    relay->writer.wait = writer_wait;
+    relay->writer.ctx = relay;
+
+    if (!arm_read(relay) || !submit(relay, 0)) {
+        teardown(relay);
+        return false;
+    }
+
+    // Nothing may be half-written through writev() when the writer takes over
+    output_drain(out);
+    output_set_writer(out, &relay->writer);
+
+    return true;
+}
+
+bool uring_relay_release(UringRelay *relay) {
+    while (relay->held_count > 0) {
+        if (!output_flush(relay->out)) {
+            return false;
+        }
+        if (!output_can_fill(relay->out)) {
+            output_wait_writable(relay->out);
+            if (relay->write_error != 0) {
+                errno = relay->write_error;
+                return false;
+            }
+        }
+        release_ready(relay);
+    }
+
+    return output_flush(relay->out);
+}
+
+void uring_relay_free(UringRelay *relay) {
+    if (relay == NULL || relay->fd == -1) {
+        return;
+    }
+
+    // Stop the pty read before its buffers go away
+    relay->stopping = true;
+    if (relay->read_armed) {
+        struct io_uring_sqe *sqe = get_sqe(relay);
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = relay->src_fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = URING_TAG_CANCEL;
+        }
+        while (relay->read_armed && relay->write_error == 0 && submit(relay, 1)) {
+            uring_relay_process(relay);
+        }
+    }
+
+    // Whatever was read goes out before the queue is handed back
+    uring_relay_release(relay);
+    while (relay->out->in_flight > 0 && relay->write_error == 0) {
+        writer_wait(relay);
+    }
+    output_set_writer(relay->out, NULL);
+
+    teardown(relay);
+}
+
+#else /* !__linux__ */
+
+bool uring_relay_init(UringRelay *relay, int src_fd, OutputBuffer *out) {
+    (void)src_fd;
+    (void)out;
+    uring_relay_clear(relay);
+    errno = ENOSYS;
+    return false;
+}
+
+bool uring_relay_process(UringRelay *relay) {
+    (void)relay;
+    return true;
+}
+
+bool uring_relay_release(UringRelay *relay) {
+    (void)relay;
+    return true;
+}
+
+void uring_relay_free(UringRelay *relay) {
+    (void)relay;
+}
+
+#endif
@@ -0,0 +1,146 @@
+/**
+ * @file uring.h
+ * @brief io_uring relay backend for AISH (AI Shell)
+ *
+ * Moves bash output from the pty master to the terminal through io_uring
+ * instead of read()/writev() pairs. The pty is read with a multishot read
+ * into a ring of kernel-provided buffers, so a steady stream of output costs
+ * no system calls on the read side, and the output queue is registered with
+ * the kernel so writes to the terminal use WRITE_FIXED. Completions are
+ * reaped when the ring's fd becomes readable in the main event loop.
+ *
+ * Talks to the kernel through the raw system calls (no liburing). Only
+ * available on Linux; uring_relay_init() fails elsewhere and on kernels
+ * without io_uring, and the caller keeps using the epoll relay.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include "output.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define URING_BUF_COUNT 16          /**< Provided buffers for pty reads */
+#define URING_BUF_SIZE (4 * 1024)   /**< Size of each provided buffer */
+
+/**
+ * @struct UringStats
+ * @brief Counters kept by the io_uring relay
+ */
+typedef struct {
+    uint64_t enters;        /**< io_uring_enter() calls */
+    uint64_t submissions;   /**< SQEs submitted */
+    uint64_t completions;   /**< CQEs reaped */
+    uint64_t rearms;        /**< Times the pty read had to be submitted again */
+} UringStats;
+
+/**
+ * @struct UringRelay
+ * @brief Structure to hold the state of the io_uring relay
+ */
+typedef struct {
+    int fd;                     /**< io_uring instance (-1 if not active) */
+    int src_fd;                 /**< Pty master being read */
+    int dst_fd;                 /**< Terminal being written */
+    OutputBuffer *out;          /**< Output queue fed by reads, drained by writes */
+    OutputWriter writer;        /**< Hooks installed on the output queue */
+
+    void *sq_ring;              /**< Submission ring mapping */
+    void *cq_ring;              /**< Completion ring mapping (may equal sq_ring) */
+    void *sqes;                 /**< Submission queue entries */
+    size_t sq_ring_size;        /**< Size of the sq_ring mapping */
+    size_t cq_ring_size;        /**< Size of the cq_ring mapping */
+    size_t sqes_size;           /**< Size of the sqes mapping */
+    unsigned *sq_head;          /**< Kernel-owned submission head */
+    unsigned *sq_tail;          /**< Submission tail published to the kernel */
+    unsigned *sq_array;         /**< Submission index array */
+    unsigned sq_mask;           /**< Submission ring mask */
+    unsigned sq_entries;        /**< Submission ring size */
+    unsigned sqe_tail;          /**< Next SQE to hand out */
+    unsigned *cq_head;          /**< Completion head owned by us */
+    unsigned *cq_tail;          /**< Kernel-owned completion tail */
+    unsigned cq_mask;           /**< Completion ring mask */
+    void *cqes;                 /**< Completion queue entries */
+
+    void *buf_ring;             /**< Provided buffer ring shared with the kernel */
+    char *buffers;              /**< Storage behind the provided buffers */
+    uint16_t buf_tail;          /**< Local copy of the buffer ring tail */
+    uint16_t held_bid[URING_BUF_COUNT];  /**< Filled buffers waiting for queue space */
+    uint32_t held_len[URING_BUF_COUNT];  /**< Bytes in each held buffer */
+    unsigned held_head;         /**< First held buffer */
+    unsigned held_count;        /**< Number of held buffers */
+
+    bool multishot;             /**< Kernel supports multishot reads */
+    bool fixed;                 /**< Output queue is registered for WRITE_FIXED */
+    bool read_armed;            /**< A read on the pty is outstanding */
+    bool in_process;            /**< Reaping completions; defer submission */
+    bool stopping;              /**< Being torn down; do not re-arm the read */
+    bool eof;                   /**< The pty reported EOF or EIO */
+    int read_error;             /**< Unexpected read error (errno), 0 if none */
+    int write_error;            /**< Failed write to the terminal (errno), 0 if none */
+    size_t bytes_read;          /**< Bytes queued by the last uring_relay_process() */
+    const char *pending_data;   /**< Write to retry once the terminal is writable */
+    size_t pending_len;         /**< Length of that write */
+    UringStats stats;           /**< Running totals */
+} UringRelay;
+
+/**
+ * @brief Mark a relay as inactive without touching the kernel
+ *
+ * @param relay Pointer to UringRelay structure
+ */
+void uring_relay_clear(UringRelay *relay);
+
+/**
+ * @brief Set up io_uring and start relaying from a pty to the output queue
+ *
+ * Installs itself as the writer of the output queue. Fails without side
+ * effects if io_uring or a required operation is not supported.
+ *
+ * @param relay Pointer to UringRelay structure to initialize
+ * @param src_fd Pty master to read
+ * @param out Output queue (its fd is the write destination)
+ * @return true if the relay is running, false otherwise (errno is set)
+ */
+bool uring_relay_init(UringRelay *relay, int src_fd, OutputBuffer *out);
+
+/**
+ * @brief Check whether the relay is active
+ *
+ * @param relay Pointer to UringRelay structure
+ * @return true if io_uring is carrying the output
+ */
+bool uring_relay_active(const UringRelay *relay);
+
+/**
+ * @brief Reap completions, queue what was read and submit follow-up work
+ *
+ * Sets relay->bytes_read, relay->eof and relay->read_error as appropriate.
+ *
+ * @param relay Pointer to UringRelay structure
+ * @return true if successful, false if a write to the terminal failed (errno is set)
+ */
+bool uring_relay_process(UringRelay *relay);
+
+/**
+ * @brief Queue every held buffer, waiting for the terminal if necessary
+ *
+ * Used before reading the pty directly so output stays in order.
+ *
+ * @param relay Pointer to UringRelay structure
+ * @return true if successful, false otherwise
+ */
+bool uring_relay_release(UringRelay *relay);
+
+/**
+ * @brief Stop the relay and hand the output queue back to writev()
+ *
+ * Waits for an outstanding write to finish first.
+ *
+ * @param relay Pointer to UringRelay structure
+ */
+void uring_relay_free(UringRelay *relay);
+
+#endif /* URING_H */